@@ -40,6 +40,7 @@
 /* Standard includes */
 #include <tclap/CmdLine.h>
 #include "stdio.h"
+#include "sstream"
 
 /* Itk includes */
 #include "itkNormalizedCorrelationImageToImageMetric.h"
@@ -62,6 +63,9 @@
 #include "btkSliceBySliceRigidRegistration.h"
 #include "btkResampleImageByInjectionFilter.h"
 #include "btkImageIntersectionCalculator.h"
+#include "btkIOTransformHelper.h"
+#include "btkReconstructionCheckpoint.h"
+#include "btkTelemetry.h"
 
 
 
@@ -124,6 +128,17 @@ int main( int argc, char *argv[] )
       "image is reconstructed with the identity transform. This option is important "
       "to have a reference for performance assessment. ", cmd, false);
 
+  TCLAP::ValueArg<std::string> checkpointArg("","checkpoint","Directory of the checkpoint "
+      "written at the end of every iteration: HR image, transforms and iteration counter "
+      "(default: no checkpoint)",false,"","string",cmd);
+
+  TCLAP::SwitchArg  resumeSwitchArg("","resume","Resume the reconstruction from the last "
+      "checkpoint of the checkpoint directory (if any).", cmd, false);
+
+  TCLAP::ValueArg<std::string> telemetryArg("","telemetry","JSON-lines file receiving the "
+      "telemetry of every iteration: metric, wall time of the registration and of the "
+      "injection, peak memory (default: no telemetry)",false,"","string",cmd);
+
   // xor arguments for roi assessment
 
   std::vector<TCLAP::Arg*>  xorlist;
@@ -151,6 +166,9 @@ int main( int argc, char *argv[] )
   bool rigid3D = rigid3DSwitchArg.getValue();
   bool noreg   = noregSwitchArg.getValue();
 
+  if ( telemetryArg.getValue() != "" )
+    btk::Telemetry::GetInstance().Open( telemetryArg.getValue() );
+
   // typedefs
 
   const    unsigned int    Dimension = 3;
@@ -212,6 +230,9 @@ int main( int argc, char *argv[] )
   typedef itk::CastImageFilter<ImageType,ImageMaskType> CasterType;
   typedef itk::ImageDuplicator<ImageType> DuplicatorType;
 
+  typedef itk::ImageFileWriter< ImageType >      WriterType;
+  typedef itk::ImageFileWriter< ImageMaskType >  MaskWriterType;
+
     // Filter setup
   unsigned int numberOfImages = input.size();
   std::vector< ImagePointer >         images(numberOfImages);
@@ -230,6 +251,7 @@ int main( int argc, char *argv[] )
   ImagePointer hrImageOld;
   ImagePointer hrImageIni;
   ImagePointer hrRefImage;
+  ImageMaskPointer combinedMaskImage;
 
   lowToHighResFilter -> SetNumberOfImages(numberOfImages);
   lowToHighResFilter -> SetTargetImage( 0 );
@@ -331,73 +353,160 @@ int main( int argc, char *argv[] )
         }
   }
 
-  std::cout<<"Start rigid registration on the desired target image (#0 by default)\n";
-  try
-    {
+  // Checkpoint of the registration / injection loop
+  btk::ReconstructionCheckpoint * checkpoint = NULL;
+  bool resume = false;
 
-       lowToHighResFilter->StartRegistration();
+  if ( checkpointArg.getValue() != "" )
+  {
+    checkpoint = new btk::ReconstructionCheckpoint( checkpointArg.getValue() );
+
+    if ( resumeSwitchArg.getValue() )
+    {
+      resume = checkpoint -> Load();
 
+      if ( !resume )
+        std::cout<<"No checkpoint in "<<checkpointArg.getValue()<<", starting from the beginning.\n";
     }
-  catch( itk::ExceptionObject & err )
+  }
+
+  unsigned int firstIteration = 1;
+  float previousMetric = 0.0;
+  float currentMetric = 0.0;
+  bool converged = false;
+
+  if ( resume )
+  {
+    if ( checkpoint -> GetValue< unsigned int >("images") != numberOfImages ||
+         checkpoint -> GetValue< bool >("rigid3D") != rigid3D )
     {
-        std::cerr << "ExceptionObject caught !" << std::endl;
-        std::cerr << err << std::endl;
-        return EXIT_FAILURE;
+      btkException("The checkpoint does not match the input images or the type of transforms.");
     }
 
-  // Write combined image mask
+    // The initial registration is not performed again: its results (reference
+    // image, combined mask and transforms) are read from the checkpoint
 
-  typedef itk::ImageFileWriter< ImageMaskType >  MaskWriterType;
+    std::cout<<"Resuming after iteration "<<checkpoint -> GetValue< unsigned int >("iteration")<<"\n";
 
-  if ( strcmp(combinedMask,"") != 0 )
-  {
-    MaskWriterType::Pointer maskWriter =  MaskWriterType::New();
-    maskWriter -> SetFileName( combinedMask );
-    maskWriter -> SetInput( lowToHighResFilter -> GetImageMaskCombination() );
-    maskWriter -> Update();
-  }
+    ImageReaderType::Pointer referenceReader = ImageReaderType::New();
+    referenceReader -> SetFileName( checkpoint -> GetFileName("reference") );
+    referenceReader -> Update();
+    hrRefImage = referenceReader -> GetOutput();
+
+    ImageReaderType::Pointer estimateReader = ImageReaderType::New();
+    estimateReader -> SetFileName( checkpoint -> GetFileName("estimate") );
+    estimateReader -> Update();
+    hrImage = estimateReader -> GetOutput();
+
+    MaskReaderType::Pointer maskReader = MaskReaderType::New();
+    maskReader -> SetFileName( checkpoint -> GetFileName("mask") );
+    maskReader -> Update();
+    combinedMaskImage = maskReader -> GetOutput();
 
-  // Write resampled LR images in HR space
-  if ( resampled.size() > 0 )
-  {
     for (unsigned int i=0; i<numberOfImages; i++)
     {
-      lowToHighResFilter -> WriteResampledImages( i, resampled[i].c_str() );
+      std::ostringstream name;
+      name << "transform" << i;
+
+      if (rigid3D)
+      {
+        rigid3DTransforms[i] = btk::IOTransformHelper< Rigid3DTransformType >::ReadTransform( checkpoint -> GetFileName(name.str()) );
+      }else
+      {
+        transforms[i] = btk::IOTransformHelper< TransformType >::ReadTransform( checkpoint -> GetFileName(name.str()) );
+        transforms[i] -> SetImage( images[i] );
+      }
     }
-  }
 
-  // Image registration performed slice by slice or affine 3D according to
-  // the user selection
+    firstIteration = checkpoint -> GetValue< unsigned int >("iteration") + 1;
+    currentMetric  = checkpoint -> GetValue< float >("metric");
+    converged      = checkpoint -> GetValue< bool >("converged");
 
-  hrImageIni = lowToHighResFilter->GetHighResolutionImage();
-  
-  if(computeRefImage)
-  {
-      hrRefImage = lowToHighResFilter->GetHighResolutionImage();
+    if ( resampled.size() > 0 )
+      std::cout<<"The resampled LR images are not written when resuming.\n";
   }
+  else
+  {
+    std::cout<<"Start rigid registration on the desired target image (#0 by default)\n";
+    double time = btk::Telemetry::GetTime();
+    try
+      {
 
+         lowToHighResFilter->StartRegistration();
 
-  for (unsigned int i=0; i<numberOfImages; i++)
-  {
-    if (rigid3D)
+      }
+    catch( itk::ExceptionObject & err )
+      {
+          std::cerr << "ExceptionObject caught !" << std::endl;
+          std::cerr << err << std::endl;
+          return EXIT_FAILURE;
+      }
+
+    if ( btk::Telemetry::GetInstance().IsEnabled() )
     {
-      rigid3DTransforms[i] = lowToHighResFilter -> GetTransformArray(i);
-    }else
+      btk::Telemetry::Record record("image_reconstruction");
+      record.SetIteration(0);
+      record.AddPhaseTime("registration", btk::Telemetry::GetTime() - time);
+      btk::Telemetry::GetInstance().Write(record);
+    }
+
+    // Write resampled LR images in HR space
+    if ( resampled.size() > 0 )
     {
-      transforms[i] = TransformType::New();
-      transforms[i] -> SetImage( images[i] );
-      transforms[i] -> Initialize( lowToHighResFilter -> GetInverseTransformArray(i) );
+      for (unsigned int i=0; i<numberOfImages; i++)
+      {
+        lowToHighResFilter -> WriteResampledImages( i, resampled[i].c_str() );
+      }
     }
+
+    // Image registration performed slice by slice or affine 3D according to
+    // the user selection
+
+    hrImageIni = lowToHighResFilter->GetHighResolutionImage();
+
+    if(computeRefImage)
+    {
+        hrRefImage = lowToHighResFilter->GetHighResolutionImage();
+    }
+
+
+    for (unsigned int i=0; i<numberOfImages; i++)
+    {
+      if (rigid3D)
+      {
+        rigid3DTransforms[i] = lowToHighResFilter -> GetTransformArray(i);
+      }else
+      {
+        transforms[i] = TransformType::New();
+        transforms[i] -> SetImage( images[i] );
+        transforms[i] -> Initialize( lowToHighResFilter -> GetInverseTransformArray(i) );
+      }
+    }
+
+    combinedMaskImage = lowToHighResFilter -> GetImageMaskCombination();
+  }
+
+  // Write combined image mask
+
+  if ( strcmp(combinedMask,"") != 0 )
+  {
+    MaskWriterType::Pointer maskWriter =  MaskWriterType::New();
+    maskWriter -> SetFileName( combinedMask );
+    maskWriter -> SetInput( combinedMaskImage );
+    maskWriter -> Update();
   }
 
   unsigned int im = numberOfImages;
-  float previousMetric = 0.0;
-  float currentMetric = 0.0;
 
-  for(unsigned int it=1; it <= itMax; it++)
+  for(unsigned int it=firstIteration; it <= itMax && !converged; it++)
   {
     std::cout << "Iteration " << it << std::endl; std::cout.flush();
 
+    bool telemetry = btk::Telemetry::GetInstance().IsEnabled();
+    double time = telemetry ? btk::Telemetry::GetTime() : 0.0;
+    double registrationTime = 0.0;
+    double injectionTime = 0.0;
+
     // Start registration
 
     #pragma omp parallel for private(im) schedule(dynamic)
@@ -460,10 +569,15 @@ int main( int argc, char *argv[] )
 
     std::cout << std::endl; std::cout.flush();
 
+    if ( telemetry )
+      registrationTime = btk::Telemetry::GetTime() - time;
+
     // Inject images
 
     std::cout << "Injecting images ... "; std::cout.flush();
 
+    if ( telemetry )
+      time = btk::Telemetry::GetTime();
 
     ResamplerType::Pointer resampler = ResamplerType::New();
 
@@ -484,7 +598,7 @@ int main( int argc, char *argv[] )
 
     resampler -> UseReferenceImageOn();
     resampler -> SetReferenceImage( hrRefImage );
-    resampler -> SetImageMask(lowToHighResFilter -> GetImageMaskCombination());
+    resampler -> SetImageMask( combinedMaskImage );
     resampler -> Update();
 
     if (it == 1)
@@ -494,6 +608,9 @@ int main( int argc, char *argv[] )
 
     hrImage = resampler -> GetOutput();
 
+    if ( telemetry )
+      injectionTime = btk::Telemetry::GetTime() - time;
+
     std::cout << "done. " << std::endl; std::cout.flush();
 
     // compute error
@@ -525,13 +642,73 @@ int main( int argc, char *argv[] )
     else
       delta = 1;
 
-    if (delta < epsilon) break;
+    converged = (delta < epsilon);
+
+    if ( telemetry )
+    {
+      btk::Telemetry::Record record("image_reconstruction");
+      record.SetIteration(it);
+      record.AddPhaseTime("registration", registrationTime);
+      record.AddPhaseTime("injection", injectionTime);
+      record.SetValue("metric", currentMetric);
+      record.SetValue("previous_metric", previousMetric);
+      record.SetValue("delta", delta);
+      record.SetValue("converged", converged);
+      btk::Telemetry::GetInstance().Write(record);
+    }
+
+    // Checkpoint (the reference image and the combined mask do not change
+    // and are only written once)
+
+    if ( checkpoint != NULL )
+    {
+      if ( it == firstIteration && !resume )
+      {
+        WriterType::Pointer referenceWriter = WriterType::New();
+        referenceWriter -> SetFileName( checkpoint -> NewFileName("reference", ".nii.gz") );
+        referenceWriter -> SetInput( hrRefImage );
+        referenceWriter -> Update();
+
+        MaskWriterType::Pointer maskWriter = MaskWriterType::New();
+        maskWriter -> SetFileName( checkpoint -> NewFileName("mask", ".nii.gz") );
+        maskWriter -> SetInput( combinedMaskImage );
+        maskWriter -> Update();
+      }
+
+      WriterType::Pointer estimateWriter = WriterType::New();
+      estimateWriter -> SetFileName( checkpoint -> NewFileName("estimate", ".nii.gz") );
+      estimateWriter -> SetInput( hrImage );
+      estimateWriter -> Update();
+
+      for (unsigned int i=0; i<numberOfImages; i++)
+      {
+        std::ostringstream name;
+        name << "transform" << i;
+
+        if (rigid3D)
+        {
+          btk::IOTransformHelper< Rigid3DTransformType >::WriteTransform( rigid3DTransforms[i], checkpoint -> NewFileName(name.str(), ".txt") );
+        } else
+          {
+            btk::IOTransformHelper< TransformType >::WriteTransform( transforms[i], checkpoint -> NewFileName(name.str(), ".txt") );
+          }
+      }
+
+      checkpoint -> SetValue("images", numberOfImages);
+      checkpoint -> SetValue("rigid3D", rigid3D);
+      checkpoint -> SetValue("iteration", it);
+      checkpoint -> SetValue("metric", currentMetric);
+      checkpoint -> SetValue("converged", converged);
+      checkpoint -> Save();
+    }
 
   }
 
-  // Write HR image
+  delete checkpoint;
+
+  btk::Telemetry::GetInstance().Close();
 
-  typedef itk::ImageFileWriter< ImageType >  WriterType;
+  // Write HR image
 
   WriterType::Pointer writer =  WriterType::New();
   writer-> SetFileName( outImage );
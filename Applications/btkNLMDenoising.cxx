@@ -47,10 +47,91 @@ This program implements a denoising method proposed by Coupé et al. described i
 
 #include "itkImage.h"
 #include "itkConstrainedValueDifferenceImageFilter.h"
+#include "itkRegionOfInterestImageFilter.h"
+#include "itkImageRegionIterator.h"
 
 #include "btkNLMTool.h"
+#include "btkImageHelper.h"
 
 #include <vector>
+#include <cstring>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//Read only a region of an image file (the file is streamed if its format allows it). The index of the output image starts at 0.
+template<typename TImage>
+typename TImage::Pointer ReadImageRegion(const std::string & fileName, const typename TImage::RegionType & region)
+{
+  typedef itk::ImageFileReader< TImage > ReaderType;
+  typedef itk::RegionOfInterestImageFilter< TImage, TImage > ROIFilterType;
+
+  typename ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName( fileName );
+
+  typename ROIFilterType::Pointer roiFilter = ROIFilterType::New();
+  roiFilter->SetInput( reader->GetOutput() );
+  roiFilter->SetRegionOfInterest( region );
+  roiFilter->Update();
+  return roiFilter->GetOutput();
+}
+
+//Exact median of non-negative floats given again at each pass: the bit patterns of such floats are ordered as the floats,
+//so the median is located with a histogram of the 16 upper bits (first pass), then of the 16 lower bits (second pass).
+//As in NLMTool::MADSigma, the median of n values is the element of rank n/2.
+class StreamingMedian
+{
+public:
+  StreamingMedian() : m_pass(0), m_prefix(0), m_rank(0), m_count(0), m_median(0), m_histogram(65536, 0) {}
+
+  void Add(float value)
+  {
+    unsigned int bits;
+    std::memcpy(&bits, &value, sizeof(float));
+    if(m_pass == 0){
+      m_histogram[bits >> 16]++;
+      m_count++;
+    }
+    else if( (bits >> 16) == m_prefix )
+      m_histogram[bits & 0xffff]++;
+  }
+
+  //End of a pass over the values: return true once the median is known
+  bool EndPass()
+  {
+    if(m_count == 0)
+      return true;
+    if(m_pass == 0)
+      m_rank = m_count / 2;
+
+    unsigned int bin = 0;
+    while( m_rank >= m_histogram[bin] ){
+      m_rank -= m_histogram[bin];
+      bin++;
+    }
+    std::fill(m_histogram.begin(), m_histogram.end(), 0);
+
+    if(m_pass == 0){
+      m_prefix = bin;
+      m_pass = 1;
+      return false;
+    }
+    unsigned int bits = (m_prefix << 16) | bin;
+    std::memcpy(&m_median, &bits, sizeof(float));
+    return true;
+  }
+
+  float GetMedian() const { return m_median; }
+
+private:
+  unsigned int m_pass;
+  unsigned int m_prefix;
+  unsigned long m_rank;
+  unsigned long m_count;
+  float m_median;
+  std::vector<unsigned long> m_histogram;
+};
 
 int main(int argc, char** argv)
 {
@@ -79,8 +160,12 @@ int main(int argc, char** argv)
     cmd.add( blockArg );
     TCLAP::ValueArg< int > centerArg("c","center","weight of the central patch (possible value: 0, 1, -1 (max)) (default is -1)",false,-1,"int");
     cmd.add( centerArg );
-    TCLAP::ValueArg< int > optimizedArg("","opt","optimized mode (use mean and standard deviation of patches) (0: no, 1: yes) (default is 1)",false,1,"int");
+    TCLAP::ValueArg< int > optimizedArg("","opt","optimized mode (0: no, 1: use mean and standard deviation of patches, 2: integral images, pointwise only) (default is 1)",false,1,"int");
     cmd.add( optimizedArg );
+    TCLAP::ValueArg< int > candidatesArg("","pm","approximate search (PatchMatch): number of candidate patches per voxel, 0 for the exhaustive search (default is 0)",false,0,"int");
+    cmd.add( candidatesArg );
+    TCLAP::ValueArg< int > pmIterationsArg("","pmi","number of iterations of the approximate search (default is 4)",false,4,"int");
+    cmd.add( pmIterationsArg );
     TCLAP::ValueArg< float > lowerMeanThresholdArg("","lmt","lower mean threshold (0.95 by default) -- for optimized mode only",false,0.95,"float");
     cmd.add( lowerMeanThresholdArg );
     TCLAP::ValueArg< float > lowerVarianceThresholdArg("","lvt","lower variance threshold (0.5 by default) -- for optimized mode only",false,0.5,"float");
@@ -89,6 +174,10 @@ int main(int argc, char** argv)
     cmd.add( outputDifferenceImageArg );
     TCLAP::ValueArg< int > localArg("","local","Estimation of the smoothing parameter. 0: global, 1: local (default is 0)",false,0,"int");
     cmd.add( localArg );
+    TCLAP::ValueArg< int > tileArg("","tile","size (in voxels) of the tiles processed independently to limit the memory, 0: no tiling (default is 0)",false,0,"int");
+    cmd.add( tileArg );
+    TCLAP::ValueArg< int > parallelTilesArg("","nbt","number of tiles processed at the same time, the threads being shared among them (default is 1)",false,1,"int");
+    cmd.add( parallelTilesArg );
     
  
     // Parse the args.
@@ -108,10 +197,14 @@ int main(int argc, char** argv)
     int block                    = blockArg.getValue();
     int center                   = centerArg.getValue();
     int optimized                = optimizedArg.getValue();
+    int numberOfCandidates       = candidatesArg.getValue();
+    int numberOfPMIterations     = pmIterationsArg.getValue();
     float lowerMeanThreshold     = lowerMeanThresholdArg.getValue();
     float lowerVarianceThreshold = lowerVarianceThresholdArg.getValue();
     std::string difference_file  = outputDifferenceImageArg.getValue();
     int localSmoothing           = localArg.getValue();
+    int tileSize                 = tileArg.getValue();
+    int numberOfParallelTiles    = parallelTilesArg.getValue();
 
     //ITK declaration
     typedef float PixelType;
@@ -122,6 +215,212 @@ int main(int argc, char** argv)
     typedef itk::ImageFileReader< ImageType >  ReaderType;
     typedef itk::ImageFileWriter< ImageType >  WriterType;
 
+    //Tiled mode: the image is split into tiles, each of them being denoised with a halo large enough to give
+    //the same result as the whole image. Only the bricks (tile + halo) of the input image are read, and the core of
+    //every tile is written to the output file (and to the difference file) as soon as it is denoised.
+    if(tileSize > 0){
+      if( !btk::ImageHelper<ImageType>::CanStreamWrite(output_file) ||
+          (difference_file != "" && !btk::ImageHelper<ImageType>::CanStreamWrite(difference_file)) ){
+        std::cerr<<"Error: the tiled mode needs an output format allowing streamed writing (e.g. .nrrd, .mha or .nii).\n";
+        return EXIT_FAILURE;
+      }
+      //the bricks are read with a region of interest: this only saves memory and I/O if the input files can be streamed
+      if( !btk::ImageHelper<ImageType>::CanStreamRead(input_file) ||
+          (mask_file != "" && !btk::ImageHelper<ImageType>::CanStreamRead(mask_file)) ||
+          (ref_file != "" && !btk::ImageHelper<ImageType>::CanStreamRead(ref_file)) ){
+        std::cout<<"Warning: the format of the input files (e.g. .nii.gz) does not allow streamed reading. Each tile will read the whole files: "
+                   "use an uncompressed format (e.g. .nii, .nrrd or .mha) to limit the memory to the size of a tile.\n";
+      }
+      //the candidates of the approximate search are propagated along the whole image: a tile would not find the same ones
+      if(numberOfCandidates > 0){
+        std::cerr<<"Error: the tiled mode cannot be used with the approximate search (--pm), whose result depends on the whole image.\n";
+        return EXIT_FAILURE;
+      }
+
+      ReaderType::Pointer infoReader = ReaderType::New();
+      infoReader->SetFileName( input_file );
+      infoReader->UpdateOutputInformation();
+      ImageType::RegionType largestRegion = infoReader->GetOutput()->GetLargestPossibleRegion();
+      ImageType::SizeType   imageSize     = largestRegion.GetSize();
+      ImageType::SpacingType spacing      = infoReader->GetOutput()->GetSpacing();
+
+      //half patch size and half spatial bandwidth along each axis (as in NLMTool::SetPatchSize and NLMTool::SetSpatialBandwidth)
+      float minVoxSz = std::min( spacing[0], std::min(spacing[1], spacing[2]) );
+      ImageType::SizeType halo;
+      int tile[3];
+      for(unsigned int i=0; i!= 3; i++){
+        int hp = (int)(0.5 + hwn * minVoxSz / spacing[i]);
+        int hs = (int)(0.5 + hwvs * minVoxSz / spacing[i]);
+        //the denoised patches overlapping a voxel are centred at most hp away, and their neighbours are at most hs further
+        halo[i] = 2*hp + hs;
+        //local smoothing: pseudo-residuals over the search region of these neighbours
+        if(localSmoothing == 1)
+          halo[i] += hs + 2;
+        tile[i] = tileSize;
+        //fast blockwise: the tiles and the halos have to keep the grid of the processed voxels
+        if(block == 2){
+          tile[i] = ( (tile[i] + hp) / (hp+1) ) * (hp+1);
+          halo[i] = ( (halo[i] + hp) / (hp+1) ) * (hp+1);
+        }
+      }
+      std::cout<<"Tiled mode. Tile size : "<<tile[0]<<" "<<tile[1]<<" "<<tile[2]<<", halo : "<<halo[0]<<" "<<halo[1]<<" "<<halo[2]<<"\n";
+
+      //core regions of the tiles
+      std::vector< ImageType::RegionType > tiles;
+      ImageType::IndexType tileIndex;
+      for(tileIndex[2] = 0; tileIndex[2] < (long)imageSize[2]; tileIndex[2] += tile[2])
+        for(tileIndex[1] = 0; tileIndex[1] < (long)imageSize[1]; tileIndex[1] += tile[1])
+          for(tileIndex[0] = 0; tileIndex[0] < (long)imageSize[0]; tileIndex[0] += tile[0]){
+            ImageType::SizeType tileRegionSize;
+            for(unsigned int i=0; i!= 3; i++)
+              tileRegionSize[i] = std::min( (long)tile[i], (long)imageSize[i] - tileIndex[i] );
+            ImageType::RegionType tileRegion;
+            tileRegion.SetIndex(tileIndex);
+            tileRegion.SetSize(tileRegionSize);
+            tiles.push_back(tileRegion);
+          }
+      std::cout<<"Number of tiles : "<<tiles.size()<<"\n";
+
+      //First pass: global range bandwidth, estimated on the pseudo-residuals of the whole image. The median and the median
+      //absolute deviation are both found with two passes over the tiles (see StreamingMedian), so that only the pseudo-residuals
+      //of one tile are kept in memory. The result is the same as NLMTool::MADEstimation on the whole image.
+      std::vector<float> vecei;
+      btk::NLMTool<PixelType> residualTool;
+      StreamingMedian median, deviationMedian;
+      for(unsigned int pass=0; pass < 4; pass++)
+      for(unsigned int t=0; t < tiles.size(); t++){
+        ImageType::RegionType brickRegion = tiles[t];
+        brickRegion.PadByRadius(1);
+        brickRegion.Crop(largestRegion);
+
+        ImagePointer brick = ReadImageRegion<ImageType>(input_file, brickRegion);
+        residualTool.SetInput(brick);
+        if (mask_file != "")
+          residualTool.SetMaskImage( ReadImageRegion<ImageType>(mask_file, brickRegion) );
+        else
+          residualTool.SetPaddingValue(padding);
+        residualTool.SetPatchSize(hwn);
+        if (ref_file != "")
+          residualTool.SetReferenceImage( ReadImageRegion<ImageType>(ref_file, brickRegion) );
+
+        //core of the tile in the brick coordinate system
+        ImageType::RegionType coreRegion = tiles[t];
+        ImageType::IndexType coreIndex;
+        for(unsigned int i=0; i!= 3; i++)
+          coreIndex[i] = tiles[t].GetIndex()[i] - brickRegion.GetIndex()[i];
+        coreRegion.SetIndex(coreIndex);
+        vecei.clear();
+        residualTool.GetPseudoResiduals(coreRegion, vecei);
+
+        for(unsigned int i=0; i < vecei.size(); i++){
+          if(pass < 2)
+            median.Add(vecei[i]);
+          else
+            deviationMedian.Add( fabs(vecei[i] - median.GetMedian()) );
+        }
+        if(t+1 == tiles.size()){
+          if(pass < 2)
+            median.EndPass();
+          else
+            deviationMedian.EndPass();
+        }
+      }
+      double sigma = 1.4826 * deviationMedian.GetMedian();
+      std::cout<<"sigma : "<<sigma<<"\n";
+      float rangeBandwidth = residualTool.GetRangeBandwidth(sigma, beta);
+      std::cout<<"Global smoothing parameter h : "<<sqrt(rangeBandwidth)<<"\n";
+      std::vector<float>().swap(vecei);
+
+      //Second pass: denoising of the tiles
+      if(numberOfParallelTiles < 1)
+        numberOfParallelTiles = 1;
+#ifdef _OPENMP
+      int numberOfThreadsPerTile = std::max( omp_get_max_threads() / numberOfParallelTiles, 1 );
+      omp_set_nested(1);
+#endif
+
+      int t;
+      #pragma omp parallel for private(t) schedule(dynamic) num_threads(numberOfParallelTiles)
+      for(t=0; t < (int)tiles.size(); t++){
+#ifdef _OPENMP
+        omp_set_num_threads(numberOfThreadsPerTile);
+#endif
+        #pragma omp critical
+        std::cout<<"Denoising tile "<<t+1<<" / "<<tiles.size()<<"\n";
+
+        ImageType::RegionType brickRegion = tiles[t];
+        brickRegion.PadByRadius(halo);
+        brickRegion.Crop(largestRegion);
+
+        ImagePointer brick = ReadImageRegion<ImageType>(input_file, brickRegion);
+
+        btk::NLMTool<PixelType> tileTool;
+        tileTool.SetInput( brick );
+        if (mask_file != "")
+          tileTool.SetMaskImage( ReadImageRegion<ImageType>(mask_file, brickRegion) );
+        else
+          tileTool.SetPaddingValue(padding);
+
+        tileTool.SetPatchSize(hwn);
+        tileTool.SetSpatialBandwidth(hwvs);
+        if (ref_file != "")
+          tileTool.SetReferenceImage( ReadImageRegion<ImageType>(ref_file, brickRegion) );
+
+        tileTool.SetCentralPointStrategy(center);
+        tileTool.SetBlockwiseStrategy(block);
+        tileTool.SetOptimizationStrategy(optimized);
+        tileTool.SetPatchMatchStrategy(numberOfCandidates, numberOfPMIterations);
+        tileTool.SetLowerThresholds(lowerMeanThreshold, lowerVarianceThreshold);
+
+        tileTool.SetRangeBandwidth(rangeBandwidth);
+        if(localSmoothing == 1)
+          tileTool.SetLocalSmoothing(beta);
+
+        tileTool.ComputeOutput();
+
+        //core of the tile (the tiles do not overlap), in the brick coordinate system
+        ImageType::RegionType coreRegion = tiles[t];
+        ImageType::IndexType coreIndex;
+        for(unsigned int i=0; i!= 3; i++)
+          coreIndex[i] = tiles[t].GetIndex()[i] - brickRegion.GetIndex()[i];
+        coreRegion.SetIndex(coreIndex);
+
+        //the cores are written at their place in the whole image
+        ImagePointer tileOutput = tileTool.GetOutput();
+        ImagePointer coreOutput = ImageType::New();
+        coreOutput->CopyInformation( infoReader->GetOutput() );
+        coreOutput->SetRegions( tiles[t] );
+        coreOutput->Allocate();
+
+        ImagePointer coreDifference;
+        if (difference_file != ""){
+          coreDifference = ImageType::New();
+          coreDifference->CopyInformation( infoReader->GetOutput() );
+          coreDifference->SetRegions( tiles[t] );
+          coreDifference->Allocate();
+        }
+
+        itk::ImageRegionConstIterator< ImageType > tileIt( tileOutput, coreRegion );
+        itk::ImageRegionConstIterator< ImageType > brickIt( brick, coreRegion );
+        itk::ImageRegionIterator< ImageType > outputIt( coreOutput, tiles[t] );
+        for(tileIt.GoToBegin(), brickIt.GoToBegin(), outputIt.GoToBegin(); !tileIt.IsAtEnd(); ++tileIt, ++brickIt, ++outputIt){
+          outputIt.Set( tileIt.Get() );
+          //same value as itk::ConstrainedValueDifferenceImageFilter for float images
+          if (difference_file != "")
+            coreDifference->SetPixel( outputIt.GetIndex(), brickIt.Get() - tileIt.Get() );
+        }
+
+        #pragma omp critical(btkNLMDenoisingWriter)
+        {
+          btk::ImageHelper<ImageType>::WriteImageRegion( coreOutput, largestRegion, output_file );
+          if (difference_file != "")
+            btk::ImageHelper<ImageType>::WriteImageRegion( coreDifference, largestRegion, difference_file );
+        }
+      }
+
+      return 1;
+    }
+
     //Read the image
     ReaderType::Pointer reader = ReaderType::New();
     reader->SetFileName( input_file );
@@ -161,6 +460,7 @@ int main(int argc, char** argv)
     myTool.SetCentralPointStrategy(center);
     myTool.SetBlockwiseStrategy(block);
     myTool.SetOptimizationStrategy(optimized);
+    myTool.SetPatchMatchStrategy(numberOfCandidates, numberOfPMIterations);
     myTool.SetLowerThresholds(lowerMeanThreshold, lowerVarianceThreshold);
 
     myTool.SetSmoothing(beta);
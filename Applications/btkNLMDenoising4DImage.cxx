@@ -37,12 +37,17 @@ knowledge of the CeCILL-B license and that you accept its terms.
 #include "itkImageFileWriter.h"
 
 #include "itkImage.h"
-#include "itkExtractImageFilter.h"
-#include "itkJoinSeriesImageFilter.h"
 
 #include "../Code/Denoising/btkNLMTool.h"
+#include "../Code/Denoising/btkMultiChannelNLMTool.h"
+#include "btkImageHelper.h"
 
 #include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 int main(int argc, char** argv)
 {
@@ -71,7 +76,7 @@ int main(int argc, char** argv)
     cmd.add( blockArg );
     TCLAP::ValueArg< int > centerArg("c","center","weight of the central patch (possible value: 0, 1, -1 (max)) (default is -1)",false,-1,"int");
     cmd.add( centerArg );
-    TCLAP::ValueArg< int > optimizedArg("","opt","optimized mode (use mean and standard deviation of patches) (0: no, 1: yes) (default is 1)",false,1,"int");
+    TCLAP::ValueArg< int > optimizedArg("","opt","optimized mode (0: no, 1: use mean and standard deviation of patches, 2: integral images, pointwise only) (default is 1)",false,1,"int");
     cmd.add( optimizedArg );
     TCLAP::ValueArg< float > lowerMeanThresholdArg("","lmt","lower mean threshold (0.95 by default) -- for optimized mode only",false,0.95,"float");
     cmd.add( lowerMeanThresholdArg );
@@ -79,6 +84,10 @@ int main(int argc, char** argv)
     cmd.add( lowerVarianceThresholdArg );
     TCLAP::ValueArg< int > localArg("","local","Estimation of the smoothing parameter. 0: global, 1: local (default is 0)",false,0,"int");
     cmd.add( localArg );
+    TCLAP::ValueArg< int > volumesArg("","nbv","number of 3D images denoised at the same time, the threads being shared among them (default is 1)",false,1,"int");
+    cmd.add( volumesArg );
+    TCLAP::ValueArg< int > jointArg("","joint","0: each 3D image is denoised independently, 1: joint multi-channel pointwise denoising, the weights being computed once over all the 3D images (default is 0)",false,0,"int");
+    cmd.add( jointArg );
     
     // Parse the args.
     cmd.parse( argc, argv );
@@ -100,6 +109,8 @@ int main(int argc, char** argv)
     float lowerMeanThreshold     = lowerMeanThresholdArg.getValue();
     float lowerVarianceThreshold = lowerVarianceThresholdArg.getValue();
     int localSmoothing           = localArg.getValue();
+    int numberOfParallelVolumes  = volumesArg.getValue();
+    int joint                    = jointArg.getValue();
 
 
     //ITK declaration
@@ -114,109 +125,210 @@ int main(int argc, char** argv)
     typedef itk::ImageFileReader< Image3DType >  Reader3DType;
     typedef itk::ImageFileWriter< Image4DType >  Writer4DType;
 
-    typedef itk::ExtractImageFilter< Image4DType, Image3DType > ExtractImageFilterType;
-    ExtractImageFilterType::Pointer extractor  = ExtractImageFilterType::New();
-
-    typedef itk::JoinSeriesImageFilter< Image3DType, Image4DType > JoinSeriesFilterType;
-    JoinSeriesFilterType::Pointer concatenator  = JoinSeriesFilterType::New();
-
 
     //Read the image
     Reader4DType::Pointer reader = Reader4DType::New();
     reader->SetFileName( input_file );
     reader->Update();
     Image4DPointer inputImage = reader->GetOutput();
-
-    extractor->SetInput( inputImage );
+    inputImage->DisconnectPipeline();
 
     Image4DType::RegionType input4DRegion = inputImage->GetLargestPossibleRegion();
     Image4DType::SizeType input4DSize = input4DRegion.GetSize();
 
-    Image4DType::SizeType desired3DSize;
-    desired3DSize[0] = input4DSize[0];
-    desired3DSize[1] = input4DSize[1];
-    desired3DSize[2] = input4DSize[2];
-    desired3DSize[3] = 0;
-
-    concatenator->SetOrigin( inputImage->GetOrigin()[3] );
-    concatenator->SetSpacing( inputImage->GetSpacing()[3] );
+    //Geometry of the 3D images (as given by an extraction with the direction collapsed to the submatrix)
+    Image3DType::RegionType input3DRegion;
+    Image3DType::SpacingType spacing3D;
+    Image3DType::PointType origin3D;
+    Image3DType::DirectionType direction3D;
+    for(unsigned int d = 0; d < 3; d++){
+      input3DRegion.SetIndex( d, input4DRegion.GetIndex()[d] );
+      input3DRegion.SetSize( d, input4DSize[d] );
+      spacing3D[d] = inputImage->GetSpacing()[d];
+      origin3D[d]  = inputImage->GetOrigin()[d];
+      for(unsigned int e = 0; e < 3; e++)
+        direction3D[d][e] = inputImage->GetDirection()[d][e];
+    }
 
-    Image4DType::IndexType start = input4DRegion.GetIndex();
-    uint numberOf3Dimages = input4DSize[3];
+    //The mask and the reference image are shared by all the 3D images: the mask is read, or created once using the
+    //padding value (voxels whose mean value over the 3D images is above it)
+    Image3DPointer maskImage;
+    Image3DPointer refImage;
 
-    for (uint i = 0; i < numberOf3Dimages; i++){
-      std::cout<<"Filtering the 3D image : "<<i+1<<"\n";
-
-      start[3] = i;
+    if (mask_file!=""){               //reading the mask image
+      Reader3DType::Pointer maskReader = Reader3DType::New();
+      maskReader->SetFileName( mask_file );
+      maskReader->Update();
+      maskImage = maskReader->GetOutput();
+    }
+    else
+      maskImage = btk::MultiChannelNLMTool<PixelType>::CreatePaddingMask(inputImage, padding);
+
+    if (ref_file != ""){
+      Reader3DType::Pointer refReader = Reader3DType::New();
+      refReader->SetFileName( ref_file );
+      refReader->Update();
+      refImage = refReader->GetOutput();
+    }
 
-      Image4DType::RegionType desiredRegion;
-      desiredRegion.SetSize(  desired3DSize  );
-      desiredRegion.SetIndex( start );
-      std::cout<<"3D region : "<<desired3DSize[0]<<" "<<desired3DSize[1]<<" "<<desired3DSize[2]<<" "<<desired3DSize[3]<<"\n";
+    //Joint denoising: one search for all the 3D images
+    if(joint == 1){
+      btk::MultiChannelNLMTool<PixelType> jointTool;
+      jointTool.SetInput(inputImage);
+      jointTool.SetMaskImage(maskImage);
+
+      if (ref_file != "")
+        std::cout<<"WARNING : the reference image is not used for joint denoising\n";
+      //joint denoising is pointwise, with a global range bandwidth
+      if (blockArg.isSet() || optimizedArg.isSet() || lowerMeanThresholdArg.isSet() || lowerVarianceThresholdArg.isSet())
+        std::cout<<"WARNING : --block, --opt, --lmt and --lvt are not used for joint denoising (pointwise, not optimized)\n";
+      if (localArg.isSet())
+        std::cout<<"WARNING : --local is not used for joint denoising (global smoothing parameter)\n";
+      if (volumesArg.isSet())
+        std::cout<<"WARNING : --nbv is not used for joint denoising\n";
+
+      jointTool.SetPatchSize(hwn);
+      jointTool.SetSpatialBandwidth(hwvs);
+      jointTool.SetCentralPointStrategy(center);
+      jointTool.SetSmoothing(beta);
+      jointTool.ComputeOutput();
+
+      Writer4DType::Pointer writer = Writer4DType::New();
+      writer->SetFileName( output_file );
+      writer->SetInput( jointTool.GetOutput() );
+      writer->Update();
+
+      return 1;
+    }
 
-      extractor->SetExtractionRegion( desiredRegion );
-      extractor->SetDirectionCollapseToSubmatrix();
-      extractor->Update();
-      Image3DPointer input3DImage = extractor->GetOutput();
+    //The denoised 3D images are written one by one when the output format allows it. Otherwise, the output 4D image
+    //is allocated once, and every denoised 3D image is directly copied at its place.
+    const bool streamedOutput = btk::ImageHelper<Image4DType>::CanStreamWrite( output_file );
+    Image4DPointer outputImage = Image4DType::New();
+    outputImage->CopyInformation( inputImage );
+    if(!streamedOutput){
+      std::cout<<"The output format does not allow streamed writing, the denoised 3D images are kept in memory.\n";
+      outputImage->SetRegions( input4DRegion );
+      outputImage->Allocate();
+    }
+    const long numberOfVoxelsPer3DImage = input4DSize[0] * input4DSize[1] * input4DSize[2];
 
-      Image3DType::RegionType input3DRegion = input3DImage->GetLargestPossibleRegion();
-      Image3DType::SizeType input3DSize = input3DRegion.GetSize();
-      std::cout<<"3D image size : "<<input3DSize[0]<<" "<<input3DSize[1]<<" "<<input3DSize[2]<<"\n";
+    Image4DType::IndexType start = input4DRegion.GetIndex();
+    int numberOf3Dimages = input4DSize[3];
+
+    //The noise level is estimated once: on the reference image if any (as NLMTool does), otherwise as the median of the
+    //noise levels of the 3D images. Every 3D image is then denoised with the same global range bandwidth.
+    std::cout<<"Computing the global noise level (corresponding to the smoothing parameter for the NLM algorithm)."<<std::endl;
+    double sigma = 0;
+    std::vector<float> vecei;
+    if (ref_file != ""){
+      btk::NLMTool<PixelType>::GetPseudoResiduals(refImage->GetBufferPointer(), maskImage->GetBufferPointer(), input3DRegion.GetSize(), vecei);
+      if(vecei.size() > 0)
+        sigma = btk::NLMTool<PixelType>::MADSigma(vecei);
+    }
+    else{
+      std::vector<double> sigmas;
+      for(int v = 0; v < numberOf3Dimages; v++){
+        vecei.clear();
+        btk::NLMTool<PixelType>::GetPseudoResiduals(inputImage->GetBufferPointer() + v * numberOfVoxelsPer3DImage, maskImage->GetBufferPointer(), input3DRegion.GetSize(), vecei);
+        if(vecei.size() > 0)
+          sigmas.push_back( btk::NLMTool<PixelType>::MADSigma(vecei) );
+      }
+      if(sigmas.size() > 0){
+        std::nth_element(sigmas.begin(), sigmas.begin() + sigmas.size()/2, sigmas.end());
+        sigma = sigmas[sigmas.size()/2];
+      }
+    }
+    std::vector<float>().swap(vecei);
+    std::cout<<"sigma : "<<sigma<<std::endl;
+
+    //Nested parallelism: the volumes are distributed over numberOfParallelVolumes threads, each of them using its share of the cores for the NLM filter
+    if(numberOfParallelVolumes < 1)
+      numberOfParallelVolumes = 1;
+    if(numberOfParallelVolumes > numberOf3Dimages)
+      numberOfParallelVolumes = numberOf3Dimages;
+#ifdef _OPENMP
+    int numberOfThreadsPerVolume = omp_get_max_threads() / numberOfParallelVolumes;
+    if(numberOfThreadsPerVolume < 1)
+      numberOfThreadsPerVolume = 1;
+    omp_set_nested(1);
+    std::cout<<"Number of 3D images denoised at the same time : "<<numberOfParallelVolumes<<" ("<<numberOfThreadsPerVolume<<" thread(s) each)\n";
+#endif
+
+    int i;
+    #pragma omp parallel for private(i) schedule(dynamic) num_threads(numberOfParallelVolumes)
+    for (i = 0; i < numberOf3Dimages; i++){
+#ifdef _OPENMP
+      omp_set_num_threads(numberOfThreadsPerVolume);
+#endif
+      #pragma omp critical
+      std::cout<<"Filtering the 3D image : "<<i+1<<"\n";
 
-      Image3DPointer output3DImage = Image3DType::New();
-      Image3DPointer maskImage = Image3DType::New();
-      Image3DPointer refImage = Image3DType::New();
+      //the 4D buffer stores the 3D images one after the other: the 3D image is copied out of it without any pipeline,
+      //as the volumes are processed concurrently
+      Image3DPointer input3DImage = Image3DType::New();
+      input3DImage->SetRegions( input3DRegion );
+      input3DImage->SetSpacing( spacing3D );
+      input3DImage->SetOrigin( origin3D );
+      input3DImage->SetDirection( direction3D );
+      input3DImage->Allocate();
+      std::copy(inputImage->GetBufferPointer() + i * numberOfVoxelsPer3DImage, inputImage->GetBufferPointer() + (i+1) * numberOfVoxelsPer3DImage,
+                input3DImage->GetBufferPointer());
 
       btk::NLMTool<PixelType> myTool;
 
       myTool.SetInput(input3DImage);
-
-      if (mask_file!=""){               //reading the mask image
-        Reader3DType::Pointer maskReader = Reader3DType::New();
-        maskReader->SetFileName( mask_file );
-        maskReader->Update();
-        maskImage = maskReader->GetOutput();
-        myTool.SetMaskImage(maskImage);
-      }
-      else                                 //creating a mask image using the padding value
-        myTool.SetPaddingValue(padding);
+      myTool.SetMaskImage(maskImage);
 
       myTool.SetPatchSize(hwn);
       myTool.SetSpatialBandwidth(hwvs);
 
-      if (ref_file != ""){
-        Reader3DType::Pointer refReader = Reader3DType::New();
-        refReader->SetFileName( ref_file );
-        refReader->Update();
-        refImage = refReader->GetOutput();
-        myTool.SetReferenceImage(refImage);    
-      }
-      
+      if (ref_file != "")
+        myTool.SetReferenceImage(refImage);
+
       myTool.SetCentralPointStrategy(center);
       myTool.SetBlockwiseStrategy(block);
       myTool.SetOptimizationStrategy(optimized);
       myTool.SetLowerThresholds(lowerMeanThreshold, lowerVarianceThreshold);
 
-      myTool.SetSmoothing(beta);
+      //global range bandwidth (also used where the local estimation is not possible)
+      myTool.SetRangeBandwidth( myTool.GetRangeBandwidth(sigma, beta) );
       if(localSmoothing == 1)
         myTool.SetLocalSmoothing(beta);
 
-
-
-      
       myTool.ComputeOutput();
-      output3DImage = myTool.GetOutput();
-
-      concatenator->PushBackInput(output3DImage);
+      Image3DPointer output3DImage = myTool.GetOutput();
+
+      if(streamedOutput){
+        Image4DType::RegionType volumeRegion = input4DRegion;
+        volumeRegion.SetIndex( 3, start[3] + i );
+        volumeRegion.SetSize( 3, 1 );
+
+        Image4DPointer volumeImage = Image4DType::New();
+        volumeImage->CopyInformation( inputImage );
+        volumeImage->SetRegions( volumeRegion );
+        volumeImage->Allocate();
+        std::copy(output3DImage->GetBufferPointer(), output3DImage->GetBufferPointer() + numberOfVoxelsPer3DImage,
+                  volumeImage->GetBufferPointer());
+
+        #pragma omp critical(btkNLMDenoising4DImageWriter)
+        btk::ImageHelper<Image4DType>::WriteImageRegion( volumeImage, input4DRegion, output_file );
+      }
+      else{
+        std::copy(output3DImage->GetBufferPointer(), output3DImage->GetBufferPointer() + numberOfVoxelsPer3DImage,
+                  outputImage->GetBufferPointer() + i * numberOfVoxelsPer3DImage);
+      }
     }
 
 
     //Write the result
 
-    Writer4DType::Pointer writer = Writer4DType::New();
-    writer->SetFileName( output_file );
-    writer->SetInput( concatenator->GetOutput() );
-    writer->Update();
+    if(!streamedOutput){
+      Writer4DType::Pointer writer = Writer4DType::New();
+      writer->SetFileName( output_file );
+      writer->SetInput( outputImage );
+      writer->Update();
+    }
 
     return 1;
 
@@ -56,6 +56,7 @@
 #include "btkSuperResolutionRigidImageFilter.h"
 
 #include "btkNLMTool.h"
+#include "btkTelemetry.h"
 
 
 int main( int argc, char *argv[] )
@@ -90,6 +91,13 @@ int main( int argc, char *argv[] )
   TCLAP::SwitchArg  boxcarSwitchArg("","boxcar","A boxcar-shaped PSF is assumed as imaging model"
       " (by default a Gaussian-shaped PSF is employed.).",cmd,false);
   TCLAP::ValueArg<int> loopArg  ("","loop","Number of loops (SR/denoising) (default = 5)",false, 5,"int",cmd);
+  TCLAP::ValueArg<std::string> hCacheArg  ("","hcache","File caching the H matrix: H is read from it when "
+      "the inputs are unchanged, and written to it otherwise (default: no cache)",false,"","string",cmd);
+  TCLAP::SwitchArg  pcgSwitchArg("","pcg","Solve the normal equations with a preconditioned conjugate gradient"
+      " (at most iter iterations) instead of the default conjugate gradient minimization.",cmd,false);
+  TCLAP::ValueArg<std::string> telemetryArg  ("","telemetry","JSON-lines file receiving the telemetry: "
+      "cost, data and regularization terms of every evaluation of the cost function, wall time "
+      "of the phases and peak memory (default: no telemetry)",false,"","string",cmd);
     
 
   // Parse the argv array.
@@ -103,6 +111,9 @@ int main( int argc, char *argv[] )
   iter = iterArg.getValue();
   lambda = lambdaArg.getValue();
 
+  if ( telemetryArg.getValue() != "" )
+    btk::Telemetry::GetInstance().Open( telemetryArg.getValue() );
+
   // typedefs
   const   unsigned int    Dimension = 3;
   typedef btk::SliceBySliceTransform< double, Dimension > TransformType;
@@ -207,13 +218,27 @@ int main( int argc, char *argv[] )
   resampler -> SetLambda( lambda );
   if ( boxcarSwitchArg.isSet() )
     resampler -> SetPSF( ResamplerType::BOXCAR );
+  resampler -> SetHMatrixCacheFileName( hCacheArg.getValue() );
+  resampler -> SetSolveNormalEquations( pcgSwitchArg.isSet() );
+
+  double time = btk::Telemetry::GetTime();
   resampler -> Update();
+
+  if ( btk::Telemetry::GetInstance().IsEnabled() )
+  {
+    btk::Telemetry::Record record("super_resolution");
+    record.SetIteration(0);
+    record.AddPhaseTime("super_resolution", btk::Telemetry::GetTime() - time);
+    btk::Telemetry::GetInstance().Write(record);
+  }
 	  
   int numberOfLoops = loopArg.getValue();
     
     
   for (int i=0; i<numberOfLoops; i++){
     std::cout<<"Loop : "<<i+1<<std::endl;
+
+    time = btk::Telemetry::GetTime();
        
     btk::NLMTool<float> myTool;
     myTool.SetInput(resampler -> GetOutput());
@@ -224,8 +249,20 @@ int main( int argc, char *argv[] )
     ImagePointer outputImage = ImageType::New();
     outputImage = myTool.GetOutput();
 
+    double nlmTime = btk::Telemetry::GetTime() - time;
+    time = btk::Telemetry::GetTime();
+
     resampler -> SetReferenceImage( outputImage );
     resampler -> Update();
+
+    if ( btk::Telemetry::GetInstance().IsEnabled() )
+    {
+      btk::Telemetry::Record record("super_resolution");
+      record.SetIteration(i+1);
+      record.AddPhaseTime("nlm", nlmTime);
+      record.AddPhaseTime("super_resolution", btk::Telemetry::GetTime() - time);
+      btk::Telemetry::GetInstance().Write(record);
+    }
   }
   //NLM denoising desired at the last step if number of loops > 0
   if(numberOfLoops>0){
@@ -255,6 +292,8 @@ int main( int argc, char *argv[] )
     std::cout << "done." << std::endl;
   }
 
+  btk::Telemetry::GetInstance().Close();
+
   } catch (TCLAP::ArgException &e)  // catch any exceptions
   { std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl; }
 
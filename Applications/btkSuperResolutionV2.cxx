@@ -57,6 +57,8 @@
 #include "btkEulerSliceBySliceTransform.h"
 #include "btkSuperResolutionFilter.h"
 #include "btkIOTransformHelper.h"
+#include "btkReconstructionCheckpoint.h"
+#include "btkTelemetry.h"
 
 #include "btkApplyTransformToImageFilter.h"
 #include "btkNLMTool.h"
@@ -98,6 +100,30 @@ btk::PSF::Pointer ChoosePSF(unsigned int _psf)
 
 }
 
+// Save the estimate after a loop in the checkpoint
+void SaveCheckpoint(btk::ReconstructionCheckpoint & _checkpoint, itk::Image< float, 3 >::Pointer _estimate,
+                    unsigned int _loop, unsigned int _numberOfImages)
+{
+    btk::ImageHelper< itk::Image< float, 3 > >::WriteImage(_estimate, _checkpoint.NewFileName("estimate", ".nii.gz"));
+
+    _checkpoint.SetValue("images", _numberOfImages);
+    _checkpoint.SetValue("loop", _loop);
+    _checkpoint.Save();
+}
+
+// Write the telemetry of a loop (the cost function writes its own records at every evaluation)
+void WriteLoopTelemetry(unsigned int _loop, double _srTime, double _nlmTime)
+{
+    if(btk::Telemetry::GetInstance().IsEnabled())
+    {
+        btk::Telemetry::Record record("super_resolution");
+        record.SetIteration(_loop);
+        record.AddPhaseTime("super_resolution", _srTime);
+        record.AddPhaseTime("nlm", _nlmTime);
+        btk::Telemetry::GetInstance().Write(record);
+    }
+}
+
 int main(int argc, char * argv[])
 {
 
@@ -155,6 +181,26 @@ int main(int argc, char * argv[])
 
     TCLAP::ValueArg<unsigned int> psfArg("","psf","Psf type -> 0 : BoxCar, 1: Gaussian (default), 2: Sinc, 3 : hybrid (sinc on x & y, gaussian on z)" ,false,1,"uint",cmd);
 
+    TCLAP::ValueArg<std::string> hCacheArg("","hcache","File caching the H matrix: H is read from it when the inputs are unchanged, "
+                                           "and written to it otherwise (default: no cache)" ,false,"","string",cmd);
+
+    TCLAP::ValueArg<unsigned int> pyramidArg("","pyramid","Number of levels of the coarse-to-fine pyramid of the first loop: level l is reconstructed "
+                                             "with a spacing 2^l times the one of the reference image (default 1: no pyramid)" ,false,1,"uint",cmd);
+
+    TCLAP::ValueArg<unsigned int> blockArg("","block","Size (in voxels) of the blocks of the block-wise reconstruction: blocks are reconstructed "
+                                           "independently on the available cores and blended in their overlaps (default 0: whole image)" ,false,0,"uint",cmd);
+
+    TCLAP::ValueArg<unsigned int> blockOverlapArg("","block-overlap","Overlap (in voxels) between the blocks of the block-wise reconstruction (default 8)" ,false,8,"uint",cmd);
+
+    TCLAP::ValueArg<std::string> checkpointArg("","checkpoint","Directory of the checkpoint written after every loop "
+                                               "(current estimate and number of loops done) (default: no checkpoint)" ,false,"","string",cmd);
+
+    TCLAP::SwitchArg resumeArg("","resume","Resume from the last checkpoint of the checkpoint directory (if any)", cmd, false);
+
+    TCLAP::ValueArg<std::string> telemetryArg("","telemetry","JSON-lines file receiving the telemetry: cost, data and regularization terms "
+                                              "and residual norm of every evaluation of the cost function, wall time of the phases and peak memory "
+                                              "(default: no telemetry)" ,false,"","string",cmd);
+
 
     std::vector< std::string > input;
     std::vector< std::string > mask;
@@ -193,6 +239,11 @@ int main(int argc, char * argv[])
 
     float lambda = lambdaArg.getValue();
 
+    if(!telemetryArg.getValue().empty())
+    {
+        btk::Telemetry::GetInstance().Open(telemetryArg.getValue());
+    }
+
 
 
     inputsLRImages.resize(numberOfImages);
@@ -210,6 +261,28 @@ int main(int argc, char * argv[])
 
     referenceImage = btk::ImageHelper< itkImage > ::ReadImage(refImage);
 
+    // Checkpoint: the estimate after each loop
+    btk::ReconstructionCheckpoint * checkpoint = NULL;
+    unsigned int firstLoop = 0;
+
+    if(!checkpointArg.getValue().empty())
+    {
+        checkpoint = new btk::ReconstructionCheckpoint(checkpointArg.getValue());
+
+        if(resumeArg.getValue() && checkpoint->Load())
+        {
+            if(checkpoint->GetValue< unsigned int >("images") != (unsigned int)numberOfImages)
+            {
+                btkException("The checkpoint does not match the input images !");
+            }
+
+            firstLoop = checkpoint->GetValue< unsigned int >("loop");
+            referenceImage = btk::ImageHelper< itkImage >::ReadImage(checkpoint->GetFileName("estimate"));
+
+            std::cout<<"Resuming after loop "<<firstLoop<<std::endl;
+        }
+    }
+
     //Super Resolution Filter
     btk::SuperResolutionFilter::Pointer SRFilter = btk::SuperResolutionFilter::New();
 
@@ -219,8 +292,18 @@ int main(int argc, char * argv[])
 
     SRFilter->SetPSF(ChoosePSF(psf));
 
+    SRFilter->SetHMatrixCacheFileName(hCacheArg.getValue());
+
+    // The transforms do not change between the loops: H is kept and only updated
+    SRFilter->SetHMatrixIncrementalUpdate(loop > 1);
+
     SRFilter->SetLambda(lambda);
 
+    SRFilter->SetNumberOfPyramidLevels(pyramidArg.getValue());
+
+    SRFilter->SetBlockSize(blockArg.getValue());
+    SRFilter->SetBlockOverlap(blockOverlapArg.getValue());
+
     //If  simulation
     if(!simulation.empty())
     {
@@ -289,46 +372,80 @@ int main(int argc, char * argv[])
 
 
 
-    std::cout<<"Loop : "<<1<<std::endl;
-
     SRFilter->SetMasks(inputsLRMasks);
-    SRFilter->Initialize();
-
-    //Perform super resolution
-    SRFilter->Update();
-
-    //Get Output image
-    referenceImage = SRFilter->GetOutput();
 
     //Denoising
     btk::NLMTool<float>* myTool = new btk::NLMTool<float>();
-    myTool->SetInput(referenceImage);
-    myTool->SetPaddingValue(0);
-    myTool->SetDefaultParameters();
-    myTool->ComputeOutput();
 
-    referenceImage = myTool->GetOutput();
+    if(firstLoop == 0)
+    {
+        std::cout<<"Loop : "<<1<<std::endl;
+
+        double time = btk::Telemetry::GetTime();
+
+        SRFilter->Initialize();
+
+        //Perform super resolution
+        SRFilter->Update();
+
+        //Get Output image
+        referenceImage = SRFilter->GetOutput();
+
+        double srTime = btk::Telemetry::GetTime() - time;
+        time = btk::Telemetry::GetTime();
+
+        myTool->SetInput(referenceImage);
+        myTool->SetPaddingValue(0);
+        myTool->SetDefaultParameters();
+        myTool->ComputeOutput();
+
+        referenceImage = myTool->GetOutput();
+
+        WriteLoopTelemetry(1, srTime, btk::Telemetry::GetTime() - time);
+
+        firstLoop = 1;
+
+        if(checkpoint != NULL)
+        {
+            SaveCheckpoint(*checkpoint, referenceImage, 1, numberOfImages);
+        }
+    }
+
+    // The next loops start from the full resolution estimate
+    SRFilter->SetNumberOfPyramidLevels(1);
 
     //iterative process
-    for(unsigned int i = 1; i< loop; i++)
+    for(unsigned int i = firstLoop; i< loop; i++)
     {
         std::cout<<"Loop : "<<i+1<<std::endl;
 
+        double time = btk::Telemetry::GetTime();
+
         SRFilter->SetReferenceImage(referenceImage);
         SRFilter->Initialize();
         SRFilter->Update();
 
+        double srTime = btk::Telemetry::GetTime() - time;
+        time = btk::Telemetry::GetTime();
+
         myTool->SetInput(referenceImage);
         myTool->SetPaddingValue(0);
         myTool->SetDefaultParameters();
         myTool->ComputeOutput();
 
         referenceImage = myTool->GetOutput();
+
+        WriteLoopTelemetry(i+1, srTime, btk::Telemetry::GetTime() - time);
+
+        if(checkpoint != NULL)
+        {
+            SaveCheckpoint(*checkpoint, referenceImage, i+1, numberOfImages);
+        }
     }
 
 
-    //if simulation, we write it
-    if(!simulation.empty())
+    //if simulation, we write it (not available when every loop was done before resuming)
+    if(!simulation.empty() && !SRFilter->GetSimulatedImages().empty())
     {
        std::cout<<"Simulated Low Resolution..."<<std::endl;
        std::vector< itkImage::Pointer > simImages = SRFilter->GetSimulatedImages();
@@ -340,6 +457,9 @@ int main(int argc, char * argv[])
 
     //since btk::NLMTool has no smart pointer
     delete myTool;
+    delete checkpoint;
+
+    btk::Telemetry::GetInstance().Close();
 
     //end
     return EXIT_SUCCESS;
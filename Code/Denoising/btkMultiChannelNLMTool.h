@@ -0,0 +1,184 @@
+/*
+Copyright or © or Copr. Université de Strasbourg - Centre National de la Recherche Scientifique
+
+16 october 2026
+rousseau@unistra.fr
+
+This software is governed by the CeCILL-B license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL-B
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL-B license and that you accept its terms.
+*/
+
+#ifndef btkMultiChannelNLMTool_H
+#define btkMultiChannelNLMTool_H
+
+#include "itkImage.h"
+#include "itkImageDuplicator.h"
+
+#include "btkPatchDistanceKernel.h"
+#include "btkNLMTool.h"
+
+#include "vector"
+#include "algorithm"
+#include "cmath"
+
+namespace btk
+{
+/**
+ * @class MultiChannelNLMTool
+ * @brief Pointwise NLM denoising of a 4D image (e.g. a btk::DiffusionSequence) seen as a multi-channel 3D image.
+ * The patch distance is computed jointly over the channels (the 4th dimension), so that the weights are
+ * computed once per pair of voxels and applied to every channel. Compared to denoising each 3D image
+ * independently with NLMTool, the search is done only once and the weights benefit from all the channels.
+ * @author François Rousseau
+ * @ingroup Denoising
+ */
+template <typename TPixelType>
+class MultiChannelNLMTool
+{
+ public:
+    /**
+     * @brief Multi-channel (4D) image type.
+     */
+  typedef typename itk::Image< TPixelType, 4> itkT4DImage;
+    /**
+     * @brief Pointer to multi-channel image type
+     */
+  typedef typename itkT4DImage::Pointer itkT4DPointer;
+    /**
+     * @brief 3D image type (mask)
+     */
+  typedef typename itk::Image< TPixelType, 3> itkTImage;
+    /**
+     * @brief Pointer to 3D image type
+     */
+  typedef typename itkTImage::Pointer itkTPointer;
+
+    /**
+     * @brief Per-thread scratch buffers. A multi-channel patch stores the patches of all the channels one after the other.
+     */
+  struct PatchWorkspace
+  {
+    std::vector<TPixelType> centralPatch;    /**< multi-channel patch around the current voxel */
+    std::vector<TPixelType> neighbourPatch;  /**< multi-channel patch around a voxel of the search region (image border only) */
+    std::vector<double> estimate;        /**< weighted sum of the neighbour values, for every channel */
+  };
+
+  /**
+   * @brief Set the input image. The 4th dimension indexes the channels (e.g. the gradient directions).
+   * @param inputImage Multi-channel image (a btk::DiffusionSequence can be given directly)
+   */
+  void SetInput(const itkT4DImage * inputImage);
+  /**
+   * @brief Set the mask image (only voxels > 0 are denoised).
+   * @param maskImage 3D image having the size of one channel
+   */
+  void SetMaskImage(itkTPointer maskImage);
+  /**
+   * @brief Create the mask image: voxels whose mean value over the channels is above the padding value are denoised.
+   * @param padding Padding value
+   */
+  void SetPaddingValue(float padding);
+  /**
+   * @brief Create a mask image whose voxels are 1 if their mean value over the channels is above the padding value (0 otherwise).
+   * @param inputImage Multi-channel image
+   * @param padding Padding value
+   * @return 3D mask having the geometry of one channel
+   */
+  static itkTPointer CreatePaddingMask(const itkT4DImage * inputImage, float padding);
+  /**
+   * @brief Set the half patch size (taking into account possible image anisotropy).
+   */
+  void SetPatchSize(int h);
+  /**
+   * @brief Set the half size of the search region (taking into account possible image anisotropy).
+   */
+  void SetSpatialBandwidth(int s);
+  /**
+   * @brief Set the weight of the central voxel (0: no weight, 1: weight of 1, -1: maximum weight of the neighbours).
+   */
+  void SetCentralPointStrategy(int s);
+  /**
+   * @brief Compute the range bandwidth. The noise standard deviation of each channel is estimated with
+   * the MAD of the pseudo-residuals and the range bandwidth is the sum over the channels of 2*beta*sigma^2*|P|.
+   * @param beta Smoothing parameter
+   */
+  void SetSmoothing(float beta);
+  /**
+   * @brief Denoise all the channels using the joint weights.
+   */
+  void ComputeOutput();
+  /**
+   * @brief Get the denoised multi-channel image.
+   */
+  itkT4DPointer GetOutput();
+
+protected:
+
+  /**
+   * @brief Copy the multi-channel patch centred on p into a contiguous array (voxels outside the image are set to 0).
+   */
+  void GetPatch(long x, long y, long z, bool inside, TPixelType * patch);
+  /**
+   * @brief Distance between the multi-channel patch centralPatch and the patch centred on (x,y,z).
+   * Inside the image, the distance is computed in place (the rows of a patch are contiguous in each channel) and stops
+   * as soon as it is above the cutoff. On the image border, the neighbour patch is copied into the workspace.
+   * @return the distance, or a partial distance larger than cutoff
+   */
+  double ComputeDistance(const TPixelType * centralPatch, long x, long y, long z, bool inside, PatchWorkspace & workspace, double cutoff);
+  /**
+   * @brief Return true if the patch centred on (x,y,z) lies entirely in the image.
+   */
+  bool IsPatchInside(long x, long y, long z) const;
+  /**
+   * @brief Denoise the voxel (x,y,z) of every channel.
+   */
+  void DenoiseVoxel(long x, long y, long z, PatchWorkspace & workspace, TPixelType * output);
+
+  const itkT4DImage * m_inputImage;/**< Pointer to input Image */
+  itkT4DPointer m_outputImage;/**< Pointer to output Image */
+  itkTPointer m_maskImage;/**< Pointer to mask Image */
+
+  typename itkT4DImage::SizeType    m_size;/**< size (4th dimension: number of channels) */
+  typename itkT4DImage::SpacingType m_spacing;/**< spacing */
+  long m_numberOfVoxels;/**< number of voxels of one channel */
+
+private :
+
+  long m_halfPatchSize[3];          /**< half of the patch size*/
+  long m_halfSpatialBandwidth[3];   /**< half size of the search region */
+  std::vector<long> m_patchOffsets; /**< linear offsets of the patch voxels wrt the central voxel, in one channel */
+  std::vector<long> m_rowOffsets;   /**< linear offsets of the first voxel of each patch row (along x) wrt the central voxel */
+  long m_rowLength;                 /**< number of voxels of a patch row */
+  double m_rangeBandwidth;          /**< range bandwidth of the multi-channel weights */
+  int   m_centralPointStrategy;     /**< weight of the central voxel */
+};
+}
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "btkMultiChannelNLMTool.txx"
+#endif
+
+#endif
@@ -0,0 +1,411 @@
+#ifndef __BTKMULTICHANNELNLMTOOL_TXX__
+#define __BTKMULTICHANNELNLMTOOL_TXX__
+
+#include "btkMultiChannelNLMTool.h"
+
+namespace btk
+{
+template <typename T>
+void MultiChannelNLMTool<T>::SetInput(const itkT4DImage * inputImage)
+{
+  m_inputImage = inputImage;
+  m_size    = m_inputImage->GetLargestPossibleRegion().GetSize();
+  m_spacing = m_inputImage->GetSpacing();
+  m_numberOfVoxels = m_size[0] * m_size[1] * m_size[2];
+  std::cout<<"Number of channels : "<<m_size[3]<<std::endl;
+
+  //duplicate the input image into the output image to keep all header information
+  typename itk::ImageDuplicator< itkT4DImage >::Pointer duplicator = itk::ImageDuplicator< itkT4DImage >::New();
+  duplicator->SetInputImage( inputImage );
+  duplicator->Update();
+  m_outputImage = duplicator->GetOutput();
+
+  m_centralPointStrategy = -1;
+  m_rangeBandwidth = 1;
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::SetMaskImage(itkTPointer maskImage)
+{
+  m_maskImage = maskImage;
+
+  typename itkTImage::SizeType size = m_maskImage->GetLargestPossibleRegion().GetSize();
+  for(unsigned int i=0; i!= 3; i++)
+  {
+    if(size[i] != m_size[i])
+    {
+      std::cout<<"*************************************************************************************"<<std::endl;
+      std::cout<<"WARNING : the size of the mask image is incorrect wrt the input image"<<std::endl;
+      std::cout<<"*************************************************************************************"<<std::endl;
+      break;
+    }
+  }
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::SetPaddingValue(float padding)
+{
+  m_maskImage = CreatePaddingMask(m_inputImage, padding);
+}
+
+template <typename T>
+typename MultiChannelNLMTool<T>::itkTPointer
+MultiChannelNLMTool<T>::CreatePaddingMask(const itkT4DImage * inputImage, float padding)
+{
+  std::cout<<"Creating the mask image using the padding value ("<<padding<<")"<<std::endl;
+  typename itkT4DImage::SizeType inputSize = inputImage->GetLargestPossibleRegion().GetSize();
+
+  //geometry of one channel (the direction is collapsed to the 3D submatrix)
+  typename itkTImage::RegionType region;
+  typename itkTImage::SizeType size;
+  typename itkTImage::SpacingType spacing;
+  typename itkTImage::PointType origin;
+  typename itkTImage::DirectionType direction;
+  for(unsigned int i=0; i!= 3; i++)
+  {
+    size[i]    = inputSize[i];
+    spacing[i] = inputImage->GetSpacing()[i];
+    origin[i]  = inputImage->GetOrigin()[i];
+    for(unsigned int j=0; j!= 3; j++)
+    {
+      direction[i][j] = inputImage->GetDirection()[i][j];
+    }
+  }
+  region.SetSize(size);
+  itkTPointer maskImage = itkTImage::New();
+  maskImage->SetRegions(region);
+  maskImage->SetSpacing(spacing);
+  maskImage->SetOrigin(origin);
+  maskImage->SetDirection(direction);
+  maskImage->Allocate();
+
+  const long numberOfVoxels = (long)size[0] * size[1] * size[2];
+  const T * inputBuffer = inputImage->GetBufferPointer();
+  T * maskBuffer = maskImage->GetBufferPointer();
+
+  double count = 0;
+  for(long v=0; v < numberOfVoxels; v++)
+  {
+    double mean = 0;
+    for(unsigned int c=0; c < inputSize[3]; c++)
+    {
+      mean += inputBuffer[v + c * numberOfVoxels];
+    }
+    mean /= inputSize[3];
+
+    if(mean <= padding)
+    {
+      maskBuffer[v] = 0;
+    }
+    else
+    {
+      maskBuffer[v] = 1;
+      count++;
+    }
+  }
+  std::cout<<"Percentage of points to be processed : "<<(int)(count / numberOfVoxels * 100.0) <<std::endl;
+
+  return maskImage;
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::SetPatchSize(int h)
+{
+  std::cout<<"Computing patch size (taking into account possible image anisotropy)"<<std::endl;
+  float minVoxSz = std::min( m_spacing[0], std::min(m_spacing[1], m_spacing[2]) );
+
+  for(unsigned int i=0; i!= 3; i++)
+  {
+    m_halfPatchSize[i] = (int)(0.5 + h * minVoxSz / m_spacing[i]);
+  }
+  std::cout<<"half patchSize : "<<m_halfPatchSize[0]<<" "<<m_halfPatchSize[1]<<" "<<m_halfPatchSize[2]<<std::endl;
+
+  //offsets are ordered as the voxels of an itk::Image patch (x first, then y, then z)
+  m_patchOffsets.clear();
+  m_rowOffsets.clear();
+  m_rowLength = 2*m_halfPatchSize[0]+1;
+  for(long pz=-m_halfPatchSize[2]; pz<=m_halfPatchSize[2]; pz++)
+  {
+    for(long py=-m_halfPatchSize[1]; py<=m_halfPatchSize[1]; py++)
+    {
+      m_rowOffsets.push_back( -m_halfPatchSize[0] + (long)m_size[0] * ( py + (long)m_size[1] * pz ) );
+      for(long px=-m_halfPatchSize[0]; px<=m_halfPatchSize[0]; px++)
+      {
+        m_patchOffsets.push_back( px + (long)m_size[0] * ( py + (long)m_size[1] * pz ) );
+      }
+    }
+  }
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::SetSpatialBandwidth(int s)
+{
+  std::cout<<"Computing spatial bandwidth (taking into account possible image anisotropy)"<<std::endl;
+  float minVoxSz = std::min( m_spacing[0], std::min(m_spacing[1], m_spacing[2]) );
+
+  for(unsigned int i=0; i!= 3; i++)
+  {
+    m_halfSpatialBandwidth[i] = (int)(0.5 + s * minVoxSz / m_spacing[i]);
+  }
+  std::cout<<"half spatialBandwidth : "<<m_halfSpatialBandwidth[0]<<" "<<m_halfSpatialBandwidth[1]<<" "<<m_halfSpatialBandwidth[2]<<std::endl;
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::SetCentralPointStrategy(int s)
+{
+  m_centralPointStrategy = s;
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::SetSmoothing(float beta)
+{
+  std::cout<<"Computing the global range bandwidth (joint over the channels)."<<std::endl;
+  const T * inputBuffer = m_inputImage->GetBufferPointer();
+
+  m_rangeBandwidth = 0;
+
+  for(unsigned int c=0; c < m_size[3]; c++)
+  {
+    //pseudo-residuals of the voxels of the mask (same estimation as NLMTool, so that the joint and single-channel denoisings match)
+    std::vector<float> vecei;
+    NLMTool<T>::GetPseudoResiduals(inputBuffer + c * m_numberOfVoxels, m_maskImage->GetBufferPointer(), m_maskImage->GetLargestPossibleRegion().GetSize(), vecei);
+    if(vecei.size() == 0)
+    {
+      continue;
+    }
+
+    double sigma = NLMTool<T>::MADSigma(vecei);
+    std::cout<<"channel "<<c<<", sigma : "<<sigma<<std::endl;
+
+    m_rangeBandwidth += 2 * beta * sigma * sigma * m_patchOffsets.size();
+  }
+
+  if(m_rangeBandwidth <= 0)
+  {
+    m_rangeBandwidth = 1;
+  }
+  std::cout<<"Global smoothing parameter h : "<<sqrt(m_rangeBandwidth)<<std::endl;
+}
+
+template <typename T>
+typename MultiChannelNLMTool<T>::itkT4DPointer
+MultiChannelNLMTool<T>::GetOutput()
+{
+  return m_outputImage;
+}
+
+template <typename T>
+bool MultiChannelNLMTool<T>::IsPatchInside(long x, long y, long z) const
+{
+  return (x >= m_halfPatchSize[0]) && (x + m_halfPatchSize[0] < (long)m_size[0])
+      && (y >= m_halfPatchSize[1]) && (y + m_halfPatchSize[1] < (long)m_size[1])
+      && (z >= m_halfPatchSize[2]) && (z + m_halfPatchSize[2] < (long)m_size[2]);
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::GetPatch(long x, long y, long z, bool inside, T * patch)
+{
+  const T * inputBuffer = m_inputImage->GetBufferPointer();
+  const unsigned int n = m_patchOffsets.size();
+
+  if(inside == true)
+  {
+    const T * center = inputBuffer + x + (long)m_size[0] * ( y + (long)m_size[1] * z );
+    for(unsigned int c=0; c < m_size[3]; c++, center += m_numberOfVoxels, patch += n)
+    {
+      for(unsigned int k=0; k < n; k++)
+      {
+        patch[k] = center[ m_patchOffsets[k] ];
+      }
+    }
+    return;
+  }
+
+  //boundary case: voxels outside the image are set to 0
+  for(unsigned int c=0; c < m_size[3]; c++)
+  {
+    const T * buffer = inputBuffer + c * m_numberOfVoxels;
+    for(long pz=z-m_halfPatchSize[2]; pz<=z+m_halfPatchSize[2]; pz++)
+    {
+      for(long py=y-m_halfPatchSize[1]; py<=y+m_halfPatchSize[1]; py++)
+      {
+        for(long px=x-m_halfPatchSize[0]; px<=x+m_halfPatchSize[0]; px++, patch++)
+        {
+          if( (px>=0) && (px<(long)m_size[0]) && (py>=0) && (py<(long)m_size[1]) && (pz>=0) && (pz<(long)m_size[2]) )
+          {
+            *patch = buffer[ px + (long)m_size[0] * ( py + (long)m_size[1] * pz ) ];
+          }
+          else
+          {
+            *patch = 0;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+double MultiChannelNLMTool<T>::ComputeDistance(const T * centralPatch, long x, long y, long z, bool inside, PatchWorkspace & workspace, double cutoff)
+{
+  const unsigned int n = m_patchOffsets.size();
+  const unsigned int numberOfRows = m_rowOffsets.size();
+  double distance = 0;
+
+  if(inside == true)
+  {
+    const T * center = m_inputImage->GetBufferPointer() + x + (long)m_size[0] * ( y + (long)m_size[1] * z );
+    for(unsigned int c=0; c < m_size[3]; c++, center += m_numberOfVoxels)
+    {
+      for(unsigned int r=0; r < numberOfRows; r++, centralPatch += m_rowLength)
+      {
+        distance += PatchDistanceKernel::Compute(centralPatch, center + m_rowOffsets[r], m_rowLength, cutoff - distance);
+        if(distance > cutoff)
+        {
+          return distance;
+        }
+      }
+    }
+    return distance;
+  }
+
+  //boundary case
+  T * neighbourPatch = &workspace.neighbourPatch[0];
+  GetPatch(x, y, z, false, neighbourPatch);
+  for(unsigned int c=0; c < m_size[3]; c++, centralPatch += n, neighbourPatch += n)
+  {
+    distance += PatchDistanceKernel::Compute(centralPatch, neighbourPatch, n, cutoff - distance);
+    if(distance > cutoff)
+    {
+      return distance;
+    }
+  }
+  return distance;
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::DenoiseVoxel(long x, long y, long z, PatchWorkspace & workspace, T * output)
+{
+  const T * inputBuffer = m_inputImage->GetBufferPointer();
+  const unsigned int numberOfChannels = m_size[3];
+  const long v = x + (long)m_size[0] * ( y + (long)m_size[1] * z );
+  const double cutoff = PatchDistanceKernel::Cutoff(m_rangeBandwidth);
+
+  double wmax = 0; //maximum weight of patches
+  double sum  = 0; //sum of weights (used for normalization purpose)
+  std::fill(workspace.estimate.begin(), workspace.estimate.end(), 0.0);
+
+  GetPatch(x, y, z, IsPatchInside(x,y,z), &workspace.centralPatch[0]);
+
+  //search region (clipped to the image)
+  long start[3], end[3];
+  long p[3] = {x, y, z};
+  bool regionInside = true;
+  for(unsigned int i=0; i!= 3; i++)
+  {
+    start[i] = std::max(p[i] - m_halfSpatialBandwidth[i], 0L);
+    end[i]   = std::min(p[i] + m_halfSpatialBandwidth[i], (long)m_size[i]-1);
+    if( (start[i] < m_halfPatchSize[i]) || (end[i] + m_halfPatchSize[i] >= (long)m_size[i]) )
+    {
+      regionInside = false;
+    }
+  }
+
+  for(long qz=start[2]; qz<=end[2]; qz++)
+  {
+    for(long qy=start[1]; qy<=end[1]; qy++)
+    {
+      for(long qx=start[0]; qx<=end[0]; qx++)
+      {
+        bool inside = regionInside || IsPatchInside(qx,qy,qz);
+
+        //the distance is computed jointly over all the channels
+        double distance = ComputeDistance(&workspace.centralPatch[0], qx, qy, qz, inside, workspace, cutoff);
+        if(distance > cutoff)
+        {
+          continue;
+        }
+        double weight = exp( - distance / m_rangeBandwidth);
+
+        if( (weight > wmax) && (qx != x) && (qy != y) && (qz != z) )
+        {
+          wmax = weight;
+        }
+        sum += weight;
+
+        //the same weight is used for every channel
+        long q = qx + (long)m_size[0] * ( qy + (long)m_size[1] * qz );
+        for(unsigned int c=0; c < numberOfChannels; c++)
+        {
+          workspace.estimate[c] += weight * inputBuffer[q + c * m_numberOfVoxels];
+        }
+      }
+    }
+  }
+
+  //consider now the special case of the central voxel (as in NLMTool)
+  double centralWeight = 0;
+  switch(m_centralPointStrategy)
+  {
+  case 0:
+      centralWeight = -1.0;
+      break;
+  case 1:
+      break;
+  case -1:
+  default:
+      centralWeight = wmax - 1.0;
+      break;
+  }
+  sum += centralWeight;
+
+  for(unsigned int c=0; c < numberOfChannels; c++)
+  {
+    double value = inputBuffer[v + c * m_numberOfVoxels];
+    if(sum > 0.0001)
+    {
+      output[v + c * m_numberOfVoxels] = (workspace.estimate[c] + centralWeight * value) / sum;
+    }
+    else
+    {
+      output[v + c * m_numberOfVoxels] = value;
+    }
+  }
+}
+
+template <typename T>
+void MultiChannelNLMTool<T>::ComputeOutput()
+{
+  std::cout<<"Compute the denoised image using multi-channel NLM algorithm (pointwise)"<<std::endl;
+  const T * maskBuffer = m_maskImage->GetBufferPointer();
+  T * outputBuffer = m_outputImage->GetBufferPointer();
+
+  int x,y,z;
+  #pragma omp parallel private(x,y,z)
+  {
+  //scratch buffers are allocated once per thread
+  PatchWorkspace workspace;
+  workspace.centralPatch.assign(m_patchOffsets.size() * m_size[3], 0);
+  workspace.neighbourPatch.assign(m_patchOffsets.size() * m_size[3], 0);
+  workspace.estimate.assign(m_size[3], 0);
+
+  #pragma omp for schedule(dynamic)
+  for(z=0; z < (int)m_size[2]; z++)
+  {
+    for(y=0; y < (int)m_size[1]; y++)
+    {
+      for(x=0; x < (int)m_size[0]; x++)
+      {
+        if( maskBuffer[x + (long)m_size[0] * ( y + (long)m_size[1] * z )] > 0 )
+        {
+          DenoiseVoxel(x, y, z, workspace, outputBuffer);
+        }
+      }
+    }
+  }
+  }
+}
+
+}
+
+#endif
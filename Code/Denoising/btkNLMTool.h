@@ -50,10 +50,15 @@ knowledge of the CeCILL-B license and that you accept its terms.
 #include "itkImageRegionIteratorWithIndex.h"
 #include "itkCastImageFilter.h"
 
+#include "btkPatchDistanceKernel.h"
+#include "btkPatchStatistics.h"
+
 #include "string"
 #include "iomanip"
 #include "sstream"
 #include "fstream"
+#include "vector"
+#include "algorithm"
 
 //WARNING:
 //the possible types for T are float or double. Other types may introduce error during the computations 
@@ -97,6 +102,19 @@ class NLMTool
      */
   typedef typename itk::ImageRegionIteratorWithIndex< itkTImage > itkTIteratorWithIndex;
 
+    /**
+     * @brief Per-thread scratch buffers used to denoise a patch without any allocation.
+     * Patches are stored as contiguous arrays (x first, then y, then z), as in an itk::Image buffer.
+     */
+  struct PatchWorkspace
+  {
+    std::vector<TPixelType> centralPatch;            /**< patch around the current voxel */
+    std::vector<TPixelType> centralReferencePatch;   /**< patch around the current voxel in the reference image */
+    std::vector<TPixelType> neighbourPatch;          /**< patch around a voxel of the search region */
+    std::vector<TPixelType> neighbourReferencePatch; /**< patch around a voxel of the search region in the reference image */
+    std::vector<TPixelType> denoisedPatch;           /**< weighted estimate of the central patch */
+  };
+
     /**
      * @brief Set Input Image
      * @param inputImage Image to set in Input
@@ -147,6 +165,16 @@ class NLMTool
    * @param Todo
    */
   void SetOptimizationStrategy(int o);
+  /**
+   * @brief Use an approximate search (PatchMatch-like) instead of the whole search region.
+   * For every voxel, the numberOfCandidates most similar patches of the search region are looked for by
+   * propagating the candidates of the neighbouring voxels and by a random search, and only these candidates
+   * (plus the central patch) are weighted. A large spatial bandwidth can then be used at a reduced cost.
+   * This is used by the pointwise and blockwise modes (not by the integral image optimization).
+   * @param numberOfCandidates Number of candidates per voxel (0: exhaustive search, default)
+   * @param numberOfIterations Number of propagation/random search iterations
+   */
+  void SetPatchMatchStrategy(int numberOfCandidates, int numberOfIterations = 4);
   /**
    * @brief Todo
    * @param Todo
@@ -163,15 +191,60 @@ class NLMTool
    */
   double ComputePseudoResidualSafely(typename itkTImage::IndexType & pixelIndex);
   /**
-   * @brief Todo
-   * @param Todo
+   * @brief Compute the absolute pseudo-residual of every voxel (0 where ComputePseudoResidualSafely returns 0).
+   * @param residualImage Output buffer having the size of the input image
+   */
+  void ComputePseudoResidualImage(std::vector<float> & residualImage);
+  /**
+   * @brief Range bandwidth from a MAD estimation of the noise standard deviation.
+   * @param vecei Absolute pseudo-residuals (reordered by the function)
+   * @param beta Smoothing parameter
+   * @param verbose If true, the estimated sigma is printed
+   */
+  float MADEstimation(std::vector<float> & vecei, float & beta, bool verbose = true);
+  /**
+   * @brief MAD estimation of the noise standard deviation (1.4826 times the median absolute deviation).
+   * @param vecei Pseudo-residuals (modified by the function)
    */
-  float MADEstimation(std::vector<float> & vecei, float & beta);
+  static double MADSigma(std::vector<float> & vecei);
+  /**
+   * @brief Range bandwidth corresponding to a noise standard deviation, for the current patch size.
+   * @param sigma Noise standard deviation
+   * @param beta Smoothing parameter
+   */
+  float GetRangeBandwidth(double sigma, float beta);
   /**
    * @brief Todo
    * @param Todo
    */
   void SetSmoothing(float beta); //set the smoothing parameter and compute the corrected smoothing value (m_rangeBandwidth)
+  /**
+   * @brief Set the same range bandwidth (squared smoothing value) for every voxel, e.g. when it has been estimated on a larger image.
+   * @param rangeBandwidth Range bandwidth
+   */
+  void SetRangeBandwidth(float rangeBandwidth);
+  /**
+   * @brief Append the absolute pseudo-residuals of the mask voxels of a region (the image border is neglected) to vecei.
+   * @param region Region of the input image
+   * @param vecei Vector of pseudo-residuals (see MADEstimation)
+   */
+  void GetPseudoResiduals(const typename itkTImage::RegionType & region, std::vector<float> & vecei);
+  /**
+   * @brief Append the absolute pseudo-residuals of the mask voxels of an image buffer (the image border is neglected) to vecei.
+   * @param buffer Image buffer (e.g. one 3D image of a 4D buffer)
+   * @param maskBuffer Buffer of the mask image (only voxels > 0 are used)
+   * @param size Size of the image
+   * @param vecei Vector of pseudo-residuals (see MADSigma)
+   */
+  static void GetPseudoResiduals(const TPixelType * buffer, const TPixelType * maskBuffer, const typename itkTImage::SizeType & size, std::vector<float> & vecei);
+  /**
+   * @brief Bounds of the voxels of a region where the pseudo-residuals are computed by GetPseudoResiduals (the image border is neglected).
+   * @param region Region of the image
+   * @param size Size of the image
+   * @param begin First index along each axis
+   * @param end Last index (excluded) along each axis
+   */
+  static void GetPseudoResidualBounds(const typename itkTImage::RegionType & region, const typename itkTImage::SizeType & size, int begin[3], int end[3]);
   /**
    * @brief Todo
    * @param Todo
@@ -187,6 +260,15 @@ class NLMTool
    * @param Todo
    */
   void ComputeOutput();
+  /**
+   * @brief Pointwise denoising using integral images (optimization strategy 2).
+   * For every displacement s of the search window, the squared difference image between the image and its
+   * shifted version is computed once, and the distances between all the patches p and p+s are obtained by
+   * separable box sums. The cost is thus independent of the patch size. As D(p,p+s) = D(p+s,p), only half
+   * of the displacements are computed. The result matches the pointwise mode without voxel preselection.
+   * @param denoisedImage Output image (voxels outside the mask are left unchanged)
+   */
+  void ComputeOutputUsingIntegralImages(itkTPointer & denoisedImage);
   /**
    * @brief Todo
    * @param Todo
@@ -217,6 +299,41 @@ class NLMTool
    * @param Todo
    */
   double PatchDistance(itkTPointer & p,itkTPointer & q);
+  /**
+   * @brief Allocate the scratch buffers of a workspace according to the current patch size.
+   * @param workspace Workspace to initialize (one per thread)
+   */
+  void InitializeWorkspace(PatchWorkspace & workspace);
+  /**
+   * @brief Copy the patch centred on p from an image buffer into a contiguous array (voxels outside the image are set to 0).
+   * @param buffer Pixel buffer of an image having the size of the input image
+   * @param p Central voxel of the patch
+   * @param inside True if the whole patch is known to lie in the image (no boundary test is then done)
+   * @param patch Output array of m_patchOffsets.size() values
+   */
+  void GetPatch(const TPixelType * buffer, const typename itkTImage::IndexType & p, bool inside, TPixelType * patch);
+  /**
+   * @brief Add a contiguous patch to an image buffer and the corresponding weight to a weight buffer.
+   * @param p Central voxel of the patch
+   * @param patch Contiguous patch values
+   * @param image Pixel buffer of the accumulated image
+   * @param weightImage Pixel buffer of the accumulated weights
+   * @param weight Weight of the patch
+   */
+  void AddPatchToImage(const typename itkTImage::IndexType & p, const TPixelType * patch, TPixelType * image, TPixelType * weightImage, double weight);
+  /**
+   * @brief Squared L2 distance between two contiguous patches.
+   * @param cutoff The computation stops once the partial distance is above this value (see PatchDistanceKernel)
+   */
+  double PatchDistance(const TPixelType * p, const TPixelType * q, double cutoff = std::numeric_limits<double>::max());
+  /**
+   * @brief Compute the denoised patch around p into workspace.denoisedPatch.
+   * @param p Central voxel
+   * @param workspace Per-thread scratch buffers (see InitializeWorkspace)
+   * @param useTheReferenceImage If true, weights are computed on the reference image
+   * @return sum of the weights
+   */
+  double GetDenoisedPatch(typename itkTImage::IndexType p, PatchWorkspace & workspace, bool useTheReferenceImage);
   /**
    * @brief Todo
    * @param Todo
@@ -243,9 +360,50 @@ class NLMTool
    * @param Todo
    */
   bool CheckSpeed(typename itkTImage::IndexType p, typename itkTImage::IndexType q);
+  /**
+   * @brief Same as CheckSpeed but using linear indices in the image buffers.
+   */
+  bool CheckSpeed(long p, long q);
+  /**
+   * @brief Linear index of a voxel in the image buffers.
+   */
+  long GetLinearIndex(const typename itkTImage::IndexType & p) const
+  {
+    return p[0] + (long)m_size[0] * ( p[1] + (long)m_size[1] * p[2] );
+  }
+  /**
+   * @brief Return true if the patch centred on p lies entirely in the image.
+   */
+  bool IsPatchInside(const typename itkTImage::IndexType & p) const
+  {
+    for(unsigned int i=0; i!= 3; i++)
+    {
+      if( (p[i] < (long)m_halfPatchSize[i]) || (p[i] + (long)m_halfPatchSize[i] >= (long)m_size[i]) )
+      {
+        return false;
+      }
+    }
+    return true;
+  }
 
 protected:
 
+  /**
+   * @brief Precompute the linear offsets of the patch voxels wrt the central voxel.
+   */
+  void InitializePatchOffsets();
+  /**
+   * @brief Compute the candidate neighbours of every voxel of the mask (see SetPatchMatchStrategy).
+   */
+  void ComputeCandidates();
+  /**
+   * @brief Replace the worst candidate of p by p+offset if this patch is closer to the patch of p.
+   * @param slot Position of p in the candidate arrays (see m_candidateSlots)
+   * @return true if the candidate has been kept
+   */
+  bool TryCandidate(const typename itkTImage::IndexType & p, long slot, const short * offset, const TPixelType * centralWeightPatch, const TPixelType * weightBuffer, PatchWorkspace & workspace);
+
+
   itkTPointer m_inputImage;/**< Pointer to input Image */
   itkTPointer m_outputImage;/**< Pointer to outputImage */
   itkTPointer m_maskImage;/**< Pointer to mask Image */
@@ -265,11 +423,18 @@ private :
   typename itkTImage::SizeType m_fullPatchSize;          /**< patch size  : 2 * halfPatchSize + 1*/
   typename itkTImage::SizeType m_halfSpatialBandwidth;   /**< equivalent to the half size of the volume search area in non-local means*/
   typename itkTImage::SizeType m_fullSpatialBandwidth;   /**< spatial bandwidth : 2 * halfSpatialBandwidth + 1*/
+  std::vector<long> m_patchOffsets;                      /**< linear offsets (in the image buffer) of the patch voxels wrt the central voxel */
+  long m_centralPatchOffset;                             /**< position of the central voxel in a contiguous patch */
+  int  m_numberOfCandidates;                             /**< number of candidates per voxel for the approximate search (0: exhaustive search) */
+  int  m_numberOfPatchMatchIterations;                   /**< number of iterations of the approximate search */
+  std::vector<int>   m_candidateSlots;                   /**< position of every voxel in the candidate arrays (-1 outside the mask) */
+  std::vector<short> m_candidateOffsets;                 /**< offsets (x,y,z) of the candidates of every voxel of the mask */
+  std::vector<float> m_candidateDistances;               /**< patch distances of the candidates of every voxel of the mask (max float: no candidate) */
 
   float m_padding; /**< float value of padding */
   int   m_centralPointStrategy; /**< todo */
   int   m_blockwise;/**< todo */
-  int   m_optimized;/**< todo */
+  int   m_optimized;/**< 0: no preselection, 1: preselection using mean and variance images, 2: integral images (pointwise only) */
   float m_lowerMeanThreshold;/**< todo */
   float m_lowerVarianceThreshold;/**< todo */
   bool  m_useTheReferenceImage;/**< todo */
@@ -22,6 +22,8 @@ void NLMTool<T>::SetInput(itkTPointer inputImage)
 
   m_useTheReferenceImage = false;
   m_useGlobalSmoothing = true;
+  m_numberOfCandidates = 0;
+  m_numberOfPatchMatchIterations = 0;
 
   //duplicate the input image into the rangeBandwidth image to keep all header information
   typename itkTDuplicator::Pointer duplicator2 = itkTDuplicator::New();
@@ -75,6 +77,26 @@ void NLMTool<T>::SetPatchSize(int h)
   m_fullPatchSize[0] = 2 * m_halfPatchSize[0] + 1;
   m_fullPatchSize[1] = 2 * m_halfPatchSize[1] + 1;
   m_fullPatchSize[2] = 2 * m_halfPatchSize[2] + 1;
+
+  InitializePatchOffsets();
+}
+
+template <typename T>
+void NLMTool<T>::InitializePatchOffsets()
+{
+  //offsets are ordered as the voxels of an itk::Image patch (x first, then y, then z)
+  m_patchOffsets.clear();
+  for(int pz=-(int)m_halfPatchSize[2]; pz<=(int)m_halfPatchSize[2]; pz++)
+  {
+    for(int py=-(int)m_halfPatchSize[1]; py<=(int)m_halfPatchSize[1]; py++)
+    {
+      for(int px=-(int)m_halfPatchSize[0]; px<=(int)m_halfPatchSize[0]; px++)
+      {
+        m_patchOffsets.push_back( px + (long)m_size[0] * ( py + (long)m_size[1] * pz ) );
+      }
+    }
+  }
+  m_centralPatchOffset = m_halfPatchSize[0] + m_fullPatchSize[0] * ( m_halfPatchSize[1] + m_fullPatchSize[1] * m_halfPatchSize[2] );
 }
 
 template <typename T>
@@ -187,6 +209,11 @@ void NLMTool<T>::SetOptimizationStrategy(int o)
 {
     m_optimized = o;
 
+    if(o==2)
+    {
+        std::cout<<"Optimized mode using integral images (pointwise denoising, no voxel preselection)"<<std::endl;
+    }
+
     if(o==1)
     {
         std::cout<<"Optimized mode. Computing Mean and Variance images"<<std::endl;
@@ -206,44 +233,19 @@ void NLMTool<T>::SetOptimizationStrategy(int o)
         m_varianceImage->Allocate();
         m_varianceImage->FillBuffer(0);
 
-        int x,y,z;
-        #pragma omp parallel for private(x,y,z) schedule(dynamic)
-
-        for(z=0; z < (int)m_size[2]; z++)
-        {
-            for(y=0; y < (int)m_size[1]; y++)
-            {
-                for(x=0; x < (int)m_size[0]; x++)
-                {
-                    typename itkTImage::IndexType p;
-                    p[0] = x;
-                    p[1] = y;
-                    p[2] = z;
-
-                    if( m_maskImage->GetPixel(p) > 0 )
-                    {
-                        itkTPointer patch = itkTImage::New();
-                        CreatePatch(patch);
-                        GetPatch(p,patch);
-                        itkTIterator itp( patch, patch->GetRequestedRegion() );
-                        double m = 0;
-                        double m2= 0;
-                        for(itp.GoToBegin(); !itp.IsAtEnd(); ++itp)
-                        {
-                            m += itp.Get();
-                            m2+= (itp.Get() * itp.Get());
-                        }
-                        int n = patch->GetLargestPossibleRegion().GetNumberOfPixels();
-                        float mean = m / n;
-                        float variance = (m2 / n) - (mean * mean) ;
-
-                        m_meanImage->SetPixel( p, mean );
-                        m_varianceImage->SetPixel( p, variance );
-                    }
-                }
-            }
-        }
+        PatchStatistics::ComputeMeanAndVariance(m_inputImage->GetBufferPointer(), m_maskImage->GetBufferPointer(), m_size, m_halfPatchSize,
+                                                m_meanImage->GetBufferPointer(), m_varianceImage->GetBufferPointer());
+    }
+}
 
+template <typename T>
+void NLMTool<T>::SetPatchMatchStrategy(int numberOfCandidates, int numberOfIterations)
+{
+    m_numberOfCandidates = std::max(numberOfCandidates, 0);
+    m_numberOfPatchMatchIterations = numberOfIterations;
+    if(m_numberOfCandidates > 0)
+    {
+        std::cout<<"Approximate search (PatchMatch): "<<m_numberOfCandidates<<" candidates per voxel, "<<m_numberOfPatchMatchIterations<<" iterations"<<std::endl;
     }
 }
 
@@ -309,20 +311,36 @@ double NLMTool<T>::ComputePseudoResidualSafely(typename itkTImage::IndexType & p
 }
 
 template <typename T>
-float NLMTool<T>::MADEstimation(std::vector<float> & vecei, float & beta)
+float NLMTool<T>::MADEstimation(std::vector<float> & vecei, float & beta, bool verbose)
 {
-  //Estimation of sigma with MAD
-  std::sort(vecei.begin(), vecei.end());
-  float med = vecei[(int)(vecei.size()/2)];
+  double sigma = MADSigma(vecei);
+  if(verbose == true)
+  {
+    std::cout<<"sigma : "<<sigma<<std::endl;
+  }
+  return GetRangeBandwidth(sigma, beta);
+}
+
+template <typename T>
+double NLMTool<T>::MADSigma(std::vector<float> & vecei)
+{
+  //Estimation of sigma with MAD (only the median elements are needed, so a full sort is not required)
+  unsigned int middle = vecei.size()/2;
+  std::nth_element(vecei.begin(), vecei.begin() + middle, vecei.end());
+  float med = vecei[middle];
   for(unsigned int i=0; i<vecei.size(); i++)
   {
     vecei[i] = fabs(vecei[i] - med);
   }
-  std::sort(vecei.begin(), vecei.end());
+  std::nth_element(vecei.begin(), vecei.begin() + middle, vecei.end());
+
+  return 1.4826 * vecei[middle];
+}
 
-  double sigma2 = 1.4826 * vecei[(int)(vecei.size()/2)];
-  std::cout<<"sigma : "<<sigma2<<std::endl;
-  sigma2 = sigma2 * sigma2;
+template <typename T>
+float NLMTool<T>::GetRangeBandwidth(double sigma, float beta)
+{
+  double sigma2 = sigma * sigma;
   float NLMsmooth = 2 * beta * sigma2 * (2*m_halfPatchSize[0]+1) * (2*m_halfPatchSize[1]+1) * (2*m_halfPatchSize[2]+1);
   return NLMsmooth;
 }
@@ -332,17 +350,39 @@ void NLMTool<T>::SetSmoothing(float beta)
 {
     //this function should be rewritten using a convolution-based approach
     std::cout<<"Computing the global range bandwidth (corresponding to the smoothing parameter for the NLM algorithm)."<<std::endl;
-    int x,y,z;
 
     std::vector<float> vecei;
-    //since we have use to use a neighborhood around the current voxel, we neglect the border to avoid slow tests.
+    GetPseudoResiduals(m_region, vecei);
+
+    float NLMsmooth = MADEstimation(vecei, beta);
+    std::cout<<"Global smoothing parameter h : "<<sqrt(NLMsmooth)<<std::endl;
+    SetRangeBandwidth(NLMsmooth);
+
+}
+
+template <typename T>
+void NLMTool<T>::SetRangeBandwidth(float rangeBandwidth)
+{
+    m_rangeBandwidthImage->FillBuffer(rangeBandwidth);
+}
+
+template <typename T>
+void NLMTool<T>::GetPseudoResiduals(const typename itkTImage::RegionType & region, std::vector<float> & vecei)
+{
+    int begin[3], end[3];
+    GetPseudoResidualBounds(region, m_size, begin, end);
 
-    #pragma omp parallel for private(x,y,z) schedule(dynamic)
-    for(z=1;z<(int)m_size[2]-1;z++)
+    int x,y,z;
+    #pragma omp parallel private(x,y,z)
+    {
+    std::vector<float> threadVecei;
+
+    #pragma omp for schedule(dynamic)
+    for(z=begin[2];z<end[2];z++)
     {
-        for(y=1;y<(int)m_size[1]-1;y++)
+        for(y=begin[1];y<end[1];y++)
         {
-            for(x=1;x<(int)m_size[0]-1;x++)
+            for(x=begin[0];x<end[0];x++)
             {
                 typename itkTImage::IndexType pixelIndex;
                 pixelIndex[0] = x;
@@ -352,90 +392,165 @@ void NLMTool<T>::SetSmoothing(float beta)
                 if( m_maskImage->GetPixel(pixelIndex) > 0)
                 {
                     double ei = ComputePseudoResidual(pixelIndex);
+                    threadVecei.push_back(fabs(ei));
+                }
+            }
+        }
+    }
+
+    #pragma omp critical
+    vecei.insert(vecei.end(), threadVecei.begin(), threadVecei.end());
+    }
+}
+
+template <typename T>
+void NLMTool<T>::GetPseudoResiduals(const T * buffer, const T * maskBuffer, const typename itkTImage::SizeType & size, std::vector<float> & vecei)
+{
+    const long sx  = size[0];
+    const long sxy = (long)size[0] * size[1];
+
+    typename itkTImage::RegionType region;
+    region.SetSize(size);
+    int begin[3], end[3];
+    GetPseudoResidualBounds(region, size, begin, end);
 
-                    #pragma omp critical
-//                    if(fabs(ei>0))
-//                    {
-                        vecei.push_back(fabs(ei));
-//                    }
+    for(long z=begin[2]; z<end[2]; z++)
+    {
+        for(long y=begin[1]; y<end[1]; y++)
+        {
+            long v = begin[0] + sx * ( y + (long)size[1] * z );
+            for(long x=begin[0]; x<end[0]; x++, v++)
+            {
+                if( maskBuffer[v] > 0 )
+                {
+                    double ei = buffer[v+1];
+                    ei += buffer[v-1];
+                    ei += buffer[v+sx];
+                    ei += buffer[v-sx];
+                    ei += buffer[v+sxy];
+                    ei += buffer[v-sxy];
+                    ei = sqrt(6.0/7.0)*(buffer[v] - ei/6.0);
+                    vecei.push_back(fabs(ei));
                 }
             }
         }
     }
-    float NLMsmooth = MADEstimation(vecei, beta);
-    std::cout<<"Global smoothing parameter h : "<<sqrt(NLMsmooth)<<std::endl;
-    m_rangeBandwidthImage->FillBuffer(NLMsmooth);
+}
 
+template <typename T>
+void NLMTool<T>::GetPseudoResidualBounds(const typename itkTImage::RegionType & region, const typename itkTImage::SizeType & size, int begin[3], int end[3])
+{
+    //since we have use to use a neighborhood around the current voxel, we neglect the border to avoid slow tests.
+    for(unsigned int i=0; i!= 3; i++)
+    {
+        begin[i] = std::max( (int)region.GetIndex()[i], 1 );
+        end[i]   = std::min( (int)(region.GetIndex()[i] + region.GetSize()[i]), (int)size[i]-1 );
+    }
 }
+
 template <typename T>
 void NLMTool<T>::SetLocalSmoothing(float beta)
 {
     std::cout<<"Computing the range bandwidth locally, for every voxel."<<std::endl;
     int x,y,z;
 
+    //the pseudo-residuals are computed once, each of them is used by every voxel of its search region
+    std::vector<float> residualImage;
+    ComputePseudoResidualImage(residualImage);
+
+    const T * maskBuffer = m_maskImage->GetBufferPointer();
+    T * rangeBuffer = m_rangeBandwidthImage->GetBufferPointer();
 
-#pragma omp parallel for private(x,y,z) schedule(dynamic)
+#pragma omp parallel private(x,y,z)
+    {
+    std::vector<float> vecei;
+    vecei.reserve( m_fullSpatialBandwidth[0] * m_fullSpatialBandwidth[1] * m_fullSpatialBandwidth[2] );
+
+#pragma omp for schedule(dynamic)
     for(z=0;z<(int)m_size[2];z++)
     {
         for(y=0;y<(int)m_size[1];y++)
         {
             for(x=0;x<(int)m_size[0];x++)
             {
-
                 typename itkTImage::IndexType pixelIndex;
-                double ei = 0;
                 pixelIndex[0] = x;
                 pixelIndex[1] = y;
                 pixelIndex[2] = z;
+                long pLinear = GetLinearIndex(pixelIndex);
 
-                if( m_maskImage->GetPixel(pixelIndex) > 0)
+                if( maskBuffer[pLinear] > 0)
                 {
-
                     typename itkTImage::RegionType searchRegion;
                     ComputeSearchRegion(pixelIndex,searchRegion);
+                    typename itkTImage::IndexType start = searchRegion.GetIndex();
+                    typename itkTImage::SizeType  size  = searchRegion.GetSize();
 
-                    itkTIteratorWithIndex itRegion(m_inputImage, searchRegion);
-                    typename itkTImage::IndexType neighbourPixelIndex;
+                    vecei.clear();
 
-                    std::vector<float> vecei;
-
-                    for(itRegion.GoToBegin(); !itRegion.IsAtEnd(); ++itRegion)
+                    for(long qz = start[2]; qz < start[2] + (long)size[2]; qz++)
                     {
-                        neighbourPixelIndex = itRegion.GetIndex();
-
-                        bool goForIt = true;
-                        if(m_optimized == 1)
+                        for(long qy = start[1]; qy < start[1] + (long)size[1]; qy++)
                         {
-                            goForIt = CheckSpeed(pixelIndex, neighbourPixelIndex);
-                        }
-
-                        if(goForIt == true)
-                        {
-                            if( m_maskImage->GetPixel(neighbourPixelIndex) > 0)
+                            long qLinear = start[0] + (long)m_size[0] * ( qy + (long)m_size[1] * qz );
+                            for(long qx = start[0]; qx < start[0] + (long)size[0]; qx++, qLinear++)
                             {
-                                ei = ComputePseudoResidualSafely(neighbourPixelIndex);
-//                                if(fabs(ei>0))
-//                                {
-                                    vecei.push_back(fabs(ei));
-//                                }
-                            }
-
+                                bool goForIt = true;
+                                if(m_optimized == 1)
+                                {
+                                    goForIt = CheckSpeed(pLinear, qLinear);
+                                }
 
+                                if( (goForIt == true) && (maskBuffer[qLinear] > 0) )
+                                {
+                                    vecei.push_back(residualImage[qLinear]);
+                                }
+                            }
                         }
-
                     }
                     if(vecei.size()>0)
                     {
-                        float NLMsmooth = MADEstimation(vecei, beta);
-                        m_rangeBandwidthImage->SetPixel(pixelIndex, NLMsmooth);
-
+                        float NLMsmooth = MADEstimation(vecei, beta, false);
+                        rangeBuffer[pLinear] = NLMsmooth;
                     }
                 }
-
             }
         }
     }
+    }
+
+}
+
+template <typename T>
+void NLMTool<T>::ComputePseudoResidualImage(std::vector<float> & residualImage)
+{
+    const T * buffer = (m_useTheReferenceImage == true) ? m_refImage->GetBufferPointer() : m_inputImage->GetBufferPointer();
+    const long sx  = m_size[0];
+    const long sxy = (long)m_size[0] * m_size[1];
+
+    residualImage.assign(sxy * m_size[2], 0);
 
+    //same border as ComputePseudoResidualSafely: the residual is 0 elsewhere
+    int x,y,z;
+    #pragma omp parallel for private(x,y,z) schedule(static)
+    for(z=2; z<(int)m_size[2]-1; z++)
+    {
+        for(y=2; y<(int)m_size[1]-1; y++)
+        {
+            long v = 2 + sx * ( y + (long)m_size[1] * z );
+            for(x=2; x<(int)m_size[0]-1; x++, v++)
+            {
+                double ei = buffer[v+1];
+                ei += buffer[v-1];
+                ei += buffer[v+sx];
+                ei += buffer[v-sx];
+                ei += buffer[v+sxy];
+                ei += buffer[v-sxy];
+                ei = sqrt(6.0/7.0)*(buffer[v] - ei/6.0);
+                residualImage[v] = fabs(ei);
+            }
+        }
+    }
 }
 
 template <typename T>
@@ -472,17 +587,31 @@ void NLMTool<T>::ComputeOutput()
   itkTIterator denoisedIt( denoisedImage, denoisedImage->GetLargestPossibleRegion() );
   itkTIterator outputIt( m_outputImage, m_outputImage->GetLargestPossibleRegion());
 
+  const T * maskBuffer = m_maskImage->GetBufferPointer();
+  T * denoisedBuffer = denoisedImage->GetBufferPointer();
+
   int x,y,z;
 
-  if(m_blockwise == 0)
+  if( (m_numberOfCandidates > 0) && (m_optimized != 2) )
+  {
+    ComputeCandidates();
+  }
+
+  if(m_optimized == 2)
+  {
+    std::cout<<"fast pointwise denoising (integral images)"<<std::endl;
+    ComputeOutputUsingIntegralImages(denoisedImage);
+  }
+  else if(m_blockwise == 0)
   {
     std::cout<<"pointwise denoising"<<std::endl;
-    typename itkTImage::IndexType q;
-    for(unsigned int i=0; i!= q.GetIndexDimension(); i++)
-    {
-      q[i] = m_halfPatchSize[i];
-    }
-      #pragma omp parallel for private(x,y,z) schedule(dynamic)
+      #pragma omp parallel private(x,y,z)
+      {
+      //scratch buffers are allocated once per thread
+      PatchWorkspace workspace;
+      InitializeWorkspace(workspace);
+
+      #pragma omp for schedule(dynamic)
       for(z=0; z < (int)m_size[2]; z++)
       {
         for(y=0; y < (int)m_size[1]; y++)
@@ -493,27 +622,19 @@ void NLMTool<T>::ComputeOutput()
             p[0] = x;
             p[1] = y;
             p[2] = z;
+            long pLinear = GetLinearIndex(p);
 
-            if( m_maskImage->GetPixel(p) > 0 )
+            if( maskBuffer[pLinear] > 0 )
             {
-              itkTPointer patch = itkTImage::New();
-              double sum = 0;
-              if(m_useTheReferenceImage==false)
-              {
-                  sum = GetDenoisedPatch(p, patch);
-              }
-              else
-              {
-                  sum = GetDenoisedPatchUsingTheReferenceImage(p, patch);
-              }
-
-              denoisedImage->SetPixel( p, patch->GetPixel(q) );
+              GetDenoisedPatch(p, workspace, m_useTheReferenceImage);
+              denoisedBuffer[pLinear] = workspace.denoisedPatch[m_centralPatchOffset];
             }
           }
         }
       }
+      }
   }
-  if(m_blockwise >= 1)
+  else if(m_blockwise >= 1)
   {
     itkTPointer weightImage = itkTImage::New();
     weightImage->SetRegions(m_inputImage->GetLargestPossibleRegion());
@@ -522,88 +643,67 @@ void NLMTool<T>::ComputeOutput()
     weightImage->SetDirection( m_inputImage->GetDirection() );
     weightImage->Allocate();
     weightImage->FillBuffer(0);
+    T * weightBuffer = weightImage->GetBufferPointer();
 
+    //patches are only computed on a grid with a step of halfPatchSize+1 in fast blockwise mode
+    int step[3] = {1, 1, 1};
     if(m_blockwise == 1)
     {
       std::cout<<"blockwise denoising"<<std::endl;
-      #pragma omp parallel for private(x,y,z) schedule(dynamic)
-      for(z=0; z < (int)m_size[2]; z++)
+    }
+    if(m_blockwise == 2)
+    {
+      std::cout<<"fast blockwise denoising"<<std::endl;
+      for(unsigned int i=0; i!= 3; i++)
       {
-        for(y=0; y < (int)m_size[1]; y++)
+        step[i] = m_halfPatchSize[i] + 1;
+      }
+    }
+
+    //The image is split along z into slabs of 2*halfPatchSize+1 slices. The patches centred in a slab only
+    //overlap the two neighbouring slabs, so the even slabs (then the odd ones) can be processed in parallel
+    //without any lock. Each voxel receives its contributions in the same order whatever the number of threads.
+    int slabThickness = 2 * m_halfPatchSize[2] + 1;
+    int numberOfSlabs = (m_size[2] + slabThickness - 1) / slabThickness;
+    int slab;
+
+    for(int phase=0; phase < 2; phase++)
+    {
+      #pragma omp parallel private(x,y,z,slab)
+      {
+      PatchWorkspace workspace;
+      InitializeWorkspace(workspace);
+
+      #pragma omp for schedule(dynamic)
+      for(slab=phase; slab < numberOfSlabs; slab+=2)
+      {
+        for(z=slab*slabThickness; z < std::min( (slab+1)*slabThickness, (int)m_size[2] ); z++)
         {
-          for(x=0; x < (int)m_size[0]; x++)
+          if( z%step[2] != 0 )
           {
-            typename itkTImage::IndexType p;
-            p[0] = x;
-            p[1] = y;
-            p[2] = z;
-
-            if( m_maskImage->GetPixel(p) > 0 )
+            continue;
+          }
+          for(y=0; y < (int)m_size[1]; y+=step[1])
+          {
+            for(x=0; x < (int)m_size[0]; x+=step[0])
             {
-              itkTPointer patch = itkTImage::New();
-              double sum = 0;
-              if(m_useTheReferenceImage==false)
-              {
-                  sum = GetDenoisedPatch(p, patch);
-              }
-              else
+              typename itkTImage::IndexType p;
+              p[0] = x;
+              p[1] = y;
+              p[2] = z;
+
+              if( maskBuffer[GetLinearIndex(p)] > 0 )
               {
-                  sum = GetDenoisedPatchUsingTheReferenceImage(p, patch);
-              }
+                GetDenoisedPatch(p, workspace, m_useTheReferenceImage);
 
-              double weight = 1.0;
-              #pragma omp critical
-              AddPatchToImage(p, patch, denoisedImage, weightImage, weight);
+                double weight = 1.0;
+                AddPatchToImage(p, &workspace.denoisedPatch[0], denoisedBuffer, weightBuffer, weight);
+              }
             }
           }
         }
       }
-    }
-    if(m_blockwise == 2)
-    {
-        std::cout<<"fast blockwise denoising"<<std::endl;
-        //TODO: Simplify this, there is to much for-if-for !
-        #pragma omp parallel for private(x,y,z) schedule(dynamic)
-        for(z=0; z < (int)m_size[2]; z++)
-        {
-            if( z%(m_halfPatchSize[2]+1) == 0)
-            {
-                for(y=0; y < (int)m_size[1]; y++)
-                {
-                    if( y%(m_halfPatchSize[1]+1) == 0)
-                    {
-                        for(x=0; x < (int)m_size[0]; x++)
-                        {
-                            if( x%(m_halfPatchSize[0]+1) == 0 )
-                            {
-                                typename itkTImage::IndexType p;
-                                p[0] = x;
-                                p[1] = y;
-                                p[2] = z;
-
-                                if( m_maskImage->GetPixel(p) > 0 )
-                                {
-                                    itkTPointer patch = itkTImage::New();
-                                    double sum = 0;
-                                    if(m_useTheReferenceImage==false)
-                                    {
-                                        sum = GetDenoisedPatch(p, patch);
-                                    }
-                                    else
-                                    {
-                                        sum = GetDenoisedPatchUsingTheReferenceImage(p, patch);
-                                    }
-
-                                    double weight = 1.0;
-                                    #pragma omp critical
-                                    AddPatchToImage(p, patch, denoisedImage, weightImage, weight);
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+      }
     }
 
     itkTIterator weightIt( weightImage, weightImage->GetLargestPossibleRegion() );
@@ -618,6 +718,11 @@ void NLMTool<T>::ComputeOutput()
 
   }
 
+  //the candidates are only needed during the denoising
+  std::vector<int>().swap(m_candidateSlots);
+  std::vector<short>().swap(m_candidateOffsets);
+  std::vector<float>().swap(m_candidateDistances);
+
   //TODO:This should be modified by just copy the two images.
   //Convert data from denoisedImage to m_outputImage
   for ( denoisedIt.GoToBegin(), outputIt.GoToBegin(); !denoisedIt.IsAtEnd(); ++denoisedIt, ++outputIt)
@@ -630,6 +735,415 @@ void NLMTool<T>::ComputeOutput()
 
 
 
+template <typename T>
+void NLMTool<T>::ComputeOutputUsingIntegralImages(itkTPointer & denoisedImage)
+{
+  const int sx = m_size[0];
+  const int sy = m_size[1];
+  const int sz = m_size[2];
+  const int hx = m_halfPatchSize[0];
+  const int hy = m_halfPatchSize[1];
+  const int hz = m_halfPatchSize[2];
+  const long sxy = (long)sx * sy;
+
+  //extended sizes along y and z: patches are zero-padded outside the image
+  const int ey = sy + 2*hy;
+  const int ez = sz + 2*hz;
+
+  const T * inputBuffer  = m_inputImage->GetBufferPointer();
+  const T * weightBuffer = (m_useTheReferenceImage == true) ? m_refImage->GetBufferPointer() : inputBuffer;
+  const T * maskBuffer   = m_maskImage->GetBufferPointer();
+  const T * rangeBuffer  = m_rangeBandwidthImage->GetBufferPointer();
+
+  //per voxel accumulators
+  std::vector<double> sumImage(sxy*sz, 0.0);      //sum of the weights
+  std::vector<double> estimateImage(sxy*sz, 0.0); //weighted sum of the neighbour values
+  std::vector<double> wmaxImage(sxy*sz, 0.0);     //maximum weight (see GetDenoisedPatch)
+
+  //box sums along x (on the extended yz grid), then along y, then along z
+  std::vector<double> boxX( (long)sx * ey * ez );
+  std::vector<double> boxY( (long)sx * sy * ez );
+  std::vector<double> & distanceImage = boxX;     //boxX is no longer needed once boxY is computed
+
+  int x,y,z;
+
+  for(int dz=0; dz <= (int)m_halfSpatialBandwidth[2]; dz++)
+  for(int dy=-(int)m_halfSpatialBandwidth[1]; dy <= (int)m_halfSpatialBandwidth[1]; dy++)
+  for(int dx=-(int)m_halfSpatialBandwidth[0]; dx <= (int)m_halfSpatialBandwidth[0]; dx++)
+  {
+    //only half of the displacements are processed: D(p,p+s) is also used for the pair (p+s,p)
+    if( (dz == 0) && ( (dy < 0) || ( (dy == 0) && (dx < 0) ) ) )
+    {
+      continue;
+    }
+    const bool  isNullShift = (dx == 0) && (dy == 0) && (dz == 0);
+    const bool  isDiagonal  = (dx != 0) && (dy != 0) && (dz != 0);  //same condition as in GetDenoisedPatch for wmax
+    const long  shift       = dx + sx * ( dy + (long)sy * dz );
+
+    //1. squared differences summed along x, for every line of the extended yz grid
+    #pragma omp parallel private(x,y,z)
+    {
+    std::vector<double> prefix(sx + 2*hx + 1);
+
+    #pragma omp for schedule(static)
+    for(z=0; z < ez; z++)
+    {
+      for(y=0; y < ey; y++)
+      {
+        const int iz = z - hz;
+        const int iy = y - hy;
+        const bool lineInside      = (iz >= 0) && (iz < sz) && (iy >= 0) && (iy < sy);
+        const bool shiftLineInside = (iz+dz >= 0) && (iz+dz < sz) && (iy+dy >= 0) && (iy+dy < sy);
+        const T * line      = weightBuffer + sx * ( (long)iy + (long)sy * iz );
+        const T * shiftLine = weightBuffer + sx * ( (long)(iy+dy) + (long)sy * (iz+dz) );
+
+        prefix[0] = 0;
+        for(int ix=-hx; ix < sx+hx; ix++)
+        {
+          double a = ( lineInside && (ix >= 0) && (ix < sx) ) ? (double)line[ix] : 0.0;
+          double b = ( shiftLineInside && (ix+dx >= 0) && (ix+dx < sx) ) ? (double)shiftLine[ix+dx] : 0.0;
+          prefix[ix+hx+1] = prefix[ix+hx] + (a-b)*(a-b);
+        }
+
+        double * out = &boxX[ (long)sx * ( y + (long)ey * z ) ];
+        for(x=0; x < sx; x++)
+        {
+          out[x] = prefix[x+2*hx+1] - prefix[x];
+        }
+      }
+    }
+    }
+
+    //2. box sums along y
+    #pragma omp parallel for private(x,y,z) schedule(static)
+    for(z=0; z < ez; z++)
+    {
+      for(y=0; y < sy; y++)
+      {
+        double * out = &boxY[ (long)sx * ( y + (long)sy * z ) ];
+        for(x=0; x < sx; x++)
+        {
+          out[x] = 0;
+        }
+        for(int py=0; py <= 2*hy; py++)
+        {
+          const double * in = &boxX[ (long)sx * ( (y+py) + (long)ey * z ) ];
+          for(x=0; x < sx; x++)
+          {
+            out[x] += in[x];
+          }
+        }
+      }
+    }
+
+    //3. box sums along z: distanceImage[p] = D(p,p+s)
+    #pragma omp parallel for private(x,y,z) schedule(static)
+    for(z=0; z < sz; z++)
+    {
+      double * out = &distanceImage[ sxy * z ];
+      for(long k=0; k < sxy; k++)
+      {
+        out[k] = 0;
+      }
+      for(int pz=0; pz <= 2*hz; pz++)
+      {
+        const double * in = &boxY[ sxy * (z+pz) ];
+        for(long k=0; k < sxy; k++)
+        {
+          out[k] += in[k];
+        }
+      }
+    }
+
+    //4. accumulation: each voxel v gets the contribution of v+s (distance D(v,v+s)) and of v-s (distance D(v-s,v)).
+    //Only v is written, so there is no concurrent access, and the order of the contributions does not depend on the number of threads.
+    #pragma omp parallel for private(x,y,z) schedule(static)
+    for(z=0; z < sz; z++)
+    {
+      for(y=0; y < sy; y++)
+      {
+        for(x=0; x < sx; x++)
+        {
+          long v = x + sx * ( (long)y + (long)sy * z );
+          if( maskBuffer[v] <= 0 )
+          {
+            continue;
+          }
+          double rangeBandwidth = rangeBuffer[v];
+          double cutoff = PatchDistanceKernel::Cutoff(rangeBandwidth);
+
+          //neighbour v+s
+          if( (x+dx >= 0) && (x+dx < sx) && (y+dy >= 0) && (y+dy < sy) && (z+dz < sz) )
+          {
+            double distance = distanceImage[v];
+            if(distance <= cutoff)
+            {
+              double weight = exp( - distance / rangeBandwidth);
+              sumImage[v] += weight;
+              estimateImage[v] += weight * inputBuffer[v+shift];
+              if( isDiagonal && (weight > wmaxImage[v]) )
+              {
+                wmaxImage[v] = weight;
+              }
+            }
+          }
+
+          //neighbour v-s
+          if( (isNullShift == false) && (x-dx >= 0) && (x-dx < sx) && (y-dy >= 0) && (y-dy < sy) && (z-dz >= 0) )
+          {
+            double distance = distanceImage[v-shift];
+            if(distance <= cutoff)
+            {
+              double weight = exp( - distance / rangeBandwidth);
+              sumImage[v] += weight;
+              estimateImage[v] += weight * inputBuffer[v-shift];
+              if( isDiagonal && (weight > wmaxImage[v]) )
+              {
+                wmaxImage[v] = weight;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  //central point strategy and normalization (as in GetDenoisedPatch)
+  T * denoisedBuffer = denoisedImage->GetBufferPointer();
+  long v;
+  #pragma omp parallel for private(v) schedule(static)
+  for(v=0; v < sxy*sz; v++)
+  {
+    if( maskBuffer[v] <= 0 )
+    {
+      continue;
+    }
+    double sum = sumImage[v];
+    double estimate = estimateImage[v];
+    double value = inputBuffer[v];
+
+    switch(m_centralPointStrategy)
+    {
+    case 0:
+        estimate -= value;
+        sum -= 1.0;
+        break;
+    case 1:
+        break;
+    case -1:
+    default:
+        estimate += (wmaxImage[v] - 1.0) * value;
+        sum += (wmaxImage[v] - 1.0);
+        break;
+    }
+
+    if(sum>0.0001)
+    {
+      denoisedBuffer[v] = estimate / sum;
+    }
+    else
+    {
+      denoisedBuffer[v] = value;
+    }
+  }
+}
+
+template <typename T>
+void NLMTool<T>::ComputeCandidates()
+{
+  std::cout<<"Computing the candidate neighbours (PatchMatch)"<<std::endl;
+  const long numberOfVoxels = (long)m_size[0] * m_size[1] * m_size[2];
+  const int K = m_numberOfCandidates;
+  const T * maskBuffer = m_maskImage->GetBufferPointer();
+  const T * weightBuffer = (m_useTheReferenceImage == true) ? m_refImage->GetBufferPointer() : m_inputImage->GetBufferPointer();
+
+  //the candidates are only stored for the voxels of the mask
+  m_candidateSlots.assign(numberOfVoxels, -1);
+  long numberOfMaskVoxels = 0;
+  for(long v=0; v < numberOfVoxels; v++)
+  {
+    if( maskBuffer[v] > 0 )
+    {
+      m_candidateSlots[v] = numberOfMaskVoxels++;
+    }
+  }
+
+  m_candidateOffsets.assign(3 * numberOfMaskVoxels * K, 0);
+  m_candidateDistances.assign(numberOfMaskVoxels * K, std::numeric_limits<float>::max());
+
+  //largest radius of the random search
+  int maxRadius = std::max( m_halfSpatialBandwidth[0], std::max(m_halfSpatialBandwidth[1], m_halfSpatialBandwidth[2]) );
+
+  //Iteration 0 draws random candidates. Each further iteration propagates the candidates of the previous voxels (in scan order,
+  //alternately forward and backward) and refines them by a random search of decreasing radius. The even planes and then the odd
+  //planes are processed in parallel, so that the candidates of the neighbouring planes are not modified concurrently and the
+  //result does not depend on the number of threads.
+  for(int iteration=0; iteration <= m_numberOfPatchMatchIterations; iteration++)
+  {
+    const int direction = (iteration%2 == 1) ? 1 : -1;  //the candidates of p - direction are propagated to p
+
+    for(int phase=0; phase < 2; phase++)
+    {
+      int x,y,z;
+      #pragma omp parallel private(x,y,z)
+      {
+      PatchWorkspace workspace;
+      InitializeWorkspace(workspace);
+      std::vector<short> offsets(3*K);
+
+      #pragma omp for schedule(dynamic)
+      for(z=phase; z < (int)m_size[2]; z+=2)
+      {
+        for(int yy=0; yy < (int)m_size[1]; yy++)
+        {
+          y = (direction == 1) ? yy : (int)m_size[1] - 1 - yy;
+          for(int xx=0; xx < (int)m_size[0]; xx++)
+          {
+            x = (direction == 1) ? xx : (int)m_size[0] - 1 - xx;
+
+            typename itkTImage::IndexType p;
+            p[0] = x;
+            p[1] = y;
+            p[2] = z;
+            long pLinear = GetLinearIndex(p);
+            if( maskBuffer[pLinear] <= 0 )
+            {
+              continue;
+            }
+            const long pSlot = m_candidateSlots[pLinear];
+
+            //random generator (LCG) seeded by the voxel and the iteration
+            unsigned int seed = (unsigned int)pLinear * 2654435761u + (unsigned int)iteration * 40503u + 1u;
+
+            T * centralWeightPatch = (m_useTheReferenceImage == true) ? &workspace.centralReferencePatch[0] : &workspace.centralPatch[0];
+            GetPatch(weightBuffer, p, IsPatchInside(p), centralWeightPatch);
+
+            if(iteration == 0)
+            {
+              for(int attempt=0; attempt < 2*K; attempt++)
+              {
+                short o[3];
+                for(unsigned int i=0; i!= 3; i++)
+                {
+                  seed = seed * 1664525u + 1013904223u;
+                  o[i] = (short)( (long)( (seed >> 8) % (2*m_halfSpatialBandwidth[i]+1) ) - (long)m_halfSpatialBandwidth[i] );
+                }
+                TryCandidate(p, pSlot, o, centralWeightPatch, weightBuffer, workspace);
+              }
+              continue;
+            }
+
+            //propagation from the previous voxels along x, y and z
+            for(unsigned int axis=0; axis!= 3; axis++)
+            {
+              typename itkTImage::IndexType q = p;
+              q[axis] -= direction;
+              if( (q[axis] < 0) || (q[axis] >= (long)m_size[axis]) )
+              {
+                continue;
+              }
+              const long qSlot = m_candidateSlots[GetLinearIndex(q)];
+              if( qSlot < 0 )
+              {
+                continue;
+              }
+              for(int k=0; k < K; k++)
+              {
+                if( m_candidateDistances[qSlot * K + k] < std::numeric_limits<float>::max() )
+                {
+                  TryCandidate(p, pSlot, &m_candidateOffsets[3 * (qSlot * K + k)], centralWeightPatch, weightBuffer, workspace);
+                }
+              }
+            }
+
+            //random search around the current candidates
+            std::copy(&m_candidateOffsets[3 * pSlot * K], &m_candidateOffsets[3 * pSlot * K] + 3*K, offsets.begin());
+            for(int k=0; k < K; k++)
+            {
+              if( m_candidateDistances[pSlot * K + k] == std::numeric_limits<float>::max() )
+              {
+                continue;
+              }
+              for(int radius = maxRadius; radius >= 1; radius /= 2)
+              {
+                short o[3];
+                for(unsigned int i=0; i!= 3; i++)
+                {
+                  seed = seed * 1664525u + 1013904223u;
+                  o[i] = offsets[3*k+i] + (short)( (long)( (seed >> 8) % (2*radius+1) ) - radius );
+                }
+                TryCandidate(p, pSlot, o, centralWeightPatch, weightBuffer, workspace);
+              }
+            }
+          }
+        }
+      }
+      }
+    }
+  }
+}
+
+template <typename T>
+bool NLMTool<T>::TryCandidate(const typename itkTImage::IndexType & p, long slot, const short * offset, const T * centralWeightPatch, const T * weightBuffer, PatchWorkspace & workspace)
+{
+  const int K = m_numberOfCandidates;
+  typename itkTImage::IndexType q;
+  bool isNull = true;
+  for(unsigned int i=0; i!= 3; i++)
+  {
+    //the candidate has to lie in the search window and in the image
+    if( (offset[i] < -(long)m_halfSpatialBandwidth[i]) || (offset[i] > (long)m_halfSpatialBandwidth[i]) )
+    {
+      return false;
+    }
+    q[i] = p[i] + offset[i];
+    if( (q[i] < 0) || (q[i] >= (long)m_size[i]) )
+    {
+      return false;
+    }
+    if(offset[i] != 0)
+    {
+      isNull = false;
+    }
+  }
+  //the central patch is always used (see GetDenoisedPatch)
+  if(isNull == true)
+  {
+    return false;
+  }
+
+  //look for the worst candidate, and check that the offset is not already a candidate
+  short * offsets   = &m_candidateOffsets[3 * slot * K];
+  float * distances = &m_candidateDistances[slot * K];
+  int worst = 0;
+  for(int k=0; k < K; k++)
+  {
+    if( (offsets[3*k] == offset[0]) && (offsets[3*k+1] == offset[1]) && (offsets[3*k+2] == offset[2]) && (distances[k] < std::numeric_limits<float>::max()) )
+    {
+      return false;
+    }
+    if(distances[k] > distances[worst])
+    {
+      worst = k;
+    }
+  }
+
+  T * neighbourWeightPatch = (m_useTheReferenceImage == true) ? &workspace.neighbourReferencePatch[0] : &workspace.neighbourPatch[0];
+  GetPatch(weightBuffer, q, IsPatchInside(q), neighbourWeightPatch);
+  double distance = PatchDistance(centralWeightPatch, neighbourWeightPatch, distances[worst]);
+  if(distance >= distances[worst])
+  {
+    return false;
+  }
+
+  distances[worst] = distance;
+  for(unsigned int i=0; i!= 3; i++)
+  {
+    offsets[3*worst+i] = offset[i];
+  }
+  return true;
+}
+
 template <typename T>
 void NLMTool<T>::PrintInfo()
 {
@@ -751,64 +1265,230 @@ void NLMTool<T>::AddPatchToImage(typename itkTImage::IndexType p, itkTPointer &
 template <typename T>
 double NLMTool<T>::PatchDistance(itkTPointer & p,itkTPointer & q)
 {
-  double diff=0;
-  double dist = 0;
-  itkTConstIterator itp( p, p->GetRequestedRegion() );
-  itkTConstIterator itq( q, q->GetRequestedRegion() );
+  return PatchDistanceKernel::Compute(p->GetBufferPointer(), q->GetBufferPointer(), p->GetRequestedRegion().GetNumberOfPixels());
+}
 
-  for(itp.GoToBegin(), itq.GoToBegin(); !itp.IsAtEnd(); ++itp, ++itq)
+template <typename T>
+void NLMTool<T>::InitializeWorkspace(PatchWorkspace & workspace)
+{
+  unsigned int n = m_patchOffsets.size();
+  workspace.centralPatch.assign(n, 0);
+  workspace.neighbourPatch.assign(n, 0);
+  workspace.denoisedPatch.assign(n, 0);
+  if(m_useTheReferenceImage == true)
   {
-    diff = itp.Get() - itq.Get();
-    dist += diff*diff;
+    workspace.centralReferencePatch.assign(n, 0);
+    workspace.neighbourReferencePatch.assign(n, 0);
   }
-  return dist;
 }
 
 template <typename T>
-double NLMTool<T>::GetDenoisedPatch(typename itkTImage::IndexType p, itkTPointer & patch)
+void NLMTool<T>::GetPatch(const T * buffer, const typename itkTImage::IndexType & p, bool inside, T * patch)
+{
+  if(inside == true)
+  {
+    //the whole patch is in the image: direct reads using the precomputed offsets
+    const T * center = buffer + GetLinearIndex(p);
+    for(unsigned int k=0; k < m_patchOffsets.size(); k++)
+    {
+      patch[k] = center[ m_patchOffsets[k] ];
+    }
+    return;
+  }
+
+  //boundary case: voxels outside the image are set to 0
+  unsigned int k = 0;
+  for(int pz=-(int)m_halfPatchSize[2]; pz<=(int)m_halfPatchSize[2]; pz++)
+  {
+    long z = p[2] + pz;
+    for(int py=-(int)m_halfPatchSize[1]; py<=(int)m_halfPatchSize[1]; py++)
+    {
+      long y = p[1] + py;
+      for(int px=-(int)m_halfPatchSize[0]; px<=(int)m_halfPatchSize[0]; px++, k++)
+      {
+        long x = p[0] + px;
+        if( (x>=0) && (x<(long)m_size[0]) && (y>=0) && (y<(long)m_size[1]) && (z>=0) && (z<(long)m_size[2]) )
+        {
+          patch[k] = buffer[ x + (long)m_size[0] * ( y + (long)m_size[1] * z ) ];
+        }
+        else
+        {
+          patch[k] = 0;
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+void NLMTool<T>::AddPatchToImage(const typename itkTImage::IndexType & p, const T * patch, T * image, T * weightImage, double weight)
+{
+  if(IsPatchInside(p) == true)
+  {
+    long pLinear = GetLinearIndex(p);
+    for(unsigned int k=0; k < m_patchOffsets.size(); k++)
+    {
+      image[ pLinear + m_patchOffsets[k] ] += patch[k];
+      weightImage[ pLinear + m_patchOffsets[k] ] += weight;
+    }
+    return;
+  }
+
+  //boundary case: only voxels inside the image are updated
+  unsigned int k = 0;
+  for(int pz=-(int)m_halfPatchSize[2]; pz<=(int)m_halfPatchSize[2]; pz++)
+  {
+    long z = p[2] + pz;
+    for(int py=-(int)m_halfPatchSize[1]; py<=(int)m_halfPatchSize[1]; py++)
+    {
+      long y = p[1] + py;
+      for(int px=-(int)m_halfPatchSize[0]; px<=(int)m_halfPatchSize[0]; px++, k++)
+      {
+        long x = p[0] + px;
+        if( (x>=0) && (x<(long)m_size[0]) && (y>=0) && (y<(long)m_size[1]) && (z>=0) && (z<(long)m_size[2]) )
+        {
+          long index = x + (long)m_size[0] * ( y + (long)m_size[1] * z );
+          image[index] += patch[k];
+          weightImage[index] += weight;
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+double NLMTool<T>::PatchDistance(const T * p, const T * q, double cutoff)
+{
+  return PatchDistanceKernel::Compute(p, q, m_patchOffsets.size(), cutoff);
+}
+
+template <typename T>
+double NLMTool<T>::GetDenoisedPatch(typename itkTImage::IndexType p, PatchWorkspace & workspace, bool useTheReferenceImage)
 {
   double wmax = 0; //maximum weight of patches
   double sum  = 0; //sum of weights (used for normalization purpose)
-  double rangeBandwidth = m_rangeBandwidthImage->GetPixel(p);
+  long pLinear = GetLinearIndex(p);
+  double rangeBandwidth = m_rangeBandwidthImage->GetBufferPointer()[pLinear];
+  //the central patch belongs to the search region, so the best distance is 0
+  double cutoff = PatchDistanceKernel::Cutoff(rangeBandwidth);
+  unsigned int n = m_patchOffsets.size();
+
+  const T * inputBuffer = m_inputImage->GetBufferPointer();
+  const T * refBuffer = NULL;
+
+  T * patch          = &workspace.denoisedPatch[0];
+  T * centralPatch   = &workspace.centralPatch[0];
+  T * neighbourPatch = &workspace.neighbourPatch[0];
+
+  //patches used for the weight computation (taken from the reference image if required)
+  T * centralWeightPatch   = centralPatch;
+  T * neighbourWeightPatch = neighbourPatch;
+  if(useTheReferenceImage == true)
+  {
+    refBuffer = m_refImage->GetBufferPointer();
+    centralWeightPatch   = &workspace.centralReferencePatch[0];
+    neighbourWeightPatch = &workspace.neighbourReferencePatch[0];
+  }
 
-  //create the patch and set the estimate to 0
-  CreatePatch(patch);
-  itkTIterator patchIt(patch, patch->GetRequestedRegion());
+  //set the estimate to 0
+  std::fill(patch, patch + n, 0);
 
   //get the value of the patch around the current pixel
-  itkTPointer centralPatch = itkTImage::New();
-  CreatePatch(centralPatch);
-  GetPatch(p,centralPatch);
-  itkTIterator centralPatchIt(centralPatch, centralPatch->GetRequestedRegion());
+  bool centralInside = IsPatchInside(p);
+  GetPatch(inputBuffer, p, centralInside, centralPatch);
+  if(useTheReferenceImage == true)
+  {
+    GetPatch(refBuffer, p, centralInside, centralWeightPatch);
+  }
 
   //set the search region around the current pixel
   typename itkTImage::RegionType searchRegion;
   ComputeSearchRegion(p,searchRegion);
+  typename itkTImage::IndexType start = searchRegion.GetIndex();
+  typename itkTImage::SizeType  size  = searchRegion.GetSize();
 
-  //create the patch for pixels in the neighbourhood of the current pixel
-  itkTPointer neighbourPatch = itkTImage::New();
-  CreatePatch(neighbourPatch);
-  itkTIterator neighbourPatchIt(neighbourPatch, neighbourPatch->GetRequestedRegion());
+  //boundary handling is done once for the search region: if all the neighbour patches lie in the image, no test is done per neighbour
+  bool regionInside = true;
+  for(unsigned int i=0; i!= 3; i++)
+  {
+    if( (start[i] < (long)m_halfPatchSize[i]) || (start[i] + (long)size[i] + (long)m_halfPatchSize[i] > (long)m_size[i]) )
+    {
+      regionInside = false;
+    }
+  }
 
-  //go through the neighbourhood with a region iterator
-  itkTIteratorWithIndex it( m_inputImage, searchRegion);
+  //go through the neighbourhood, or through the candidates of p found by ComputeCandidates (the central patch is then added explicitly)
   typename itkTImage::IndexType neighbourPixelIndex;
+  long numberOfNeighbours = size[0] * size[1] * size[2];
+  //without stored candidates for p (outside the mask, or once ComputeOutput is done), the exhaustive search is used
+  long pSlot = -1;
+  if( (m_numberOfCandidates > 0) && (m_candidateSlots.empty() == false) )
+  {
+    pSlot = m_candidateSlots[pLinear];
+  }
+  const bool useCandidates = (pSlot >= 0);
+  if(useCandidates == true)
+  {
+    numberOfNeighbours = m_numberOfCandidates;
+    regionInside = false;
+    sum += 1.0;
+    for(unsigned int k=0; k < n; k++)
+    {
+      patch[k] += centralPatch[k];
+    }
+  }
 
-  for(it.GoToBegin(); !it.IsAtEnd(); ++it)
+  for(long j=0; j < numberOfNeighbours; j++)
   {
-    neighbourPixelIndex = it.GetIndex();
+    if(useCandidates == true)
+    {
+      const short * offset = &m_candidateOffsets[ 3 * (pSlot * m_numberOfCandidates + j) ];
+      if( m_candidateDistances[pSlot * m_numberOfCandidates + j] == std::numeric_limits<float>::max() )
+      {
+        continue; //no candidate found for this slot
+      }
+      for(unsigned int i=0; i!= 3; i++)
+      {
+        neighbourPixelIndex[i] = p[i] + offset[i];
+      }
+    }
+    else
+    {
+      neighbourPixelIndex[0] = start[0] + j % size[0];
+      neighbourPixelIndex[1] = start[1] + (j / size[0]) % size[1];
+      neighbourPixelIndex[2] = start[2] + j / (size[0] * size[1]);
+    }
 
     bool goForIt = true;
     if(m_optimized == 1)
     {
-      goForIt = CheckSpeed(p, neighbourPixelIndex);
+      goForIt = CheckSpeed(pLinear, GetLinearIndex(neighbourPixelIndex));
     }
 
     if(goForIt == true)
     {
+      bool inside = regionInside || IsPatchInside(neighbourPixelIndex);
+      if(useTheReferenceImage == true)
+      {
+        GetPatch(refBuffer, neighbourPixelIndex, inside, neighbourWeightPatch);
+      }
+      else
+      {
+        GetPatch(inputBuffer, neighbourPixelIndex, inside, neighbourPatch);
+      }
+
+      //patches beyond the cutoff would get a negligible weight
+      double distance = PatchDistance(centralWeightPatch, neighbourWeightPatch, cutoff);
+      if(distance > cutoff)
+      {
+        continue;
+      }
+      if(useTheReferenceImage == true)
+      {
+        GetPatch(inputBuffer, neighbourPixelIndex, inside, neighbourPatch);
+      }
 
-      GetPatch(neighbourPixelIndex, neighbourPatch);
-      double weight = exp( - PatchDistance(centralPatch, neighbourPatch) / rangeBandwidth);
+      double weight = exp( - distance / rangeBandwidth);
 
       if(weight>wmax)
       {
@@ -821,38 +1501,30 @@ double NLMTool<T>::GetDenoisedPatch(typename itkTImage::IndexType p, itkTPointer
       sum += weight;
 
       //Add this patch to the current estimate using the computed weight
-      for(patchIt.GoToBegin(), neighbourPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++neighbourPatchIt)
+      for(unsigned int k=0; k < n; k++)
       {
-        patchIt.Set( patchIt.Get() + neighbourPatchIt.Get() * weight );
+        patch[k] += neighbourPatch[k] * weight;
       }
     }
   }
 
-
   //consider now the special case of the central patch
   switch(m_centralPointStrategy)
   {
   case 0:                                        //remove the central patch to the estimated patch
-      for(patchIt.GoToBegin(), centralPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++centralPatchIt)
+      for(unsigned int k=0; k < n; k++)
       {
-          patchIt.Set( patchIt.Get() -1.0 * centralPatchIt.Get() );
+          patch[k] -= 1.0 * centralPatch[k];
       }
       sum -= 1.0;
       break;
   case 1:
       break;                                 //nothing to do
   case -1:
-      for(patchIt.GoToBegin(), centralPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++centralPatchIt)
-      {
-          patchIt.Set( patchIt.Get()  + (wmax -1.0) * centralPatchIt.Get() );
-      }
-      sum += (wmax - 1.0);
-      break;
-  default:
-      //as in case -1
-      for(patchIt.GoToBegin(), centralPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++centralPatchIt)
+  default:                                   //as in case -1
+      for(unsigned int k=0; k < n; k++)
       {
-          patchIt.Set( patchIt.Get()  + (wmax -1.0) * centralPatchIt.Get() );
+          patch[k] += (wmax -1.0) * centralPatch[k];
       }
       sum += (wmax - 1.0);
       break;
@@ -861,160 +1533,62 @@ double NLMTool<T>::GetDenoisedPatch(typename itkTImage::IndexType p, itkTPointer
   if(sum>0.0001)
   {
     //Normalization of the denoised patch
-    for(patchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt)
+    for(unsigned int k=0; k < n; k++)
     {
-      patchIt.Set( patchIt.Get() / sum );
+      patch[k] /= sum;
     }
   }
   else
   {
     //copy the central patch to the denoised patch
-    for(patchIt.GoToBegin(), centralPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++centralPatchIt)
-    {
-      patchIt.Set( centralPatchIt.Get() );
-    }
+    std::copy(centralPatch, centralPatch + n, patch);
   }
 
   return sum;
 }
 
 template <typename T>
-double NLMTool<T>::GetDenoisedPatchUsingTheReferenceImage(typename itkTImage::IndexType p, itkTPointer & patch)
+double NLMTool<T>::GetDenoisedPatch(typename itkTImage::IndexType p, itkTPointer & patch)
 {
-    double wmax = 0; //maximum weight of patches
-    double sum  = 0; //sum of weights (used for normalization purpose)
-    double rangeBandwidth = m_rangeBandwidthImage->GetPixel(p);
-
-    //create the patch and set the estimate to 0
-    CreatePatch(patch);
-    itkTIterator patchIt(patch, patch->GetRequestedRegion());
-
-    //get the value of the patch around the current pixel
-    itkTPointer centralPatch = itkTImage::New();
-    CreatePatch(centralPatch);
-    GetPatch(p,centralPatch);
-    itkTIterator centralPatchIt(centralPatch, centralPatch->GetRequestedRegion());
-
-    //get the value of the patch around the current pixel in the reference image
-    itkTPointer centralPatchReferenceImage = itkTImage::New();
-    CreatePatch(centralPatchReferenceImage);
-    GetPatchFromReferenceImage(p,centralPatchReferenceImage);
-
-    //set the search region around the current pixel
-    typename itkTImage::RegionType searchRegion;
-    ComputeSearchRegion(p,searchRegion);
-
-    //create the patch for pixels in the neighbourhood of the current pixel
-    itkTPointer neighbourPatch = itkTImage::New();
-    CreatePatch(neighbourPatch);
-    itkTIterator neighbourPatchIt(neighbourPatch, neighbourPatch->GetRequestedRegion());
-
-    //create the patch for pixels in the neighbourhood of the current pixel in the reference image
-    itkTPointer neighbourPatchReferenceImage = itkTImage::New();
-    CreatePatch(neighbourPatchReferenceImage);
-
-    //go through the neighbourhood with a region iterator
-    itkTIteratorWithIndex it( m_inputImage, searchRegion);
-    typename itkTImage::IndexType neighbourPixelIndex;
-
-    for(it.GoToBegin(); !it.IsAtEnd(); ++it)
-    {
-        neighbourPixelIndex = it.GetIndex();
-
-        bool goForIt = true;
-        if(m_optimized == 1)
-            goForIt = CheckSpeed(p, neighbourPixelIndex);
-
-        if(goForIt == true)
-        {
-
-            GetPatchFromReferenceImage(neighbourPixelIndex, neighbourPatchReferenceImage);
-            GetPatch(neighbourPixelIndex, neighbourPatch);
-
-            double weight = exp( - PatchDistance(centralPatchReferenceImage, neighbourPatchReferenceImage) / rangeBandwidth);
-
-            if(weight>wmax)
-            {
-                if( (p[0] != neighbourPixelIndex[0]) && (p[1] != neighbourPixelIndex[1]) && (p[2] != neighbourPixelIndex[2]) ) //has to be modify
-                {
-                    wmax = weight;
-                }
-            }
-
-            sum += weight;
-
-            //Add this patch to the current estimate using the computed weight
-            for(patchIt.GoToBegin(), neighbourPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++neighbourPatchIt)
-            {
-                patchIt.Set( patchIt.Get() + neighbourPatchIt.Get() * weight );
-            }
-        }
-    }
-
-
-    //consider now the special case of the central patch
-    switch(m_centralPointStrategy)
-    {
-    case 0:                                        //remove the central patch to the estimated patch
-        for(patchIt.GoToBegin(), centralPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++centralPatchIt)
-        {
-            patchIt.Set( patchIt.Get() -1.0 * centralPatchIt.Get() );
-        }
-        sum -= 1.0;
-        break;
+  PatchWorkspace workspace;
+  InitializeWorkspace(workspace);
+  double sum = GetDenoisedPatch(p, workspace, false);
 
-    case 1:
-        //nothing to do
-        break;
-
-    case -1:
-        for(patchIt.GoToBegin(), centralPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++centralPatchIt)
-        {
-            patchIt.Set( patchIt.Get()  + (wmax -1.0) * centralPatchIt.Get() );
-        }
-        sum += (wmax - 1.0);
-        break;
-
-    default:
-        //as in case -1
-        for(patchIt.GoToBegin(), centralPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++centralPatchIt)
-        {
-            patchIt.Set( patchIt.Get()  + (wmax -1.0) * centralPatchIt.Get() );
-        }
-        sum += (wmax - 1.0);
-        break;
-    }
+  CreatePatch(patch);
+  std::copy(workspace.denoisedPatch.begin(), workspace.denoisedPatch.end(), patch->GetBufferPointer());
+  return sum;
+}
 
-    if(sum>0.0001)
-    {
-        //Normalization of the denoised patch
-        for(patchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt)
-        {
-            patchIt.Set( patchIt.Get() / sum );
-        }
-    }
-    else
-    {
-        //copy the central patch to the denoised patch
-        for(patchIt.GoToBegin(), centralPatchIt.GoToBegin(); !patchIt.IsAtEnd(); ++patchIt, ++centralPatchIt)
-        {
-            patchIt.Set( centralPatchIt.Get() );
-        }
-    }
+template <typename T>
+double NLMTool<T>::GetDenoisedPatchUsingTheReferenceImage(typename itkTImage::IndexType p, itkTPointer & patch)
+{
+  PatchWorkspace workspace;
+  InitializeWorkspace(workspace);
+  double sum = GetDenoisedPatch(p, workspace, true);
 
-    return sum;
+  CreatePatch(patch);
+  std::copy(workspace.denoisedPatch.begin(), workspace.denoisedPatch.end(), patch->GetBufferPointer());
+  return sum;
 }
 
 
 template <typename T>
 bool NLMTool<T>::CheckSpeed(typename itkTImage::IndexType p, typename itkTImage::IndexType q)
+{
+    return CheckSpeed(GetLinearIndex(p), GetLinearIndex(q));
+}
+
+template <typename T>
+bool NLMTool<T>::CheckSpeed(long p, long q)
 {
     bool goForIt = true;
+    const T * meanBuffer     = m_meanImage->GetBufferPointer();
+    const T * varianceBuffer = m_varianceImage->GetBufferPointer();
 
     float mSpeed = 0;
-    if(m_meanImage->GetPixel(q) ==0)
+    if(meanBuffer[q] ==0)
     {
-        if(m_meanImage->GetPixel(p) == 0)
+        if(meanBuffer[p] == 0)
         {
             mSpeed = 1;
         }
@@ -1025,7 +1599,7 @@ bool NLMTool<T>::CheckSpeed(typename itkTImage::IndexType p, typename itkTImage:
     }
     else
     {
-        mSpeed = m_meanImage->GetPixel(p) / m_meanImage->GetPixel(q);
+        mSpeed = meanBuffer[p] / meanBuffer[q];
     }
 
     if( (mSpeed < m_lowerMeanThreshold) || (mSpeed > 1/m_lowerMeanThreshold) )
@@ -1034,9 +1608,9 @@ bool NLMTool<T>::CheckSpeed(typename itkTImage::IndexType p, typename itkTImage:
     }
 
     float vSpeed = 0;
-    if(m_varianceImage->GetPixel(q) ==0)
+    if(varianceBuffer[q] ==0)
     {
-        if(m_varianceImage->GetPixel(p) == 0)
+        if(varianceBuffer[p] == 0)
         {
             vSpeed = 1;
         }
@@ -1047,7 +1621,7 @@ bool NLMTool<T>::CheckSpeed(typename itkTImage::IndexType p, typename itkTImage:
     }
     else
     {
-        vSpeed = m_varianceImage->GetPixel(p) / m_varianceImage->GetPixel(q);
+        vSpeed = varianceBuffer[p] / varianceBuffer[q];
     }
 
     if( (vSpeed < m_lowerVarianceThreshold) || (vSpeed > 1/m_lowerVarianceThreshold) )
@@ -288,7 +288,7 @@ void PandoraBoxReconstructionFilters::ComputePSFImage(itkFloatImagePointer & PSF
 
 }
 
-void PandoraBoxReconstructionFilters::ComputerObservationModelParameters(vnl_sparse_matrix<float> & H, vnl_vector<float> & Y, vnl_vector<float> & X, itkFloatImagePointer & HRImage, std::vector< std::vector<itkFloatImagePointer> > & maskStacks, std::vector< std::vector<itkFloatImagePointer> > & inputStacks, std::vector< std::vector<itkTransformType::Pointer> > & inverseAffineSBSTransforms, itkFloatImagePointer & PSFImage)
+void PandoraBoxReconstructionFilters::ComputerObservationModelParameters(btk::SparseMatrix<float> & H, vnl_vector<float> & Y, vnl_vector<float> & X, itkFloatImagePointer & HRImage, std::vector< std::vector<itkFloatImagePointer> > & maskStacks, std::vector< std::vector<itkFloatImagePointer> > & inputStacks, std::vector< std::vector<itkTransformType::Pointer> > & inverseAffineSBSTransforms, itkFloatImagePointer & PSFImage)
 {
   //Principle: for each voxel of the LR images, we compute the influence of each voxel of the PSF (centered at the current LR voxel) and add the corresponding influence value (PSF value * interpolation weight) in the matrix H
   std::cout<<"ComputerObservationModelParameters"<<std::endl;
@@ -307,7 +307,7 @@ void PandoraBoxReconstructionFilters::ComputerObservationModelParameters(vnl_spa
       nrows += inputStacks[im][s]->GetLargestPossibleRegion().GetNumberOfPixels();
     }
   }
-  H.set_size(nrows, ncols);
+  H.SetSize(nrows, ncols);
   Y.set_size(nrows);
   Y.fill(0.0);
   X.set_size(ncols);
@@ -457,7 +457,7 @@ void PandoraBoxReconstructionFilters::ComputerObservationModelParameters(vnl_spa
                   hrLinearIndex = hrIndex[0] + hrIndex[1]*hrSize[0] + hrIndex[2]*hrSize[0]*hrSize[1];
 
                   //Add weight*PSFValue to the corresponding element in H
-                  H(lrLinearIndex,hrLinearIndex) += itPSF.Get() * bsplineWeights[weightLinearIndex];
+                  H.AddValue(lrLinearIndex, hrLinearIndex, itPSF.Get() * bsplineWeights[weightLinearIndex]);
                   weightLinearIndex += 1;
                 }
               }
@@ -468,16 +468,8 @@ void PandoraBoxReconstructionFilters::ComputerObservationModelParameters(vnl_spa
     }
   }
   // Normalize H
-  for(unsigned int i = 0; i < H.rows(); i++){
-
-    double sum = H.sum_row(i);
-
-    vnl_sparse_matrix<float>::row & r = H.get_row(i);
-    vnl_sparse_matrix<float>::row::iterator col_iter;
-
-    for (col_iter = r.begin(); col_iter != r.end(); ++col_iter)
-      (*col_iter).second = (*col_iter).second / sum;
-  }
+  H.Finalize();
+  H.NormalizeRows();
 
   //Fill X
   //Instantiate an iterator on HR image
@@ -652,7 +644,7 @@ void PandoraBoxReconstructionFilters::ImageFusionByScatteredInterpolation(itkFlo
 
 }
 
-void PandoraBoxReconstructionFilters::SimulateObservations(vnl_sparse_matrix<float> & H, vnl_vector<float> & X, std::vector< std::vector<itkFloatImagePointer> > & inputStacks, std::vector< std::vector<itkFloatImagePointer> > & outputStacks)
+void PandoraBoxReconstructionFilters::SimulateObservations(btk::SparseMatrix<float> & H, vnl_vector<float> & X, std::vector< std::vector<itkFloatImagePointer> > & inputStacks, std::vector< std::vector<itkFloatImagePointer> > & outputStacks)
 {
   std::cout<<"SimulateObservations"<<std::endl;
   std::vector< std::vector<unsigned int> > offset;
@@ -670,7 +662,7 @@ void PandoraBoxReconstructionFilters::SimulateObservations(vnl_sparse_matrix<flo
 
   //Compute H * x
   vnl_vector<float> Hx;
-  H.mult(X,Hx);
+  H.Multiply(X,Hx);
 
   //Now, we have to convert this vector into a set of stacks
   outputStacks.resize(inputStacks.size());
@@ -841,7 +833,7 @@ void PandoraBoxReconstructionFilters::IterativeBackProjection(itkFloatImagePoint
   ComputePSFImage(psfImage, outputSpacing, inputStacks[0][0]->GetSpacing() );
 
   //Compute the parameters (H,X,Y) of the observation model
-  vnl_sparse_matrix<float> H;
+  btk::SparseMatrix<float> H;
   vnl_vector<float>        Y;
   vnl_vector<float>        X;
   ComputerObservationModelParameters(H, Y, X, outputImage, maskStacks, inputStacks, inverseAffineSBSTransforms, psfImage);
@@ -0,0 +1,167 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkConjugateGradientSolverTest.h"
+
+
+#define EPSILON     1e-6
+#define WEIGHT      0.5
+#define LAMBDA      0.1
+
+
+namespace btk
+{
+
+void ConjugateGradientSolverTest::setUp()
+{
+    // 4 x 3 x 2 image observed by 10 rows averaging 3 voxels each
+    S.SetSize(4,3,2);
+    S.SetBoundary(FiniteDifferenceStencil< double >::ZERO_BOUNDARY);
+
+    H.SetSize(10,24);
+    y.set_size(10);
+
+    for(unsigned int r = 0; r < 10; r++)
+    {
+        H.AddValue(r, (5*r) % 24, 1.0/3);
+        H.AddValue(r, (5*r + 7) % 24, 1.0/3);
+        H.AddValue(r, (5*r + 13) % 24, 1.0/3);
+        y[r] = (r*r) % 7;
+    }
+    H.Finalize();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ConjugateGradientSolverTest::tearDown()
+{
+    H.Clear();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ConjugateGradientSolverTest::ComputeGradient(const vnl_vector< double > & x, vnl_vector< double > & g)
+{
+    FiniteDifferenceOperator< double > L(S);
+    vnl_vector< double > Hx, Lx, LtLx;
+
+    H.Multiply(x, Hx);
+    Hx -= y;
+    H.TransposeMultiply(Hx, g);
+
+    L.Multiply(x, Lx);
+    L.TransposeMultiply(Lx, LtLx);
+
+    g = WEIGHT * g + LAMBDA * LtLx;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ConjugateGradientSolverTest::testColumnSquaredNorms()
+{
+    vnl_vector< double > norms, matrixNorms;
+
+    // 7-point Laplacian with zero boundaries: 36 + 1 per neighbour
+    FiniteDifferenceOperator< double > L(S);
+    CPPUNIT_ASSERT(L.GetColumnSquaredNorms(norms));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(36.0 + 3, norms[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(36.0 + 5, norms[5], EPSILON);
+
+    // same norms as the ones of the matrices, with or without transposed copy
+    SparseMatrix< double > M;
+    S.GetLaplacianMatrix(M);
+    M.GetColumnSquaredNorms(matrixNorms);
+    for(unsigned int i = 0; i < 24; i++)
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(matrixNorms[i], norms[i], EPSILON);
+
+    S.SetBoundary(FiniteDifferenceStencil< double >::MIRROR_BOUNDARY);
+    FiniteDifferenceOperator< double > D(S, 1, FiniteDifferenceStencil< double >::FORWARD_DIFFERENCE);
+    S.GetMatrix(1, FiniteDifferenceStencil< double >::FORWARD_DIFFERENCE, M);
+    M.SetTransposeCache(false);
+    D.GetColumnSquaredNorms(norms);
+    M.GetColumnSquaredNorms(matrixNorms);
+    for(unsigned int i = 0; i < 24; i++)
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(matrixNorms[i], norms[i], EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ConjugateGradientSolverTest::testSolve()
+{
+    FiniteDifferenceOperator< double > L(S);
+
+    for(unsigned int preconditioner = 0; preconditioner < 2; preconditioner++)
+    {
+        ConjugateGradientSolver< double > solver;
+        solver.SetObservationOperator(&H, WEIGHT);
+        solver.AddRegularization(&L, LAMBDA);
+        solver.SetPreconditioner((ConjugateGradientSolver< double >::PreconditionerType)preconditioner);
+        solver.SetMaximumNumberOfIterations(200);
+        solver.SetTolerance(1e-12);
+
+        vnl_vector< double > x, g;
+        solver.Solve(y, x);
+
+        CPPUNIT_ASSERT(solver.GetRelativeResidual() <= 1e-12);
+
+        // the gradient of the cost function vanishes at the solution
+        this->ComputeGradient(x, g);
+        for(unsigned int i = 0; i < 24; i++)
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, g[i], EPSILON);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ConjugateGradientSolverTest::testWarmStart()
+{
+    FiniteDifferenceOperator< double > L(S);
+
+    ConjugateGradientSolver< double > solver;
+    solver.SetObservationOperator(&H, WEIGHT);
+    solver.AddRegularization(&L, LAMBDA);
+    solver.SetMaximumNumberOfIterations(200);
+    solver.SetTolerance(1e-10);
+
+    vnl_vector< double > x;
+    solver.Solve(y, x);
+    CPPUNIT_ASSERT(solver.GetNumberOfIterations() > 0);
+
+    // starting from the solution: no iteration is needed
+    solver.Solve(y, x);
+    CPPUNIT_ASSERT_EQUAL(0u, solver.GetNumberOfIterations());
+}
+
+} // namespace btk
@@ -0,0 +1,77 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_CONJUGATE_GRADIENT_SOLVER_TEST_H
+#define BTK_CONJUGATE_GRADIENT_SOLVER_TEST_H
+
+// CppUnit includes
+#include "extensions/HelperMacros.h"
+
+// Local includes
+#include "btkSparseMatrix.h"
+#include "btkFiniteDifferenceOperator.h"
+#include "btkConjugateGradientSolver.h"
+
+namespace btk
+{
+
+class ConjugateGradientSolverTest : public CppUnit::TestFixture
+{
+        CPPUNIT_TEST_SUITE(ConjugateGradientSolverTest);
+        CPPUNIT_TEST(testColumnSquaredNorms);
+        CPPUNIT_TEST(testSolve);
+        CPPUNIT_TEST(testWarmStart);
+        CPPUNIT_TEST_SUITE_END();
+
+    public:
+        void setUp();
+        void tearDown();
+
+        void testColumnSquaredNorms();
+        void testSolve();
+        void testWarmStart();
+
+    private:
+        /** Gradient of w ||Hx - y||^2 + lambda ||Lx||^2 (divided by 2) */
+        void ComputeGradient(const vnl_vector< double > & x, vnl_vector< double > & g);
+
+        SparseMatrix< double > H;
+        vnl_vector< double > y;
+        FiniteDifferenceStencil< double > S;
+};
+
+} // namespace btk
+
+#endif // BTK_CONJUGATE_GRADIENT_SOLVER_TEST_H
@@ -0,0 +1,184 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkFiniteDifferenceStencilTest.h"
+
+
+#define EPSILON     1e-9
+
+
+namespace btk
+{
+
+void FiniteDifferenceStencilTest::setUp()
+{
+    // 4 x 3 x 2 image with x(i,j,k) = i*i + 10*j + 100*k*k
+    S.SetSize(4,3,2);
+    x.set_size(24);
+
+    for(unsigned int k = 0; k < 2; k++)
+        for(unsigned int j = 0; j < 3; j++)
+            for(unsigned int i = 0; i < 4; i++)
+                x[i + 4*j + 12*k] = i*i + 10*j + 100*k*k;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void FiniteDifferenceStencilTest::tearDown()
+{
+    S.SetBoundary(FiniteDifferenceStencil< double >::MIRROR_BOUNDARY);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void FiniteDifferenceStencilTest::testForwardDifference()
+{
+    vnl_vector< double > y;
+
+    // along x: 1 3 5 then mirrored boundary x[2] - x[3] = -5
+    S.Apply(0, FiniteDifferenceStencil< double >::FORWARD_DIFFERENCE, x, y);
+    CPPUNIT_ASSERT_EQUAL(24u, (unsigned int)y.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 1.0, y[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 5.0, y[2], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-5.0, y[3], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-5.0, y[23], EPSILON);
+
+    // along y and z
+    S.Apply(1, FiniteDifferenceStencil< double >::FORWARD_DIFFERENCE, x, y);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 10.0, y[5], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-10.0, y[9], EPSILON);
+
+    S.Apply(2, FiniteDifferenceStencil< double >::FORWARD_DIFFERENCE, x, y);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 100.0, y[6], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-100.0, y[18], EPSILON);
+
+    // zero boundary: x[4] = 0
+    S.SetBoundary(FiniteDifferenceStencil< double >::ZERO_BOUNDARY);
+    S.Apply(0, FiniteDifferenceStencil< double >::FORWARD_DIFFERENCE, x, y);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-9.0, y[3], EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void FiniteDifferenceStencilTest::testBackwardDifference()
+{
+    vnl_vector< double > y;
+
+    // along x: mirrored boundary x[0] - x[1] = -1, then 1 3 5
+    S.Apply(0, FiniteDifferenceStencil< double >::BACKWARD_DIFFERENCE, x, y);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-1.0, y[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 1.0, y[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 5.0, y[3], EPSILON);
+
+    S.Apply(2, FiniteDifferenceStencil< double >::BACKWARD_DIFFERENCE, x, y);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-100.0, y[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 100.0, y[12], EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void FiniteDifferenceStencilTest::testTranspose()
+{
+    vnl_vector< double > z(24), Kx, Ktz;
+    for(unsigned int i = 0; i < 24; i++)
+        z[i] = (i*7) % 5 - 2.0;
+
+    // <Kx,z> = <x,K^T z> for every stencil, axis and boundary
+    for(unsigned int b = 0; b < 2; b++)
+    {
+        S.SetBoundary((FiniteDifferenceStencil< double >::BoundaryType)b);
+
+        for(unsigned int kernel = 0; kernel < 3; kernel++)
+        {
+            for(unsigned int axis = 0; axis < 3; axis++)
+            {
+                S.Apply(axis, (FiniteDifferenceStencil< double >::KernelType)kernel, x, Kx);
+                S.ApplyTranspose(axis, (FiniteDifferenceStencil< double >::KernelType)kernel, z, Ktz);
+
+                CPPUNIT_ASSERT_DOUBLES_EQUAL(dot_product(Kx,z), dot_product(x,Ktz), 1e-6);
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void FiniteDifferenceStencilTest::testLaplacian()
+{
+    vnl_vector< double > y;
+
+    // mirrored boundaries: second differences 2 along x, 0 along y, and +-200 along z
+    S.ApplyLaplacian(x, y);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 202.0, y[5], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-198.0, y[17], EPSILON);
+    // x(0,0,0): 2*(x[1]-x[0]) + 2*(x(0,1,0)-x(0,0,0)) + 2*(x(0,0,1)-x(0,0,0))
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 222.0, y[0], EPSILON);
+
+    // zero boundaries: the neighbours outside the image are ignored
+    S.SetBoundary(FiniteDifferenceStencil< double >::ZERO_BOUNDARY);
+    S.ApplyLaplacian(x, y);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1 + 10 + 100, y[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(10 + 14 + 1 + 21 + 111 - 6*11, y[5], EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void FiniteDifferenceStencilTest::testMatrix()
+{
+    vnl_vector< double > y, Mx;
+    SparseMatrix< double > M;
+
+    S.SetBoundary(FiniteDifferenceStencil< double >::ZERO_BOUNDARY);
+    S.GetLaplacianMatrix(M);
+
+    CPPUNIT_ASSERT_EQUAL(24u, M.GetNumberOfRows());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-6.0, M.GetValue(5,5), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 1.0, M.GetValue(5,17), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 0.0, M.GetValue(5,10), EPSILON);
+
+    S.ApplyLaplacian(x, y);
+    M.Multiply(x, Mx);
+    for(unsigned int i = 0; i < 24; i++)
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(y[i], Mx[i], EPSILON);
+
+    S.SetBoundary(FiniteDifferenceStencil< double >::MIRROR_BOUNDARY);
+    S.GetMatrix(1, FiniteDifferenceStencil< double >::FORWARD_DIFFERENCE, M);
+    S.Apply(1, FiniteDifferenceStencil< double >::FORWARD_DIFFERENCE, x, y);
+    M.Multiply(x, Mx);
+    for(unsigned int i = 0; i < 24; i++)
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(y[i], Mx[i], EPSILON);
+}
+
+} // namespace btk
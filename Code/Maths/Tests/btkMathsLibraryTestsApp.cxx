@@ -48,6 +48,11 @@
 #include "btkSphericalHarmonicsTest.h"
 #include "btkNormalProbabilityDensityTest.h"
 #include "btkVonMisesFisherProbabilityDensityTest.h"
+#include "btkSparseMatrixTest.h"
+#include "btkFiniteDifferenceStencilTest.h"
+#include "btkConjugateGradientSolverTest.h"
+#include "btkResidualBackProjectionTest.h"
+#include "btkSeparablePSFKernelTest.h"
 
 
 int main(int argc, char *argv[])
@@ -60,6 +65,11 @@ int main(int argc, char *argv[])
     runner.addTest(btk::SphericalHarmonicsTest::suite());
     runner.addTest(btk::NormalProbabilityDensityTest::suite());
     runner.addTest(btk::VonMisesFisherProbabilityDensityTest::suite());
+    runner.addTest(btk::SparseMatrixTest::suite());
+    runner.addTest(btk::FiniteDifferenceStencilTest::suite());
+    runner.addTest(btk::ConjugateGradientSolverTest::suite());
+    runner.addTest(btk::ResidualBackProjectionTest::suite());
+    runner.addTest(btk::SeparablePSFKernelTest::suite());
 
     runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
 
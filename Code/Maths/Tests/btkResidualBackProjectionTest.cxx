@@ -0,0 +1,141 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkResidualBackProjectionTest.h"
+
+
+#define EPSILON     1e-9
+
+
+namespace btk
+{
+
+void ResidualBackProjectionTest::setUp()
+{
+    // 4 observations of 3 voxels
+    H.SetSize(4,3);
+    H.AddValue(0, 0, 0.5);  H.AddValue(0, 1, 0.5);
+    H.AddValue(1, 1, 1.0);
+    H.AddValue(2, 0, 0.25); H.AddValue(2, 2, 0.75);
+    H.AddValue(3, 1, 0.5);  H.AddValue(3, 2, 0.5);
+    H.Finalize();
+
+    x.set_size(3);
+    x[0] = 1; x[1] = 2; x[2] = 3;
+
+    // residual y - Hx = (1, -1, 1, 2)
+    y.set_size(4);
+    y[0] = 2.5; y[1] = 1; y[2] = 3.5; y[3] = 4.5;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ResidualBackProjectionTest::tearDown()
+{
+    H.Clear();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ResidualBackProjectionTest::testSimulation()
+{
+    ResidualBackProjection< double > backProjection;
+    backProjection.SetObservationMatrix(&H);
+
+    vnl_vector< double > correction;
+    backProjection.Compute(y, x, correction);
+
+    const vnl_vector< double > & Hx = backProjection.GetSimulation();
+    CPPUNIT_ASSERT_EQUAL(4u, (unsigned int)Hx.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.5,  Hx[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0,  Hx[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.5,  Hx[2], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.5,  Hx[3], EPSILON);
+
+    // a single group: weighted mean of the residuals of every column
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0,         correction[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5 / 2.0,   correction[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.75 / 1.25, correction[2], EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ResidualBackProjectionTest::testMean()
+{
+    std::vector< unsigned int > firstRows(2);
+    firstRows[0] = 0; firstRows[1] = 2;
+
+    ResidualBackProjection< double > backProjection;
+    backProjection.SetObservationMatrix(&H);
+    backProjection.SetGroups(firstRows);
+
+    vnl_vector< double > correction;
+    backProjection.Compute(y, x, correction);
+
+    // group 0: (1, -1/3, 0), group 1: (1, 2, 1.4)
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0,       correction[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(5.0 / 6.0, correction[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.7,       correction[2], EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void ResidualBackProjectionTest::testMedian()
+{
+    std::vector< unsigned int > firstRows(3);
+    firstRows[0] = 0; firstRows[1] = 1; firstRows[2] = 2;
+
+    ResidualBackProjection< double > backProjection;
+    backProjection.SetObservationMatrix(&H);
+    backProjection.SetGroups(firstRows);
+    backProjection.SetMedian(true);
+
+    vnl_vector< double > correction;
+    backProjection.Compute(y, x, correction);
+
+    // group 0: (1, 1, 0), group 1: (0, -1, 0), group 2: (1, 2, 1.4)
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, correction[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, correction[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, correction[2], EPSILON);
+
+    // mean of the same groups
+    backProjection.SetMedian(false);
+    backProjection.Compute(y, x, correction);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0 / 3.0, correction[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0 / 3.0, correction[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.4 / 3.0, correction[2], EPSILON);
+}
+
+} // namespace btk
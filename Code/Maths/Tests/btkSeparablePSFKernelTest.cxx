@@ -0,0 +1,110 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkSeparablePSFKernelTest.h"
+
+
+#define EPSILON     1e-5
+
+
+namespace btk
+{
+
+void SeparablePSFKernelTest::setUp()
+{
+    sigma[0] = 0.5; sigma[1] = 0.75; sigma[2] = 2.0;
+
+    for(unsigned int axis = 0; axis < 3; axis++)
+    {
+        kernel.SetProfile(axis, SeparablePSFKernel::GAUSSIAN, sigma[axis], 8.0*sigma[axis]);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SeparablePSFKernelTest::tearDown()
+{
+    // ----
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SeparablePSFKernelTest::testGaussian()
+{
+    double points[4][3] = { {0.0, 0.0, 0.0}, {0.3, -0.2, 1.0}, {-1.1, 0.9, -3.7}, {0.05, 1.5, 2.5} };
+
+    for(unsigned int p = 0; p < 4; p++)
+    {
+        const double *x = points[p];
+        double expected = std::exp(-(x[0]*x[0])/(2*sigma[0]*sigma[0]) - (x[1]*x[1])/(2*sigma[1]*sigma[1]) - (x[2]*x[2])/(2*sigma[2]*sigma[2]));
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, kernel.Evaluate(x), EPSILON);
+    }
+
+    // profiles are even
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(kernel.EvaluateProfile(2, 1.3), kernel.EvaluateProfile(2, -1.3), EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SeparablePSFKernelTest::testBoxCar()
+{
+    SeparablePSFKernel boxCar;
+    boxCar.SetProfile(0, SeparablePSFKernel::BOXCAR, 1.0, 2.0);
+    boxCar.SetProfile(1, SeparablePSFKernel::BOXCAR, 1.0, 2.0);
+    boxCar.SetProfile(2, SeparablePSFKernel::BOXCAR, 3.0, 2.0);
+
+    double inside[3] = { 0.25, -0.4, 1.4 };
+    double outside[3] = { 0.25, 0.6, 0.0 };
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, boxCar.Evaluate(inside), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, boxCar.Evaluate(outside), EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SeparablePSFKernelTest::testRadius()
+{
+    double x[3] = { 0.0, 0.0, 8.0*sigma[2] + 0.1 };
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(8.0*sigma[2], kernel.GetRadius(2), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, kernel.Evaluate(x), EPSILON);
+
+    // a profile which is not set is 0
+    SeparablePSFKernel empty;
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, empty.EvaluateProfile(0, 0.0), EPSILON);
+}
+
+} // namespace btk
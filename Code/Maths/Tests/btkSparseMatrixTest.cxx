@@ -0,0 +1,306 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkSparseMatrixTest.h"
+
+
+#define EPSILON     1e-6
+
+
+namespace btk
+{
+
+void SparseMatrixTest::setUp()
+{
+    // M = | 1 0 2 0 |
+    //     | 0 0 0 0 |
+    //     | 0 3 0 0 |
+    //     | 4 0 1 5 |
+    //     | 0 0 0 0 |
+    M.SetSize(5,4);
+    M.AddValue(0,2,1.5); M.AddValue(0,0,1); M.AddValue(0,2,0.5);
+    M.AddValue(2,1,3);
+    M.AddValue(3,3,5); M.AddValue(3,0,4); M.AddValue(3,2,1);
+    M.Finalize();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::tearDown()
+{
+    M.Clear();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testAssembly()
+{
+    CPPUNIT_ASSERT_EQUAL(5u, M.GetNumberOfRows());
+    CPPUNIT_ASSERT_EQUAL(4u, M.GetNumberOfColumns());
+    CPPUNIT_ASSERT_EQUAL(6ul, M.GetNumberOfNonZeros());
+
+    // duplicated entries are summed
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, M.GetValue(0,2), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, M.GetValue(0,0), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, M.GetValue(0,1), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, M.GetValue(2,1), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(5.0, M.GetValue(3,3), EPSILON);
+
+    // empty rows
+    CPPUNIT_ASSERT_EQUAL(M.GetRowBegin(1), M.GetRowEnd(1));
+    CPPUNIT_ASSERT_EQUAL(M.GetRowBegin(4), M.GetRowEnd(4));
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(10.0, M.GetRowSum(3), EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testNormalizeRows()
+{
+    M.NormalizeRows();
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, M.GetRowSum(0), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, M.GetRowSum(1), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, M.GetRowSum(3), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.4, M.GetValue(3,0), EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testMultiply()
+{
+    vnl_vector< float > x(4), y;
+    x[0] = 1; x[1] = 2; x[2] = 3; x[3] = 4;
+
+    M.Multiply(x,y);
+
+    CPPUNIT_ASSERT_EQUAL(5u, (unsigned int)y.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 7.0, y[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 0.0, y[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 6.0, y[2], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(27.0, y[3], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 0.0, y[4], EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testTransposeMultiply()
+{
+    vnl_vector< float > y(5), x;
+    y[0] = 1; y[1] = 2; y[2] = 3; y[3] = 4; y[4] = 5;
+
+    // transposed copy
+    M.TransposeMultiply(y,x);
+
+    CPPUNIT_ASSERT_EQUAL(4u, (unsigned int)x.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(17.0, x[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 9.0, x[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 6.0, x[2], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(20.0, x[3], EPSILON);
+
+    // per-thread buffers
+    M.SetTransposeCache(false);
+    M.TransposeMultiply(y,x);
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(17.0, x[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 9.0, x[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL( 6.0, x[2], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(20.0, x[3], EPSILON);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testRowBlocks()
+{
+    // M assembled from three blocks of rows (2, 1 and 2 rows)
+    std::vector< SparseMatrix< float > > blocks(3);
+    blocks[0].SetSize(2,4);
+    blocks[0].AddValue(0,2,1.5); blocks[0].AddValue(0,0,1); blocks[0].AddValue(0,2,0.5);
+    blocks[1].SetSize(1,4);
+    blocks[2].SetSize(2,4);
+    blocks[2].AddValue(0,1,3);
+    blocks[2].AddValue(1,3,5); blocks[2].AddValue(1,0,4); blocks[2].AddValue(1,2,1);
+
+    SparseMatrix< float > B(5,4);
+    B.SetRowBlocks(blocks);
+
+    CPPUNIT_ASSERT(B.IsFinalized());
+    CPPUNIT_ASSERT_EQUAL(M.GetNumberOfNonZeros(), B.GetNumberOfNonZeros());
+    CPPUNIT_ASSERT_EQUAL(0ul, blocks[0].GetNumberOfNonZeros());
+
+    for(unsigned int i = 0; i < 5; i++)
+    {
+        for(unsigned int j = 0; j < 4; j++)
+        {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(M.GetValue(i,j), B.GetValue(i,j), EPSILON);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testSetArrays()
+{
+    // copy of M built from its CSR arrays
+    std::vector< SparseMatrix< float >::OffsetType > rowPointers(M.GetNumberOfRows()+1);
+    for(unsigned int i = 0; i <= M.GetNumberOfRows(); i++)
+    {
+        rowPointers[i] = (i < M.GetNumberOfRows()) ? M.GetRowBegin(i) : M.GetNumberOfNonZeros();
+    }
+
+    SparseMatrix< float > B;
+    B.SetArrays(M.GetNumberOfRows(), M.GetNumberOfColumns(), rowPointers, M.GetColumns(), M.GetValues());
+
+    CPPUNIT_ASSERT(B.IsFinalized());
+    CPPUNIT_ASSERT_EQUAL(M.GetNumberOfNonZeros(), B.GetNumberOfNonZeros());
+
+    for(unsigned int i = 0; i < 5; i++)
+    {
+        for(unsigned int j = 0; j < 4; j++)
+        {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(M.GetValue(i,j), B.GetValue(i,j), EPSILON);
+        }
+    }
+
+    // invalid column index
+    std::vector< unsigned int > columns(M.GetColumns(), M.GetColumns() + M.GetNumberOfNonZeros());
+    columns[0] = 4;
+    CPPUNIT_ASSERT_THROW(B.SetArrays(M.GetNumberOfRows(), M.GetNumberOfColumns(), rowPointers, &columns[0], M.GetValues()), itk::ExceptionObject);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testSwapArrays()
+{
+    std::vector< SparseMatrix< float >::OffsetType > rowPointers(M.GetNumberOfRows()+1);
+    for(unsigned int i = 0; i <= M.GetNumberOfRows(); i++)
+    {
+        rowPointers[i] = (i < M.GetNumberOfRows()) ? M.GetRowBegin(i) : M.GetNumberOfNonZeros();
+    }
+    std::vector< unsigned int > columns(M.GetColumns(), M.GetColumns() + M.GetNumberOfNonZeros());
+    std::vector< float > values(M.GetValues(), M.GetValues() + M.GetNumberOfNonZeros());
+
+    // the arrays are moved into B
+    SparseMatrix< float > B;
+    B.SwapArrays(M.GetNumberOfRows(), M.GetNumberOfColumns(), rowPointers, columns, values);
+
+    CPPUNIT_ASSERT(B.IsFinalized());
+    CPPUNIT_ASSERT_EQUAL(M.GetNumberOfNonZeros(), B.GetNumberOfNonZeros());
+    CPPUNIT_ASSERT(values.empty());
+
+    for(unsigned int i = 0; i < 5; i++)
+    {
+        for(unsigned int j = 0; j < 4; j++)
+        {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(M.GetValue(i,j), B.GetValue(i,j), EPSILON);
+        }
+    }
+
+    // arrays of inconsistent sizes
+    rowPointers.assign(M.GetNumberOfRows()+1, 0);
+    columns.assign(1, 0);
+    values.assign(1, 1.0);
+    CPPUNIT_ASSERT_THROW(B.SwapArrays(M.GetNumberOfRows(), M.GetNumberOfColumns(), rowPointers, columns, values), itk::ExceptionObject);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testReplaceRowBlocks()
+{
+    // rows 0-1 and 3 of M are replaced:
+    //     | 0 7 0 0 |
+    //     | 0 0 0 6 |
+    //     | 0 3 0 0 |
+    //     | 0 0 0 0 |
+    //     | 0 0 0 0 |
+    std::vector< SparseMatrix< float > > blocks(2);
+    std::vector< unsigned int > firstRows(2);
+    firstRows[0] = 0;
+    blocks[0].SetSize(2,4);
+    blocks[0].AddValue(0,1,7); blocks[0].AddValue(1,3,6);
+    firstRows[1] = 3;
+    blocks[1].SetSize(1,4);
+
+    vnl_vector< float > y(5, 1.0), x;
+    M.TransposeMultiply(y, x); // the transposed copy has to be updated
+    M.ReplaceRowBlocks(firstRows, blocks);
+
+    CPPUNIT_ASSERT_EQUAL(3ul, M.GetNumberOfNonZeros());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(7.0, M.GetValue(0,1), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, M.GetValue(0,0), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(6.0, M.GetValue(1,3), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, M.GetValue(2,1), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, M.GetValue(3,3), EPSILON);
+
+    M.TransposeMultiply(y, x);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, x[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(10.0, x[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(6.0, x[3], EPSILON);
+
+    // overlapping blocks
+    firstRows[1] = 1;
+    blocks[0].SetSize(2,4);
+    blocks[1].SetSize(1,4);
+    CPPUNIT_ASSERT_THROW(M.ReplaceRowBlocks(firstRows, blocks), itk::ExceptionObject);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+void SparseMatrixTest::testRemoveEmptyRows()
+{
+    // rows 1 and 4 of M are empty
+    std::vector< unsigned int > rows;
+    M.RemoveEmptyRows(rows);
+
+    CPPUNIT_ASSERT_EQUAL(3u, M.GetNumberOfRows());
+    CPPUNIT_ASSERT_EQUAL(4u, M.GetNumberOfColumns());
+    CPPUNIT_ASSERT_EQUAL(3u, (unsigned int)rows.size());
+    CPPUNIT_ASSERT_EQUAL(0u, rows[0]);
+    CPPUNIT_ASSERT_EQUAL(2u, rows[1]);
+    CPPUNIT_ASSERT_EQUAL(3u, rows[2]);
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, M.GetValue(0,2), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, M.GetValue(1,1), EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(5.0, M.GetValue(2,3), EPSILON);
+
+    vnl_vector< float > x(4, 1.0), y;
+    M.Multiply(x, y);
+    CPPUNIT_ASSERT_EQUAL(3u, (unsigned int)y.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, y[0], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, y[1], EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(10.0, y[2], EPSILON);
+}
+
+} // namespace btk
@@ -0,0 +1,181 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_CONJUGATE_GRADIENT_SOLVER_H
+#define BTK_CONJUGATE_GRADIENT_SOLVER_H
+
+// VNL includes
+#include "vnl/vnl_vector.h"
+
+// Local includes
+#include "btkMacro.h"
+#include "btkLinearOperator.h"
+
+// STL includes
+#include "vector"
+#include "iostream"
+#include "cmath"
+#include "sstream"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace btk
+{
+
+/**
+ * @brief Preconditioned conjugate gradient solver of the regularized normal equations of a linear inverse problem:
+ * (w H^T H + sum_k lambda_k R_k^T R_k) x = w H^T y, i.e. the minimum of w ||Hx - y||^2 + sum_k lambda_k ||R_k x||^2.
+ *
+ * H and the regularization operators R_k are only used through their products (see LinearOperator), so that neither
+ * the normal matrix nor any inverse is built. The solver starts from the given x (warm start), and may use a Jacobi
+ * (diagonal) preconditioner when the operators provide the squared norms of their columns.
+ * @author François Rousseau
+ * @ingroup Maths
+ */
+template < typename TValue >
+class ConjugateGradientSolver
+{
+    public:
+        typedef ConjugateGradientSolver< TValue >   Self;
+        typedef LinearOperator< TValue >            OperatorType;
+        typedef vnl_vector< TValue >                VectorType;
+
+        /** @brief Preconditioners. */
+        enum PreconditionerType
+        {
+            NO_PRECONDITIONER = 0,
+            JACOBI_PRECONDITIONER   /**< inverse of the diagonal of the normal matrix (default) */
+        };
+
+        /**
+         * @brief Constructor.
+         */
+        ConjugateGradientSolver();
+
+        /**
+         * @brief Set the observation operator H and the weight w of the data term (not copied).
+         */
+        void SetObservationOperator(const OperatorType * H, double weight = 1.0);
+
+        /**
+         * @brief Add a regularization term lambda ||R x||^2 (R is not copied).
+         */
+        void AddRegularization(const OperatorType * R, double lambda);
+
+        /**
+         * @brief Remove the regularization terms.
+         */
+        void ClearRegularizations();
+
+        btkSetMacro(Preconditioner, PreconditionerType);
+        btkGetMacro(Preconditioner, PreconditionerType);
+
+        /** @brief Maximum number of iterations (default 100). */
+        btkSetMacro(MaximumNumberOfIterations, unsigned int);
+        btkGetMacro(MaximumNumberOfIterations, unsigned int);
+
+        /** @brief Convergence threshold on the relative residual ||b - Ax|| / ||b|| (default 1e-6). */
+        btkSetMacro(Tolerance, double);
+        btkGetMacro(Tolerance, double);
+
+        /** @brief Print the residual at every iteration (default false). */
+        btkSetMacro(Verbose, bool);
+        btkGetMacro(Verbose, bool);
+
+        /**
+         * @brief Solve the normal equations.
+         * @param y Observations (size: number of rows of H)
+         * @param x Initial estimate (set to 0 if its size is not the number of columns of H), replaced by the solution
+         */
+        void Solve(const VectorType & y, VectorType & x);
+
+        /** @brief Number of iterations of the last Solve. */
+        btkGetMacro(NumberOfIterations, unsigned int);
+
+        /** @brief Relative residual at the end of the last Solve. */
+        btkGetMacro(RelativeResidual, double);
+
+    protected:
+        /**
+         * @brief Compute Ax = (w H^T H + sum_k lambda_k R_k^T R_k) x.
+         */
+        void ApplyNormalMatrix(const VectorType & x, VectorType & Ax);
+
+        /**
+         * @brief Compute the inverse of the diagonal of the normal matrix (false if an operator cannot provide it).
+         */
+        bool ComputeJacobiPreconditioner();
+
+        /**
+         * @brief Compute z = M^-1 r.
+         */
+        void ApplyPreconditioner(const VectorType & r, VectorType & z) const;
+
+        /**
+         * @brief Dot product (multithreaded, accumulated in double precision).
+         */
+        static double DotProduct(const VectorType & a, const VectorType & b);
+
+    private:
+        const OperatorType *                m_H;
+        double                              m_DataWeight;
+        std::vector< const OperatorType * > m_Regularizations;
+        std::vector< double >               m_Lambdas;
+
+        PreconditionerType                  m_Preconditioner;
+        unsigned int                        m_MaximumNumberOfIterations;
+        double                              m_Tolerance;
+        bool                                m_Verbose;
+
+        unsigned int                        m_NumberOfIterations;
+        double                              m_RelativeResidual;
+
+        bool                                m_UseJacobi;
+        VectorType                          m_InverseDiagonal;
+
+        /** Work buffers (products by H and R_k) */
+        VectorType                          m_Rows;
+        VectorType                          m_Columns;
+};
+
+} // namespace btk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "btkConjugateGradientSolver.txx"
+#endif
+
+#endif // BTK_CONJUGATE_GRADIENT_SOLVER_H
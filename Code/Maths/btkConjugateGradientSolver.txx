@@ -0,0 +1,286 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_CONJUGATE_GRADIENT_SOLVER_TXX
+#define BTK_CONJUGATE_GRADIENT_SOLVER_TXX
+
+#include "btkConjugateGradientSolver.h"
+
+namespace btk
+{
+
+template < typename TValue >
+ConjugateGradientSolver< TValue >::ConjugateGradientSolver() : m_H(NULL), m_DataWeight(1.0), m_Preconditioner(JACOBI_PRECONDITIONER),
+    m_MaximumNumberOfIterations(100), m_Tolerance(1e-6), m_Verbose(false), m_NumberOfIterations(0), m_RelativeResidual(0.0),
+    m_UseJacobi(false)
+{
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ConjugateGradientSolver< TValue >::SetObservationOperator(const OperatorType * H, double weight)
+{
+    m_H = H;
+    m_DataWeight = weight;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ConjugateGradientSolver< TValue >::AddRegularization(const OperatorType * R, double lambda)
+{
+    m_Regularizations.push_back(R);
+    m_Lambdas.push_back(lambda);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ConjugateGradientSolver< TValue >::ClearRegularizations()
+{
+    m_Regularizations.clear();
+    m_Lambdas.clear();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+double ConjugateGradientSolver< TValue >::DotProduct(const VectorType & a, const VectorType & b)
+{
+    const long n = a.size();
+    double sum = 0.0;
+
+    long i;
+    #pragma omp parallel for private(i) schedule(static) reduction(+:sum)
+    for(i = 0; i < n; i++)
+    {
+        sum += (double)a[i] * b[i];
+    }
+
+    return sum;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ConjugateGradientSolver< TValue >::ApplyNormalMatrix(const VectorType & x, VectorType & Ax)
+{
+    const long n = x.size();
+    long i;
+
+    m_H->Multiply(x, m_Rows);
+    m_H->TransposeMultiply(m_Rows, Ax);
+
+    #pragma omp parallel for private(i) schedule(static)
+    for(i = 0; i < n; i++)
+    {
+        Ax[i] *= m_DataWeight;
+    }
+
+    for(unsigned int k = 0; k < m_Regularizations.size(); k++)
+    {
+        m_Regularizations[k]->Multiply(x, m_Rows);
+        m_Regularizations[k]->TransposeMultiply(m_Rows, m_Columns);
+
+        const double lambda = m_Lambdas[k];
+
+        #pragma omp parallel for private(i) schedule(static)
+        for(i = 0; i < n; i++)
+        {
+            Ax[i] += lambda * m_Columns[i];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+bool ConjugateGradientSolver< TValue >::ComputeJacobiPreconditioner()
+{
+    if(!m_H->GetColumnSquaredNorms(m_InverseDiagonal))
+    {
+        return false;
+    }
+    m_InverseDiagonal *= m_DataWeight;
+
+    for(unsigned int k = 0; k < m_Regularizations.size(); k++)
+    {
+        if(!m_Regularizations[k]->GetColumnSquaredNorms(m_Columns))
+        {
+            return false;
+        }
+
+        for(unsigned int i = 0; i < m_InverseDiagonal.size(); i++)
+        {
+            m_InverseDiagonal[i] += m_Lambdas[k] * m_Columns[i];
+        }
+    }
+
+    // null diagonal values (e.g. voxels seen by no observation) are not scaled
+    for(unsigned int i = 0; i < m_InverseDiagonal.size(); i++)
+    {
+        m_InverseDiagonal[i] = (m_InverseDiagonal[i] > 0) ? 1.0 / m_InverseDiagonal[i] : 1.0;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ConjugateGradientSolver< TValue >::ApplyPreconditioner(const VectorType & r, VectorType & z) const
+{
+    const long n = r.size();
+    z.set_size(n);
+
+    long i;
+    #pragma omp parallel for private(i) schedule(static)
+    for(i = 0; i < n; i++)
+    {
+        z[i] = m_UseJacobi ? m_InverseDiagonal[i] * r[i] : r[i];
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ConjugateGradientSolver< TValue >::Solve(const VectorType & y, VectorType & x)
+{
+    if(m_H == NULL || y.size() != m_H->GetNumberOfRows())
+    {
+        btkException("ConjugateGradientSolver::Solve: the observation operator is not set or the size of y does not match its number of rows.");
+    }
+    for(unsigned int k = 0; k < m_Regularizations.size(); k++)
+    {
+        if(m_Regularizations[k]->GetNumberOfColumns() != m_H->GetNumberOfColumns())
+        {
+            btkException("ConjugateGradientSolver::Solve: the number of columns of a regularization operator does not match the one of the observation operator.");
+        }
+    }
+
+    const long n = m_H->GetNumberOfColumns();
+    long i;
+
+    if((long)x.size() != n)
+    {
+        x.set_size(n);
+        x.fill(0);
+    }
+
+    m_UseJacobi = false;
+    if(m_Preconditioner == JACOBI_PRECONDITIONER)
+    {
+        m_UseJacobi = this->ComputeJacobiPreconditioner();
+        if(!m_UseJacobi)
+        {
+            std::cout<<"ConjugateGradientSolver: an operator does not provide its diagonal, no preconditioner is used."<<std::endl;
+        }
+    }
+
+    // b = w H^T y, r = b - Ax, z = M^-1 r, p = z
+    VectorType b, r, z, p, q;
+
+    m_H->TransposeMultiply(y, b);
+    b *= m_DataWeight;
+
+    this->ApplyNormalMatrix(x, q);
+    r.set_size(n);
+
+    #pragma omp parallel for private(i) schedule(static)
+    for(i = 0; i < n; i++)
+    {
+        r[i] = b[i] - q[i];
+    }
+
+    const double normB = std::sqrt(DotProduct(b, b));
+    m_NumberOfIterations = 0;
+    m_RelativeResidual   = 0.0;
+
+    if(normB == 0)
+    {
+        x.fill(0);
+        return;
+    }
+
+    this->ApplyPreconditioner(r, z);
+    p = z;
+    double rz = DotProduct(r, z);
+
+    m_RelativeResidual = std::sqrt(DotProduct(r, r)) / normB;
+
+    while(m_NumberOfIterations < m_MaximumNumberOfIterations && m_RelativeResidual > m_Tolerance)
+    {
+        this->ApplyNormalMatrix(p, q);
+
+        const double pq = DotProduct(p, q);
+        if(pq <= 0)
+        {
+            // A is not positive definite along p (or p is null): no further progress is possible
+            break;
+        }
+        const double alpha = rz / pq;
+
+        #pragma omp parallel for private(i) schedule(static)
+        for(i = 0; i < n; i++)
+        {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+
+        this->ApplyPreconditioner(r, z);
+        const double rzNew = DotProduct(r, z);
+        const double beta  = rzNew / rz;
+        rz = rzNew;
+
+        #pragma omp parallel for private(i) schedule(static)
+        for(i = 0; i < n; i++)
+        {
+            p[i] = z[i] + beta * p[i];
+        }
+
+        m_NumberOfIterations++;
+        m_RelativeResidual = std::sqrt(DotProduct(r, r)) / normB;
+
+        if(m_Verbose)
+        {
+            std::cout<<"Conjugate gradient: iteration "<<m_NumberOfIterations<<", relative residual "<<m_RelativeResidual<<std::endl;
+        }
+    }
+}
+
+} // namespace btk
+
+#endif // BTK_CONJUGATE_GRADIENT_SOLVER_TXX
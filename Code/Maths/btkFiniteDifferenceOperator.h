@@ -0,0 +1,116 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_FINITE_DIFFERENCE_OPERATOR_H
+#define BTK_FINITE_DIFFERENCE_OPERATOR_H
+
+// Local includes
+#include "btkLinearOperator.h"
+#include "btkFiniteDifferenceStencil.h"
+
+namespace btk
+{
+
+/**
+ * @brief Finite differences along one axis, or 7-point Laplacian, as a linear operator (e.g. a regularization operator of
+ * ConjugateGradientSolver). The products are computed with FiniteDifferenceStencil, without building any matrix.
+ * @author François Rousseau
+ * @ingroup Maths
+ */
+template < typename TValue >
+class FiniteDifferenceOperator : public LinearOperator< TValue >
+{
+    public:
+        typedef FiniteDifferenceStencil< TValue >                   StencilType;
+        typedef typename LinearOperator< TValue >::VectorType       VectorType;
+
+        /**
+         * @brief Constructor (stencil along one axis).
+         * @param stencil Size and boundaries of the image (copied)
+         * @param axis Axis of the stencil (0: x, 1: y, 2: z)
+         * @param kernel Stencil
+         */
+        FiniteDifferenceOperator(const StencilType & stencil, unsigned int axis, typename StencilType::KernelType kernel) :
+            m_Stencil(stencil), m_Laplacian(false), m_Axis(axis), m_Kernel(kernel) {}
+
+        /**
+         * @brief Constructor (7-point Laplacian).
+         * @param stencil Size and boundaries of the image (copied)
+         */
+        explicit FiniteDifferenceOperator(const StencilType & stencil) :
+            m_Stencil(stencil), m_Laplacian(true), m_Axis(0), m_Kernel(StencilType::SECOND_DIFFERENCE) {}
+
+        virtual void Multiply(const VectorType & x, VectorType & y) const
+        {
+            if(m_Laplacian)
+                m_Stencil.ApplyLaplacian(x, y);
+            else
+                m_Stencil.Apply(m_Axis, m_Kernel, x, y);
+        }
+
+        virtual void TransposeMultiply(const VectorType & y, VectorType & x) const
+        {
+            if(m_Laplacian)
+                m_Stencil.ApplyLaplacianTranspose(y, x);
+            else
+                m_Stencil.ApplyTranspose(m_Axis, m_Kernel, y, x);
+        }
+
+        virtual bool GetColumnSquaredNorms(VectorType & norms) const
+        {
+            if(m_Laplacian)
+                m_Stencil.GetLaplacianColumnSquaredNorms(norms);
+            else
+                m_Stencil.GetColumnSquaredNorms(m_Axis, m_Kernel, norms);
+
+            return true;
+        }
+
+        /** @brief Number of rows (number of voxels). */
+        virtual unsigned int GetNumberOfRows() const { return m_Stencil.GetNumberOfVoxels(); }
+
+        /** @brief Number of columns (number of voxels). */
+        virtual unsigned int GetNumberOfColumns() const { return m_Stencil.GetNumberOfVoxels(); }
+
+    private:
+        StencilType                             m_Stencil;
+        bool                                    m_Laplacian;
+        unsigned int                            m_Axis;
+        typename StencilType::KernelType        m_Kernel;
+};
+
+} // namespace btk
+
+#endif // BTK_FINITE_DIFFERENCE_OPERATOR_H
@@ -0,0 +1,208 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_FINITE_DIFFERENCE_STENCIL_H
+#define BTK_FINITE_DIFFERENCE_STENCIL_H
+
+// VNL includes
+#include "vnl/vnl_vector.h"
+
+// Local includes
+#include "btkMacro.h"
+#include "btkSparseMatrix.h"
+
+// STL includes
+#include "algorithm"
+#include "sstream"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace btk
+{
+
+/**
+ * @brief Finite differences (3-point stencils) along the axes of a 3D image stored as a flat vector (x fastest, then y, then z),
+ * as used by the regularization terms of the super-resolution cost functions.
+ *
+ * The stencils are applied directly on the vector, without copying the lines, and are multithreaded over the lines of the image.
+ * Boundaries are handled explicitly on the first and last samples of every line: either mirrored (dcb|abcd, x[-1] = x[1])
+ * or set to zero. The transposed operators (used by the gradients) and the sparse matrices of the operators are also provided.
+ * @author François Rousseau
+ * @ingroup Maths
+ */
+template < typename TValue >
+class FiniteDifferenceStencil
+{
+    public:
+        typedef FiniteDifferenceStencil< TValue >   Self;
+        typedef TValue                              ValueType;
+        typedef vnl_vector< TValue >                VectorType;
+        typedef SparseMatrix< TValue >              MatrixType;
+
+        /** @brief Stencils along one axis. */
+        enum KernelType
+        {
+            FORWARD_DIFFERENCE = 0,  /**< x[i+1] - x[i] */
+            BACKWARD_DIFFERENCE,     /**< x[i] - x[i-1] */
+            SECOND_DIFFERENCE        /**< x[i-1] - 2x[i] + x[i+1] (the Laplacian being the sum over the three axes) */
+        };
+
+        /** @brief Values of the samples outside the image. */
+        enum BoundaryType
+        {
+            MIRROR_BOUNDARY = 0,     /**< x[-1] = x[1] and x[n] = x[n-2] (default) */
+            ZERO_BOUNDARY            /**< x[-1] = x[n] = 0 */
+        };
+
+        /**
+         * @brief Constructor (empty image, mirrored boundaries).
+         */
+        FiniteDifferenceStencil();
+
+        /**
+         * @brief Set the size of the image.
+         */
+        void SetSize(unsigned int width, unsigned int height, unsigned int depth);
+
+        /** @brief Size of the image along an axis. */
+        unsigned int GetSize(unsigned int axis) const { return m_Size[axis]; }
+
+        /** @brief Number of voxels of the image. */
+        unsigned long GetNumberOfVoxels() const { return (unsigned long)m_Size[0] * m_Size[1] * m_Size[2]; }
+
+        btkSetMacro(Boundary, BoundaryType);
+        btkGetMacro(Boundary, BoundaryType);
+
+        /**
+         * @brief Apply a stencil along an axis: y = K x.
+         * @param axis Axis of the stencil (0: x, 1: y, 2: z)
+         * @param kernel Stencil
+         * @param x Input image (cannot be y)
+         * @param y Output image (resized to the number of voxels)
+         */
+        void Apply(unsigned int axis, KernelType kernel, const VectorType & x, VectorType & y) const;
+
+        /**
+         * @brief Apply the transpose of a stencil along an axis: y = K^T x (e.g. for the gradient of a function of K x).
+         * @param axis Axis of the stencil (0: x, 1: y, 2: z)
+         * @param kernel Stencil
+         * @param x Input image (cannot be y)
+         * @param y Output image (resized to the number of voxels)
+         */
+        void ApplyTranspose(unsigned int axis, KernelType kernel, const VectorType & x, VectorType & y) const;
+
+        /**
+         * @brief Apply the 7-point Laplacian: y = sum of the second differences along the three axes.
+         * @param x Input image (cannot be y)
+         * @param y Output image (resized to the number of voxels)
+         */
+        void ApplyLaplacian(const VectorType & x, VectorType & y) const;
+
+        /**
+         * @brief Apply the transpose of the 7-point Laplacian (the Laplacian itself with zero boundaries).
+         * @param x Input image (cannot be y)
+         * @param y Output image (resized to the number of voxels)
+         */
+        void ApplyLaplacianTranspose(const VectorType & x, VectorType & y) const;
+
+        /**
+         * @brief Build the sparse matrix of a stencil along an axis (one row per voxel).
+         */
+        void GetMatrix(unsigned int axis, KernelType kernel, MatrixType & matrix) const;
+
+        /**
+         * @brief Build the sparse matrix of the 7-point Laplacian (one row per voxel).
+         */
+        void GetLaplacianMatrix(MatrixType & matrix) const;
+
+        /**
+         * @brief Squared norms of the columns of the operator of a stencil along an axis (the diagonal of K^T*K).
+         */
+        void GetColumnSquaredNorms(unsigned int axis, KernelType kernel, VectorType & norms) const;
+
+        /**
+         * @brief Squared norms of the columns of the 7-point Laplacian (the diagonal of L^T*L).
+         */
+        void GetLaplacianColumnSquaredNorms(VectorType & norms) const;
+
+    protected:
+        /**
+         * @brief Coefficients of the stencil on the previous, current and next samples.
+         */
+        static void GetTaps(KernelType kernel, ValueType * taps);
+
+        /**
+         * @brief Element (i,k) of the operator on a line of n samples, the boundaries being folded into the first and last rows.
+         */
+        ValueType GetCoefficient(const ValueType * taps, long i, long k, long n) const;
+
+        /**
+         * @brief Value of the operator (or of its transpose) at a sample of a line, computed with the exact coefficients (used near the boundaries).
+         * @param sample Pointer to the sample in the input image
+         * @param position Position of the sample in its line
+         * @param length Length of the line
+         * @param stride Distance between two consecutive samples of the line in the image
+         */
+        ValueType GetBoundaryValue(const ValueType * taps, bool transpose, const ValueType * sample, long position, long length, long stride) const;
+
+        /**
+         * @brief Apply the operator (or its transpose) along an axis, the result being either stored in y or added to y.
+         */
+        void ApplyAlongAxis(unsigned int axis, const ValueType * taps, bool transpose, const VectorType & x, VectorType & y, bool accumulate) const;
+
+        /**
+         * @brief Add the rows of the operators of several axes to a matrix (the stencils of the axes being summed).
+         */
+        void FillMatrix(const bool * axes, const ValueType * taps, MatrixType & matrix) const;
+
+        /**
+         * @brief Squared norms of the columns of the operators of several axes (the stencils of the axes being summed).
+         */
+        void ComputeColumnSquaredNorms(const bool * axes, const ValueType * taps, VectorType & norms) const;
+
+    private:
+        unsigned int    m_Size[3];
+        BoundaryType    m_Boundary;
+};
+
+} // namespace btk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "btkFiniteDifferenceStencil.txx"
+#endif
+
+#endif // BTK_FINITE_DIFFERENCE_STENCIL_H
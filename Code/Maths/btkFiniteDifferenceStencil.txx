@@ -0,0 +1,383 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_FINITE_DIFFERENCE_STENCIL_TXX
+#define BTK_FINITE_DIFFERENCE_STENCIL_TXX
+
+#include "btkFiniteDifferenceStencil.h"
+
+namespace btk
+{
+
+template < typename TValue >
+FiniteDifferenceStencil< TValue >::FiniteDifferenceStencil() : m_Boundary(MIRROR_BOUNDARY)
+{
+    this->SetSize(0,0,0);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::SetSize(unsigned int width, unsigned int height, unsigned int depth)
+{
+    m_Size[0] = width;
+    m_Size[1] = height;
+    m_Size[2] = depth;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::GetTaps(KernelType kernel, ValueType * taps)
+{
+    switch(kernel)
+    {
+        case FORWARD_DIFFERENCE:
+            taps[0] =  0; taps[1] = -1; taps[2] = 1;
+            break;
+        case BACKWARD_DIFFERENCE:
+            taps[0] = -1; taps[1] =  1; taps[2] = 0;
+            break;
+        default:
+            taps[0] =  1; taps[1] = -2; taps[2] = 1;
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+TValue FiniteDifferenceStencil< TValue >::GetCoefficient(const ValueType * taps, long i, long k, long n) const
+{
+    // with mirrored boundaries, the outside sample x[-1] (resp. x[n]) is x[1] (resp. x[n-2])
+    ValueType folded = (m_Boundary == MIRROR_BOUNDARY) ? 1 : 0;
+
+    if(n == 1)
+    {
+        return taps[1] + folded * (taps[0] + taps[2]);
+    }
+
+    if(i > 0 && i < n-1)
+    {
+        return (k == i-1) ? taps[0] : (k == i) ? taps[1] : (k == i+1) ? taps[2] : 0;
+    }
+
+    if(i == 0)
+    {
+        return (k == 0) ? taps[1] : (k == 1) ? taps[2] + folded * taps[0] : 0;
+    }
+
+    return (k == n-1) ? taps[1] : (k == n-2) ? taps[0] + folded * taps[2] : 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+TValue FiniteDifferenceStencil< TValue >::GetBoundaryValue(const ValueType * taps, bool transpose, const ValueType * sample,
+                                                            long position, long length, long stride) const
+{
+    ValueType value = 0;
+
+    for(long q = std::max(position-1, 0L); q <= std::min(position+1, length-1); q++)
+    {
+        ValueType coefficient = transpose ? this->GetCoefficient(taps, q, position, length) : this->GetCoefficient(taps, position, q, length);
+        value += coefficient * sample[(q-position)*stride];
+    }
+
+    return value;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::ApplyAlongAxis(unsigned int axis, const ValueType * taps, bool transpose,
+                                                        const VectorType & x, VectorType & y, bool accumulate) const
+{
+    if(x.size() != this->GetNumberOfVoxels())
+    {
+        btkException("FiniteDifferenceStencil: the size of the input vector does not match the size of the image.");
+    }
+    if(&x == &y)
+    {
+        btkException("FiniteDifferenceStencil: the stencils cannot be applied in place.");
+    }
+    if(!accumulate)
+    {
+        y.set_size(x.size());
+    }
+
+    const long width  = m_Size[0];
+    const long height = m_Size[1];
+    const long length = m_Size[axis];
+    const long stride = (axis == 0) ? 1 : (axis == 1) ? width : width*height;
+
+    // Inside the lines, the stencil is applied directly (the transpose of a stencil being the reversed stencil).
+    // Only the positions [first,last] are concerned: the rows of the operator near the boundaries differ from the stencil.
+    const ValueType previous = transpose ? taps[2] : taps[0];
+    const ValueType center   = taps[1];
+    const ValueType next     = transpose ? taps[0] : taps[2];
+    const long first = transpose ? 2 : 1;
+    const long last  = length - 1 - first;
+
+    const ValueType * input  = x.data_block();
+    ValueType *       output = y.data_block();
+
+    // every line of voxels along x is computed by one thread (for the y and z axes, the neighbouring lines are read contiguously)
+    const long numberOfLines = height * m_Size[2];
+    long l;
+
+    #pragma omp parallel for private(l) schedule(static)
+    for(l = 0; l < numberOfLines; l++)
+    {
+        const ValueType * in  = input  + l*width;
+        ValueType *       out = output + l*width;
+
+        if(axis == 0)
+        {
+            for(long i = 0; i < width; i++)
+            {
+                ValueType value = (i >= first && i <= last) ? previous*in[i-1] + center*in[i] + next*in[i+1]
+                                                            : this->GetBoundaryValue(taps, transpose, in+i, i, length, 1);
+                out[i] = accumulate ? out[i] + value : value;
+            }
+        }
+        else
+        {
+            const long position = (axis == 1) ? l % height : l / height;
+
+            if(position >= first && position <= last)
+            {
+                const ValueType * inPrevious = in - stride;
+                const ValueType * inNext     = in + stride;
+
+                for(long i = 0; i < width; i++)
+                {
+                    ValueType value = previous*inPrevious[i] + center*in[i] + next*inNext[i];
+                    out[i] = accumulate ? out[i] + value : value;
+                }
+            }
+            else
+            {
+                for(long i = 0; i < width; i++)
+                {
+                    ValueType value = this->GetBoundaryValue(taps, transpose, in+i, position, length, stride);
+                    out[i] = accumulate ? out[i] + value : value;
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::Apply(unsigned int axis, KernelType kernel, const VectorType & x, VectorType & y) const
+{
+    ValueType taps[3];
+    GetTaps(kernel, taps);
+
+    this->ApplyAlongAxis(axis, taps, false, x, y, false);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::ApplyTranspose(unsigned int axis, KernelType kernel, const VectorType & x, VectorType & y) const
+{
+    ValueType taps[3];
+    GetTaps(kernel, taps);
+
+    this->ApplyAlongAxis(axis, taps, true, x, y, false);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::ApplyLaplacian(const VectorType & x, VectorType & y) const
+{
+    ValueType taps[3];
+    GetTaps(SECOND_DIFFERENCE, taps);
+
+    for(unsigned int axis = 0; axis < 3; axis++)
+    {
+        this->ApplyAlongAxis(axis, taps, false, x, y, axis > 0);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::ApplyLaplacianTranspose(const VectorType & x, VectorType & y) const
+{
+    ValueType taps[3];
+    GetTaps(SECOND_DIFFERENCE, taps);
+
+    for(unsigned int axis = 0; axis < 3; axis++)
+    {
+        this->ApplyAlongAxis(axis, taps, true, x, y, axis > 0);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::FillMatrix(const bool * axes, const ValueType * taps, MatrixType & matrix) const
+{
+    const long n = this->GetNumberOfVoxels();
+    const long strides[3] = { 1, (long)m_Size[0], (long)m_Size[0]*m_Size[1] };
+
+    matrix.SetSize(n, n);
+
+    for(long r = 0; r < n; r++)
+    {
+        const long position[3] = { r % m_Size[0], (r / m_Size[0]) % m_Size[1], r / strides[2] };
+
+        for(unsigned int axis = 0; axis < 3; axis++)
+        {
+            if(!axes[axis])
+            {
+                continue;
+            }
+
+            const long length = m_Size[axis];
+            for(long q = std::max(position[axis]-1, 0L); q <= std::min(position[axis]+1, length-1); q++)
+            {
+                ValueType coefficient = this->GetCoefficient(taps, position[axis], q, length);
+                if(coefficient != 0)
+                {
+                    matrix.AddValue(r, r + (q-position[axis])*strides[axis], coefficient);
+                }
+            }
+        }
+    }
+
+    matrix.Finalize();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::GetMatrix(unsigned int axis, KernelType kernel, MatrixType & matrix) const
+{
+    ValueType taps[3];
+    GetTaps(kernel, taps);
+
+    bool axes[3] = { axis == 0, axis == 1, axis == 2 };
+    this->FillMatrix(axes, taps, matrix);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::GetLaplacianMatrix(MatrixType & matrix) const
+{
+    ValueType taps[3];
+    GetTaps(SECOND_DIFFERENCE, taps);
+
+    bool axes[3] = { true, true, true };
+    this->FillMatrix(axes, taps, matrix);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::ComputeColumnSquaredNorms(const bool * axes, const ValueType * taps, VectorType & norms) const
+{
+    const long n = this->GetNumberOfVoxels();
+    const long strides[3] = { 1, (long)m_Size[0], (long)m_Size[0]*m_Size[1] };
+
+    norms.set_size(n);
+    norms.fill(0);
+
+    // The rows are scattered into the columns: the off-diagonal values of a row come from a single axis,
+    // while the diagonal value is the sum of the centers of the stencils of the axes.
+    for(long r = 0; r < n; r++)
+    {
+        const long position[3] = { r % m_Size[0], (r / m_Size[0]) % m_Size[1], r / strides[2] };
+        ValueType diagonal = 0;
+
+        for(unsigned int axis = 0; axis < 3; axis++)
+        {
+            if(!axes[axis])
+            {
+                continue;
+            }
+
+            const long length = m_Size[axis];
+            for(long q = std::max(position[axis]-1, 0L); q <= std::min(position[axis]+1, length-1); q++)
+            {
+                ValueType coefficient = this->GetCoefficient(taps, position[axis], q, length);
+                if(q == position[axis])
+                {
+                    diagonal += coefficient;
+                }
+                else
+                {
+                    norms[r + (q-position[axis])*strides[axis]] += coefficient * coefficient;
+                }
+            }
+        }
+
+        norms[r] += diagonal * diagonal;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::GetColumnSquaredNorms(unsigned int axis, KernelType kernel, VectorType & norms) const
+{
+    ValueType taps[3];
+    GetTaps(kernel, taps);
+
+    bool axes[3] = { axis == 0, axis == 1, axis == 2 };
+    this->ComputeColumnSquaredNorms(axes, taps, norms);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void FiniteDifferenceStencil< TValue >::GetLaplacianColumnSquaredNorms(VectorType & norms) const
+{
+    ValueType taps[3];
+    GetTaps(SECOND_DIFFERENCE, taps);
+
+    bool axes[3] = { true, true, true };
+    this->ComputeColumnSquaredNorms(axes, taps, norms);
+}
+
+} // namespace btk
+
+#endif // BTK_FINITE_DIFFERENCE_STENCIL_TXX
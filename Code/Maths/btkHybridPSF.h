@@ -155,6 +155,7 @@ class HybridPSF : public btk::PSF
                     break;
             };
 
+            this->Modified();
 
         }
         /** Set Y axis fonction, _f is a FONCTION_TYPE */
@@ -178,6 +179,8 @@ class HybridPSF : public btk::PSF
                     m_Functions[1] = &HybridPSF::functionBoxCar;
                     break;
             };
+
+            this->Modified();
         }
         /** Set Z axis fonction, _f is a FONCTION_TYPE */
         void SetZFunction(FUNCTION_TYPE _f)
@@ -200,6 +203,8 @@ class HybridPSF : public btk::PSF
                     m_Functions[Z] = &HybridPSF::functionBoxCar;
                     break;
             };
+
+            this->Modified();
         }
 
     protected:
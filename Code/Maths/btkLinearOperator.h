@@ -0,0 +1,94 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_LINEAR_OPERATOR_H
+#define BTK_LINEAR_OPERATOR_H
+
+// VNL includes
+#include "vnl/vnl_vector.h"
+
+namespace btk
+{
+
+/**
+ * @brief Interface of a linear operator y = H*x, such as the observation operator of the super-resolution methods.
+ *
+ * The operator may be an explicit matrix (see SparseMatrix) or be computed on the fly (matrix-free), so that the
+ * algorithms using only the products H*x and H^T*y (cost functions, iterative back-projection) work with both.
+ * @author François Rousseau
+ * @ingroup Maths
+ */
+template < typename TValue >
+class LinearOperator
+{
+    public:
+        typedef vnl_vector< TValue >    VectorType;
+
+        /**
+         * @brief Destructor.
+         */
+        virtual ~LinearOperator() {}
+
+        /**
+         * @brief Compute y = H*x.
+         * @param x Input vector (size: number of columns)
+         * @param y Output vector (resized to the number of rows)
+         */
+        virtual void Multiply(const VectorType & x, VectorType & y) const = 0;
+
+        /**
+         * @brief Compute x = H^T*y.
+         * @param y Input vector (size: number of rows)
+         * @param x Output vector (resized to the number of columns)
+         */
+        virtual void TransposeMultiply(const VectorType & y, VectorType & x) const = 0;
+
+        /**
+         * @brief Compute the squared norm of every column of H (e.g. the diagonal of H^T*H for a Jacobi preconditioner).
+         * @param norms Output vector (resized to the number of columns)
+         * @return false if the operator cannot provide them (default)
+         */
+        virtual bool GetColumnSquaredNorms(VectorType & norms) const { return false; }
+
+        /** @brief Number of rows. */
+        virtual unsigned int GetNumberOfRows() const = 0;
+
+        /** @brief Number of columns. */
+        virtual unsigned int GetNumberOfColumns() const = 0;
+};
+
+} // namespace btk
+
+#endif // BTK_LINEAR_OPERATOR_H
@@ -0,0 +1,233 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkPSFKernelCache.h"
+
+// ITK includes
+#include "itkImageDuplicator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+namespace btk
+{
+
+PSFKernelCache::PSFKernelCache() : m_PSF(NULL), m_PSFTime(0), m_NumberOfConstructions(0)
+{
+    // ----
+}
+
+//----------------------------------------------------------------------------------------
+
+bool PSFKernelCache::Key::operator<(const Key &other) const
+{
+    if(name != other.name)
+    {
+        return name < other.name;
+    }
+
+    for(unsigned int i = 0; i < 3; i++)
+    {
+        if(lrSpacing[i] != other.lrSpacing[i])
+        {
+            return lrSpacing[i] < other.lrSpacing[i];
+        }
+
+        if(hrSpacing[i] != other.hrSpacing[i])
+        {
+            return hrSpacing[i] < other.hrSpacing[i];
+        }
+
+        if(size[i] != other.size[i])
+        {
+            return size[i] < other.size[i];
+        }
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------
+
+PSFKernelCache::Key PSFKernelCache::MakeKey(const std::string &name, const SpacingType &lrSpacing, const SpacingType &hrSpacing, const SizeType &size)
+{
+    Key key;
+    key.name = name;
+
+    for(unsigned int i = 0; i < 3; i++)
+    {
+        key.lrSpacing[i] = lrSpacing[i];
+        key.hrSpacing[i] = hrSpacing[i];
+        key.size[i] = size[i];
+    }
+
+    return key;
+}
+
+//----------------------------------------------------------------------------------------
+
+const PSFKernelCache::Samples &PSFKernelCache::GetSamples(PSF *psf, const SpacingType &lrSpacing, const SpacingType &hrSpacing, const SizeType &size)
+{
+    if(psf != m_PSF || psf->GetMTime() != m_PSFTime)
+    {
+        m_Samples.clear();
+        m_PSF = psf;
+        m_PSFTime = psf->GetMTime();
+    }
+
+    Key key = MakeKey(psf->GetNameOfClass(), lrSpacing, hrSpacing, size);
+    std::map< Key, Samples >::iterator it = m_Samples.find(key);
+
+    if(it != m_Samples.end())
+    {
+        return it->second;
+    }
+
+    SpacingType spacing = lrSpacing;
+    psf->SetLrSpacing(spacing);
+    psf->SetSpacing(hrSpacing);
+    psf->SetSize(size);
+    psf->ConstructImage();
+
+    // Centering the PSF on a LR voxel only translates the PSF image, so the
+    // samples are stored as offsets to the center of the PSF image.
+    ImageType::Pointer image = psf->GetPsfImage();
+    ImageType::IndexType centerIndex;
+    centerIndex[0] = (size[0]-1)/2;
+    centerIndex[1] = (size[1]-1)/2;
+    centerIndex[2] = (size[2]-1)/2;
+    ImageType::PointType center;
+    image->TransformIndexToPhysicalPoint(centerIndex, center);
+
+    Samples &samples = m_Samples[key];
+
+    itk::ImageRegionConstIteratorWithIndex< ImageType > it2(image, image->GetLargestPossibleRegion());
+    for(it2.GoToBegin(); !it2.IsAtEnd(); ++it2)
+    {
+        if(it2.Get() <= 0.0)
+        {
+            continue;
+        }
+
+        ImageType::PointType point;
+        image->TransformIndexToPhysicalPoint(it2.GetIndex(), point);
+        samples.offsets.push_back(point - center);
+        samples.values.push_back(it2.Get());
+    }
+
+    m_NumberOfConstructions++;
+
+    return samples;
+}
+
+//----------------------------------------------------------------------------------------
+
+PSFKernelCache::ImageType::Pointer PSFKernelCache::GetImage(const std::string &name, const SpacingType &lrSpacing, const SpacingType &hrSpacing, const SizeType &size) const
+{
+    std::map< Key, ImageType::Pointer >::const_iterator it = m_Images.find(MakeKey(name, lrSpacing, hrSpacing, size));
+
+    if(it == m_Images.end())
+    {
+        return NULL;
+    }
+
+    typedef itk::ImageDuplicator< ImageType > DuplicatorType;
+    DuplicatorType::Pointer duplicator = DuplicatorType::New();
+    duplicator->SetInputImage(it->second);
+    duplicator->Update();
+
+    return duplicator->GetOutput();
+}
+
+//----------------------------------------------------------------------------------------
+
+void PSFKernelCache::AddImage(const std::string &name, const SpacingType &lrSpacing, const SpacingType &hrSpacing, const SizeType &size, const ImageType *image)
+{
+    typedef itk::ImageDuplicator< ImageType > DuplicatorType;
+    DuplicatorType::Pointer duplicator = DuplicatorType::New();
+    duplicator->SetInputImage(image);
+    duplicator->Update();
+
+    m_Images[MakeKey(name, lrSpacing, hrSpacing, size)] = duplicator->GetOutput();
+    m_NumberOfConstructions++;
+}
+
+//----------------------------------------------------------------------------------------
+
+const SeparablePSFKernel &PSFKernelCache::GetGaussianKernel(const SpacingType &sigma, double truncation)
+{
+    SpacingType radius = sigma * truncation;
+    SizeType size;
+    size.Fill(0);
+
+    // a Gaussian kernel is identified by its standard deviations and its radii
+    Key key = MakeKey("Gaussian", sigma, radius, size);
+    SeparablePSFKernel *kernel = NULL;
+
+    // the nodes of a map are not moved by insertions, so that the kernel can be used outside the critical section
+    #pragma omp critical(btkPSFKernelCache)
+    {
+        std::map< Key, SeparablePSFKernel >::iterator it = m_Kernels.find(key);
+
+        if(it != m_Kernels.end())
+        {
+            kernel = &it->second;
+        }
+        else
+        {
+            kernel = &m_Kernels[key];
+
+            for(unsigned int axis = 0; axis < 3; axis++)
+            {
+                kernel->SetProfile(axis, SeparablePSFKernel::GAUSSIAN, sigma[axis], radius[axis]);
+            }
+
+            m_NumberOfConstructions++;
+        }
+    }
+
+    return *kernel;
+}
+
+//----------------------------------------------------------------------------------------
+
+void PSFKernelCache::Clear()
+{
+    m_Samples.clear();
+    m_Images.clear();
+    m_Kernels.clear();
+    m_PSF = NULL;
+    m_PSFTime = 0;
+}
+
+} // namespace btk
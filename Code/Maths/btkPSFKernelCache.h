@@ -0,0 +1,166 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_PSF_KERNEL_CACHE_H
+#define BTK_PSF_KERNEL_CACHE_H
+
+// ITK includes
+#include "itkImage.h"
+#include "itkVector.h"
+#include "itkSize.h"
+
+// Local includes
+#include "btkPSF.h"
+#include "btkSeparablePSFKernel.h"
+
+// STL includes
+#include "map"
+#include "vector"
+#include "string"
+
+namespace btk
+{
+
+/**
+ * @brief Cache of the PSF kernels of a set of LR images.
+ *
+ * A PSF only depends on the spacing of the LR image, on the spacing of the HR image and on the size of its support,
+ * and the same few geometries recur across all the LR images (and across the updates of a reconstruction). The kernels
+ * are therefore built at their first request only and then shared:
+ * - the samples (offsets to the center and values) of a btk::PSF,
+ * - the PSF images built by a filter itself (stored under a name describing the construction),
+ * - the tabulated separable Gaussian kernels (btk::SeparablePSFKernel).
+ *
+ * Only GetGaussianKernel() may be called concurrently.
+ * @author François Rousseau
+ * @ingroup Maths
+ */
+class PSFKernelCache
+{
+    public:
+        typedef PSF::ImageType          ImageType;
+        typedef PSF::SpacingType        SpacingType;
+        typedef PSF::SizeType           SizeType;
+        typedef itk::Vector< double,3 > OffsetType;
+
+        /** @brief Nonzero samples of a PSF image. */
+        struct Samples
+        {
+            std::vector< OffsetType > offsets;  /**< physical offsets to the center of the PSF */
+            std::vector< double >     values;   /**< values of the samples */
+        };
+
+        /**
+         * @brief Constructor.
+         */
+        PSFKernelCache();
+
+        /**
+         * @brief Samples of a PSF, constructed by the PSF at the first request only.
+         * The cache is cleared when it is given another PSF, or when the PSF has been modified.
+         * @param psf PSF (its spacings and size are set by this method).
+         * @param lrSpacing Spacing of the LR image.
+         * @param hrSpacing Spacing of the HR image.
+         * @param size Size of the support of the PSF (in HR voxels).
+         * @return Nonzero samples of the PSF image.
+         */
+        const Samples &GetSamples(PSF *psf, const SpacingType &lrSpacing, const SpacingType &hrSpacing, const SizeType &size);
+
+        /**
+         * @brief Copy of a PSF image previously added to the cache.
+         * @param name Name of the construction of the image.
+         * @return A new image, or a null pointer when no image has been added for this construction and geometry.
+         */
+        ImageType::Pointer GetImage(const std::string &name, const SpacingType &lrSpacing, const SpacingType &hrSpacing, const SizeType &size) const;
+
+        /**
+         * @brief Add a copy of a PSF image to the cache.
+         * @param name Name of the construction of the image.
+         * @param image PSF image.
+         */
+        void AddImage(const std::string &name, const SpacingType &lrSpacing, const SpacingType &hrSpacing, const SizeType &size, const ImageType *image);
+
+        /**
+         * @brief Separable Gaussian kernel (in physical units), tabulated at the first request only.
+         * @param sigma Standard deviations of the Gaussian along the axes of the kernel.
+         * @param truncation Number of standard deviations beyond which the kernel is 0.
+         * @return Kernel, which remains valid until the cache is cleared.
+         */
+        const SeparablePSFKernel &GetGaussianKernel(const SpacingType &sigma, double truncation = 8.0);
+
+        /**
+         * @brief Remove all the kernels.
+         */
+        void Clear();
+
+        /**
+         * @brief Number of kernels built since the construction of the cache.
+         */
+        unsigned int GetNumberOfConstructions() const
+        {
+            return m_NumberOfConstructions;
+        }
+
+    private:
+        /** Key of a kernel */
+        struct Key
+        {
+            std::string   name;
+            double        lrSpacing[3];
+            double        hrSpacing[3];
+            unsigned long size[3];
+
+            bool operator<(const Key &other) const;
+        };
+
+        /**
+         * @brief Build the key of a kernel.
+         */
+        static Key MakeKey(const std::string &name, const SpacingType &lrSpacing, const SpacingType &hrSpacing, const SizeType &size);
+
+        /** PSF whose samples are cached (and its modification time) */
+        const PSF    *m_PSF;
+        unsigned long m_PSFTime;
+
+        std::map< Key, Samples >             m_Samples;
+        std::map< Key, ImageType::Pointer >  m_Images;
+        std::map< Key, SeparablePSFKernel >  m_Kernels;
+
+        unsigned int m_NumberOfConstructions;
+};
+
+} // namespace btk
+
+#endif // BTK_PSF_KERNEL_CACHE_H
@@ -0,0 +1,130 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_RESIDUAL_BACK_PROJECTION_H
+#define BTK_RESIDUAL_BACK_PROJECTION_H
+
+// VNL includes
+#include "vnl/vnl_vector.h"
+
+// Local includes
+#include "btkMacro.h"
+#include "btkSparseMatrix.h"
+
+// STL includes
+#include "vector"
+#include "algorithm"
+
+namespace btk
+{
+
+/**
+ * @brief Back-projection of the residual y - Hx of an observation matrix, as used by the iterated back-projection (IBP).
+ *
+ * The rows of H are split into groups (one group per LR image). For every column c (HR voxel) and every group g, the residual
+ * is back-projected as the mean of the residuals of the rows of g weighted by H: b_g(c) = sum_r H(r,c) e(r) / sum_r H(r,c)
+ * (0 when no row of g contains c). The correction of c is then the mean of b_g(c) over the groups, or their median.
+ *
+ * H*x is computed first (multithreaded over the rows of H), and the residual is back-projected in a single pass over the
+ * columns of H (multithreaded, using the transposed copy of H), without storing the residual or one image per group.
+ * @author François Rousseau
+ * @ingroup Maths
+ */
+template < typename TValue >
+class ResidualBackProjection
+{
+    public:
+        typedef ResidualBackProjection< TValue >        Self;
+        typedef SparseMatrix< TValue >                  MatrixType;
+        typedef typename MatrixType::IndexType          IndexType;
+        typedef typename MatrixType::OffsetType         OffsetType;
+        typedef vnl_vector< TValue >                    VectorType;
+
+        /** @brief Maximum number of groups of the median. */
+        enum { MAXIMUM_NUMBER_OF_GROUPS = 64 };
+
+        /**
+         * @brief Constructor.
+         */
+        ResidualBackProjection();
+
+        /**
+         * @brief Set the observation matrix H (not copied).
+         */
+        void SetObservationMatrix(const MatrixType * H);
+
+        /**
+         * @brief Set the groups of rows: group g starts at row firstRows[g] and ends before the first row of the next group
+         * (one group with all the rows by default).
+         * @param firstRows First row of every group, in increasing order (the first one is 0)
+         */
+        void SetGroups(const std::vector< unsigned int > & firstRows);
+
+        /** @brief Take the median of the back-projections of the groups instead of their mean (default false). */
+        btkSetMacro(Median, bool);
+        btkGetMacro(Median, bool);
+
+        /**
+         * @brief Compute the correction of x.
+         * @param y Observations (size: number of rows of H)
+         * @param x Current estimate (size: number of columns of H)
+         * @param correction Back-projected residual (resized to the number of columns of H)
+         */
+        void Compute(const VectorType & y, const VectorType & x, VectorType & correction);
+
+        /** @brief Simulated observations H*x of the last Compute. */
+        const VectorType & GetSimulation() const { return m_Simulation; }
+
+    protected:
+        /**
+         * @brief Median of a few values (the values are reordered).
+         */
+        static double SelectMedian(double * values, unsigned int n);
+
+    private:
+        const MatrixType *          m_H;
+        std::vector< IndexType >    m_FirstRows;
+        bool                        m_Median;
+
+        VectorType                  m_Simulation;
+};
+
+} // namespace btk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "btkResidualBackProjection.txx"
+#endif
+
+#endif // BTK_RESIDUAL_BACK_PROJECTION_H
@@ -0,0 +1,177 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_RESIDUAL_BACK_PROJECTION_TXX
+#define BTK_RESIDUAL_BACK_PROJECTION_TXX
+
+#include "btkResidualBackProjection.h"
+
+namespace btk
+{
+
+template < typename TValue >
+ResidualBackProjection< TValue >::ResidualBackProjection() : m_H(NULL), m_Median(false)
+{
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ResidualBackProjection< TValue >::SetObservationMatrix(const MatrixType * H)
+{
+    m_H = H;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ResidualBackProjection< TValue >::SetGroups(const std::vector< unsigned int > & firstRows)
+{
+    m_FirstRows.assign(firstRows.begin(), firstRows.end());
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ResidualBackProjection< TValue >::Compute(const VectorType & y, const VectorType & x, VectorType & correction)
+{
+    if(m_H == NULL || !m_H->IsFinalized() || y.size() != m_H->GetNumberOfRows() || x.size() != m_H->GetNumberOfColumns())
+    {
+        btkException("ResidualBackProjection::Compute: H is not set or finalized, or the sizes of y and x do not match the ones of H.");
+    }
+
+    const IndexType numberOfRows    = m_H->GetNumberOfRows();
+    const IndexType numberOfColumns = m_H->GetNumberOfColumns();
+
+    // one group with all the rows by default
+    std::vector< IndexType > groupEnds;
+    if(m_FirstRows.empty())
+    {
+        groupEnds.push_back(numberOfRows);
+    }
+    else
+    {
+        if(m_FirstRows[0] != 0)
+        {
+            btkException("ResidualBackProjection::Compute: the first group does not start at row 0.");
+        }
+
+        for(unsigned int g = 1; g < m_FirstRows.size(); g++)
+        {
+            if(m_FirstRows[g] < m_FirstRows[g-1] || m_FirstRows[g] > numberOfRows)
+            {
+                btkException("ResidualBackProjection::Compute: the first rows of the groups are not increasing or exceed the number of rows.");
+            }
+            groupEnds.push_back(m_FirstRows[g]);
+        }
+        groupEnds.push_back(numberOfRows);
+    }
+
+    const unsigned int numberOfGroups = groupEnds.size();
+
+    if(m_Median && numberOfGroups > MAXIMUM_NUMBER_OF_GROUPS)
+    {
+        btkException("ResidualBackProjection::Compute: too many groups for the median.");
+    }
+
+    // simulated observations
+    m_H->Multiply(x, m_Simulation);
+
+    const OffsetType * columnPointers;
+    const IndexType  * rows;
+    const TValue     * values;
+    m_H->GetTranspose(columnPointers, rows, values);
+
+    correction.set_size(numberOfColumns);
+
+    const TValue    * yData          = y.data_block();
+    const TValue    * simulationData = m_Simulation.data_block();
+    TValue          * correctionData = correction.data_block();
+    const IndexType * ends           = &groupEnds[0];
+    const bool        median         = m_Median;
+
+    // every column of H is a row of the transposed copy, its values being sorted by row (hence by group)
+    long c;
+    #pragma omp parallel for private(c) schedule(static)
+    for(c = 0; c < (long)numberOfColumns; c++)
+    {
+        double backProjections[MAXIMUM_NUMBER_OF_GROUPS];
+        double sum = 0.0;
+
+        OffsetType k   = columnPointers[c];
+        OffsetType end = columnPointers[c+1];
+
+        for(unsigned int g = 0; g < numberOfGroups; g++)
+        {
+            double numerator   = 0.0;
+            double denominator = 0.0;
+
+            for(; k < end && rows[k] < ends[g]; k++)
+            {
+                IndexType r = rows[k];
+                numerator   += values[k] * (yData[r] - simulationData[r]);
+                denominator += values[k];
+            }
+
+            double backProjection = (denominator > 0.0) ? numerator / denominator : 0.0;
+
+            if(median)
+            {
+                backProjections[g] = backProjection;
+            }
+            else
+            {
+                sum += backProjection;
+            }
+        }
+
+        correctionData[c] = median ? SelectMedian(backProjections, numberOfGroups) : sum / numberOfGroups;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+double ResidualBackProjection< TValue >::SelectMedian(double * values, unsigned int n)
+{
+    // upper median for an even number of values
+    std::nth_element(values, values + n/2, values + n);
+
+    return values[n/2];
+}
+
+} // namespace btk
+
+#endif // BTK_RESIDUAL_BACK_PROJECTION_TXX
@@ -0,0 +1,98 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkSeparablePSFKernel.h"
+
+namespace btk
+{
+
+SeparablePSFKernel::SeparablePSFKernel()
+{
+    for(unsigned int axis = 0; axis < 3; axis++)
+    {
+        m_InverseSteps[axis] = 0.0;
+        m_Radii[axis] = 0.0;
+    }
+}
+
+//----------------------------------------------------------------------------------------
+
+void SeparablePSFKernel::SetProfile(unsigned int axis, ProfileType type, double width, double radius, unsigned int numberOfSamples)
+{
+    std::vector< double > &profile = m_Profiles[axis];
+
+    if(numberOfSamples < 2 || radius <= 0.0 || width <= 0.0)
+    {
+        profile.clear();
+        m_InverseSteps[axis] = 0.0;
+        m_Radii[axis] = 0.0;
+        return;
+    }
+
+    profile.resize(numberOfSamples);
+    double step = radius / (numberOfSamples-1);
+
+    for(unsigned int i = 0; i < numberOfSamples; i++)
+    {
+        double x = i * step;
+
+        switch(type)
+        {
+            case BOXCAR:
+                profile[i] = (x <= 0.5*width) ? 1.0 : 0.0;
+                break;
+
+            case GAUSSIAN:
+                profile[i] = std::exp(-(x*x) / (2.0*width*width));
+                break;
+
+            case SINC:
+            {
+                double u = M_PI * x / width;
+                profile[i] = (u == 0.0) ? 1.0 : std::sin(u) / u;
+                break;
+            }
+
+            default:
+                profile[i] = 0.0;
+                break;
+        }
+    }
+
+    m_InverseSteps[axis] = 1.0 / step;
+    m_Radii[axis] = radius;
+}
+
+} // namespace btk
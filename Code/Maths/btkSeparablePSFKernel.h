@@ -0,0 +1,149 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_SEPARABLE_PSF_KERNEL_H
+#define BTK_SEPARABLE_PSF_KERNEL_H
+
+// STL includes
+#include "vector"
+#include "cmath"
+
+namespace btk
+{
+
+/**
+ * @brief PSF kernel given by the product of three 1D profiles (one per axis of the kernel frame).
+ *
+ * Each profile is tabulated once on a regular grid of [0, radius] (profiles are even) and evaluated by linear interpolation,
+ * so that evaluating the kernel costs three table lookups instead of an exp or a sinc per sample. The kernel is 0 beyond
+ * the radius of an axis. A kernel is not modified by its evaluation and can be shared between threads.
+ * @author François Rousseau
+ * @ingroup Maths
+ */
+class SeparablePSFKernel
+{
+    public:
+        /** @brief Type of a 1D profile. */
+        enum ProfileType
+        {
+            BOXCAR = 0,  /**< 1 on [-width/2, width/2] */
+            GAUSSIAN,    /**< exp(-x^2 / (2 width^2)), width being the standard deviation */
+            SINC         /**< sin(pi x / width) / (pi x / width) */
+        };
+
+        /** @brief Default number of samples of a tabulated profile. */
+        enum { DEFAULT_NUMBER_OF_SAMPLES = 4096 };
+
+        /**
+         * @brief Constructor (the three profiles are 0 until they are set).
+         */
+        SeparablePSFKernel();
+
+        /**
+         * @brief Tabulate the profile of an axis.
+         * @param axis Axis of the profile (0, 1 or 2).
+         * @param type Type of the profile.
+         * @param width Width of the profile (see ProfileType).
+         * @param radius Radius beyond which the profile is 0.
+         * @param numberOfSamples Number of samples of the table over [0, radius].
+         */
+        void SetProfile(unsigned int axis, ProfileType type, double width, double radius, unsigned int numberOfSamples = DEFAULT_NUMBER_OF_SAMPLES);
+
+        /**
+         * @brief Value of the profile of an axis.
+         * @param axis Axis of the profile.
+         * @param x Coordinate along this axis.
+         * @return Linearly interpolated value of the profile (0 beyond its radius).
+         */
+        inline double EvaluateProfile(unsigned int axis, double x) const
+        {
+            const std::vector< double > &profile = m_Profiles[axis];
+            double t = std::fabs(x) * m_InverseSteps[axis];
+
+            if(profile.size() < 2 || t >= profile.size()-1)
+            {
+                return 0.0;
+            }
+
+            unsigned int i = static_cast< unsigned int >(t);
+            double f = t - i;
+
+            return (1.0-f) * profile[i] + f * profile[i+1];
+        }
+
+        /**
+         * @brief Value of the kernel.
+         * @param x Coordinates of the point in the frame of the kernel.
+         * @return Product of the values of the three profiles.
+         */
+        inline double Evaluate(const double x[3]) const
+        {
+            double value = this->EvaluateProfile(0, x[0]);
+
+            if(value != 0.0)
+            {
+                value *= this->EvaluateProfile(1, x[1]);
+            }
+
+            if(value != 0.0)
+            {
+                value *= this->EvaluateProfile(2, x[2]);
+            }
+
+            return value;
+        }
+
+        /**
+         * @brief Radius of the profile of an axis.
+         */
+        double GetRadius(unsigned int axis) const
+        {
+            return m_Radii[axis];
+        }
+
+    private:
+        /** Samples of the profiles over [0, radius] */
+        std::vector< double > m_Profiles[3];
+
+        /** Inverse of the sampling steps of the profiles */
+        double m_InverseSteps[3];
+
+        /** Radii of the profiles */
+        double m_Radii[3];
+};
+
+} // namespace btk
+
+#endif // BTK_SEPARABLE_PSF_KERNEL_H
@@ -0,0 +1,282 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_SPARSE_MATRIX_H
+#define BTK_SPARSE_MATRIX_H
+
+// VNL includes
+#include "vnl/vnl_vector.h"
+
+// Local includes
+#include "btkMacro.h"
+#include "btkLinearOperator.h"
+
+// STL includes
+#include "vector"
+#include "algorithm"
+#include "utility"
+#include "sstream"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace btk
+{
+
+/**
+ * @brief Sparse matrix stored in compressed sparse row (CSR) format, used for the observation matrix H (y = Hx) of the super-resolution methods.
+ *
+ * The matrix is filled row after row with AddValue (rows in increasing order, columns in any order, duplicated entries being summed),
+ * and then closed with Finalize. The products H*x and H^T*y are multithreaded. H^T*y either uses a transposed copy of the matrix
+ * (compressed sparse column, built at the first call) or per-thread accumulation buffers when the copy would be too large (see SetTransposeCache).
+ * @author François Rousseau
+ * @ingroup Maths
+ */
+template < typename TValue >
+class SparseMatrix : public LinearOperator< TValue >
+{
+    public:
+        typedef SparseMatrix< TValue >  Self;
+        typedef TValue                  ValueType;
+        typedef unsigned int            IndexType;  /**< row and column indices */
+        typedef unsigned long           OffsetType; /**< position in the arrays of non-zero values (may exceed 2^32) */
+        typedef typename LinearOperator< TValue >::VectorType VectorType;
+
+        /**
+         * @brief Constructor (empty matrix).
+         */
+        SparseMatrix();
+
+        /**
+         * @brief Constructor (matrix of size rows x cols without any non-zero value).
+         */
+        SparseMatrix(IndexType rows, IndexType cols);
+
+        /**
+         * @brief Set the size of the matrix. All the values are removed.
+         * @param rows Number of rows
+         * @param cols Number of columns
+         */
+        void SetSize(IndexType rows, IndexType cols);
+
+        /**
+         * @brief Remove all the values and free the memory.
+         */
+        void Clear();
+
+        /**
+         * @brief Add a value to the element (row,col). Rows have to be filled in increasing order.
+         * @param row Row of the element (greater or equal to the row of the previous call)
+         * @param col Column of the element
+         * @param value Value added to the element
+         */
+        void AddValue(IndexType row, IndexType col, ValueType value);
+
+        /**
+         * @brief Close the matrix once filled (the remaining rows are empty). This has to be called before any product.
+         */
+        void Finalize();
+
+        /**
+         * @brief Fill the matrix with row blocks built independently (e.g. one block per thread or per slice) and then finalize it.
+         * The blocks are stacked in the given order, and are emptied as they are copied.
+         * @param blocks Row blocks. Their numbers of rows have to sum up to the number of rows of the matrix, and they have
+         * the same number of columns as the matrix.
+         */
+        void SetRowBlocks(std::vector< Self > & blocks);
+
+        /**
+         * @brief Replace some blocks of consecutive rows (e.g. the rows of the slices whose transform has changed), the other rows being kept.
+         * The matrix is rebuilt in a single pass, and the blocks are emptied as they are copied.
+         * @param firstRows First row of every block in the matrix, in increasing order (the blocks cannot overlap)
+         * @param blocks New rows. They have the same number of columns as the matrix.
+         */
+        void ReplaceRowBlocks(const std::vector< IndexType > & firstRows, std::vector< Self > & blocks);
+
+        /**
+         * @brief Fill the matrix with its CSR arrays (e.g. read from a file) and then finalize it. The arrays are copied and checked.
+         * @param rows Number of rows
+         * @param cols Number of columns
+         * @param rowPointers Positions of the first value of every row (rows+1 elements, the last one being the number of values)
+         * @param columns Column of every value
+         * @param values Values
+         */
+        void SetArrays(IndexType rows, IndexType cols, const OffsetType * rowPointers, const IndexType * columns, const ValueType * values);
+
+        /**
+         * @brief Same as above, with the row pointers stored in a vector (its size has to be rows+1).
+         */
+        void SetArrays(IndexType rows, IndexType cols, const std::vector< OffsetType > & rowPointers, const IndexType * columns, const ValueType * values);
+
+        /**
+         * @brief Same as SetArrays, but the arrays are checked and then swapped with those of the matrix instead of being copied.
+         * On return, the content of the vectors is unspecified.
+         */
+        void SwapArrays(IndexType rows, IndexType cols, std::vector< OffsetType > & rowPointers, std::vector< IndexType > & columns, std::vector< ValueType > & values);
+
+        /**
+         * @brief Divide every row by the sum of its values (rows with a null sum are left unchanged).
+         */
+        void NormalizeRows();
+
+        /**
+         * @brief Remove the rows without any value (e.g. the rows of the LR voxels which do not reach a sub-grid of the HR image).
+         * @param rows Output: index (before removal) of every row kept, in increasing order
+         */
+        void RemoveEmptyRows(std::vector< IndexType > & rows);
+
+        /**
+         * @brief Compute y = H*x (multithreaded over the rows).
+         * @param x Input vector (size: number of columns)
+         * @param y Output vector (resized to the number of rows)
+         */
+        virtual void Multiply(const VectorType & x, VectorType & y) const;
+
+        /**
+         * @brief Compute x = H^T*y (multithreaded).
+         * @param y Input vector (size: number of rows)
+         * @param x Output vector (resized to the number of columns)
+         */
+        virtual void TransposeMultiply(const VectorType & y, VectorType & x) const;
+
+        /**
+         * @brief Compute the squared norm of every column (the diagonal of H^T*H).
+         * @param norms Output vector (resized to the number of columns)
+         * @return true
+         */
+        virtual bool GetColumnSquaredNorms(VectorType & norms) const;
+
+        /**
+         * @brief Transposed copy of the matrix (compressed sparse column), built at the first call even when the transpose cache is disabled.
+         * The values of column c are at positions columnPointers[c] to columnPointers[c+1]-1 of rows and values, in increasing row order.
+         * @param columnPointers Positions of the first value of every column (number of columns + 1 elements)
+         * @param rows Row of every value
+         * @param values Values
+         */
+        void GetTranspose(const OffsetType *& columnPointers, const IndexType *& rows, const ValueType *& values) const;
+
+        /**
+         * @brief Use (or not) a transposed copy of the matrix for TransposeMultiply. The copy doubles the memory used by the matrix,
+         * while the per-thread buffers used otherwise need one vector of size the number of columns per thread.
+         * @param useCache true to use the transposed copy (default)
+         */
+        void SetTransposeCache(bool useCache);
+
+        /**
+         * @brief Sum of the values of a row.
+         */
+        double GetRowSum(IndexType row) const;
+
+        /**
+         * @brief Value of the element (row,col) (0 if the element is not stored).
+         */
+        ValueType GetValue(IndexType row, IndexType col) const;
+
+        /** @brief Number of rows. */
+        virtual IndexType GetNumberOfRows() const { return m_NumberOfRows; }
+
+        /** @brief Number of columns. */
+        virtual IndexType GetNumberOfColumns() const { return m_NumberOfColumns; }
+
+        /** @brief Number of stored (non-zero) values. */
+        OffsetType GetNumberOfNonZeros() const { return m_Values.size(); }
+
+        /** @brief Position of the first value of a row in the arrays of values and columns. */
+        OffsetType GetRowBegin(IndexType row) const { return m_RowPointers[row]; }
+
+        /** @brief Position after the last value of a row in the arrays of values and columns. */
+        OffsetType GetRowEnd(IndexType row) const { return m_RowPointers[row+1]; }
+
+        /** @brief Column indices of the stored values. */
+        const IndexType * GetColumns() const { return m_Columns.empty() ? NULL : &m_Columns[0]; }
+
+        /** @brief Stored values. */
+        const ValueType * GetValues() const { return m_Values.empty() ? NULL : &m_Values[0]; }
+
+        /** @brief Stored values (the structure of the matrix cannot be modified). */
+        ValueType * GetValues() { InvalidateTranspose(); return m_Values.empty() ? NULL : &m_Values[0]; }
+
+        /** @brief Return true once Finalize has been called. */
+        bool IsFinalized() const { return m_IsFinalized; }
+
+    protected:
+
+        /**
+         * @brief Sort the values of the current row by column and sum the duplicated entries.
+         */
+        void CloseCurrentRow();
+
+        /**
+         * @brief Check CSR arrays given to SetArrays or SwapArrays (an exception is thrown if they are not valid).
+         */
+        static void CheckArrays(IndexType rows, IndexType cols, const OffsetType * rowPointers, const IndexType * columns);
+
+        /**
+         * @brief Build the transposed copy used by TransposeMultiply.
+         */
+        void ComputeTranspose() const;
+
+        /**
+         * @brief Remove the transposed copy (the values have been modified).
+         */
+        void InvalidateTranspose();
+
+    private:
+
+        IndexType                   m_NumberOfRows;
+        IndexType                   m_NumberOfColumns;
+
+        std::vector< OffsetType >   m_RowPointers;  /**< m_RowPointers[r] .. m_RowPointers[r+1] : values of row r */
+        std::vector< IndexType >    m_Columns;      /**< column of every stored value */
+        std::vector< ValueType >    m_Values;       /**< stored values */
+
+        IndexType                   m_CurrentRow;   /**< row being filled by AddValue */
+        bool                        m_IsFinalized;
+
+        bool                                m_UseTransposeCache;
+        mutable bool                        m_IsTransposeComputed;
+        mutable std::vector< OffsetType >   m_ColumnPointers;   /**< transposed copy (CSC): m_ColumnPointers[c] .. m_ColumnPointers[c+1] : values of column c */
+        mutable std::vector< IndexType >    m_TransposedRows;   /**< row of every value of the transposed copy */
+        mutable std::vector< ValueType >    m_TransposedValues; /**< values of the transposed copy */
+};
+
+} // namespace btk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "btkSparseMatrix.txx"
+#endif
+
+#endif // BTK_SPARSE_MATRIX_H
@@ -0,0 +1,745 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_SPARSE_MATRIX_TXX
+#define BTK_SPARSE_MATRIX_TXX
+
+#include "btkSparseMatrix.h"
+
+namespace btk
+{
+
+template < typename TValue >
+SparseMatrix< TValue >::SparseMatrix() : m_UseTransposeCache(true)
+{
+    this->SetSize(0,0);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+SparseMatrix< TValue >::SparseMatrix(IndexType rows, IndexType cols) : m_UseTransposeCache(true)
+{
+    this->SetSize(rows,cols);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::SetSize(IndexType rows, IndexType cols)
+{
+    this->Clear();
+
+    m_NumberOfRows    = rows;
+    m_NumberOfColumns = cols;
+
+    m_RowPointers.assign(rows+1, 0);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::Clear()
+{
+    m_NumberOfRows    = 0;
+    m_NumberOfColumns = 0;
+    m_CurrentRow      = 0;
+    m_IsFinalized     = false;
+
+    // swap with empty vectors to really free the memory
+    std::vector< OffsetType >().swap(m_RowPointers);
+    std::vector< IndexType >().swap(m_Columns);
+    std::vector< ValueType >().swap(m_Values);
+    m_RowPointers.assign(1, 0);
+
+    this->InvalidateTranspose();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::AddValue(IndexType row, IndexType col, ValueType value)
+{
+    if(m_IsFinalized || row < m_CurrentRow || row >= m_NumberOfRows || col >= m_NumberOfColumns)
+    {
+        std::stringstream message;
+        message << "SparseMatrix: invalid element (" << row << "," << col << ") (rows have to be filled in increasing order before Finalize).";
+        btkException(message.str());
+    }
+
+    if(row != m_CurrentRow)
+    {
+        this->CloseCurrentRow();
+
+        // the rows between the current one and the new one are empty
+        for(IndexType r = m_CurrentRow+1; r <= row; r++)
+        {
+            m_RowPointers[r] = m_Values.size();
+        }
+        m_CurrentRow = row;
+    }
+
+    m_Columns.push_back(col);
+    m_Values.push_back(value);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::CloseCurrentRow()
+{
+    OffsetType begin = m_RowPointers[m_CurrentRow];
+    OffsetType end   = m_Values.size();
+
+    if(end - begin < 2)
+    {
+        return;
+    }
+
+    // a row only has a few tens of values: sort them by column and sum the duplicated entries
+    std::vector< std::pair< IndexType, ValueType > > entries(end - begin);
+    for(OffsetType k = begin; k < end; k++)
+    {
+        entries[k-begin] = std::make_pair(m_Columns[k], m_Values[k]);
+    }
+    std::sort(entries.begin(), entries.end());
+
+    OffsetType position = begin;
+    m_Columns[position] = entries[0].first;
+    m_Values[position]  = entries[0].second;
+    for(unsigned int k = 1; k < entries.size(); k++)
+    {
+        if(entries[k].first == m_Columns[position])
+        {
+            m_Values[position] += entries[k].second;
+        }
+        else
+        {
+            position++;
+            m_Columns[position] = entries[k].first;
+            m_Values[position]  = entries[k].second;
+        }
+    }
+
+    m_Columns.resize(position+1);
+    m_Values.resize(position+1);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::Finalize()
+{
+    if(m_IsFinalized)
+    {
+        return;
+    }
+
+    if(m_NumberOfRows > 0)
+    {
+        this->CloseCurrentRow();
+    }
+
+    for(IndexType r = m_CurrentRow+1; r <= m_NumberOfRows; r++)
+    {
+        m_RowPointers[r] = m_Values.size();
+    }
+
+    // release the memory reserved by the successive push_back
+    std::vector< IndexType >(m_Columns).swap(m_Columns);
+    std::vector< ValueType >(m_Values).swap(m_Values);
+
+    m_IsFinalized = true;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::SetRowBlocks(std::vector< Self > & blocks)
+{
+    IndexType  numberOfRows     = 0;
+    OffsetType numberOfNonZeros = 0;
+
+    std::vector< IndexType >  firstRows(blocks.size());
+    std::vector< OffsetType > firstValues(blocks.size());
+
+    for(unsigned int b = 0; b < blocks.size(); b++)
+    {
+        if(blocks[b].GetNumberOfColumns() != m_NumberOfColumns)
+        {
+            btkException("SparseMatrix::SetRowBlocks: the number of columns of a block does not match the number of columns of the matrix.");
+        }
+        blocks[b].Finalize();
+
+        firstRows[b]   = numberOfRows;
+        firstValues[b] = numberOfNonZeros;
+        numberOfRows     += blocks[b].GetNumberOfRows();
+        numberOfNonZeros += blocks[b].GetNumberOfNonZeros();
+    }
+
+    if(numberOfRows != m_NumberOfRows)
+    {
+        btkException("SparseMatrix::SetRowBlocks: the numbers of rows of the blocks do not sum up to the number of rows of the matrix.");
+    }
+
+    this->SetSize(m_NumberOfRows, m_NumberOfColumns);
+    m_Columns.resize(numberOfNonZeros);
+    m_Values.resize(numberOfNonZeros);
+
+    // every block is copied at its own place: no synchronization is needed
+    long b;
+    #pragma omp parallel for private(b) schedule(dynamic)
+    for(b = 0; b < (long)blocks.size(); b++)
+    {
+        Self & block = blocks[b];
+
+        for(IndexType r = 0; r < block.GetNumberOfRows(); r++)
+        {
+            m_RowPointers[firstRows[b] + r] = firstValues[b] + block.m_RowPointers[r];
+        }
+        std::copy(block.m_Columns.begin(), block.m_Columns.end(), m_Columns.begin() + firstValues[b]);
+        std::copy(block.m_Values.begin(), block.m_Values.end(), m_Values.begin() + firstValues[b]);
+
+        block.Clear();
+    }
+
+    m_RowPointers[m_NumberOfRows] = numberOfNonZeros;
+    m_CurrentRow  = (m_NumberOfRows > 0) ? m_NumberOfRows-1 : 0;
+    m_IsFinalized = true;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::ReplaceRowBlocks(const std::vector< IndexType > & firstRows, std::vector< Self > & blocks)
+{
+    if(!m_IsFinalized)
+    {
+        btkException("SparseMatrix::ReplaceRowBlocks: the matrix has to be finalized.");
+    }
+    if(firstRows.size() != blocks.size())
+    {
+        btkException("SparseMatrix::ReplaceRowBlocks: one first row is needed per block.");
+    }
+
+    // The matrix is split into segments of consecutive rows, either kept (block -1) or replaced by a block
+    std::vector< IndexType > segmentFirstRows;
+    std::vector< IndexType > segmentSizes;
+    std::vector< long >      segmentBlocks;
+
+    IndexType row = 0;
+    for(unsigned int b = 0; b < blocks.size(); b++)
+    {
+        if(blocks[b].GetNumberOfColumns() != m_NumberOfColumns)
+        {
+            btkException("SparseMatrix::ReplaceRowBlocks: the number of columns of a block does not match the number of columns of the matrix.");
+        }
+        if(firstRows[b] < row || (OffsetType)firstRows[b] + blocks[b].GetNumberOfRows() > m_NumberOfRows)
+        {
+            btkException("SparseMatrix::ReplaceRowBlocks: the blocks are not sorted, overlap or exceed the matrix.");
+        }
+        blocks[b].Finalize();
+
+        segmentFirstRows.push_back(row);
+        segmentSizes.push_back(firstRows[b] - row);
+        segmentBlocks.push_back(-1);
+
+        segmentFirstRows.push_back(firstRows[b]);
+        segmentSizes.push_back(blocks[b].GetNumberOfRows());
+        segmentBlocks.push_back(b);
+
+        row = firstRows[b] + blocks[b].GetNumberOfRows();
+    }
+    segmentFirstRows.push_back(row);
+    segmentSizes.push_back(m_NumberOfRows - row);
+    segmentBlocks.push_back(-1);
+
+    // new row pointers
+    std::vector< OffsetType > rowPointers(m_NumberOfRows+1);
+    rowPointers[0] = 0;
+    for(unsigned int s = 0; s < segmentBlocks.size(); s++)
+    {
+        for(IndexType r = 0; r < segmentSizes[s]; r++)
+        {
+            IndexType  matrixRow = segmentFirstRows[s] + r;
+            OffsetType length    = (segmentBlocks[s] < 0) ? m_RowPointers[matrixRow+1] - m_RowPointers[matrixRow] :
+                                   blocks[segmentBlocks[s]].m_RowPointers[r+1] - blocks[segmentBlocks[s]].m_RowPointers[r];
+            rowPointers[matrixRow+1] = rowPointers[matrixRow] + length;
+        }
+    }
+
+    std::vector< IndexType > columns(rowPointers[m_NumberOfRows]);
+    std::vector< ValueType > values(rowPointers[m_NumberOfRows]);
+
+    // every segment is copied at its own place: no synchronization is needed
+    long s;
+    #pragma omp parallel for private(s) schedule(dynamic)
+    for(s = 0; s < (long)segmentBlocks.size(); s++)
+    {
+        OffsetType destination = rowPointers[segmentFirstRows[s]];
+
+        if(segmentBlocks[s] < 0)
+        {
+            OffsetType begin = m_RowPointers[segmentFirstRows[s]];
+            OffsetType end   = m_RowPointers[segmentFirstRows[s] + segmentSizes[s]];
+            std::copy(m_Columns.begin() + begin, m_Columns.begin() + end, columns.begin() + destination);
+            std::copy(m_Values.begin() + begin, m_Values.begin() + end, values.begin() + destination);
+        }
+        else
+        {
+            Self & block = blocks[segmentBlocks[s]];
+            std::copy(block.m_Columns.begin(), block.m_Columns.end(), columns.begin() + destination);
+            std::copy(block.m_Values.begin(), block.m_Values.end(), values.begin() + destination);
+            block.Clear();
+        }
+    }
+
+    m_RowPointers.swap(rowPointers);
+    m_Columns.swap(columns);
+    m_Values.swap(values);
+
+    this->InvalidateTranspose();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::SetArrays(IndexType rows, IndexType cols, const std::vector< OffsetType > & rowPointers, const IndexType * columns, const ValueType * values)
+{
+    if(rowPointers.size() != (OffsetType)rows+1)
+    {
+        btkException("SparseMatrix::SetArrays: the row pointers do not match the number of rows.");
+    }
+
+    this->SetArrays(rows, cols, &rowPointers[0], columns, values);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::CheckArrays(IndexType rows, IndexType cols, const OffsetType * rowPointers, const IndexType * columns)
+{
+    if(rowPointers[0] != 0)
+    {
+        btkException("SparseMatrix::SetArrays: the row pointers do not match the number of rows.");
+    }
+    for(IndexType r = 0; r < rows; r++)
+    {
+        if(rowPointers[r+1] < rowPointers[r])
+        {
+            btkException("SparseMatrix::SetArrays: the row pointers are not sorted.");
+        }
+    }
+
+    OffsetType numberOfNonZeros = rowPointers[rows];
+    for(OffsetType k = 0; k < numberOfNonZeros; k++)
+    {
+        if(columns[k] >= cols)
+        {
+            btkException("SparseMatrix::SetArrays: invalid column index.");
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::SetArrays(IndexType rows, IndexType cols, const OffsetType * rowPointers, const IndexType * columns, const ValueType * values)
+{
+    CheckArrays(rows, cols, rowPointers, columns);
+
+    OffsetType numberOfNonZeros = rowPointers[rows];
+    this->SetSize(rows, cols);
+    m_RowPointers.assign(rowPointers, rowPointers + rows + 1);
+    m_Columns.assign(columns, columns + numberOfNonZeros);
+    m_Values.assign(values, values + numberOfNonZeros);
+
+    m_CurrentRow  = (m_NumberOfRows > 0) ? m_NumberOfRows-1 : 0;
+    m_IsFinalized = true;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::SwapArrays(IndexType rows, IndexType cols, std::vector< OffsetType > & rowPointers, std::vector< IndexType > & columns, std::vector< ValueType > & values)
+{
+    if(rowPointers.size() != (OffsetType)rows+1 || columns.size() != rowPointers[rows] || values.size() != rowPointers[rows])
+    {
+        btkException("SparseMatrix::SwapArrays: the sizes of the arrays do not match.");
+    }
+    CheckArrays(rows, cols, &rowPointers[0], columns.empty() ? NULL : &columns[0]);
+
+    this->SetSize(rows, cols);
+    m_RowPointers.swap(rowPointers);
+    m_Columns.swap(columns);
+    m_Values.swap(values);
+
+    m_CurrentRow  = (m_NumberOfRows > 0) ? m_NumberOfRows-1 : 0;
+    m_IsFinalized = true;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::NormalizeRows()
+{
+    this->Finalize();
+    this->InvalidateTranspose();
+
+    long r;
+    #pragma omp parallel for private(r) schedule(static)
+    for(r = 0; r < (long)m_NumberOfRows; r++)
+    {
+        double sum = this->GetRowSum(r);
+
+        if(sum != 0)
+        {
+            for(OffsetType k = m_RowPointers[r]; k < m_RowPointers[r+1]; k++)
+            {
+                m_Values[k] = m_Values[k] / sum;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::RemoveEmptyRows(std::vector< IndexType > & rows)
+{
+    this->Finalize();
+    this->InvalidateTranspose();
+
+    rows.clear();
+
+    // the values are not moved (empty rows have no value): the row pointers are compacted in place
+    IndexType  numberOfRows = 0;
+    OffsetType begin = 0;
+    for(IndexType r = 0; r < m_NumberOfRows; r++)
+    {
+        OffsetType end = m_RowPointers[r+1];
+
+        if(end > begin)
+        {
+            rows.push_back(r);
+            m_RowPointers[++numberOfRows] = end;
+        }
+
+        begin = end;
+    }
+
+    m_RowPointers.resize(numberOfRows+1);
+    m_NumberOfRows = numberOfRows;
+    m_CurrentRow   = (m_NumberOfRows > 0) ? m_NumberOfRows-1 : 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+double SparseMatrix< TValue >::GetRowSum(IndexType row) const
+{
+    double sum = 0.0;
+
+    for(OffsetType k = m_RowPointers[row]; k < m_RowPointers[row+1]; k++)
+    {
+        sum += m_Values[k];
+    }
+
+    return sum;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+typename SparseMatrix< TValue >::ValueType SparseMatrix< TValue >::GetValue(IndexType row, IndexType col) const
+{
+    typename std::vector< IndexType >::const_iterator begin = m_Columns.begin() + m_RowPointers[row];
+    typename std::vector< IndexType >::const_iterator end   = m_Columns.begin() + m_RowPointers[row+1];
+    typename std::vector< IndexType >::const_iterator it    = std::lower_bound(begin, end, col);
+
+    if(it != end && *it == col)
+    {
+        return m_Values[it - m_Columns.begin()];
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::Multiply(const VectorType & x, VectorType & y) const
+{
+    if(!m_IsFinalized || x.size() != m_NumberOfColumns)
+    {
+        btkException("SparseMatrix::Multiply: the matrix is not finalized or the size of x does not match the number of columns.");
+    }
+
+    y.set_size(m_NumberOfRows);
+
+    const OffsetType * rowPointers = &m_RowPointers[0];
+    const IndexType  * columns     = this->GetColumns();
+    const ValueType  * values      = this->GetValues();
+    const ValueType  * xData       = x.data_block();
+    ValueType        * yData       = y.data_block();
+
+    long r;
+    #pragma omp parallel for private(r) schedule(static)
+    for(r = 0; r < (long)m_NumberOfRows; r++)
+    {
+        double sum = 0.0;
+        for(OffsetType k = rowPointers[r]; k < rowPointers[r+1]; k++)
+        {
+            sum += values[k] * xData[columns[k]];
+        }
+        yData[r] = sum;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::TransposeMultiply(const VectorType & y, VectorType & x) const
+{
+    if(!m_IsFinalized || y.size() != m_NumberOfRows)
+    {
+        btkException("SparseMatrix::TransposeMultiply: the matrix is not finalized or the size of y does not match the number of rows.");
+    }
+
+    x.set_size(m_NumberOfColumns);
+
+    const ValueType * yData = y.data_block();
+    ValueType       * xData = x.data_block();
+
+    if(m_UseTransposeCache)
+    {
+        // gather: every column of H is a row of the transposed copy
+        this->ComputeTranspose();
+
+        const OffsetType * columnPointers = &m_ColumnPointers[0];
+        const IndexType  * rows           = m_TransposedRows.empty() ? NULL : &m_TransposedRows[0];
+        const ValueType  * values         = m_TransposedValues.empty() ? NULL : &m_TransposedValues[0];
+
+        long c;
+        #pragma omp parallel for private(c) schedule(static)
+        for(c = 0; c < (long)m_NumberOfColumns; c++)
+        {
+            double sum = 0.0;
+            for(OffsetType k = columnPointers[c]; k < columnPointers[c+1]; k++)
+            {
+                sum += values[k] * yData[rows[k]];
+            }
+            xData[c] = sum;
+        }
+    }
+    else
+    {
+        // scatter: every thread accumulates the contribution of its rows in its own buffer, the buffers are then summed
+        const OffsetType * rowPointers = &m_RowPointers[0];
+        const IndexType  * columns     = this->GetColumns();
+        const ValueType  * values      = this->GetValues();
+
+        int numberOfThreads = 1;
+#ifdef _OPENMP
+        numberOfThreads = omp_get_max_threads();
+#endif
+        std::vector< std::vector< double > > buffers(numberOfThreads);
+
+        #pragma omp parallel num_threads(numberOfThreads)
+        {
+            int thread = 0;
+#ifdef _OPENMP
+            thread = omp_get_thread_num();
+#endif
+            std::vector< double > & buffer = buffers[thread];
+            buffer.assign(m_NumberOfColumns, 0.0);
+
+            long r;
+            #pragma omp for schedule(static)
+            for(r = 0; r < (long)m_NumberOfRows; r++)
+            {
+                double value = yData[r];
+                if(value != 0)
+                {
+                    for(OffsetType k = rowPointers[r]; k < rowPointers[r+1]; k++)
+                    {
+                        buffer[columns[k]] += values[k] * value;
+                    }
+                }
+            }
+
+            long c;
+            #pragma omp for schedule(static)
+            for(c = 0; c < (long)m_NumberOfColumns; c++)
+            {
+                double sum = 0.0;
+                for(int t = 0; t < (int)buffers.size(); t++)
+                {
+                    if(!buffers[t].empty())
+                    {
+                        sum += buffers[t][c];
+                    }
+                }
+                xData[c] = sum;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+bool SparseMatrix< TValue >::GetColumnSquaredNorms(VectorType & norms) const
+{
+    if(!m_IsFinalized)
+    {
+        btkException("SparseMatrix::GetColumnSquaredNorms: the matrix is not finalized.");
+    }
+
+    norms.set_size(m_NumberOfColumns);
+    norms.fill(0);
+
+    if(m_UseTransposeCache)
+    {
+        // gather over the columns of the transposed copy
+        this->ComputeTranspose();
+
+        long c;
+        #pragma omp parallel for private(c) schedule(static)
+        for(c = 0; c < (long)m_NumberOfColumns; c++)
+        {
+            double sum = 0.0;
+            for(OffsetType k = m_ColumnPointers[c]; k < m_ColumnPointers[c+1]; k++)
+            {
+                sum += m_TransposedValues[k] * m_TransposedValues[k];
+            }
+            norms[c] = sum;
+        }
+    }
+    else
+    {
+        for(OffsetType k = 0; k < m_Values.size(); k++)
+        {
+            norms[m_Columns[k]] += m_Values[k] * m_Values[k];
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::GetTranspose(const OffsetType *& columnPointers, const IndexType *& rows, const ValueType *& values) const
+{
+    if(!m_IsFinalized)
+    {
+        btkException("SparseMatrix::GetTranspose: the matrix is not finalized.");
+    }
+
+    this->ComputeTranspose();
+
+    columnPointers = &m_ColumnPointers[0];
+    rows           = m_TransposedRows.empty() ? NULL : &m_TransposedRows[0];
+    values         = m_TransposedValues.empty() ? NULL : &m_TransposedValues[0];
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::SetTransposeCache(bool useCache)
+{
+    m_UseTransposeCache = useCache;
+
+    if(!useCache)
+    {
+        this->InvalidateTranspose();
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::ComputeTranspose() const
+{
+    #pragma omp critical(btkSparseMatrixTranspose)
+    {
+        if(!m_IsTransposeComputed)
+        {
+            // counting sort of the values by column, rows being visited in increasing order
+            m_ColumnPointers.assign(m_NumberOfColumns+1, 0);
+            for(OffsetType k = 0; k < m_Columns.size(); k++)
+            {
+                m_ColumnPointers[m_Columns[k]+1]++;
+            }
+            for(IndexType c = 0; c < m_NumberOfColumns; c++)
+            {
+                m_ColumnPointers[c+1] += m_ColumnPointers[c];
+            }
+
+            m_TransposedRows.resize(m_Values.size());
+            m_TransposedValues.resize(m_Values.size());
+
+            std::vector< OffsetType > position(m_ColumnPointers.begin(), m_ColumnPointers.end()-1);
+            for(IndexType r = 0; r < m_NumberOfRows; r++)
+            {
+                for(OffsetType k = m_RowPointers[r]; k < m_RowPointers[r+1]; k++)
+                {
+                    OffsetType p = position[m_Columns[k]]++;
+                    m_TransposedRows[p]   = r;
+                    m_TransposedValues[p] = m_Values[k];
+                }
+            }
+
+            m_IsTransposeComputed = true;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void SparseMatrix< TValue >::InvalidateTranspose()
+{
+    m_IsTransposeComputed = false;
+
+    std::vector< OffsetType >().swap(m_ColumnPointers);
+    std::vector< IndexType >().swap(m_TransposedRows);
+    std::vector< ValueType >().swap(m_TransposedValues);
+}
+
+} // namespace btk
+
+#endif // BTK_SPARSE_MATRIX_TXX
@@ -3,6 +3,7 @@
 #include "itkBSplineInterpolationWeightFunction.h"
 #include "itkBSplineInterpolateImageFunction.h"
 #include "itkImageRegionIteratorWithIndex.h"
+#include "itkImageRegionConstIterator.h"
 
 #include "itkSubtractImageFilter.h"
 #include "itkResampleImageFilter.h"
@@ -13,6 +14,9 @@
 
 #include "btkNLMTool.h"
 
+#include "sstream"
+#include "cmath"
+
 
 namespace btk
 {
@@ -28,6 +32,8 @@ HighResolutionIBPFilter::HighResolutionIBPFilter()
     m_HRMaskFilter = new btk::CreateHRMaskFilter();
     m_SimuLRImagesFilter = new btk::SimulateLRImageFilter();
     SuperClass::m_InterpolationOrderPSF = 1;
+    m_UseMatrixFree = false;
+    m_Iteration = 0;
 
 
 }
@@ -76,7 +82,30 @@ void HighResolutionIBPFilter::Update()
 
 
 
-    this->HComputation();
+    double time = btk::Telemetry::GetTime();
+
+    if(m_UseMatrixFree)
+    {
+        this->InitializeMatrixFreeOperator();
+    }
+    else
+    {
+        this->HComputation();
+    }
+
+    if(btk::Telemetry::GetInstance().IsEnabled())
+    {
+        btk::Telemetry::Record record("h_build");
+        record.SetValue("matrix_free", m_UseMatrixFree);
+        record.SetValue("rows", SuperClass::m_Y.size());
+        record.SetValue("columns", SuperClass::m_X.size());
+        if(!m_UseMatrixFree)
+        {
+            record.SetValue("non_zeros", SuperClass::m_H.GetNumberOfNonZeros());
+        }
+        record.AddPhaseTime("h_build", btk::Telemetry::GetTime() - time);
+        btk::Telemetry::GetInstance().Write(record);
+    }
 
 
 
@@ -85,9 +114,11 @@ void HighResolutionIBPFilter::Update()
 
     double e = 0.1; //current change between two consecutive estimate.
     int i = 0;
+    m_Iteration = 0;
 
     while( (e>0) && (i<SuperClass::m_Nloops) )
     {
+      m_Iteration = i+1;
       e = ComputeIterativeBackProjection(m_Nlm,m_Beta,m_MedianIBP);
       i++;
       std::cout<<"Loop "<<i+1<<", current e: "<<e<<std::endl;
@@ -124,7 +155,7 @@ void HighResolutionIBPFilter::HComputation()
         nrows += SuperClass::m_ImagesLR[im]->GetLargestPossibleRegion().GetNumberOfPixels();
       }
 
-      SuperClass::m_H.set_size(nrows, ncols);
+      SuperClass::m_H.SetSize(nrows, ncols);
       SuperClass::m_Y.set_size(nrows);
       SuperClass::m_Y.fill(0.0);
       SuperClass::m_X.set_size(ncols);
@@ -287,9 +318,8 @@ void HighResolutionIBPFilter::HComputation()
                       hrLinearIndex = hrIndex[0] + hrIndex[1]*hrSize[0] + hrIndex[2]*hrSize[0]*hrSize[1];
 
                       //Add weight*PSFValue to the corresponding element in H
-                      SuperClass::m_H(lrLinearIndex,hrLinearIndex) += itPSF.Get() * bsplineWeights[weightLinearIndex];
+                      SuperClass::m_H.AddValue(lrLinearIndex, hrLinearIndex, itPSF.Get() * bsplineWeights[weightLinearIndex]);
                       weightLinearIndex += 1;
-                      //std::cout<<"HR point:"<<hrIndex[0]<<" "<<hrIndex[1]<<" "<<hrIndex[2]<<", weight:"<<m_H(lrLinearIndex,hrLinearIndex)<<"\n";
 
                     } //end of loop over the support region
 
@@ -308,17 +338,8 @@ void HighResolutionIBPFilter::HComputation()
       } //end of loop over the set of LR images
 
       // Normalize m_H
-      for(unsigned int i = 0; i < SuperClass::m_H.rows(); i++)
-      {
-
-        double sum = SuperClass::m_H.sum_row(i);
-
-        vnl_sparse_matrix<float>::row & r = SuperClass::m_H.get_row(i);
-        vnl_sparse_matrix<float>::row::iterator col_iter;
-
-        for (col_iter = r.begin(); col_iter != r.end(); ++col_iter)
-          (*col_iter).second = (*col_iter).second / sum;
-      }
+      SuperClass::m_H.Finalize();
+      SuperClass::m_H.NormalizeRows();
 
       //Fill m_X
       //Instantiate an iterator on HR image
@@ -330,6 +351,56 @@ void HighResolutionIBPFilter::HComputation()
       }
 }
 //-----------------------------------------------------------------------------------------------------------
+void HighResolutionIBPFilter::InitializeMatrixFreeOperator()
+{
+    std::cout<<"Matrix-free mode: H is not stored, Hx is computed on the fly. Fill y and x. \n";
+
+    //Same PSF sampling and transforms as in HComputation
+    std::vector< itkTransformBase::Pointer > inverseTransforms(SuperClass::m_ImagesLR.size());
+    for(unsigned int i=0; i<SuperClass::m_ImagesLR.size(); i++)
+    {
+        if(SuperClass::m_TransformType == SLICE_BY_SLICE)
+        {
+            inverseTransforms[i] = SuperClass::m_InverseTransformsLRSbS[i].GetPointer();
+        }
+        else
+        {
+            inverseTransforms[i] = SuperClass::m_InverseTransformsLR[i];
+        }
+    }
+
+    m_MatrixFreeOperator.SetImagesLR(SuperClass::m_ImagesLR);
+    m_MatrixFreeOperator.SetImageHR(SuperClass::m_ImageHR);
+    m_MatrixFreeOperator.SetPSF(SuperClass::m_PSF);
+    m_MatrixFreeOperator.SetInverseTransforms(inverseTransforms);
+    m_MatrixFreeOperator.SetPaddingValue(SuperClass::m_PaddingValue);
+    m_MatrixFreeOperator.Initialize();
+
+    SuperClass::m_Offset = m_MatrixFreeOperator.GetOffset();
+
+    //Fill m_Y (only the LR voxels above the padding value, as in HComputation)
+    SuperClass::m_Y.set_size(m_MatrixFreeOperator.GetNumberOfRows());
+    SuperClass::m_Y.fill(0.0);
+    for(unsigned int i=0; i<SuperClass::m_ImagesLR.size(); i++)
+    {
+        itkImage::SizeType lrSize = SuperClass::m_ImagesLR[i]->GetLargestPossibleRegion().GetSize();
+        itkIteratorWithIndex itLRImage(SuperClass::m_ImagesLR[i],SuperClass::m_ImagesLR[i]->GetLargestPossibleRegion());
+        for(itLRImage.GoToBegin(); !itLRImage.IsAtEnd(); ++itLRImage)
+        {
+            if(itLRImage.Get() > SuperClass::m_PaddingValue)
+            {
+                itkImage::IndexType lrIndex = itLRImage.GetIndex();
+                unsigned int lrLinearIndex = SuperClass::m_Offset[i] + lrIndex[0] + lrIndex[1]*lrSize[0] + lrIndex[2]*lrSize[0]*lrSize[1];
+                SuperClass::m_Y[lrLinearIndex] = itLRImage.Get();
+            }
+        }
+    }
+
+    //m_X is filled from the current HR image before each simulation (see UpdateX)
+    SuperClass::m_X.set_size(m_MatrixFreeOperator.GetNumberOfColumns());
+    SuperClass::m_X.fill(0.0);
+}
+//-----------------------------------------------------------------------------------------------------------
 void HighResolutionIBPFilter::Initialize()
 {
     SuperClass::m_SimulatedImagesLR.resize(SuperClass::m_ImagesLR.size());
@@ -452,6 +523,15 @@ void HighResolutionIBPFilter::InitializePSF()
       std::cout<<"HR PSF spacing : "<<SuperClass::m_ImageHR->GetSpacing()[0]<<" "<<SuperClass::m_ImageHR->GetSpacing()[1]<<" "<<SuperClass::m_ImageHR->GetSpacing()[2]<<"\n";
       std::cout<<"HR PSF size : "<<hrSize[0]<<" "<<hrSize[1]<<" "<<hrSize[2]<<"\n";
 
+      //The HR PSF only depends on the LR and HR spacings: it is built once per geometry
+      std::ostringstream psfName;
+      psfName<<"IBP"<<SuperClass::m_PsfType<<"-"<<SuperClass::m_InterpolationOrderPSF;
+      SuperClass::m_PSF[i] = m_PSFKernels.GetImage(psfName.str(), lrSpacing, SuperClass::m_ImageHR->GetSpacing(), hrSize);
+      if(SuperClass::m_PSF[i].IsNotNull()){
+        std::cout<<"HR PSF shared with a previous LR image of same spacing\n\n";
+        continue;
+      }
+
       itkImage::RegionType hrRegion;
       hrRegion.SetSize(hrSize);
       hrRegion.SetIndex(hrIndex);
@@ -511,41 +591,44 @@ void HighResolutionIBPFilter::InitializePSF()
           //set nearest neighbour interpolation mode
           bsInterpolator->SetSplineOrder(0);
 
-          //Loop over voxels of HR PSF
-          for(itPSF.GoToBegin(); !itPSF.IsAtEnd(); ++itPSF){
+          {
+            //The LR boxcar and the HR PSF are not rotated, so that the boxcar is the product of three 1D boxcars:
+            //the oversampled value of a HR voxel is the product of the number of samples falling into the boxcar
+            //along each axis. The samples are thus counted once per axis (nbSamples evaluations per HR index of
+            //each axis) instead of nbSamples^3 evaluations per HR voxel.
+            std::vector< double > counts[3];
 
-            double sum = 0;
-            int x,y,z;
-            //Coordinate in HR image
-            hrIndex = itPSF.GetIndex();
-            itkContinuousIndex hrContIndex;
-            itkImage::PointType hrPoint;
-            itkContinuousIndex lrContIndex;
+            for(unsigned int axis=0; axis<3; axis++){
+              counts[axis].assign(hrSize[axis],0.0);
 
-            //Coordinate in physical space
-            SuperClass::m_PSF[i]->TransformIndexToPhysicalPoint(hrIndex,hrPoint);
-            //Continuous coordinate in LR image
-            LRPSF->TransformPhysicalPointToContinuousIndex(hrPoint,lrContIndex);
-
-            for(z=0; z<nbSamples; z++)
-              for(y=0; y<nbSamples; y++)
-                for(x=0; x<nbSamples; x++){
+              for(unsigned int h=0; h<hrSize[axis]; h++)
+                for(int s=0; s<nbSamples; s++){
 
-                  hrContIndex[0] = hrIndex[0] - 0.5 + 1.0*x/nbSamples;
-                  hrContIndex[1] = hrIndex[1] - 0.5 + 1.0*y/nbSamples;
-                  hrContIndex[2] = hrIndex[2] - 0.5 + 1.0*z/nbSamples;
+                  itkContinuousIndex hrContIndex = hrIndexCenter;
+                  hrContIndex[axis] = h - 0.5 + 1.0*s/nbSamples;
 
                   //Coordinate in physical space
+                  itkImage::PointType hrPoint;
                   SuperClass::m_PSF[i]->TransformContinuousIndexToPhysicalPoint(hrContIndex,hrPoint);
 
-                  //Continuous coordinate in LR image
+                  //Continuous coordinate in LR image (at the center of the LR voxel along the other axes)
+                  itkContinuousIndex lrContIndex;
                   LRPSF->TransformPhysicalPointToContinuousIndex(hrPoint,lrContIndex);
+                  for(unsigned int other=0; other<3; other++)
+                    if(other != axis)
+                      lrContIndex[other] = lrIndexCenter[other];
 
-                  sum += bsInterpolator->EvaluateAtContinuousIndex(lrContIndex);
+                  counts[axis][h] += bsInterpolator->EvaluateAtContinuousIndex(lrContIndex);
                 }
+            }
+
+            //Loop over voxels of HR PSF
+            for(itPSF.GoToBegin(); !itPSF.IsAtEnd(); ++itPSF){
+              hrIndex = itPSF.GetIndex();
 
-            //Set oversampled value to m_PSF
-            itPSF.Set(sum);
+              //Set oversampled value to m_PSF
+              itPSF.Set(counts[0][hrIndex[0]] * counts[1][hrIndex[1]] * counts[2][hrIndex[2]]);
+            }
           }
           break;
           case 2:
@@ -597,6 +680,8 @@ void HighResolutionIBPFilter::InitializePSF()
       hrOrigin[1] = 0;
       hrOrigin[2] = 0;
       SuperClass::m_PSF[i]->SetOrigin(hrOrigin);
+
+      m_PSFKernels.AddImage(psfName.str(), lrSpacing, SuperClass::m_ImageHR->GetSpacing(), hrSize, SuperClass::m_PSF[i]);
     }
   }
 //-----------------------------------------------------------------------------------------------------------
@@ -619,24 +704,56 @@ void HighResolutionIBPFilter::UpdateX()
   }
 }
 //-----------------------------------------------------------------------------------------------------------
-double HighResolutionIBPFilter::ComputeIterativeBackProjection( int & nlm, float & beta, int & medianIBP)
+void HighResolutionIBPFilter::ComputeFusedBackProjection(int medianIBP)
+{
+    typedef itk::ImageRegionIteratorWithIndex< itkImage >                           itkIteratorWithIndex;
+
+    std::cout<<"Compute y-Hx and back-project it"<<std::endl;
+    this->UpdateX();
+
+    //y-Hx is back-projected through H and averaged (or its median taken) over the LR images in a single pass over the HR voxels
+    m_BackProjection.SetObservationMatrix(&SuperClass::m_H);
+    m_BackProjection.SetGroups(SuperClass::m_Offset);
+    m_BackProjection.SetMedian(medianIBP == 1);
+
+    vnl_vector< float > correction;
+    m_BackProjection.Compute(SuperClass::m_Y, SuperClass::m_X, correction);
+
+    //Fill the simulated LR images with Hx
+    const vnl_vector< float > & Hx = m_BackProjection.GetSimulation();
+    for(unsigned int i=0; i< SuperClass::m_ImagesLR.size(); i++)
+    {
+        itkImage::SizeType lrSize = SuperClass::m_SimulatedImagesLR[i]->GetLargestPossibleRegion().GetSize();
+        itkIteratorWithIndex itSimulated(SuperClass::m_SimulatedImagesLR[i], SuperClass::m_SimulatedImagesLR[i]->GetLargestPossibleRegion());
+        for(itSimulated.GoToBegin(); !itSimulated.IsAtEnd(); ++itSimulated)
+        {
+            itkImage::IndexType lrIndex = itSimulated.GetIndex();
+            unsigned int lrLinearIndex = SuperClass::m_Offset[i] + lrIndex[0] + lrIndex[1]*lrSize[0] + lrIndex[2]*lrSize[0]*lrSize[1];
+            itSimulated.Set(Hx[lrLinearIndex]);
+        }
+    }
+
+    std::cout<<"Update the current HR image"<<std::endl;
+    itkImage::SizeType hrSize = SuperClass::m_OutputHRImage->GetLargestPossibleRegion().GetSize();
+    itkIteratorWithIndex itImage(SuperClass::m_OutputHRImage, SuperClass::m_OutputHRImage->GetLargestPossibleRegion());
+    for(itImage.GoToBegin(); !itImage.IsAtEnd(); ++itImage)
+    {
+        itkImage::IndexType hrIndex = itImage.GetIndex();
+        itImage.Set(correction[hrIndex[0] + hrIndex[1]*hrSize[0] + hrIndex[2]*hrSize[0]*hrSize[1]]);
+    }
+}
+//-----------------------------------------------------------------------------------------------------------
+void HighResolutionIBPFilter::ComputeResampledBackProjection()
 {
     typedef itk::BSplineInterpolateImageFunction< itkImage, double, double >          itkBSplineInterpolator;
     typedef itk::SubtractImageFilter < itkImage, itkImage >                          itkSubtractImageFilter;
     typedef itk::ResampleImageFilter< itkImage, itkImage >                            itkResampleFilter;
     typedef itk::ImageRegionIteratorWithIndex< itkImage >                           itkIteratorWithIndex;
     typedef itk::AddImageFilter < itkImage, itkImage >                               itkAddImageFilter;
-    typedef itk::AbsoluteValueDifferenceImageFilter < itkImage, itkImage, itkImage >  itkAbsoluteValueDifferenceImageFilter;
-    typedef itk::ImageRegionIterator< itkImage > itkIterator;
-    typedef itk::ImageDuplicator< itkImage >  itkDuplicator;
-    typedef itk::StatisticsImageFilter< itkImage >                            itkStatisticsImageFilter;
-
-    std::cout<<"Do iterated back projection"<<std::endl;
-    std::cout<<"NLM Filtering type: "<<nlm<<std::endl;
 
     std::cout<<"Compute y-Hx"<<std::endl;
     this->UpdateX();
-    m_SimuLRImagesFilter->SetH(SuperClass::m_H);
+    m_SimuLRImagesFilter->SetH(&m_MatrixFreeOperator);
     m_SimuLRImagesFilter->SetLRImages(SuperClass::m_ImagesLR);
     m_SimuLRImagesFilter->SetX(SuperClass::m_X);
     m_SimuLRImagesFilter->SetOffset(SuperClass::m_Offset);
@@ -770,7 +887,43 @@ double HighResolutionIBPFilter::ComputeIterativeBackProjection( int & nlm, float
               double value = itImage.Get() / SuperClass::m_ImagesLR.size();
               itImage.Set( value );
             }
+}
+//-----------------------------------------------------------------------------------------------------------
+double HighResolutionIBPFilter::ComputeIterativeBackProjection( int & nlm, float & beta, int & medianIBP)
+{
+    typedef itk::AddImageFilter < itkImage, itkImage >                               itkAddImageFilter;
+    typedef itk::AbsoluteValueDifferenceImageFilter < itkImage, itkImage, itkImage >  itkAbsoluteValueDifferenceImageFilter;
+    typedef itk::ImageRegionIterator< itkImage > itkIterator;
+    typedef itk::ImageDuplicator< itkImage >  itkDuplicator;
+    typedef itk::StatisticsImageFilter< itkImage >                            itkStatisticsImageFilter;
+
+    std::cout<<"Do iterated back projection"<<std::endl;
+    std::cout<<"NLM Filtering type: "<<nlm<<std::endl;
 
+    bool telemetry = btk::Telemetry::GetInstance().IsEnabled();
+    double time = telemetry ? btk::Telemetry::GetTime() : 0.0;
+    double backProjectionTime = 0.0;
+    double nlmTime = 0.0;
+    double residualNorm = 0.0;
+
+    if(m_UseMatrixFree)
+    {
+        this->ComputeResampledBackProjection();
+    }
+    else
+    {
+        this->ComputeFusedBackProjection(medianIBP);
+    }
+
+    if(telemetry)
+    {
+        backProjectionTime = btk::Telemetry::GetTime() - time;
+
+        // residual of the current estimate (the one the back-projection has been computed from)
+        residualNorm = this->ComputeResidualNorm();
+
+        time = btk::Telemetry::GetTime();
+    }
 
     if(nlm==1)
     {
@@ -789,6 +942,10 @@ double HighResolutionIBPFilter::ComputeIterativeBackProjection( int & nlm, float
       //s = "ibp_nlm_error.nii.gz";
       //data.WriteOneImage(data.m_outputHRImage, s);
     }
+    if(telemetry)
+    {
+        nlmTime = btk::Telemetry::GetTime() - time;
+    }
 
     //Update the HR image correspondly
     itkAddImageFilter::Pointer addFilter2 = itkAddImageFilter::New ();
@@ -800,6 +957,11 @@ double HighResolutionIBPFilter::ComputeIterativeBackProjection( int & nlm, float
     //s = "ibp_updated.nii.gz";
     //data.WriteOneImage(data.m_currentHRImage, s);
 
+    if(telemetry)
+    {
+        time = btk::Telemetry::GetTime();
+    }
+
     if(nlm==2)
     {
       std::cout<<"Smooth the current reconstructed image ------------------ \n";
@@ -814,6 +976,10 @@ double HighResolutionIBPFilter::ComputeIterativeBackProjection( int & nlm, float
       //s = "ibp_nlm_smooth.nii.gz";
       //data.WriteOneImage(data.m_currentHRImage, s);
     }
+    if(telemetry)
+    {
+        nlmTime += btk::Telemetry::GetTime() - time;
+    }
 
     std::cout<<"Compute the changes between the two consecutive estimates\n";
     itkAbsoluteValueDifferenceImageFilter::Pointer absoluteValueDifferenceFilter = itkAbsoluteValueDifferenceImageFilter::New ();
@@ -857,11 +1023,50 @@ double HighResolutionIBPFilter::ComputeIterativeBackProjection( int & nlm, float
     double manjonCriterion = 0.002*statisticsImageFilter->GetSigma(); //As defined in Manjon et al. 2010
     std::cout<<"stopping criterion : "<<manjonCriterion<<std::endl;
 
+    if(telemetry)
+    {
+        btk::Telemetry::Record record("ibp");
+        record.SetIteration(m_Iteration);
+        record.SetValue("residual_norm", residualNorm);
+        record.AddPhaseTime("back_projection", backProjectionTime);
+        if(nlm==1 || nlm==2)
+        {
+            record.AddPhaseTime("nlm", nlmTime);
+        }
+        record.SetValue("change", meanMagnitude);
+        record.SetValue("stopping_criterion", manjonCriterion);
+        btk::Telemetry::GetInstance().Write(record);
+    }
+
     if(meanMagnitude < manjonCriterion)
       meanMagnitude = 0;
 
     return meanMagnitude;
 }
+//-----------------------------------------------------------------------------------------------------------
+double HighResolutionIBPFilter::ComputeResidualNorm() const
+{
+    typedef itk::ImageRegionConstIterator< itkImage > itkConstIterator;
+
+    double norm2 = 0.0;
+
+    for(unsigned int i=0; i< SuperClass::m_ImagesLR.size(); i++)
+    {
+        itkConstIterator itLRImage(SuperClass::m_ImagesLR[i], SuperClass::m_ImagesLR[i]->GetLargestPossibleRegion());
+        itkConstIterator itSimulated(SuperClass::m_SimulatedImagesLR[i], SuperClass::m_SimulatedImagesLR[i]->GetLargestPossibleRegion());
+
+        for(itLRImage.GoToBegin(), itSimulated.GoToBegin(); !itLRImage.IsAtEnd(); ++itLRImage, ++itSimulated)
+        {
+            if(itLRImage.Get() > SuperClass::m_PaddingValue)
+            {
+                double difference = itLRImage.Get() - itSimulated.Get();
+                norm2 += difference*difference;
+            }
+        }
+    }
+
+    return std::sqrt(norm2);
+}
 
 
 }
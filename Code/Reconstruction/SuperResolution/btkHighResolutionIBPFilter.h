@@ -41,6 +41,10 @@
 #include "btkMacro.h"
 #include "btkCreateHRMaskFilter.h"
 #include "btkSimulateLRImageFilter.h"
+#include "btkMatrixFreeObservationOperator.h"
+#include "btkResidualBackProjection.h"
+#include "btkPSFKernelCache.h"
+#include "btkTelemetry.h"
 
 /* OTHERS */
 #include "iostream"
@@ -81,19 +85,48 @@ public:
     btkGetMacro(MedianIBP,int);
     btkSetMacro(MedianIBP,int);
 
+    /** Compute H*x on the fly instead of storing H (much less memory, slower simulations) */
+    btkGetMacro(UseMatrixFree,bool);
+    btkSetMacro(UseMatrixFree,bool);
+
 
 protected:
 
     void HComputation();
+    void InitializeMatrixFreeOperator();
     void InitializePSF();
     void UpdateX();
     double ComputeIterativeBackProjection( int & nlm, float & beta, int & medianIBP);
+    /**
+     * @brief Compute y-Hx and back-project it through H in m_OutputHRImage, averaging over the LR images (or taking the median
+     * if medianIBP is 1), in a single multithreaded pass over the HR voxels (see ResidualBackProjection).
+     */
+    void ComputeFusedBackProjection(int medianIBP);
+    /**
+     * @brief Compute y-Hx on the simulated LR images and back-project it in m_OutputHRImage by resampling the LR differences
+     * (used with the matrix-free operator, whose transpose is not stored).
+     */
+    void ComputeResampledBackProjection();
+    /**
+     * @brief Norm of y-Hx, computed on the simulated LR images (LR voxels above the padding value).
+     */
+    double ComputeResidualNorm() const;
 
 private:
 
     int m_Nlm;
     float m_Beta;
     int m_MedianIBP;
+    bool m_UseMatrixFree;
+
+    /** Current iteration of the IBP (telemetry) */
+    unsigned int m_Iteration;
+
+    MatrixFreeObservationOperator m_MatrixFreeOperator;
+    ResidualBackProjection< float > m_BackProjection;
+
+    /** HR PSF of the geometries of the LR images (LR images of same spacing share their PSF) */
+    PSFKernelCache m_PSFKernels;
 
 
     CreateHRMaskFilter* m_HRMaskFilter;
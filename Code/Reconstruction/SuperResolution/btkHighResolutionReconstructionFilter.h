@@ -51,7 +51,8 @@
 
 
 /* VNL */
-#include "vnl/vnl_sparse_matrix.h"
+#include "vnl/vnl_vector.h"
+#include "btkSparseMatrix.h"
 
 /* OTHERS */
 #include "iostream"
@@ -137,8 +138,11 @@ public:
     btkSetMacro(ReferenceImage, itkImage::Pointer);
 
 
-    btkSetMacro(H,vnl_sparse_matrix< float >);
-    btkGetMacro(H,vnl_sparse_matrix< float >);
+    /** Observation matrix H (y = Hx), returned by reference since it may be very large */
+    const btk::SparseMatrix< float > & GetH() const
+    {
+        return m_H;
+    }
 
     btkSetMacro(X,vnl_vector< float >);
     btkGetMacro(X,vnl_vector< float >);
@@ -206,7 +210,7 @@ protected:
 
     TRANSFORMATION_TYPE                      m_TransformType;
 
-    vnl_sparse_matrix< float >               m_H;
+    btk::SparseMatrix< float >               m_H;
     vnl_vector< float >                      m_X;
     vnl_vector< float >                      m_Y;
     std::vector< unsigned int >              m_Offset;
@@ -9,6 +9,7 @@ HighResolutionSRFilter::HighResolutionSRFilter()
     btkCoutMacro("HighResolutionSRFilter : Constructor");
     //resampler = Resampler::New();
     m_NlmTools = new NLMTool<float>;
+    m_SolveNormalEquations = false;
 }
 //-----------------------------------------------------------------------------------------------------------
 HighResolutionSRFilter::~HighResolutionSRFilter()
@@ -193,6 +194,7 @@ void HighResolutionSRFilter::DoAffineReconstruction()
     resampler -> SetReferenceImage( SuperClass::m_ImageHR );
     resampler -> SetIterations(m_Iter);
     resampler -> SetLambda( m_Lambda );
+    resampler -> SetSolveNormalEquations( m_SolveNormalEquations );
 
     if ( SuperClass::m_PsfType == Resampler::BOXCAR )
     {
@@ -204,32 +206,40 @@ void HighResolutionSRFilter::DoAffineReconstruction()
         resampler -> SetPSF( Resampler::GAUSSIAN );
     }
 
+    double time = btk::Telemetry::GetTime();
     resampler -> Update();
+    this->WriteLoopTelemetry(0, btk::Telemetry::GetTime() - time, -1.0);
 
 
     for (int i=0; i< SuperClass::m_Nloops; i++)
     {
       std::cout<<"Loop : "<<i+1<<std::endl;
 
+      time = btk::Telemetry::GetTime();
       m_NlmTools->SetInput(resampler -> GetOutput());
       m_NlmTools->SetPaddingValue(0);
       m_NlmTools->SetDefaultParameters();
       m_NlmTools->ComputeOutput();
+      double nlmTime = btk::Telemetry::GetTime() - time;
 
       itkImage::Pointer outputImage = itkImage::New();
       outputImage = m_NlmTools->GetOutput();
 
+      time = btk::Telemetry::GetTime();
       resampler -> SetReferenceImage( outputImage );
       resampler -> Update();
+      this->WriteLoopTelemetry(i+1, btk::Telemetry::GetTime() - time, nlmTime);
     }
     //NLM denoising desired at the last step if number of loops > 0
     if(SuperClass::m_Nloops>0)
     {
 
+      time = btk::Telemetry::GetTime();
       m_NlmTools->SetInput(resampler -> GetOutput());
       m_NlmTools->SetPaddingValue(0);
       m_NlmTools->SetDefaultParameters();
       m_NlmTools->ComputeOutput();
+      this->WriteLoopTelemetry(SuperClass::m_Nloops+1, -1.0, btk::Telemetry::GetTime() - time);
 
       itkImage::Pointer outputImage = itkImage::New();
       outputImage = m_NlmTools->GetOutput();
@@ -290,6 +300,7 @@ void HighResolutionSRFilter::DoRigidReconstruction()
     resampler -> SetReferenceImage( SuperClass::m_ImageHR );
     resampler -> SetIterations(m_Iter);
     resampler -> SetLambda( m_Lambda );
+    resampler -> SetSolveNormalEquations( m_SolveNormalEquations );
 
     if ( SuperClass::m_PsfType == Resampler::BOXCAR )
     {
@@ -301,7 +312,9 @@ void HighResolutionSRFilter::DoRigidReconstruction()
         resampler -> SetPSF( Resampler::GAUSSIAN );
     }
 
+    double time = btk::Telemetry::GetTime();
     resampler -> Update();
+    this->WriteLoopTelemetry(0, btk::Telemetry::GetTime() - time, -1.0);
 
 
     for (int i=0; i< SuperClass::m_Nloops; i++)
@@ -315,25 +328,31 @@ void HighResolutionSRFilter::DoRigidReconstruction()
 //      btk::ImageHelper<itkImage>::WriteImage(resampler->GetOutput(),name);
 //      //************
 
+      time = btk::Telemetry::GetTime();
       m_NlmTools->SetInput(resampler -> GetOutput());
       m_NlmTools->SetPaddingValue(0);
       m_NlmTools->SetDefaultParameters();
       m_NlmTools->ComputeOutput();
+      double nlmTime = btk::Telemetry::GetTime() - time;
 
       itkImage::Pointer outputImage = itkImage::New();
       outputImage = m_NlmTools->GetOutput();
 
+      time = btk::Telemetry::GetTime();
       resampler -> SetReferenceImage( outputImage );
       resampler -> Update();
+      this->WriteLoopTelemetry(i+1, btk::Telemetry::GetTime() - time, nlmTime);
     }
     //NLM denoising desired at the last step if number of loops > 0
     if(SuperClass::m_Nloops>0)
     {
 
+      time = btk::Telemetry::GetTime();
       m_NlmTools->SetInput(resampler -> GetOutput());
       m_NlmTools->SetPaddingValue(0);
       m_NlmTools->SetDefaultParameters();
       m_NlmTools->ComputeOutput();
+      this->WriteLoopTelemetry(SuperClass::m_Nloops+1, -1.0, btk::Telemetry::GetTime() - time);
 
       itkImage::Pointer outputImage = itkImage::New();
       outputImage = m_NlmTools->GetOutput();
@@ -343,6 +362,31 @@ void HighResolutionSRFilter::DoRigidReconstruction()
 
     SuperClass::m_OutputHRImage = resampler->GetOutput();
 }
+//-----------------------------------------------------------------------------------------------------------
+void HighResolutionSRFilter::WriteLoopTelemetry(unsigned int loop, double srTime, double nlmTime) const
+{
+    if(!btk::Telemetry::GetInstance().IsEnabled())
+    {
+        return;
+    }
+
+    // the values of the cost function are written by the cost function itself (one record per evaluation)
+    btk::Telemetry::Record record("high_resolution_sr");
+    record.SetIteration(loop);
+    record.SetValue("lambda", m_Lambda);
+
+    if(srTime >= 0.0)
+    {
+        record.AddPhaseTime("super_resolution", srTime);
+    }
+
+    if(nlmTime >= 0.0)
+    {
+        record.AddPhaseTime("nlm", nlmTime);
+    }
+
+    btk::Telemetry::GetInstance().Write(record);
+}
 
 }
 
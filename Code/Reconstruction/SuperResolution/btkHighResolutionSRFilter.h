@@ -51,6 +51,7 @@
 #include "btkSuperResolutionAffineImageFilter.h"
 #include "btkNLMTool.h"
 #include "btkImageHelper.h"
+#include "btkTelemetry.h"
 
 /* OTHERS */
 #include "iostream"
@@ -86,6 +87,13 @@ public:
     btkSetMacro(Iter,unsigned int);
     btkGetMacro(Iter, unsigned int);
 
+    /**
+     * @brief Solve the normal equations of the least-squares cost function with a preconditioned conjugate gradient
+     * (at most Iter iterations), instead of minimizing it with vnl_conjugate_gradient (default false).
+     */
+    btkSetMacro(SolveNormalEquations,bool);
+    btkGetMacro(SolveNormalEquations,bool);
+
 
 
 
@@ -93,6 +101,13 @@ protected:
     virtual void Initialize();
     virtual void DoAffineReconstruction();
     virtual void DoRigidReconstruction();
+    /**
+     * @brief Write the telemetry of a loop (0 for the first super resolution).
+     * @param loop loop of the reconstruction
+     * @param srTime wall time of the super resolution (H build and solver, negative if not performed)
+     * @param nlmTime wall time of the NLM denoising (negative if not performed)
+     */
+    void WriteLoopTelemetry(unsigned int loop, double srTime, double nlmTime) const;
 private:
 
    //Resampler::Pointer  m_Resampler;
@@ -100,6 +115,7 @@ private:
 
     float               m_Lambda;
     unsigned int        m_Iter;
+    bool                m_SolveNormalEquations;
     bool                m_UseAffineFilter;
     bool                m_UseEulerFilter;
     bool                m_UseSliceBySlice;
@@ -0,0 +1,348 @@
+/*==========================================================================
+
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+
+==========================================================================*/
+
+#include "btkMatrixFreeObservationOperator.h"
+
+#include "algorithm"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace btk
+{
+//-----------------------------------------------------------------------------------------------------------
+static bool CompareColumns(const std::pair< unsigned int, float > & a, const std::pair< unsigned int, float > & b)
+{
+    return a.first < b.first;
+}
+//-----------------------------------------------------------------------------------------------------------
+MatrixFreeObservationOperator::MatrixFreeObservationOperator()
+{
+    m_ImageHR = NULL;
+    m_PaddingValue = 0;
+    m_NumberOfRows = 0;
+    m_NumberOfColumns = 0;
+}
+//-----------------------------------------------------------------------------------------------------------
+MatrixFreeObservationOperator::~MatrixFreeObservationOperator()
+{
+}
+//-----------------------------------------------------------------------------------------------------------
+void MatrixFreeObservationOperator::Initialize()
+{
+    if(m_ImageHR.IsNull() || m_PSF.size() != m_ImagesLR.size() || m_InverseTransforms.size() != m_ImagesLR.size())
+    {
+        btkException("MatrixFreeObservationOperator: the HR image, and one PSF and one transform per LR image are required.");
+    }
+
+    m_NumberOfColumns = m_ImageHR->GetLargestPossibleRegion().GetNumberOfPixels();
+
+    //position of each LR image in y
+    m_Offset.resize(m_ImagesLR.size());
+    m_NumberOfRows = 0;
+    for(unsigned int i = 0; i < m_ImagesLR.size(); i++)
+    {
+        m_Offset[i] = m_NumberOfRows;
+        m_NumberOfRows += m_ImagesLR[i]->GetLargestPossibleRegion().GetNumberOfPixels();
+    }
+
+    //PSF samples: the PSF is oriented as the LR image and centered on the LR voxel, so that a PSF voxel
+    //is located at lrPoint + direction * spacing * (psfIndex - psfCenter)
+    m_PSFOffsets.resize(m_ImagesLR.size());
+    m_PSFValues.resize(m_ImagesLR.size());
+
+    for(unsigned int i = 0; i < m_ImagesLR.size(); i++)
+    {
+        m_PSFOffsets[i].clear();
+        m_PSFValues[i].clear();
+
+        itkImage::DirectionType direction = m_ImagesLR[i]->GetDirection();
+        itkImage::SpacingType   psfSpacing = m_PSF[i]->GetSpacing();
+        itkImage::SizeType      psfSize = m_PSF[i]->GetLargestPossibleRegion().GetSize();
+
+        itkIteratorWithIndex itPSF(m_PSF[i],m_PSF[i]->GetLargestPossibleRegion());
+        for(itPSF.GoToBegin(); !itPSF.IsAtEnd(); ++itPSF)
+        {
+            if(itPSF.Get() > 0)
+            {
+                itkImage::IndexType psfIndex = itPSF.GetIndex();
+                itkImage::PointType::VectorType v;
+                for(unsigned int d = 0; d < 3; d++)
+                {
+                    v[d] = psfSpacing[d] * (psfIndex[d] - (psfSize[d]-1)/2.0);
+                }
+                m_PSFOffsets[i].push_back(direction * v);
+                m_PSFValues[i].push_back(itPSF.Get());
+            }
+        }
+    }
+}
+//-----------------------------------------------------------------------------------------------------------
+void MatrixFreeObservationOperator::ComputeRow(unsigned int i, const itkImage::IndexType & lrIndex, const BSplineFunctionType * bsplineFunction,
+                                               std::vector< unsigned int > & columns, std::vector< float > & values) const
+{
+    columns.clear();
+    values.clear();
+
+    BSplineFunctionType::WeightsType bsplineWeights;
+    bsplineWeights.SetSize(8); // (bsplineOrder + 1)^3
+    BSplineFunctionType::IndexType   bsplineStartIndex;
+    BSplineFunctionType::IndexType   bsplineEndIndex;
+    BSplineFunctionType::SizeType    bsplineSize = bsplineFunction->GetSupportSize();
+
+    const itkImage::RegionType & hrRegion = m_ImageHR->GetLargestPossibleRegion();
+    itkImage::SizeType hrSize = hrRegion.GetSize();
+
+    itkImage::PointType lrPoint;
+    m_ImagesLR[i]->TransformIndexToPhysicalPoint(lrIndex,lrPoint);
+
+    for(unsigned int p = 0; p < m_PSFOffsets[i].size(); p++)
+    {
+        //Physical point of the PSF voxel, mapped in the HR image
+        itkImage::PointType psfPoint = lrPoint + m_PSFOffsets[i][p];
+        itkImage::PointType transformedPoint = m_InverseTransforms[i]->TransformPoint(psfPoint);
+
+        itkContinuousIndex hrContIndex;
+        m_ImageHR->TransformPhysicalPointToContinuousIndex(transformedPoint,hrContIndex);
+
+        if(!hrRegion.IsInside(hrContIndex))
+        {
+            continue;
+        }
+
+        bsplineFunction->Evaluate(hrContIndex,bsplineWeights,bsplineStartIndex);
+
+        //Check if the bspline support region is inside the HR image
+        bsplineEndIndex[0] = bsplineStartIndex[0] + bsplineSize[0];
+        bsplineEndIndex[1] = bsplineStartIndex[1] + bsplineSize[1];
+        bsplineEndIndex[2] = bsplineStartIndex[2] + bsplineSize[2];
+
+        if(!hrRegion.IsInside(bsplineStartIndex) || !hrRegion.IsInside(bsplineEndIndex))
+        {
+            continue;
+        }
+
+        //Loop over the support region (same order as the weights: x first)
+        unsigned int weightLinearIndex = 0;
+        for(unsigned int z = 0; z < bsplineSize[2]; z++)
+        {
+            for(unsigned int y = 0; y < bsplineSize[1]; y++)
+            {
+                for(unsigned int x = 0; x < bsplineSize[0]; x++)
+                {
+                    unsigned int hrLinearIndex = (bsplineStartIndex[0]+x) + (bsplineStartIndex[1]+y)*hrSize[0]
+                                               + (bsplineStartIndex[2]+z)*hrSize[0]*hrSize[1];
+                    columns.push_back(hrLinearIndex);
+                    values.push_back(m_PSFValues[i][p] * bsplineWeights[weightLinearIndex]);
+                    weightLinearIndex++;
+                }
+            }
+        }
+    }
+}
+//-----------------------------------------------------------------------------------------------------------
+void MatrixFreeObservationOperator::Multiply(const VectorType & x, VectorType & y) const
+{
+    y.set_size(m_NumberOfRows);
+    y.fill(0.0);
+
+    for(unsigned int i = 0; i < m_ImagesLR.size(); i++)
+    {
+        itkImage::SizeType lrSize = m_ImagesLR[i]->GetLargestPossibleRegion().GetSize();
+        itkImage::IndexType lrStart = m_ImagesLR[i]->GetLargestPossibleRegion().GetIndex();
+
+        //every slice fills its own rows of y
+        int slice;
+        #pragma omp parallel for private(slice) schedule(dynamic)
+        for(slice = 0; slice < (int)lrSize[2]; slice++)
+        {
+            BSplineFunctionType::Pointer bsplineFunction = BSplineFunctionType::New();
+            std::vector< unsigned int > columns;
+            std::vector< float >        values;
+
+            itkImage::IndexType lrIndex;
+            lrIndex[2] = lrStart[2] + slice;
+            for(unsigned int py = 0; py < lrSize[1]; py++)
+            {
+                lrIndex[1] = lrStart[1] + py;
+                for(unsigned int px = 0; px < lrSize[0]; px++)
+                {
+                    lrIndex[0] = lrStart[0] + px;
+
+                    //Rows of voxels below the padding value are empty
+                    if(m_ImagesLR[i]->GetPixel(lrIndex) <= m_PaddingValue)
+                    {
+                        continue;
+                    }
+
+                    this->ComputeRow(i, lrIndex, bsplineFunction, columns, values);
+
+                    double sum   = 0;
+                    double value = 0;
+                    for(unsigned int k = 0; k < columns.size(); k++)
+                    {
+                        sum   += values[k];
+                        value += values[k] * x[columns[k]];
+                    }
+
+                    unsigned int row = m_Offset[i] + lrIndex[0] + lrIndex[1]*lrSize[0] + lrIndex[2]*lrSize[0]*lrSize[1];
+                    y[row] = (sum != 0) ? value / sum : value;
+                }
+            }
+        }
+    }
+}
+//-----------------------------------------------------------------------------------------------------------
+void MatrixFreeObservationOperator::ComputeSliceContributions(unsigned int i, unsigned int slice, const VectorType & y,
+                                                              std::vector< std::pair< unsigned int, float > > & contributions) const
+{
+    contributions.clear();
+
+    itkImage::SizeType lrSize = m_ImagesLR[i]->GetLargestPossibleRegion().GetSize();
+    itkImage::IndexType lrStart = m_ImagesLR[i]->GetLargestPossibleRegion().GetIndex();
+
+    BSplineFunctionType::Pointer bsplineFunction = BSplineFunctionType::New();
+    std::vector< unsigned int > columns;
+    std::vector< float >        values;
+
+    itkImage::IndexType lrIndex;
+    lrIndex[2] = lrStart[2] + slice;
+    for(unsigned int py = 0; py < lrSize[1]; py++)
+    {
+        lrIndex[1] = lrStart[1] + py;
+        for(unsigned int px = 0; px < lrSize[0]; px++)
+        {
+            lrIndex[0] = lrStart[0] + px;
+
+            unsigned int row = m_Offset[i] + lrIndex[0] + lrIndex[1]*lrSize[0] + lrIndex[2]*lrSize[0]*lrSize[1];
+
+            if(y[row] == 0 || m_ImagesLR[i]->GetPixel(lrIndex) <= m_PaddingValue)
+            {
+                continue;
+            }
+
+            this->ComputeRow(i, lrIndex, bsplineFunction, columns, values);
+
+            double sum = 0;
+            for(unsigned int k = 0; k < values.size(); k++)
+            {
+                sum += values[k];
+            }
+            if(sum == 0)
+            {
+                continue;
+            }
+
+            double factor = y[row] / sum;
+            for(unsigned int k = 0; k < columns.size(); k++)
+            {
+                contributions.push_back(std::make_pair(columns[k], (float)(values[k] * factor)));
+            }
+        }
+    }
+
+    //Sum the contributions to the same HR voxel (the stable sort keeps the order of the rows)
+    std::stable_sort(contributions.begin(), contributions.end(), CompareColumns);
+    unsigned int n = 0;
+    for(unsigned int k = 0; k < contributions.size(); k++)
+    {
+        if(n > 0 && contributions[n-1].first == contributions[k].first)
+        {
+            contributions[n-1].second += contributions[k].second;
+        }
+        else
+        {
+            contributions[n++] = contributions[k];
+        }
+    }
+    contributions.resize(n);
+}
+//-----------------------------------------------------------------------------------------------------------
+void MatrixFreeObservationOperator::TransposeMultiply(const VectorType & y, VectorType & x) const
+{
+    x.set_size(m_NumberOfColumns);
+    x.fill(0.0);
+    float * xData = x.data_block();
+
+    //The slices overlap in the HR image: the contributions of a batch of slices are computed in parallel, then every
+    //range of HR voxels receives them in the order of the slices. The sums are the same whatever the number of threads,
+    //which only sets the size of the batches (and so the memory used).
+    int numberOfThreads = 1;
+#ifdef _OPENMP
+    numberOfThreads = omp_get_max_threads();
+#endif
+    const int batchSize = 4 * numberOfThreads;
+    std::vector< std::vector< std::pair< unsigned int, float > > > contributions(batchSize);
+    const unsigned int rangeSize = (m_NumberOfColumns + numberOfThreads - 1) / numberOfThreads;
+
+    for(unsigned int i = 0; i < m_ImagesLR.size(); i++)
+    {
+        int numberOfSlices = m_ImagesLR[i]->GetLargestPossibleRegion().GetSize()[2];
+
+        for(int firstSlice = 0; firstSlice < numberOfSlices; firstSlice += batchSize)
+        {
+            int batchSlices = std::min(batchSize, numberOfSlices - firstSlice);
+
+            int s;
+            #pragma omp parallel for private(s) schedule(dynamic)
+            for(s = 0; s < batchSlices; s++)
+            {
+                this->ComputeSliceContributions(i, firstSlice + s, y, contributions[s]);
+            }
+
+            int range;
+            #pragma omp parallel for private(range) schedule(static)
+            for(range = 0; range < numberOfThreads; range++)
+            {
+                unsigned int firstColumn = range * rangeSize;
+                unsigned int lastColumn  = std::min(firstColumn + rangeSize, m_NumberOfColumns);
+                std::pair< unsigned int, float > first(firstColumn, 0.0f);
+
+                for(int k = 0; k < batchSlices; k++)
+                {
+                    std::vector< std::pair< unsigned int, float > >::const_iterator it =
+                            std::lower_bound(contributions[k].begin(), contributions[k].end(), first, CompareColumns);
+                    for(; it != contributions[k].end() && it->first < lastColumn; ++it)
+                    {
+                        xData[it->first] += it->second;
+                    }
+                }
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,163 @@
+/*==========================================================================
+
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+
+==========================================================================*/
+
+#ifndef __BTK_MATRIXFREEOBSERVATIONOPERATOR_H__
+#define __BTK_MATRIXFREEOBSERVATIONOPERATOR_H__
+
+/* ITK */
+#include "itkImage.h"
+#include "itkBSplineInterpolationWeightFunction.h"
+
+/* BTK */
+#include "btkMacro.h"
+#include "btkSuperResolutionType.h"
+#include "btkLinearOperator.h"
+
+/* OTHERS */
+#include "vector"
+#include "utility"
+#include "iostream"
+
+namespace btk
+{
+/**
+ * @class MatrixFreeObservationOperator
+ * @brief Observation operator H of the super-resolution (y = Hx) computed on the fly, without storing H.
+ *
+ * The rows of H are computed exactly as in HighResolutionIBPFilter::HComputation: the PSF of each LR image is centered
+ * on the LR voxel, each PSF voxel is mapped in the HR image by the inverse transform, and its influence is spread over
+ * the HR voxels with linear interpolation weights. Rows are normalized (sum of 1), and rows of LR voxels below the padding
+ * value are empty. The products H*x and H^T*y are multithreaded over the LR slices, and their results do not depend
+ * on the number of threads.
+ *
+ * Compared to an explicit btk::SparseMatrix, the memory used is negligible, but every product recomputes the weights.
+ * @author François Rousseau
+ * @ingroup SuperResolution
+ */
+class MatrixFreeObservationOperator : public LinearOperator< float >
+{
+public:
+    typedef LinearOperator< float >     SuperClass;
+    typedef SuperClass::VectorType      VectorType;
+
+    /** Linear interpolation weights (as for the computation of H) */
+    typedef itk::BSplineInterpolationWeightFunction< double, 3, 1 >  BSplineFunctionType;
+
+    MatrixFreeObservationOperator();
+    virtual ~MatrixFreeObservationOperator();
+
+    /**
+     * @brief Precompute the PSF samples and the position of each LR image in y. Must be called once the inputs are set.
+     */
+    void Initialize();
+
+    /**
+     * @brief Compute y = H*x (multithreaded over the LR slices).
+     */
+    virtual void Multiply(const VectorType & x, VectorType & y) const;
+
+    /**
+     * @brief Compute x = H^T*y. The contributions of the LR slices are computed in parallel, then added to x
+     * in the order of the slices (see ComputeSliceContributions).
+     */
+    virtual void TransposeMultiply(const VectorType & y, VectorType & x) const;
+
+    /** @brief Number of rows (total number of LR voxels). */
+    virtual unsigned int GetNumberOfRows() const { return m_NumberOfRows; }
+
+    /** @brief Number of columns (number of HR voxels). */
+    virtual unsigned int GetNumberOfColumns() const { return m_NumberOfColumns; }
+
+    btkSetMacro(ImagesLR,std::vector< itkImage::Pointer >);
+    btkGetMacro(ImagesLR,std::vector< itkImage::Pointer >);
+
+    btkSetMacro(ImageHR,itkImage::Pointer);
+    btkGetMacro(ImageHR,itkImage::Pointer);
+
+    /** PSF of each LR image, in HR space (see HighResolutionIBPFilter::InitializePSF) */
+    btkSetMacro(PSF,std::vector< itkImage::Pointer >);
+    btkGetMacro(PSF,std::vector< itkImage::Pointer >);
+
+    /** Transforms from the LR images to the HR image (inverse of the estimated transforms) */
+    btkSetMacro(InverseTransforms,std::vector< itkTransformBase::Pointer >);
+    btkGetMacro(InverseTransforms,std::vector< itkTransformBase::Pointer >);
+
+    btkSetMacro(PaddingValue,float);
+    btkGetMacro(PaddingValue,float);
+
+    btkGetMacro(Offset,std::vector< unsigned int >);
+
+protected:
+
+    /**
+     * @brief Compute the (not normalized) values of the row of H corresponding to a LR voxel.
+     * @param i index of the LR image
+     * @param lrIndex index of the LR voxel
+     * @param bsplineFunction interpolation weight function (one per thread)
+     * @param columns columns of the values (HR linear indices, possibly repeated)
+     * @param values values of the row
+     */
+    void ComputeRow(unsigned int i, const itkImage::IndexType & lrIndex, const BSplineFunctionType * bsplineFunction,
+                    std::vector< unsigned int > & columns, std::vector< float > & values) const;
+
+    /**
+     * @brief Compute the contributions of a LR slice to H^T*y, summed per HR voxel in the order of the rows.
+     * @param i index of the LR image
+     * @param slice slice of the LR image (relatively to the first index of its region)
+     * @param y vector of the LR images
+     * @param contributions pairs (HR linear index, contribution), sorted by HR linear index
+     */
+    void ComputeSliceContributions(unsigned int i, unsigned int slice, const VectorType & y,
+                                   std::vector< std::pair< unsigned int, float > > & contributions) const;
+
+private:
+
+    std::vector< itkImage::Pointer >            m_ImagesLR;
+    itkImage::Pointer                           m_ImageHR;
+    std::vector< itkImage::Pointer >            m_PSF;
+    std::vector< itkTransformBase::Pointer >    m_InverseTransforms;
+    float                                       m_PaddingValue;
+
+    std::vector< unsigned int >                 m_Offset;       /**< first row of each LR image */
+    unsigned int                                m_NumberOfRows;
+    unsigned int                                m_NumberOfColumns;
+
+    /** Positive PSF samples of each LR image: offsets (physical space) to the center of the PSF, and values */
+    std::vector< std::vector< itkImage::PointType::VectorType > >  m_PSFOffsets;
+    std::vector< std::vector< float > >                          m_PSFValues;
+};
+}
+
+#endif
@@ -1,13 +1,21 @@
 #include "btkSuperResolutionFilter.h"
 #include "btkImageHelper.h"
 
+#include "itkImageRegionConstIterator.h"
+
+#include "algorithm"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 
 
 namespace btk
 {
 //-----------------------------------------------------------------------------------------------------------
-SuperResolutionFilter::SuperResolutionFilter():m_Lambda(0.01),m_ComputeSimulations(false)
+SuperResolutionFilter::SuperResolutionFilter():m_Lambda(0.01),m_NumberOfPyramidLevels(1),m_BlockSize(0),m_BlockOverlap(8),m_ComputeSimulations(false)
 {
     m_H =NULL;
     m_Y = NULL;
@@ -28,23 +36,20 @@ SuperResolutionFilter::~SuperResolutionFilter()
 void SuperResolutionFilter::Initialize()
 {
 
-    m_H = new vnl_sparse_matrix< PrecisionType >();
-    m_Y = new vnl_vector< PrecisionType >();
+    // H and Y are kept from one update to the next one (see SetHMatrixIncrementalUpdate)
+    if(m_H == NULL)
+    {
+        m_H = new btk::SparseMatrix< PrecisionType >();
+    }
+    if(m_Y == NULL)
+    {
+        m_Y = new vnl_vector< PrecisionType >();
+    }
 
 
     m_NumberOfImages  = m_Images.size();
 
-    m_ReferenceRegion = this->m_ReferenceImage->GetLargestPossibleRegion();
-    Iterator RefIt(this->m_ReferenceImage, m_ReferenceRegion);
-
-    m_X.set_size(m_ReferenceRegion.GetNumberOfPixels() );
-
-    unsigned int linearSize = 0;
-
-    for(RefIt.GoToBegin();  !RefIt.IsAtEnd(); ++RefIt, linearSize++)
-    {
-        m_X[linearSize] = RefIt.Get();
-    }
+    this->InitializeX();
 
     m_MasksObject.resize(m_NumberOfImages);
     m_Regions.resize(m_NumberOfImages);
@@ -63,9 +68,70 @@ void SuperResolutionFilter::Initialize()
     }
 }
 
+//-----------------------------------------------------------------------------------------------------------
+void SuperResolutionFilter::InitializeX()
+{
+    m_ReferenceRegion = this->m_ReferenceImage->GetLargestPossibleRegion();
+    Iterator RefIt(this->m_ReferenceImage, m_ReferenceRegion);
+
+    m_X.set_size(m_ReferenceRegion.GetNumberOfPixels() );
+
+    unsigned int linearSize = 0;
+
+    for(RefIt.GoToBegin();  !RefIt.IsAtEnd(); ++RefIt, linearSize++)
+    {
+        m_X[linearSize] = RefIt.Get();
+    }
+}
 //-----------------------------------------------------------------------------------------------------------
 void SuperResolutionFilter::Update()
 {
+    if(m_NumberOfPyramidLevels > 1)
+    {
+        ImageType::Pointer referenceImage = m_ReferenceImage;
+        ImageType::Pointer estimate = m_ReferenceImage;
+
+        // The coarse levels are neither cached (the cache keeps H on the reference grid) nor simulated
+        std::string cacheFileName = m_H_Filter->GetCacheFileName();
+        bool computeSimulations = m_ComputeSimulations;
+        m_H_Filter->SetCacheFileName("");
+        m_ComputeSimulations = false;
+
+        for(unsigned int level = m_NumberOfPyramidLevels-1; level > 0; level--)
+        {
+            std::cout<<"Pyramid level "<<level<<" (downsampling factor "<<(1u << level)<<")"<<std::endl;
+
+            m_ReferenceImage = this->ResampleOnPyramidLevel(estimate, referenceImage, 1u << level);
+            this->InitializeX();
+            this->Reconstruct();
+
+            estimate = m_Output;
+        }
+
+        m_H_Filter->SetCacheFileName(cacheFileName);
+        m_ComputeSimulations = computeSimulations;
+
+        // The reference grid is initialized with the upsampled result of the previous level
+        std::cout<<"Pyramid level 0"<<std::endl;
+        m_ReferenceImage = this->ResampleOnPyramidLevel(estimate, referenceImage, 1);
+        this->InitializeX();
+        this->Reconstruct();
+
+        m_ReferenceImage = referenceImage;
+    }
+    else
+    {
+        this->Reconstruct();
+    }
+}
+//-----------------------------------------------------------------------------------------------------------
+void SuperResolutionFilter::Reconstruct()
+{
+    if(m_BlockSize > 0)
+    {
+        this->ReconstructByBlocks();
+        return;
+    }
 
     // H computation
     m_H_Filter->SetImages(m_Images);
@@ -86,65 +152,311 @@ void SuperResolutionFilter::Update()
 
 
     // such as Min(f(y - H*x) + lambda g(x))
-    vnl_vector< PrecisionType > HtY;
-    // Premult H with Y
-    //Since m_H is a pointer to H matrix H_Filter don't need to return it !!
-    m_H->pre_mult(*m_Y,HtY);
+    std::cout<<"Start minimization... "<<std::endl;
+    this->Minimize(m_H, *m_Y, m_ReferenceImage->GetLargestPossibleRegion().GetSize(), m_X, true);
 
+    // convert X into float (maybe not needed)
+    m_Xfloat = vnl_matops::d2f(m_X);
 
-    // Cost Function
-    VNLCostFunction CostFunction = VNLCostFunction(m_X.size());
+    if(m_ComputeSimulations)
+    {
+        this->SimulateLRImages();
+    }
 
-    CostFunction.GetCostFunction()->SetH(*m_H);//Set H
-    CostFunction.GetCostFunction()->SetLambda(m_Lambda);
-    CostFunction.GetCostFunction()->SetY(*m_Y);
-    CostFunction.GetCostFunction()->SetSRSize(m_ReferenceImage->GetLargestPossibleRegion().GetSize());
 
-    CostFunction.GetCostFunction()->SetHtY(HtY); //Set the precomputed HtY
+     m_X.clear();
 
-   vnl_conjugate_gradient optimizer(CostFunction);
-   optimizer.set_max_function_evals(20);
+    // Generate the output
 
-    // Start minimization
+    this->GenerateOutputData();
 
-    std::cout<<"Start minimization... "<<std::endl;
-    optimizer.set_verbose(true);
-    optimizer.minimize(m_X);
+   // clear all (H and Y are kept for the incremental update of the next loop)
+    if(!m_H_Filter->GetIncrementalUpdate())
+    {
+        m_H->Clear();
+        m_Y->clear();
+    }
 
-    //display optimizer result
-    optimizer.diagnose_outcome();
 
-    // convert X into float (maybe not needed)
+
+}
+
+//-----------------------------------------------------------------------------------------------------------
+void SuperResolutionFilter::ReconstructByBlocks()
+{
+    const ImageType::SizeType size = m_ReferenceImage->GetLargestPossibleRegion().GetSize();
+
+    // The cores of the blocks tile the grid, the blocks are their cores extended by the overlap (within the grid)
+    std::vector< RegionType > cores;
+    std::vector< RegionType > blocks;
+
+    ImageType::IndexType coreIndex;
+    for(coreIndex[2] = 0; coreIndex[2] < (long)size[2]; coreIndex[2] += m_BlockSize)
+    {
+        for(coreIndex[1] = 0; coreIndex[1] < (long)size[1]; coreIndex[1] += m_BlockSize)
+        {
+            for(coreIndex[0] = 0; coreIndex[0] < (long)size[0]; coreIndex[0] += m_BlockSize)
+            {
+                ImageType::SizeType  coreSize;
+                ImageType::IndexType blockIndex;
+                ImageType::SizeType  blockSize;
+
+                for(unsigned int i = 0; i < 3; i++)
+                {
+                    coreSize[i] = std::min< long >(m_BlockSize, size[i] - coreIndex[i]);
+
+                    long first = std::max< long >(0, coreIndex[i] - (long)m_BlockOverlap);
+                    long end   = std::min< long >(size[i], coreIndex[i] + coreSize[i] + m_BlockOverlap);
+
+                    blockIndex[i] = first;
+                    blockSize[i]  = end - first;
+                }
+
+                cores.push_back(RegionType(coreIndex, coreSize));
+                blocks.push_back(RegionType(blockIndex, blockSize));
+            }
+        }
+    }
+
+    const long numberOfBlocks = blocks.size();
+    std::cout<<"Block-wise reconstruction: "<<numberOfBlocks<<" blocks of "<<m_BlockSize<<" voxels (overlap "<<m_BlockOverlap<<")"<<std::endl;
+
+    // The filters computing H on the blocks are set up before the parallel loop (ITK pipelines are not thread safe).
+    // They share the LR images, the transforms and the PSF, but not the mask objects (whose bounds are computed lazily).
+    // Each of them only keeps the rows of the LR voxels whose PSF may reach its block, so that H and Y are bounded by the block.
+    std::vector< H_Filter::Pointer >           hFilters(numberOfBlocks);
+    std::vector< vnl_vector< double > >        blockX(numberOfBlocks);
+    std::vector< MaskType::Pointer >           masks(m_NumberOfImages);
+
+    for(long b = 0; b < numberOfBlocks; b++)
+    {
+        for(unsigned int i = 0; i < m_NumberOfImages; i++)
+        {
+            masks[i] = MaskType::New();
+            masks[i]->SetImage(m_Masks[i]);
+        }
+
+        ImageType::Pointer blockReference = this->ExtractBlock(m_ReferenceImage, blocks[b]);
+
+        // The block of the current estimate initializes the minimization
+        blockX[b].set_size(blocks[b].GetNumberOfPixels());
+        const PixelType * buffer = blockReference->GetBufferPointer();
+        for(unsigned int i = 0; i < blockX[b].size(); i++)
+        {
+            blockX[b][i] = buffer[i];
+        }
+
+        hFilters[b] = H_Filter::New();
+        hFilters[b]->SetImages(m_Images);
+        hFilters[b]->SetTransforms(m_Transforms);
+        hFilters[b]->SetInverseTransforms(m_InverseTransforms);
+        hFilters[b]->SetMasks(masks);
+        hFilters[b]->SetPSF(m_H_Filter->GetPSF());
+        hFilters[b]->SetReferenceImage(blockReference);
+        hFilters[b]->SetRowSelection(true);
+    }
+
+    // Blocks are independent: each one is solved by a single thread (the nested parallel regions of H computation and of
+    // the cost function are serialized), which bounds the memory to one sub-matrix of H per thread.
+    long b;
+
+    #pragma omp parallel for private(b) schedule(dynamic)
+    for(b = 0; b < numberOfBlocks; b++)
+    {
+        btk::SparseMatrix< PrecisionType > H;
+        vnl_vector< PrecisionType > Y;
+
+        hFilters[b]->SetH(&H);
+        hFilters[b]->SetY(&Y);
+        hFilters[b]->Update();
+
+        // Only the rows of the selected LR voxels whose PSF actually reaches the block are kept
+        std::vector< btk::SparseMatrix< PrecisionType >::IndexType > rows;
+        H.RemoveEmptyRows(rows);
+
+        vnl_vector< PrecisionType > blockY(rows.size());
+        for(unsigned int r = 0; r < rows.size(); r++)
+        {
+            blockY[r] = Y[rows[r]];
+        }
+        Y.clear();
+
+        // A block reached by no LR voxel keeps its initial estimate
+        if(!rows.empty())
+        {
+            this->Minimize(&H, blockY, blocks[b].GetSize(), blockX[b], false);
+        }
+
+        hFilters[b] = NULL;
+    }
+
+    // Blending: the weight of a voxel of a block increases linearly over the overlap, from the faces of the block
+    // shared with another block to its core (the faces on the border of the grid are not blended).
+    vnl_vector< double > sum(m_X.size(), 0.0);
+    vnl_vector< double > weights(m_X.size(), 0.0);
+
+    for(b = 0; b < numberOfBlocks; b++)
+    {
+        const ImageType::IndexType blockIndex = blocks[b].GetIndex();
+        const ImageType::SizeType  blockSize  = blocks[b].GetSize();
+
+        std::vector< double > axisWeights[3];
+        for(unsigned int i = 0; i < 3; i++)
+        {
+            const long lowerOverlap = cores[b].GetIndex()[i] - blockIndex[i];
+            const long upperOverlap = (blockIndex[i] + blockSize[i]) - (cores[b].GetIndex()[i] + cores[b].GetSize()[i]);
+
+            axisWeights[i].resize(blockSize[i], 1.0);
+            for(long k = 0; k < (long)blockSize[i]; k++)
+            {
+                if(lowerOverlap > 0)
+                {
+                    axisWeights[i][k] = std::min(axisWeights[i][k], (k + 1.0) / (m_BlockOverlap + 1.0));
+                }
+                if(upperOverlap > 0)
+                {
+                    axisWeights[i][k] = std::min(axisWeights[i][k], (blockSize[i] - k) / (m_BlockOverlap + 1.0));
+                }
+            }
+        }
+
+        unsigned int blockLinearIndex = 0;
+        for(unsigned int z = 0; z < blockSize[2]; z++)
+        {
+            for(unsigned int y = 0; y < blockSize[1]; y++)
+            {
+                unsigned int linearIndex = blockIndex[0] + (blockIndex[1] + y)*size[0] + (blockIndex[2] + z)*size[0]*size[1];
+
+                for(unsigned int x = 0; x < blockSize[0]; x++, linearIndex++, blockLinearIndex++)
+                {
+                    double weight = axisWeights[0][x] * axisWeights[1][y] * axisWeights[2][z];
+
+                    sum[linearIndex]     += weight * blockX[b][blockLinearIndex];
+                    weights[linearIndex] += weight;
+                }
+            }
+        }
+
+        blockX[b].clear();
+    }
+
+    for(unsigned int i = 0; i < m_X.size(); i++)
+    {
+        m_X[i] = sum[i] / weights[i];
+    }
+
     m_Xfloat = vnl_matops::d2f(m_X);
 
+    // H is never built on the whole grid
     if(m_ComputeSimulations)
     {
-        this->SimulateLRImages();
+        std::cout<<"Simulated images are not computed by the block-wise reconstruction."<<std::endl;
     }
 
+    m_X.clear();
 
-     m_X.clear();
+    this->GenerateOutputData();
+}
+//-----------------------------------------------------------------------------------------------------------
+void SuperResolutionFilter::Minimize(const btk::SparseMatrix< PrecisionType > * H, vnl_vector< PrecisionType > & Y,
+                                     const ImageType::SizeType & size, vnl_vector< double > & x, bool verbose) const
+{
+    // Premult H with Y
+    vnl_vector< PrecisionType > HtY;
+    H->TransposeMultiply(Y,HtY);
 
-    // Generate the output
+    // Cost Function
+    VNLCostFunction CostFunction = VNLCostFunction(x.size());
 
-    this->GenerateOutputData();
+    CostFunction.GetCostFunction()->SetH(H);//Set H (not copied)
+    CostFunction.GetCostFunction()->SetLambda(m_Lambda);
+    CostFunction.GetCostFunction()->SetY(Y);
+    CostFunction.GetCostFunction()->SetSRSize(size);
 
-   // clear all
-    m_H->clear();
-    m_Y->clear();
-    HtY.clear();
+    CostFunction.GetCostFunction()->SetHtY(HtY); //Set the precomputed HtY
 
+    vnl_conjugate_gradient optimizer(CostFunction);
+    optimizer.set_max_function_evals(20);
 
+    // Start minimization
+    optimizer.set_verbose(verbose);
+    optimizer.minimize(x);
 
+    //display optimizer result
+    if(verbose)
+    {
+        optimizer.diagnose_outcome();
+    }
 }
+//-----------------------------------------------------------------------------------------------------------
+SuperResolutionFilter::ImageType::Pointer SuperResolutionFilter::ExtractBlock(ImageType::Pointer image, const RegionType & region) const
+{
+    ImageType::PointType origin;
+    image->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+
+    ImageType::IndexType start;
+    start.Fill(0);
+
+    ImageType::Pointer block = ImageType::New();
+    block->SetRegions(RegionType(start, region.GetSize()));
+    block->SetOrigin(origin);
+    block->SetSpacing(image->GetSpacing());
+    block->SetDirection(image->GetDirection());
+    block->Allocate();
+
+    itk::ImageRegionConstIterator< ImageType > itImage(image, region);
+    itk::ImageRegionIterator< ImageType > itBlock(block, block->GetLargestPossibleRegion());
+
+    for(itImage.GoToBegin(), itBlock.GoToBegin(); !itImage.IsAtEnd(); ++itImage, ++itBlock)
+    {
+        itBlock.Set(itImage.Get());
+    }
 
+    return block;
+}
+//-----------------------------------------------------------------------------------------------------------
+SuperResolutionFilter::ImageType::Pointer SuperResolutionFilter::ResampleOnPyramidLevel(ImageType::Pointer image, ImageType::Pointer reference, unsigned int factor) const
+{
+    typedef itk::ResampleImageFilter< ImageType, ImageType >         ResampleFilterType;
+    typedef itk::LinearInterpolateImageFunction< ImageType, double > InterpolatorType;
+    typedef itk::IdentityTransform< double, 3 >                      IdentityTransformType;
+
+    ImageType::RegionType  referenceRegion = reference->GetLargestPossibleRegion();
+    ImageType::SizeType    size = referenceRegion.GetSize();
+    ImageType::SpacingType spacing = reference->GetSpacing();
+
+    // The first voxel of the downsampled grid is centered on the first factor^3 voxels of the reference grid
+    itk::ContinuousIndex< double, 3 > firstCenter;
+    for(unsigned int i = 0; i < 3; i++)
+    {
+        firstCenter[i] = referenceRegion.GetIndex()[i] + 0.5*(factor-1);
+        size[i]        = (size[i] + factor - 1) / factor;
+        spacing[i]    *= factor;
+    }
+
+    ImageType::PointType origin;
+    reference->TransformContinuousIndexToPhysicalPoint(firstCenter, origin);
+
+    ResampleFilterType::Pointer resampler = ResampleFilterType::New();
+    resampler->SetInput(image);
+    resampler->SetTransform(IdentityTransformType::New());
+    resampler->SetInterpolator(InterpolatorType::New());
+    resampler->SetSize(size);
+    resampler->SetOutputOrigin(origin);
+    resampler->SetOutputSpacing(spacing);
+    resampler->SetOutputDirection(reference->GetDirection());
+    resampler->SetDefaultPixelValue(0);
+    resampler->Update();
+
+    return resampler->GetOutput();
+}
 //-----------------------------------------------------------------------------------------------------------
 void SuperResolutionFilter::SimulateLRImages()
 {
     // H should previoulsy be computed
     vnl_vector< PrecisionType > simY;
 
-    m_H->mult(m_Xfloat,simY);
+    m_H->Multiply(m_Xfloat,simY);
 
     //Temporary variables
 
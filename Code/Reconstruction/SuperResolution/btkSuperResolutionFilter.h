@@ -42,6 +42,9 @@
 #include "itkImageMaskSpatialObject.h"
 #include "itkTransform.h"
 #include "itkImageRegionIteratorWithIndex.h"
+#include "itkResampleImageFilter.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "itkIdentityTransform.h"
 #include "vnl/vnl_vector.h"
 #include "vnl/algo/vnl_conjugate_gradient.h"
 #include "vnl/vnl_matops.h"
@@ -147,6 +150,26 @@ class SuperResolutionFilter: public itk::Object
         /** Set Lambda */
         btkSetMacro(Lambda,float);
 
+        /**
+         * @brief Set the number of levels of the coarse-to-fine pyramid (default 1: no pyramid).
+         * Level l is reconstructed on the grid of the reference image downsampled by 2^l, and its result, upsampled,
+         * initializes the next (finer) level.
+         */
+        btkSetMacro(NumberOfPyramidLevels,unsigned int);
+        btkGetMacro(NumberOfPyramidLevels,unsigned int);
+
+        /**
+         * @brief Set the size (in voxels) of the blocks of the block-wise reconstruction (default 0: the whole grid at once).
+         * The HR grid is split into blocks, each one reconstructed independently (blocks run concurrently) with only the rows
+         * of H of the LR voxels reaching it, and the blocks are blended in their overlaps.
+         */
+        btkSetMacro(BlockSize,unsigned int);
+        btkGetMacro(BlockSize,unsigned int);
+
+        /** Set the overlap (in voxels) added on each side of the blocks (default 8) */
+        btkSetMacro(BlockOverlap,unsigned int);
+        btkGetMacro(BlockOverlap,unsigned int);
+
         /** Use simulated images */
 
         void ComputeSimulatedImages(bool _b)
@@ -185,8 +208,47 @@ class SuperResolutionFilter: public itk::Object
             m_H_Filter->SetPSF(_p);
         }
 
+        /** Set the file caching the H matrix (see SRHMatrixComputation::SetCacheFileName) */
+        void SetHMatrixCacheFileName(const std::string & _fileName)
+        {
+            m_H_Filter->SetCacheFileName(_fileName);
+        }
+
+        /**
+         * Keep H between two updates and only rebuild the slices whose corners have moved by more than
+         * the tolerance in mm (see SRHMatrixComputation::SetIncrementalUpdate)
+         */
+        void SetHMatrixIncrementalUpdate(bool _b, double _tolerance = 0.0)
+        {
+            m_H_Filter->SetIncrementalUpdate(_b);
+            m_H_Filter->SetTransformTolerance(_tolerance);
+        }
+
 
     protected:
+        /** Fill X with the intensities of the reference image */
+        virtual void InitializeX();
+        /** Compute H on the grid of the reference image, minimize the cost function starting from X and generate the output */
+        virtual void Reconstruct();
+        /** Reconstruct the grid of the reference image block by block (see SetBlockSize) and blend the blocks in their overlaps */
+        virtual void ReconstructByBlocks();
+        /**
+         * @brief Minimize the cost function of H and Y on a grid, starting from x.
+         * @param H observation matrix
+         * @param Y LR intensities (one per row of H)
+         * @param size size of the grid (x has one element per voxel)
+         * @param x initial estimate, and solution on return
+         * @param verbose display the iterations of the optimizer
+         */
+        void Minimize(const btk::SparseMatrix< PrecisionType > * H, vnl_vector< PrecisionType > & Y, const ImageType::SizeType & size,
+                      vnl_vector< double > & x, bool verbose) const;
+        /** Copy a region of an image into a new image (starting at index 0, with the physical space of the region) */
+        ImageType::Pointer ExtractBlock(ImageType::Pointer image, const RegionType & region) const;
+        /**
+         * @brief Resample an image (linear interpolation) on the grid of a reference image downsampled by a factor.
+         * The voxel k of the downsampled grid covers the voxels k*factor to (k+1)*factor-1 of the reference grid.
+         */
+        ImageType::Pointer ResampleOnPyramidLevel(ImageType::Pointer image, ImageType::Pointer reference, unsigned int factor) const;
         /** Simulate LR Images with the precalculated H */
         virtual void SimulateLRImages();
         /** Generate the output image */
@@ -224,7 +286,7 @@ class SuperResolutionFilter: public itk::Object
 
         btk::PSF::Pointer                       m_PSF;
 
-        vnl_sparse_matrix< PrecisionType >*     m_H;
+        btk::SparseMatrix< PrecisionType >*     m_H;
 
         vnl_vector< PrecisionType >*            m_Y;
 
@@ -236,6 +298,12 @@ class SuperResolutionFilter: public itk::Object
 
         float                                   m_Lambda;
 
+        unsigned int                            m_NumberOfPyramidLevels;
+
+        unsigned int                            m_BlockSize;
+
+        unsigned int                            m_BlockOverlap;
+
 
 };//end class
 
@@ -0,0 +1,187 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_OBSERVATION_MATRIX_CACHE_H
+#define BTK_OBSERVATION_MATRIX_CACHE_H
+
+// ITK includes
+#include "itkImageBase.h"
+#include "itkTransformBase.h"
+#include "vnl/vnl_vector.h"
+
+// Local includes
+#include "btkMacro.h"
+#include "btkSparseMatrix.h"
+
+// STL includes
+#include "string"
+#include "vector"
+#include "sstream"
+#include "iostream"
+#include "fstream"
+#include "cstdio"
+#include "cstring"
+#include "algorithm"
+#include "stdint.h"
+
+namespace btk
+{
+
+/**
+ * @class ObservationMatrixCache
+ * @brief Binary file storing the observation matrix H (and optionally the vector Y of the low-resolution intensities),
+ * so that a super-resolution run on identical inputs does not need to compute H again.
+ *
+ * The file starts with a key describing everything H depends on: the grid of the high-resolution image, the geometry
+ * of the low-resolution images, the type of PSF, a hash of the (slice) transforms and a hash of any other data (masks,
+ * intensities...). The CSR arrays of H are stored after the key. The file is only used when its key is identical to the
+ * current one, and its arrays are then read directly into the matrix.
+ *
+ * Typical use: set the key, try Read, and if it fails compute H and call Write.
+ * @author François Rousseau
+ * @ingroup Reconstruction
+ */
+template < typename TValue >
+class ObservationMatrixCache
+{
+    public:
+        typedef ObservationMatrixCache< TValue >    Self;
+        typedef TValue                              ValueType;
+        typedef btk::SparseMatrix< TValue >         MatrixType;
+        typedef vnl_vector< TValue >                VectorType;
+        typedef itk::ImageBase< 3 >                 GeometryType;
+        typedef itk::TransformBase                  TransformType;
+
+        /**
+         * @brief Constructor.
+         * @param fileName Name of the cache file
+         */
+        ObservationMatrixCache(const std::string & fileName);
+
+        /**
+         * @brief Set the grid of the high-resolution image (size, origin, spacing and direction).
+         */
+        void SetHRGeometry(const GeometryType * image);
+
+        /**
+         * @brief Add the geometry of a low-resolution image (its largest possible region, origin, spacing and direction).
+         */
+        void AddLRGeometry(const GeometryType * image);
+
+        /**
+         * @brief Add the region of a low-resolution image actually used to compute H (e.g. the bounding box of its mask).
+         */
+        void AddLRRegion(const GeometryType::RegionType & region);
+
+        /**
+         * @brief Set the type of PSF (e.g. the name of the PSF class, or its numeric identifier).
+         */
+        void SetPSFType(const std::string & psf);
+
+        /**
+         * @brief Add a transform (parameters and fixed parameters) to the hash of the transforms.
+         */
+        void AddTransform(const TransformType * transform);
+
+        /**
+         * @brief Add any other data H or Y depends on (masks, intensities, padding value...) to the hash of the data.
+         * @param data Pointer to the data
+         * @param size Size of the data in bytes
+         */
+        void AddData(const void * data, std::size_t size);
+
+        /**
+         * @brief Read H (and Y) from the cache file.
+         * @param H Matrix receiving the cached matrix (finalized)
+         * @param Y Vector receiving the cached Y (ignored if NULL)
+         * @return true if the file exists, its key is the current key, and it contains Y when Y is requested
+         */
+        bool Read(MatrixType & H, VectorType * Y = NULL) const;
+
+        /**
+         * @brief Write H (and Y) to the cache file, with the current key. An existing file is replaced.
+         * @param H Finalized matrix
+         * @param Y Vector of the low-resolution intensities (not stored if NULL)
+         */
+        void Write(const MatrixType & H, const VectorType * Y = NULL) const;
+
+        /** @brief Name of the cache file. */
+        const std::string & GetFileName() const { return m_FileName; }
+
+    protected:
+
+        /**
+         * @brief Serialize the key (geometries, PSF type and hashes) as it is stored in the file.
+         */
+        std::string GetKey() const;
+
+        /**
+         * @brief Append raw bytes to a serialized block.
+         */
+        template < typename T >
+        static void Append(std::string & block, const T & value)
+        {
+            block.append(reinterpret_cast< const char * >(&value), sizeof(T));
+        }
+
+        /**
+         * @brief Update a 64 bits FNV-1a hash with a block of bytes.
+         */
+        static void Hash(uint64_t & hash, const void * data, std::size_t size);
+
+        /**
+         * @brief Serialize the geometry of an image (region, origin, spacing and direction).
+         */
+        static void AppendGeometry(std::string & block, const GeometryType * image);
+
+    private:
+
+        std::string     m_FileName;
+
+        std::string     m_HRGeometry;       /**< serialized grid of the HR image */
+        std::string     m_LRGeometries;     /**< serialized geometries of the LR images */
+        std::string     m_PSFType;
+
+        uint64_t        m_TransformHash;
+        uint64_t        m_DataHash;
+};
+
+} // namespace btk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "btkObservationMatrixCache.txx"
+#endif
+
+#endif // BTK_OBSERVATION_MATRIX_CACHE_H
@@ -0,0 +1,380 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkObservationMatrixCache.h"
+
+namespace btk
+{
+
+// Cache file layout (native byte order):
+//   magic "BTKHMAT2" | uint32 size of TValue | uint64 size of the key | key |
+//   uint32 rows | uint32 cols | uint64 number of values | uint32 has Y | padding |
+//   uint64 row pointers [rows+1] | uint32 columns [values] | padding | TValue values [values] | TValue Y [rows] (if has Y)
+// The padding aligns the arrays on 8 bytes.
+static const char BTK_OBSERVATION_MATRIX_CACHE_MAGIC[8] = { 'B','T','K','H','M','A','T','2' };
+static const std::size_t BTK_OBSERVATION_MATRIX_CACHE_ALIGNMENT = 8;
+
+/**
+ * @brief Number of padding bytes needed after offset to reach the alignment of the arrays.
+ */
+inline std::size_t ObservationMatrixCachePadding(uint64_t offset)
+{
+    return (BTK_OBSERVATION_MATRIX_CACHE_ALIGNMENT - offset % BTK_OBSERVATION_MATRIX_CACHE_ALIGNMENT) % BTK_OBSERVATION_MATRIX_CACHE_ALIGNMENT;
+}
+
+template < typename TValue >
+ObservationMatrixCache< TValue >::ObservationMatrixCache(const std::string & fileName) : m_FileName(fileName)
+{
+    // FNV-1a offset basis
+    m_TransformHash = 14695981039346656037ULL;
+    m_DataHash      = 14695981039346656037ULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::Hash(uint64_t & hash, const void * data, std::size_t size)
+{
+    const unsigned char * bytes = static_cast< const unsigned char * >(data);
+
+    for(std::size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::AppendGeometry(std::string & block, const GeometryType * image)
+{
+    GeometryType::RegionType region = image->GetLargestPossibleRegion();
+
+    for(unsigned int i = 0; i < 3; i++)
+    {
+        Append(block, (int64_t)region.GetIndex()[i]);
+        Append(block, (uint64_t)region.GetSize()[i]);
+        Append(block, (double)image->GetOrigin()[i]);
+        Append(block, (double)image->GetSpacing()[i]);
+
+        for(unsigned int j = 0; j < 3; j++)
+        {
+            Append(block, (double)image->GetDirection()[i][j]);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::SetHRGeometry(const GeometryType * image)
+{
+    m_HRGeometry.clear();
+    AppendGeometry(m_HRGeometry, image);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::AddLRGeometry(const GeometryType * image)
+{
+    AppendGeometry(m_LRGeometries, image);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::AddLRRegion(const GeometryType::RegionType & region)
+{
+    for(unsigned int i = 0; i < 3; i++)
+    {
+        Append(m_LRGeometries, (int64_t)region.GetIndex()[i]);
+        Append(m_LRGeometries, (uint64_t)region.GetSize()[i]);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::SetPSFType(const std::string & psf)
+{
+    m_PSFType = psf;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::AddTransform(const TransformType * transform)
+{
+    const TransformType::ParametersType & parameters      = transform->GetParameters();
+    const TransformType::ParametersType & fixedParameters = transform->GetFixedParameters();
+
+    std::string name = transform->GetNameOfClass();
+    Hash(m_TransformHash, name.c_str(), name.size());
+
+    for(unsigned int i = 0; i < parameters.Size(); i++)
+    {
+        double value = parameters[i];
+        Hash(m_TransformHash, &value, sizeof(double));
+    }
+    for(unsigned int i = 0; i < fixedParameters.Size(); i++)
+    {
+        double value = fixedParameters[i];
+        Hash(m_TransformHash, &value, sizeof(double));
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::AddData(const void * data, std::size_t size)
+{
+    Hash(m_DataHash, data, size);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+std::string ObservationMatrixCache< TValue >::GetKey() const
+{
+    std::string key;
+
+    Append(key, (uint64_t)m_HRGeometry.size());
+    key += m_HRGeometry;
+    Append(key, (uint64_t)m_LRGeometries.size());
+    key += m_LRGeometries;
+    Append(key, (uint64_t)m_PSFType.size());
+    key += m_PSFType;
+    Append(key, m_TransformHash);
+    Append(key, m_DataHash);
+
+    return key;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+bool ObservationMatrixCache< TValue >::Read(MatrixType & H, VectorType * Y) const
+{
+    std::ifstream file(m_FileName.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+
+    if(!file.is_open())
+    {
+        return false;
+    }
+    const uint64_t fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    const std::string key = this->GetKey();
+
+    // header
+    const std::size_t headerSize = sizeof(BTK_OBSERVATION_MATRIX_CACHE_MAGIC) + sizeof(uint32_t) + sizeof(uint64_t);
+    const std::size_t sizesSize  = 3*sizeof(uint32_t) + sizeof(uint64_t);
+
+    if(fileSize < headerSize + key.size() + sizesSize)
+    {
+        return false;
+    }
+
+    std::string header(headerSize + key.size() + sizesSize, '\0');
+    if(!file.read(&header[0], header.size()))
+    {
+        return false;
+    }
+
+    const char * data = header.data();
+    uint32_t valueSize;
+    uint64_t keySize;
+    std::memcpy(&valueSize, data + sizeof(BTK_OBSERVATION_MATRIX_CACHE_MAGIC), sizeof(uint32_t));
+    std::memcpy(&keySize, data + sizeof(BTK_OBSERVATION_MATRIX_CACHE_MAGIC) + sizeof(uint32_t), sizeof(uint64_t));
+
+    if(std::memcmp(data, BTK_OBSERVATION_MATRIX_CACHE_MAGIC, sizeof(BTK_OBSERVATION_MATRIX_CACHE_MAGIC)) != 0 ||
+       valueSize != sizeof(TValue) || keySize != key.size() || std::memcmp(data + headerSize, key.data(), key.size()) != 0)
+    {
+        std::cout<<"The cache file "<<m_FileName<<" does not match the current inputs.\n";
+        return false;
+    }
+    data += headerSize + key.size();
+
+    uint32_t rows, cols, hasY;
+    uint64_t numberOfValues;
+    std::memcpy(&rows, data, sizeof(uint32_t));                                     data += sizeof(uint32_t);
+    std::memcpy(&cols, data, sizeof(uint32_t));                                     data += sizeof(uint32_t);
+    std::memcpy(&numberOfValues, data, sizeof(uint64_t));                           data += sizeof(uint64_t);
+    std::memcpy(&hasY, data, sizeof(uint32_t));                                     data += sizeof(uint32_t);
+
+    const uint64_t arraysOffset  = headerSize + key.size() + sizesSize + ObservationMatrixCachePadding(headerSize + key.size() + sizesSize);
+    const uint64_t columnsEnd    = arraysOffset + ((uint64_t)rows+1)*sizeof(uint64_t) + numberOfValues*sizeof(uint32_t);
+    const uint64_t valuesOffset  = columnsEnd + ObservationMatrixCachePadding(columnsEnd);
+    const uint64_t expectedSize  = valuesOffset + numberOfValues*sizeof(TValue) + (hasY ? (uint64_t)rows*sizeof(TValue) : 0);
+
+    if(fileSize != expectedSize)
+    {
+        std::cout<<"The cache file "<<m_FileName<<" is truncated or corrupted.\n";
+        return false;
+    }
+    if(Y != NULL && !hasY)
+    {
+        return false;
+    }
+
+    // the arrays are read directly in the vectors given to H, so that the memory is not used twice
+    std::vector< typename MatrixType::OffsetType > rowPointers((uint64_t)rows+1);
+    std::vector< typename MatrixType::IndexType > columns(numberOfValues);
+    std::vector< TValue > values(numberOfValues);
+
+    file.seekg(arraysOffset, std::ios::beg);
+    if(sizeof(typename MatrixType::OffsetType) == sizeof(uint64_t))
+    {
+        file.read(reinterpret_cast< char * >(&rowPointers[0]), rowPointers.size()*sizeof(uint64_t));
+    }
+    else
+    {
+        // the row pointers have to be converted when OffsetType is not 64 bits wide
+        std::vector< uint64_t > storedRowPointers(rowPointers.size());
+        file.read(reinterpret_cast< char * >(&storedRowPointers[0]), storedRowPointers.size()*sizeof(uint64_t));
+        std::copy(storedRowPointers.begin(), storedRowPointers.end(), rowPointers.begin());
+    }
+    if(numberOfValues > 0)
+    {
+        file.read(reinterpret_cast< char * >(&columns[0]), numberOfValues*sizeof(uint32_t));
+        file.seekg(valuesOffset, std::ios::beg);
+        file.read(reinterpret_cast< char * >(&values[0]), numberOfValues*sizeof(TValue));
+    }
+    if(Y != NULL)
+    {
+        Y->set_size(rows);
+        if(rows > 0)
+        {
+            file.read(reinterpret_cast< char * >(Y->data_block()), rows*sizeof(TValue));
+        }
+    }
+    if(!file)
+    {
+        std::cout<<"The cache file "<<m_FileName<<" could not be read.\n";
+        return false;
+    }
+
+    H.SwapArrays(rows, cols, rowPointers, columns, values);
+
+    std::cout<<"Observation matrix H read from "<<m_FileName<<" ("<<numberOfValues<<" values).\n";
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+template < typename TValue >
+void ObservationMatrixCache< TValue >::Write(const MatrixType & H, const VectorType * Y) const
+{
+    if(!H.IsFinalized())
+    {
+        btkException("ObservationMatrixCache::Write: the matrix has to be finalized.");
+    }
+    if(Y != NULL && Y->size() != H.GetNumberOfRows())
+    {
+        btkException("ObservationMatrixCache::Write: the size of Y does not match the number of rows of H.");
+    }
+
+    // the file is written under a temporary name, and then renamed, so that an interrupted run does not leave a partial file
+    const std::string temporaryFileName = m_FileName + ".tmp";
+    std::ofstream file(temporaryFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if(!file.is_open())
+    {
+        std::stringstream message;
+        message << "ObservationMatrixCache: unable to write the file " << temporaryFileName << ".";
+        btkException(message.str());
+    }
+
+    const std::string key = this->GetKey();
+
+    std::string header(BTK_OBSERVATION_MATRIX_CACHE_MAGIC, sizeof(BTK_OBSERVATION_MATRIX_CACHE_MAGIC));
+    Append(header, (uint32_t)sizeof(TValue));
+    Append(header, (uint64_t)key.size());
+    header += key;
+    Append(header, (uint32_t)H.GetNumberOfRows());
+    Append(header, (uint32_t)H.GetNumberOfColumns());
+    Append(header, (uint64_t)H.GetNumberOfNonZeros());
+    Append(header, (uint32_t)(Y != NULL));
+    header.append(ObservationMatrixCachePadding(header.size()), '\0');
+    file.write(header.data(), header.size());
+
+    std::vector< uint64_t > rowPointers(H.GetNumberOfRows()+1);
+    for(unsigned int r = 0; r < H.GetNumberOfRows(); r++)
+    {
+        rowPointers[r] = H.GetRowBegin(r);
+    }
+    rowPointers[H.GetNumberOfRows()] = H.GetNumberOfNonZeros();
+    file.write(reinterpret_cast< const char * >(&rowPointers[0]), rowPointers.size()*sizeof(uint64_t));
+
+    if(H.GetNumberOfNonZeros() > 0)
+    {
+        file.write(reinterpret_cast< const char * >(H.GetColumns()), H.GetNumberOfNonZeros()*sizeof(uint32_t));
+
+        const std::string padding(ObservationMatrixCachePadding(header.size() + rowPointers.size()*sizeof(uint64_t)
+                                                                + H.GetNumberOfNonZeros()*sizeof(uint32_t)), '\0');
+        file.write(padding.data(), padding.size());
+        file.write(reinterpret_cast< const char * >(H.GetValues()), H.GetNumberOfNonZeros()*sizeof(TValue));
+    }
+    if(Y != NULL && Y->size() > 0)
+    {
+        file.write(reinterpret_cast< const char * >(Y->data_block()), Y->size()*sizeof(TValue));
+    }
+
+    file.close();
+
+    if(file.fail())
+    {
+        std::remove(temporaryFileName.c_str());
+        std::stringstream message;
+        message << "ObservationMatrixCache: error while writing the file " << temporaryFileName << ".";
+        btkException(message.str());
+    }
+
+    // rename does not replace an existing file on every system
+    if(std::rename(temporaryFileName.c_str(), m_FileName.c_str()) != 0 &&
+       (std::remove(m_FileName.c_str()) != 0 || std::rename(temporaryFileName.c_str(), m_FileName.c_str()) != 0))
+    {
+        std::stringstream message;
+        message << "ObservationMatrixCache: unable to rename " << temporaryFileName << " to " << m_FileName << ".";
+        btkException(message.str());
+    }
+
+    std::cout<<"Observation matrix H written to "<<m_FileName<<".\n";
+}
+
+} // namespace btk
@@ -48,6 +48,7 @@
 #include "itkNeighborhoodAlgorithm.h"
 #include "itkSize.h"
 #include "btkUserMacro.h"
+#include "btkPSFKernelCache.h"
 #include "itkImageMaskSpatialObject.h"
 #include "btkSliceBySliceTransformBase.h"
 
@@ -298,6 +299,21 @@ protected:
    * */
   void GenerateData();
 
+  /** Geometry of the injection of a slice of an input image. */
+  struct InjectedSlice
+  {
+    unsigned int                    image;             // input image
+    unsigned int                    slice;             // slice of the input image
+    VnlVectorType                   directions[3];     // transformed ijk directions of the input image (orientation of the PSF)
+    SizeType                        radius;            // radius of the support of the PSF (in output voxels)
+    const btk::SeparablePSFKernel  *kernel;            // PSF
+    long                            firstOutputSlice;  // first output slice the slice is injected into
+    long                            lastOutputSlice;   // last output slice the slice is injected into
+  };
+
+  /** Compute the geometry of the injection of every slice of the input images (in the order of the images and of their slices). */
+  void InitializeInjectedSlices( const FloatImageType * outputImage, std::vector< InjectedSlice > & slices );
+
   /** This method overrides the itkImageToImageFilter's
    *  This method do nothing, we don't want to verify if inputs are in the same physical space
    * */
@@ -323,6 +339,8 @@ private:
   IndexType                   m_OutputStartIndex;  // output image start index
   bool                        m_UseReferenceImage;
 
+  btk::PSFKernelCache         m_PSFKernels;        // tabulated Gaussian PSF of the input spacings
+
 };
 
 
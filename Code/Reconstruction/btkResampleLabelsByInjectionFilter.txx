@@ -49,10 +49,17 @@
 #include "itkNeighborhoodIterator.h"
 #include "itkNeighborhoodAlgorithm.h"
 #include "itkSpecialCoordinatesImage.h"
-#include "itkGaussianSpatialFunction.h"
+#include "itkContinuousIndex.h"
 
 #include "vnl/vnl_inverse.h"
 
+#include "algorithm"
+#include "cmath"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace btk
 {
 
@@ -164,8 +171,6 @@ ResampleLabelsByInjectionFilter<TInputImage,TOutputImage,TInterpolatorPrecisionT
   // Image of weights
   wtImage.resize( m_NumberOfClasses + 1 );
 
-  unsigned int im;
-
   // FIXME The last image ( wtImage[m_NumberOfClasses] ) is used to put the sum
   // (for normalization)
 
@@ -182,92 +187,52 @@ ResampleLabelsByInjectionFilter<TInputImage,TOutputImage,TInterpolatorPrecisionT
 
   }
 
-  // Create gaussian (psf)
-
-  typedef GaussianSpatialFunction< double, ImageDimension, PointType> GaussianFunctionType;
-  typename GaussianFunctionType::Pointer gaussian = GaussianFunctionType::New();
-
-  gaussian -> SetNormalized(false);
-
-  typedef FixedArray<double,ImageDimension> ArrayType;
+  std::vector< InjectedSlice > slices;
+  this -> InitializeInjectedSlices( outputPtr, slices );
 
-  ArrayType mean;
-  mean[0] = 0; mean[1] = 0; mean[2] = 0;
-  gaussian -> SetMean( mean  );
+  PixelType * sumBuffer = outputPtr -> GetBufferPointer();
 
-  ArrayType sigma;
-  double cst = 2*sqrt(2*log(2.0));
-
-  #pragma omp parallel for private(im) schedule(dynamic)
+  // The output is split into slabs of slices, every slab being filled by a single thread with
+  // the input voxels whose PSF support overlaps it, so that no output voxel is written by two
+  // threads and the injection is deterministic (see ResampleImageByInjectionFilter).
+  int numberOfSlabs = 1;
+#ifdef _OPENMP
+  numberOfSlabs = 2*omp_get_max_threads();
+#endif
+  numberOfSlabs = std::max(1, std::min(numberOfSlabs, (int)outputSize[2]));
 
-  for(im = 0; im < m_ImageArray.size(); im++)
+  int slab;
+  #pragma omp parallel for private(slab) schedule(dynamic)
+  for(slab = 0; slab < numberOfSlabs; slab++)
   {
-    // ijk directions for gaussian orientation
-    // TODO We should create a nex class, sth like oriented gaussian (orientations given by a reference
-    // image) to put all these calculations togheter and make the code more clear
-
-    DirectionType inputDirection = m_ImageArray[im] -> GetDirection();
-
-    PointType idir;
-    idir[0] =  inputDirection(0,0); idir[1] =  inputDirection(1,0); idir[2] =  inputDirection(2,0);
-
-    PointType jdir;
-    jdir[0] =  inputDirection(0,1); jdir[1] =  inputDirection(1,1); jdir[2] =  inputDirection(2,1);
-
-    PointType kdir;
-    kdir[0] =  inputDirection(0,2); kdir[1] =  inputDirection(1,2); kdir[2] =  inputDirection(2,2);
-
-    // Neighborhood iterators on output and weights
-
-    typename NeighborhoodIteratorType::RadiusType radius;
-
-    SpacingType inputSpacing = m_ImageArray[im] -> GetSpacing();
-
-    radius[0] = ceil(inputSpacing[2] / m_OutputSpacing[0]);
-    radius[1] = ceil(inputSpacing[2] / m_OutputSpacing[1]);
-    radius[2] = ceil(inputSpacing[2] / m_OutputSpacing[2]);
-
-    NeighborhoodIteratorType nbIt( radius, outputPtr, outputPtr -> GetLargestPossibleRegion() );
-    nbIt.NeedToUseBoundaryConditionOff();
-
-    NeighborhoodIteratorType nbWtIt( radius, wtImage[m_Labels[im]], wtImage[m_Labels[im]] -> GetLargestPossibleRegion() );
-    nbWtIt.NeedToUseBoundaryConditionOff();
-
-    // Division of outputImage into regions (for iteration over neighborhoods)
-    FaceCalculatorType faceCalculator;
-    FaceListType faceList;
-
-    faceList = faceCalculator( outputPtr, outputPtr -> GetLargestPossibleRegion(), radius);
-    typename FaceCalculatorType::FaceListType::iterator fit;
-    fit=faceList.begin();
-
-    // Change Gaussian parameters (in case of inputs with different spaces)
-    sigma[0] = inputSpacing[0]/cst;
-    sigma[1] = inputSpacing[1]/cst;
-    sigma[2] = inputSpacing[2]/cst;
+    long slabBegin = (long)outputSize[2] * slab / numberOfSlabs;
+    long slabEnd   = (long)outputSize[2] * (slab+1) / numberOfSlabs;
 
-    gaussian -> SetSigma( sigma );
+    IndexType outputIndex;
+    IndexType nbIndex;
+    PointType physicalPoint;
+    PointType nbPoint;
+    PointType rotPoint;
+    PointType transformedPoint;
 
-    IndexType inputIndex = m_InputImageRegion[im].GetIndex();
-    SizeType  inputSize  = m_InputImageRegion[im].GetSize();
-
-    for ( unsigned int i=inputIndex[2]; i < inputIndex[2] + inputSize[2]; i++ )
+    for(unsigned int s = 0; s < slices.size(); s++)
     {
-      // Extract rotation from affine metric to orient the PDF
-      VnlMatrixType NQd = m_Transform[im] -> GetSliceTransform(i) -> GetMatrix().GetVnlMatrix();
+      const InjectedSlice & injected = slices[s];
+
+      if ( injected.lastOutputSlice < slabBegin || injected.firstOutputSlice >= slabEnd )
+      {
+        continue;
+      }
 
-      VnlVectorType idirTransformed = NQd*idir.GetVnlVector();
-      VnlVectorType jdirTransformed = NQd*jdir.GetVnlVector();
-      VnlVectorType kdirTransformed = NQd*kdir.GetVnlVector();
+      unsigned int im = injected.image;
+      PixelType * wtBuffer = wtImage[m_Labels[im]] -> GetBufferPointer();
 
-      InputImageRegionType wholeSliceRegion;
- //     wholeSliceRegion = m_ImageArray[im] -> GetLargestPossibleRegion();
-      wholeSliceRegion = m_InputImageRegion[im];
+      InputImageRegionType wholeSliceRegion = m_InputImageRegion[im];
 
       IndexType  wholeSliceRegionIndex = wholeSliceRegion.GetIndex();
       SizeType   wholeSliceRegionSize = wholeSliceRegion.GetSize();
 
-      wholeSliceRegionIndex[2]= i;
+      wholeSliceRegionIndex[2]= injected.slice;
       wholeSliceRegionSize[2] = 1;
 
       wholeSliceRegion.SetIndex(wholeSliceRegionIndex);
@@ -275,80 +240,42 @@ ResampleLabelsByInjectionFilter<TInputImage,TOutputImage,TInterpolatorPrecisionT
 
       ConstIteratorType fixedIt( m_ImageArray[im], wholeSliceRegion);
 
-      IndexType fixedIndex;
-      IndexType outputIndex;
-      IndexType nbIndex;
-      PointType physicalPoint;
-      PointType nbPoint;
-      PointType diffPoint;
-      PointType rotPoint;
-      PointType transformedPoint;
-
-      double value;
-
       for(fixedIt.GoToBegin(); !fixedIt.IsAtEnd(); ++fixedIt)
       {
-        fixedIndex = fixedIt.GetIndex();
-        m_ImageArray[im] -> TransformIndexToPhysicalPoint( fixedIndex, physicalPoint );
+        m_ImageArray[im] -> TransformIndexToPhysicalPoint( fixedIt.GetIndex(), physicalPoint );
 
         transformedPoint = m_Transform[im] -> TransformPoint( physicalPoint);
         outputPtr -> TransformPhysicalPointToIndex( transformedPoint, outputIndex);
 
-        nbIt.SetLocation(outputIndex);
-        nbWtIt.SetLocation(outputIndex);
-
-        if ( (*fit).IsInside(outputIndex) )
+        // Support of the PSF, restricted to the output image and to the slab
+        long first[3], last[3];
+        for(unsigned int d = 0; d < 3; d++)
         {
-          for(unsigned int i=0; i<nbIt.Size(); i++)
-          {
-            nbIndex = nbIt.GetIndex(i);
-
-            outputPtr -> TransformIndexToPhysicalPoint( nbIndex, nbPoint );
-
-            VnlVectorType diffPoint = nbPoint.GetVnlVector() - transformedPoint.GetVnlVector();
-            rotPoint[0] = dot_product(diffPoint,idirTransformed);
-            rotPoint[1] = dot_product(diffPoint,jdirTransformed);
-            rotPoint[2] = dot_product(diffPoint,kdirTransformed);
-
-            value = gaussian->Evaluate( rotPoint );
-
-            nbIt.SetPixel(i, fixedIt.Get() *value + nbIt.GetPixel(i) );
-            nbWtIt.SetPixel(i, fixedIt.Get() *value + nbWtIt.GetPixel(i) );
-
-          }
+          first[d] = std::max( (long)outputIndex[d] - (long)injected.radius[d], 0L );
+          last[d]  = std::min( (long)outputIndex[d] + (long)injected.radius[d], (long)outputSize[d] - 1 );
         }
-        else
-        {
-          for(unsigned int i=0; i<nbIt.Size(); i++)
-          {
-            nbIndex = nbIt.GetIndex(i);
-
-            if ( outputRegion.IsInside(nbIndex) )
-            {
-
-              outputPtr -> TransformIndexToPhysicalPoint( nbIndex, nbPoint );
-
-              VnlVectorType diffPoint = nbPoint.GetVnlVector() - transformedPoint.GetVnlVector();
-              rotPoint[0] = dot_product(diffPoint,idirTransformed);
-              rotPoint[1] = dot_product(diffPoint,jdirTransformed);
-              rotPoint[2] = dot_product(diffPoint,kdirTransformed);
-
-              value = gaussian->Evaluate( rotPoint );
+        first[2] = std::max( first[2], slabBegin );
+        last[2]  = std::min( last[2], slabEnd - 1 );
 
-              nbIt.SetPixel(i, fixedIt.Get() *value + nbIt.GetPixel(i) );
-              nbWtIt.SetPixel(i, fixedIt.Get() *value + nbWtIt.GetPixel(i) );
+        for(nbIndex[2] = first[2]; nbIndex[2] <= last[2]; nbIndex[2]++)
+        for(nbIndex[1] = first[1]; nbIndex[1] <= last[1]; nbIndex[1]++)
+        for(nbIndex[0] = first[0]; nbIndex[0] <= last[0]; nbIndex[0]++)
+        {
+          outputPtr -> TransformIndexToPhysicalPoint( nbIndex, nbPoint );
 
-            }
+          VnlVectorType diffPoint = nbPoint.GetVnlVector() - transformedPoint.GetVnlVector();
+          rotPoint[0] = dot_product(diffPoint,injected.directions[0]);
+          rotPoint[1] = dot_product(diffPoint,injected.directions[1]);
+          rotPoint[2] = dot_product(diffPoint,injected.directions[2]);
 
-          }
+          double value = injected.kernel -> Evaluate( rotPoint.GetDataPointer() );
 
+          long offset = nbIndex[0] + outputSize[0]*(nbIndex[1] + outputSize[1]*nbIndex[2]);
+          sumBuffer[offset] = fixedIt.Get() *value + sumBuffer[offset];
+          wtBuffer[offset]  = fixedIt.Get() *value + wtBuffer[offset];
         }
-
-
       }
-
     }
-
   }
 
   // Normalization
@@ -410,6 +337,91 @@ ResampleLabelsByInjectionFilter<TInputImage,TOutputImage,TInterpolatorPrecisionT
 }
 
 
+/**
+ * Compute the geometry of the injection of every slice of the input images.
+ */
+template <class TInputImage, class TOutputImage, class TInterpolatorPrecisionType>
+void
+ResampleLabelsByInjectionFilter<TInputImage,TOutputImage,TInterpolatorPrecisionType>
+::InitializeInjectedSlices( const OutputImageType * outputImage, std::vector< InjectedSlice > & slices )
+{
+  // The Gaussian PSF is separable in the frame of the input image: its 1D profiles are
+  // tabulated once per input spacing and shared by the threads (see btk::PSFKernelCache).
+  double cst = 2*sqrt(2*log(2.0));
+
+  slices.clear();
+
+  for(unsigned int im = 0; im < m_ImageArray.size(); im++)
+  {
+    // ijk directions for gaussian orientation
+    VnlMatrixType inputDirection = m_ImageArray[im] -> GetDirection().GetVnlMatrix();
+
+    VnlVectorType idir = inputDirection.get_column(0);
+    VnlVectorType jdir = inputDirection.get_column(1);
+    VnlVectorType kdir = inputDirection.get_column(2);
+
+    SpacingType inputSpacing = m_ImageArray[im] -> GetSpacing();
+
+    InjectedSlice injected;
+    injected.image = im;
+
+    injected.radius[0] = ceil(inputSpacing[2] / m_OutputSpacing[0]);
+    injected.radius[1] = ceil(inputSpacing[2] / m_OutputSpacing[1]);
+    injected.radius[2] = ceil(inputSpacing[2] / m_OutputSpacing[2]);
+
+    // Gaussian parameters (in case of inputs with different spaces)
+    btk::PSFKernelCache::SpacingType sigma;
+    sigma[0] = inputSpacing[0]/cst;
+    sigma[1] = inputSpacing[1]/cst;
+    sigma[2] = inputSpacing[2]/cst;
+
+    injected.kernel = &m_PSFKernels.GetGaussianKernel( sigma );
+
+    IndexType inputIndex = m_InputImageRegion[im].GetIndex();
+    SizeType  inputSize  = m_InputImageRegion[im].GetSize();
+
+    for ( unsigned int i=inputIndex[2]; i < inputIndex[2] + inputSize[2]; i++ )
+    {
+      injected.slice = i;
+
+      // Extract rotation from affine metric to orient the PDF
+      VnlMatrixType NQd = m_Transform[im] -> GetSliceTransform(i) -> GetMatrix().GetVnlMatrix();
+
+      injected.directions[0] = NQd*idir;
+      injected.directions[1] = NQd*jdir;
+      injected.directions[2] = NQd*kdir;
+
+      // Output slices covered by the slice (bounds of its corners, enlarged by the support of the PSF)
+      double minimum = itk::NumericTraits< double >::max();
+      double maximum = -itk::NumericTraits< double >::max();
+
+      for(unsigned int corner = 0; corner < 4; corner++)
+      {
+        IndexType cornerIndex = inputIndex;
+        cornerIndex[0] += (corner & 1) ? inputSize[0] - 1 : 0;
+        cornerIndex[1] += (corner & 2) ? inputSize[1] - 1 : 0;
+        cornerIndex[2] = i;
+
+        PointType cornerPoint;
+        m_ImageArray[im] -> TransformIndexToPhysicalPoint( cornerIndex, cornerPoint );
+        cornerPoint = m_Transform[im] -> TransformPoint( cornerPoint );
+
+        itk::ContinuousIndex< double, ImageDimension > outputCornerIndex;
+        outputImage -> TransformPhysicalPointToContinuousIndex( cornerPoint, outputCornerIndex );
+
+        minimum = std::min( minimum, (double)outputCornerIndex[2] );
+        maximum = std::max( maximum, (double)outputCornerIndex[2] );
+      }
+
+      injected.firstOutputSlice = (long)floor(minimum) - (long)injected.radius[2] - 1;
+      injected.lastOutputSlice  = (long)ceil(maximum) + (long)injected.radius[2] + 1;
+
+      slices.push_back( injected );
+    }
+  }
+}
+
+
 /**
  * Inform pipeline of necessary input image region
  *
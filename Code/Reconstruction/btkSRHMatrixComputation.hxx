@@ -41,7 +41,7 @@
 #include "itkImageMaskSpatialObject.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkImageRegionIteratorWithIndex.h"
-#include "vnl/vnl_sparse_matrix.h"
+#include "vnl/vnl_vector.h"
 #include "itkBSplineInterpolationWeightFunction.h"
 
 
@@ -54,11 +54,17 @@
 #include "btkBoxCarPSF.h"
 #include "btkSincPSF.h"
 #include "btkHybridPSF.h"
+#include "btkPSFKernelCache.h"
 #include "btkImageHelper.h"
+#include "btkSparseMatrix.h"
+#include "btkObservationMatrixCache.h"
+#include "btkSliceBySliceTransformBase.h"
+#include "btkTelemetry.h"
 
 
 #include "iostream"
 #include "sstream"
+#include "limits"
 #include "limits.h"
 
 
@@ -100,6 +106,8 @@ class SRHMatrixComputation: public itk::Object
         typedef typename MaskType::Pointer   MaskPointer;
 
         typedef itk::Transform< double >        TransformType;
+        typedef typename TransformType::ParametersType ParametersType;
+        typedef btk::SliceBySliceTransformBase< double, 3 > SliceBySliceTransformType;
 
         /** Oriented spatial function typedef. */
         typedef OrientedSpatialFunction<double, 3, PointType> FunctionType;
@@ -139,12 +147,44 @@ class SRHMatrixComputation: public itk::Object
         btkSetMacro(InverseTransforms, std::vector< typename TransformType::Pointer >);
         btkGetMacro(InverseTransforms, std::vector< typename TransformType::Pointer >);
 
-        btkSetMacro(H,vnl_sparse_matrix< PrecisionType >*);
+        btkSetMacro(H,btk::SparseMatrix< PrecisionType >*);
 
         btkSetMacro(PSF,btk::PSF::Pointer);
+        btkGetMacro(PSF,btk::PSF::Pointer);
 
         btkSetMacro(Y,vnl_vector< PrecisionType >*);
 
+        /**
+         * @brief Set the name of the file caching H and Y (no cache if empty, default).
+         * H and Y are read from this file when the inputs have not changed since it was written, and written to it otherwise.
+         */
+        btkSetMacro(CacheFileName,std::string);
+        btkGetMacro(CacheFileName,std::string);
+
+        /**
+         * @brief Enable (or not) the incremental update of H (disabled by default).
+         * When H and Y given to this filter are the ones of its previous update, and the grid, PSF, images and masks are unchanged,
+         * only the rows of the slices whose transform has changed are rebuilt.
+         */
+        btkSetMacro(IncrementalUpdate,bool);
+        btkGetMacro(IncrementalUpdate,bool);
+
+        /**
+         * @brief Set the tolerance (in mm) on the displacement of the corners of a slice under which the slice is not rebuilt (default 0: any change).
+         * The corners are the ones of the slab covered by the slice (its voxels and their thickness), so that rotations and translations are compared in the same unit.
+         */
+        btkSetMacro(TransformTolerance,double);
+        btkGetMacro(TransformTolerance,double);
+
+        /**
+         * @brief Enable (or not) the selection of the rows of H (disabled by default).
+         * When enabled, only the LR voxels whose PSF may reach the reference image (e.g. a block of the HR grid) give a row of H
+         * and an element of Y, so that their sizes are bounded by the extent of the reference image instead of the LR images.
+         * The rows follow the order of the LR voxels. The PSF of a LR voxel is assumed to move rigidly with its center.
+         */
+        btkSetMacro(RowSelection,bool);
+        btkGetMacro(RowSelection,bool);
+
         /**
          * @brief SetOutliers
          * @param _outliers is a vector of vector of boolean
@@ -171,6 +211,84 @@ class SRHMatrixComputation: public itk::Object
         virtual ~SRHMatrixComputation(){}
         /** ToBeRemoved */
         void ComputeH();
+        /**
+         * @brief Compute the rows of H (and the elements of Y) of one slice of a LR image.
+         * Slices are independent, so that this method can be called concurrently.
+         * @param im index of the LR image
+         * @param slice slice of the LR image
+         * @param firstRow row of H (and element of Y) of the first voxel of the slice
+         * @param voxels linear indices (in the slice) of the voxels giving the rows, see SelectVoxels (all the voxels of the slice if NULL)
+         * @param interpolator interpolator on the reference image (used to check the bounds)
+         * @param psfOffsets PSF samples, as offsets (in LR space) to the center of the PSF
+         * @param psfValues values of the PSF samples
+         * @param block block receiving the rows of the slice
+         */
+        void ComputeSliceRows(unsigned int im, unsigned int slice, unsigned int firstRow,
+                              const std::vector< unsigned int > * voxels,
+                              const InterpolatorType * interpolator,
+                              const std::vector< typename PointType::VectorType > & psfOffsets,
+                              const std::vector< double > & psfValues,
+                              btk::SparseMatrix< PrecisionType > & block);
+        /**
+         * @brief Select the voxels of the mask of a LR image whose PSF may reach the reference image (row selection).
+         * A voxel is selected when its center, once transformed, lies in the bounding box of the reference image enlarged by the
+         * radius of the PSF. The slices whose transformed bounding box does not intersect this box are skipped.
+         * @param im index of the LR image
+         * @param psfOffsets PSF samples, as offsets (in LR space) to the center of the PSF
+         * @param voxels receives, for every slice, the linear indices (in the slice) of the selected voxels
+         */
+        void SelectVoxels(unsigned int im, const std::vector< typename PointType::VectorType > & psfOffsets,
+                          std::vector< std::vector< unsigned int > > & voxels) const;
+        /**
+         * @brief Describe the inputs H and Y depend on (geometries, PSF, transforms, masks and intensities) in the key of the cache.
+         * @param psfSamples Samples of the PSF of each LR image (their offsets and values are hashed, so that PSF parameters are part of the key)
+         */
+        void InitializeCacheKey(ObservationMatrixCache< PrecisionType > & cache, const std::vector< const PSFKernelCache::Samples * > & psfSamples) const;
+        /**
+         * @brief State of an input image H depends on (its buffer, modification time and geometry).
+         */
+        struct InputState
+        {
+            const void *                      buffer;
+            unsigned long                     time;
+            RegionType                        region;
+            PointType                         origin;
+            SpacingType                       spacing;
+            typename ImageType::DirectionType direction;
+        };
+        /**
+         * @brief Get the state of an input image (its buffer, the latest of its modification times and its geometry).
+         */
+        template< class TInputImage >
+        static InputState GetInputState(const TInputImage * image);
+        /**
+         * @brief Return true if two states describe the same buffer, modification time and geometry.
+         */
+        static bool IsSameInput(const InputState & state, const InputState & previousState);
+        /**
+         * @brief Corners of the slab covered by a slice (8 points), mapped by the transform of the slice.
+         */
+        void GetSliceCorners(unsigned int im, unsigned int slice, std::vector< PointType > & corners) const;
+        /**
+         * @brief Return true if a corner of a slice has moved by more than the tolerance (in mm) since the previous update.
+         */
+        bool HasSliceTransformChanged(unsigned int im, unsigned int slice) const;
+        /**
+         * @brief Return true if H and Y can be updated slice by slice (same H, Y, grid, PSF, images and masks as the previous update).
+         * The images and masks have to be the same objects, with the same buffers, modification times and geometries.
+         */
+        bool IsIncrementalUpdatePossible(unsigned int nrows, unsigned int ncols) const;
+        /**
+         * @brief Store the state of the inputs and the corners of the slices used to compute H.
+         */
+        void SaveUpdateState();
+        /**
+         * @brief Write the telemetry of an update (size of H, number of rebuilt slices and wall time of the build).
+         * @param startTime time of the beginning of the update
+         * @param cached true if H and Y have been read from the cache
+         * @param rebuiltSlices number of slices whose rows have been computed
+         */
+        void WriteTelemetry(double startTime, bool cached, unsigned int rebuiltSlices) const;
 
     private:
 
@@ -181,7 +299,7 @@ class SRHMatrixComputation: public itk::Object
            unsigned int depth;
         }m_XSize;
 
-        vnl_sparse_matrix< PrecisionType >* m_H;
+        btk::SparseMatrix< PrecisionType >* m_H;
         vnl_vector< PrecisionType >* m_Y;
         vnl_vector< PrecisionType > m_SimY;
         vnl_vector< PrecisionType > m_HtY;
@@ -207,8 +325,32 @@ class SRHMatrixComputation: public itk::Object
 
         std::vector< PSF::Pointer >        m_PSFs;
 
+        /** PSF samples of the geometries of the LR images */
+        PSFKernelCache                     m_PSFKernels;
+
         bool                               m_IsHComputed;
 
+        std::string                        m_CacheFileName;
+
+        bool                               m_IncrementalUpdate;
+        double                             m_TransformTolerance;
+
+        bool                               m_RowSelection;
+
+        /** Inputs of the previous update (for the incremental update) */
+        btk::SparseMatrix< PrecisionType >*          m_PreviousH;
+        vnl_vector< PrecisionType >*                 m_PreviousY;
+        PSF::Pointer                                 m_PreviousPSF;
+        RegionType                                   m_PreviousReferenceRegion;
+        PointType                                    m_PreviousReferenceOrigin;
+        SpacingType                                  m_PreviousReferenceSpacing;
+        typename ImageType::DirectionType            m_PreviousReferenceDirection;
+        std::vector< const ImageType * >             m_PreviousImages;
+        std::vector< const typename MaskType::ImageType * > m_PreviousMasks;
+        std::vector< InputState >                    m_PreviousImageStates;
+        std::vector< InputState >                    m_PreviousMaskStates;
+        std::vector< std::vector< std::vector< PointType > > > m_SliceCorners;  /**< transformed corners of every slice of every image */
+
         unsigned int m_NumberOfLRImages;
 };
 }
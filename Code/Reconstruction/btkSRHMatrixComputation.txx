@@ -45,6 +45,11 @@ namespace btk
 template < class TImage >
 SRHMatrixComputation< TImage >::SRHMatrixComputation():m_H(0),m_Y(0),m_PSF(0)
 {
+    m_IncrementalUpdate  = false;
+    m_TransformTolerance = 0.0;
+    m_RowSelection       = false;
+    m_PreviousH          = NULL;
+    m_PreviousY          = NULL;
 
 }
 //-------------------------------------------------------------------------------------------------
@@ -70,23 +75,10 @@ void SRHMatrixComputation< TImage >::Initialize()
 template< class TImage >
 void SRHMatrixComputation< TImage >::Update()
 {
+    double startTime = btk::Telemetry::GetInstance().IsEnabled() ? btk::Telemetry::GetTime() : 0.0;
 
     this->Initialize();
 
-    typename PsfImageType::Pointer PSF = PsfImageType::New();
-
-    //We use linear interpolation for the estimation of point influence in matrix H
-    typedef itk::BSplineInterpolationWeightFunction<double, 3, 1> itkBSplineFunction;
-    itkBSplineFunction::Pointer bsplineFunction = itkBSplineFunction::New();
-    itkBSplineFunction::WeightsType bsplineWeights;
-    bsplineWeights.SetSize(8); // (bsplineOrder + 1)^3
-    itkBSplineFunction::IndexType   bsplineStartIndex;
-    itkBSplineFunction::IndexType   bsplineEndIndex;
-    itkBSplineFunction::SizeType    bsplineSize;
-    RegionType                      bsplineRegion;
-
-
-    IndexType start_hr  = m_OutputImageRegion.GetIndex();
     SizeType  size_hr   = m_OutputImageRegion.GetSize();
 
     //m_XSize : size of the SR image (used in other functions)
@@ -94,253 +86,598 @@ void SRHMatrixComputation< TImage >::Update()
     m_XSize.height = size_hr[1];
     m_XSize.depth  = size_hr[2];
 
-    IndexType end_hr;
-    end_hr[0] = start_hr[0] + size_hr[0] - 1 ;
-    end_hr[1] = start_hr[1] + size_hr[1] - 1 ;
-    end_hr[2] = start_hr[2] + size_hr[2] - 1 ;
-
     // Set size of matrices
     unsigned int ncols = m_OutputImageRegion.GetNumberOfPixels();
 
-    unsigned int nrows = 0;
+    // The PSF samples (offsets to the center of the PSF and values) only depend on the
+    // spacings and on the size of the PSF: they are built once per geometry and shared
+    // by the LR images (and by the next updates).
+    std::vector< const PSFKernelCache::Samples * > psfSamples(m_NumberOfLRImages);
     for(unsigned int im = 0; im < m_NumberOfLRImages; im++)
     {
-        //nrows += m_Regions[im].GetNumberOfPixels();
-        nrows += m_Images[im]->GetLargestPossibleRegion().GetNumberOfPixels();
+        SpacingType lrSpacing = m_Images[im]->GetSpacing();
+
+        SizeType psfSize;
+        psfSize[0] = (int)ceil(m_Images[im]->GetSpacing()[0] / m_ReferenceImage->GetSpacing()[0]) + 2;
+        psfSize[1] = (int)ceil(m_Images[im]->GetSpacing()[1] / m_ReferenceImage->GetSpacing()[1]) + 2;
+        psfSize[2] = (int)ceil(m_Images[im]->GetSpacing()[2] / m_ReferenceImage->GetSpacing()[2]) + 2;
+
+        // The PSF may be shared by filters updated concurrently (e.g. one per block of the HR grid).
+        #pragma omp critical(btkSRHMatrixComputationPSF)
+        {
+            //Initialization of the PSF
+            m_PSF->SetDirection(m_Images[im]->GetDirection());
+            psfSamples[im] = &m_PSFKernels.GetSamples(m_PSF, lrSpacing, m_ReferenceImage->GetSpacing(), psfSize);
+        }
     }
 
-    m_H->set_size(nrows, ncols);
+    // With the row selection, only the LR voxels whose PSF may reach the reference image give a row
+    std::vector< std::vector< std::vector< unsigned int > > > selectedVoxels(m_RowSelection ? m_NumberOfLRImages : 0);
 
-    m_Y->set_size(nrows);
-    m_Y->fill(0.0);
+    unsigned int nrows = 0;
+    for(unsigned int im = 0; im < m_NumberOfLRImages; im++)
+    {
+        if(m_RowSelection)
+        {
+            this->SelectVoxels(im, psfSamples[im]->offsets, selectedVoxels[im]);
+            for(unsigned int slice = 0; slice < selectedVoxels[im].size(); slice++)
+            {
+                nrows += selectedVoxels[im][slice].size();
+            }
+        }
+        else
+        {
+            //nrows += m_Regions[im].GetNumberOfPixels();
+            nrows += m_Images[im]->GetLargestPossibleRegion().GetNumberOfPixels();
+        }
+    }
 
     std::cout<<"size X : "<<ncols<<std::endl;
     std::cout<<"size Y : "<<nrows<<std::endl;
 
+    // Only the slices whose transform has changed are rebuilt when H has already been computed with the same inputs
+    bool incremental = m_IncrementalUpdate && !m_RowSelection && this->IsIncrementalUpdatePossible(nrows, ncols);
 
-    typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
-    interpolator->SetInputImage(m_ReferenceImage);
+    ObservationMatrixCache< PrecisionType > cache(m_CacheFileName);
+    if(!m_CacheFileName.empty())
+    {
+        this->InitializeCacheKey(cache, psfSamples);
+    }
 
-    unsigned int lrLinearIndex = 0;
-    unsigned int hrLinearIndex = 0;
-    unsigned int offset = 0;
-    double psfValue;
+    if(!incremental)
+    {
+        m_H->SetSize(nrows, ncols);
 
+        m_Y->set_size(nrows);
+        m_Y->fill(0.0);
 
+        // H and Y are read from the cache when the inputs have not changed
+        if(!m_CacheFileName.empty() && cache.Read(*m_H, m_Y))
+        {
+            this->SaveUpdateState();
+            m_IsHComputed = true;
+            this->WriteTelemetry(startTime, true, 0);
+            return;
+        }
+    }
+
+    typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
+    interpolator->SetInputImage(m_ReferenceImage);
 
-    unsigned int im;
-    //FIXME : add critical part for H and PSF
-    // Not Sure that parallel for is necessary here !
-    //#pragma omp parallel for private(im) schedule(dynamic)
+    // One block of rows of H per (rebuilt) slice of each LR image. The blocks are filled
+    // independently by the threads and then gathered into H.
+    std::vector< btk::SparseMatrix< PrecisionType > > blocks;
+    std::vector< unsigned int > blockFirstRows;
+    unsigned int numberOfSlices = 0;
 
-    for(im = 0; im < m_Images.size(); im++)
+    unsigned int row = 0;
+
+    for(unsigned int im = 0; im < m_Images.size(); im++)
     {
 
         std::cout<<"Processing image "<<im+1<<std::endl;
 
         SizeType lrSize = m_Images[im]->GetLargestPossibleRegion().GetSize();
-        SpacingType lrSpacing = m_Images[im]->GetSpacing();
-        ConstIteratorType lrIt( m_Images[im], m_Images[im]->GetLargestPossibleRegion() );
-        //Initialization of the PSF
-        m_PSF->SetDirection(m_Images[im]->GetDirection());
-        m_PSF->SetLrSpacing(lrSpacing);
-        m_PSF->SetSpacing(m_ReferenceImage->GetSpacing());
-
-        SizeType psfSize;
-        psfSize[0] = (int)ceil(m_Images[im]->GetSpacing()[0] / m_ReferenceImage->GetSpacing()[0]) + 2;
-        psfSize[1] = (int)ceil(m_Images[im]->GetSpacing()[1] / m_ReferenceImage->GetSpacing()[1]) + 2;
-        psfSize[2] = (int)ceil(m_Images[im]->GetSpacing()[2] / m_ReferenceImage->GetSpacing()[2]) + 2;
 
-        m_PSF->SetSize(psfSize);
-        m_PSF->ConstructImage();
+        const std::vector< typename PointType::VectorType > & psfOffsets = psfSamples[im]->offsets;
+        const std::vector< double > & psfValues = psfSamples[im]->values;
 
-        // for all voxels
-        for(lrIt.GoToBegin(); !lrIt.IsAtEnd(); ++lrIt)
+        // slices to (re)build, and their first row
+        std::vector< unsigned int > slices;
+        for(unsigned int slice = 0; slice < lrSize[2]; slice++)
         {
-            IndexType lrIndex = lrIt.GetIndex();
-            PointType lrPoint;
-            m_Images[im]->TransformIndexToPhysicalPoint(lrIndex, lrPoint);
-            PointType srPoint = m_Transforms[im]->TransformPoint(lrPoint);
+            unsigned int sliceRows = m_RowSelection ? selectedVoxels[im][slice].size() : lrSize[0]*lrSize[1];
 
-            // if point is not in the mask we skip it
-            if((!m_Masks[im]->GetImage()->GetPixel(lrIndex)) > 0)
+            if(sliceRows > 0 && (!incremental || this->HasSliceTransformChanged(im, slice)))
             {
-                continue;
+                slices.push_back(slice);
+                blockFirstRows.push_back(row);
             }
+            row += sliceRows;
+        }
+        numberOfSlices += lrSize[2];
 
-            // if point is not in the sr image we skip it
-            if(!interpolator->IsInsideBuffer(srPoint))
+        unsigned int firstBlock = blocks.size();
+        blocks.resize(firstBlock + slices.size());
+
+        int s;
+        #pragma omp parallel for private(s) schedule(dynamic)
+        for(s = 0; s < (int)slices.size(); s++)
+        {
+            if(incremental)
             {
-                continue;
+                // the elements of Y of voxels now falling outside the reference image are removed
+                unsigned int sliceSize = lrSize[0]*lrSize[1];
+                std::fill(m_Y->begin() + blockFirstRows[firstBlock + s], m_Y->begin() + blockFirstRows[firstBlock + s] + sliceSize, 0.0);
             }
+            this->ComputeSliceRows(im, slices[s], blockFirstRows[firstBlock + s], m_RowSelection ? &selectedVoxels[im][slices[s]] : NULL,
+                                   interpolator, psfOffsets, psfValues, blocks[firstBlock + s]);
 
-            //compute the linear index corresponding to the index of lr image
-            lrLinearIndex =  lrIndex[0] + lrIndex[1]*lrSize[0]
-                            + lrIndex[2]*lrSize[0]*lrSize[1] + offset;
+            if(incremental)
+            {
+                // normalization of the new rows (H is already normalized)
+                blocks[firstBlock + s].NormalizeRows();
+            }
+        }
 
-            //Fill Y
-            m_Y->operator()(lrLinearIndex) = lrIt.Get();
+        assert(row < UINT_MAX);
+    }//for im
 
+    if(incremental)
+    {
+        std::cout<<"Update of H : "<<blocks.size()<<" slice(s) out of "<<numberOfSlices<<" rebuilt"<<std::endl;
 
-            m_PSF->SetCenter(lrPoint);
-             //m_PSF->ConstructImage(); //We construct an image at each voxel, time-consuming !!!
-            //std::cout<<lrPoint<<std::endl;
-            // Get PSF support (image)
-            PSF = m_PSF->GetPsfImage();
-            // Save the result (do that with a break point in debug mode,
-            // otherwise PSF is saved at each voxel).
-           // btk::ImageHelper< itk::Image< float, 3 > >::WriteImage(PSF,"PSFImage.nii.gz");
+        // the new rows replace the old ones in H (and the blocks are released)
+        m_H->ReplaceRowBlocks(blockFirstRows, blocks);
+    }
+    else
+    {
+        // gather the blocks (and release them)
+        m_H->SetRowBlocks(blocks);
 
-            ImageRegionConstIteratorWithIndex< itk::Image< float, 3 > > itPsf(PSF, PSF->GetLargestPossibleRegion());
-            // Loop over PSF voxels
-            for(itPsf.GoToBegin(); !itPsf.IsAtEnd(); ++itPsf)
-            {
-                IndexType psfIndex = itPsf.GetIndex();
-                PointType psfInLrSpacePoint, transformedPoint;
-                //Physical point of psf Index, in Lr Space
-                PSF->TransformIndexToPhysicalPoint(psfIndex,psfInLrSpacePoint);
+        // normalization of H
+        m_H->NormalizeRows();
+    }
 
-                psfValue = itPsf.Get();
+    this->SaveUpdateState();
 
-                if(psfValue <= 0.0)
-                {
-                    continue;
-                }
 
-                // psfPoint in sr space
-                transformedPoint = m_Transforms[im]->TransformPoint(psfInLrSpacePoint);
+    m_IsHComputed = true;
+    std::cout<<"H computed !"<<std::endl;
 
-                // if point is not in the sr image we skip it
-                if(interpolator->IsInsideBuffer(transformedPoint))
-                {
-                    ContinuousIndexType srContIndex;
-//                    // continuous index in sr image
-                    m_ReferenceImage->TransformPhysicalPointToContinuousIndex(transformedPoint, srContIndex);
+    if(!m_CacheFileName.empty())
+    {
+        cache.Write(*m_H, m_Y);
+    }
 
+    this->WriteTelemetry(startTime, false, blockFirstRows.size());
 
-                    // STAN VERSION :
+    // DEBUG :
+//    std::cout<<"Testing Y, X and simulated Y..."<<std::endl;
+//    //this->TestFillingOfY();
+//    this->TestFillingOfX();
+//    this->SimulateY();
 
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+template< class TInputImage >
+typename SRHMatrixComputation< TImage >::InputState SRHMatrixComputation< TImage >::GetInputState(const TInputImage * image)
+{
+    InputState state;
 
-//                    bool isInsideHR = true;
+    state.buffer    = image->GetBufferPointer();
+    state.time      = std::max(image->GetMTime(), image->GetPixelContainer()->GetMTime());
+    state.region    = image->GetLargestPossibleRegion();
+    state.origin    = image->GetOrigin();
+    state.spacing   = image->GetSpacing();
+    state.direction = image->GetDirection();
 
-//                    // FIXME This checking should be done for all points first, and discard the point
-//                    // if al least one point is out of the reference image
+    return state;
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+bool SRHMatrixComputation< TImage >::IsSameInput(const InputState & state, const InputState & previousState)
+{
+    return state.buffer == previousState.buffer && state.time == previousState.time &&
+           state.region == previousState.region && state.origin == previousState.origin &&
+           state.spacing == previousState.spacing && state.direction == previousState.direction;
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+void SRHMatrixComputation< TImage >::GetSliceCorners(unsigned int im, unsigned int slice, std::vector< PointType > & corners) const
+{
+    // a slice by slice transform gives the transform of the slice, otherwise the transform is the one of the whole image
+    const SliceBySliceTransformType * sliceBySliceTransform = dynamic_cast< const SliceBySliceTransformType * >(m_Transforms[im].GetPointer());
+    const TransformType * transform = (sliceBySliceTransform != NULL) ? sliceBySliceTransform->GetSliceTransform(slice) : m_Transforms[im].GetPointer();
 
-//                    if ( (srContIndex[0] < start_hr[0]) || (srContIndex[0] > end_hr[0]) ||
-//                         (srContIndex[1] < start_hr[1]) || (srContIndex[1] > end_hr[1]) ||
-//                         (srContIndex[2] < start_hr[2]) || (srContIndex[2] > end_hr[2]) )
-//                       isInsideHR = false;
+    RegionType lrRegion = m_Images[im]->GetLargestPossibleRegion();
+    SizeType lrSize = lrRegion.GetSize();
 
-//                    if ( isInsideHR )
-//                    {
+    corners.resize(8);
 
-//                      double hrValue = interpolator -> Evaluate( transformedPoint );
+    for(unsigned int c = 0; c < 8; c++)
+    {
+        // corners of the voxels at the border of the slice (the slab covers the whole voxels)
+        ContinuousIndexType corner;
+        corner[0] = lrRegion.GetIndex()[0] - 0.5 + (c & 1) * lrSize[0];
+        corner[1] = lrRegion.GetIndex()[1] - 0.5 + ((c >> 1) & 1) * lrSize[1];
+        corner[2] = lrRegion.GetIndex()[2] + slice - 0.5 + ((c >> 2) & 1);
+
+        PointType lrPoint;
+        m_Images[im]->TransformContinuousIndexToPhysicalPoint(corner, lrPoint);
+        corners[c] = transform->TransformPoint(lrPoint);
+    }
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+bool SRHMatrixComputation< TImage >::HasSliceTransformChanged(unsigned int im, unsigned int slice) const
+{
+    std::vector< PointType > corners;
+    this->GetSliceCorners(im, slice, corners);
 
-//                      for(unsigned int n=0; n<interpolator -> GetContributingNeighbors(); n++)
-//                      {
-//                        IndexType hrIndex = interpolator -> GetIndex(n);
-//                        IndexType hrDiffIndex;
+    const std::vector< PointType > & previousCorners = m_SliceCorners[im][slice];
 
-////                        hrDiffIndex[0] = hrIndex[0] - start_hr[0];
-////                        hrDiffIndex[1] = hrIndex[1] - start_hr[1];
-////                        hrDiffIndex[2] = hrIndex[2] - start_hr[2];
+    for(unsigned int c = 0; c < corners.size(); c++)
+    {
+        // with a zero tolerance, any displacement of a corner rebuilds the slice
+        if(corners[c].EuclideanDistanceTo(previousCorners[c]) > m_TransformTolerance)
+        {
+            return true;
+        }
+    }
 
-//                        //hrLinearIndex = hrDiffIndex[0] + hrDiffIndex[1]*size_hr[0] + hrDiffIndex[2]*size_hr[0]*size_hr[1];
-//                        hrLinearIndex = hrIndex[0] + hrIndex[1]*size_hr[0] + hrIndex[2]*size_hr[0]*size_hr[1];
-//                        //std::cout<<"old value in H("<<lrLinearIndex<<","<<hrLinearIndex<<") : "<<m_H->operator()(lrLinearIndex, hrLinearIndex)<<std::endl;
+    return false;
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+bool SRHMatrixComputation< TImage >::IsIncrementalUpdatePossible(unsigned int nrows, unsigned int ncols) const
+{
+    // H and Y have to be the ones of the previous update, computed on the same grid, with the same PSF, images and masks
+    if(m_SliceCorners.size() != m_NumberOfLRImages || m_H != m_PreviousH || m_Y != m_PreviousY || !m_H->IsFinalized() ||
+       m_H->GetNumberOfRows() != nrows || m_H->GetNumberOfColumns() != ncols || m_Y->size() != nrows ||
+       m_PSF != m_PreviousPSF ||
+       m_ReferenceImage->GetLargestPossibleRegion() != m_PreviousReferenceRegion ||
+       m_ReferenceImage->GetOrigin() != m_PreviousReferenceOrigin ||
+       m_ReferenceImage->GetSpacing() != m_PreviousReferenceSpacing ||
+       m_ReferenceImage->GetDirection() != m_PreviousReferenceDirection)
+    {
+        return false;
+    }
 
-//                        m_H->operator()(lrLinearIndex, hrLinearIndex) += psfValue * interpolator->GetOverlap(n);
+    for(unsigned int im = 0; im < m_NumberOfLRImages; im++)
+    {
+        // the objects have to be the same, and their buffers must not have been modified or re-allocated since the previous update
+        if(m_Images[im].GetPointer() != m_PreviousImages[im] || m_Masks[im]->GetImage() != m_PreviousMasks[im] ||
+           !IsSameInput(GetInputState(m_Images[im].GetPointer()), m_PreviousImageStates[im]) ||
+           !IsSameInput(GetInputState(m_Masks[im]->GetImage()), m_PreviousMaskStates[im]) ||
+           m_SliceCorners[im].size() != m_Images[im]->GetLargestPossibleRegion().GetSize()[2])
+        {
+            return false;
+        }
+    }
 
-//                       //std::cout<<"new value in H("<<lrLinearIndex<<","<<hrLinearIndex<<") : "<<m_H->operator()(lrLinearIndex, hrLinearIndex)<<std::endl;
+    return true;
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+void SRHMatrixComputation< TImage >::SaveUpdateState()
+{
+    m_PreviousH                  = m_H;
+    m_PreviousY                  = m_Y;
+    m_PreviousPSF                = m_PSF;
+    m_PreviousReferenceRegion    = m_ReferenceImage->GetLargestPossibleRegion();
+    m_PreviousReferenceOrigin    = m_ReferenceImage->GetOrigin();
+    m_PreviousReferenceSpacing   = m_ReferenceImage->GetSpacing();
+    m_PreviousReferenceDirection = m_ReferenceImage->GetDirection();
+
+    m_PreviousImages.resize(m_NumberOfLRImages);
+    m_PreviousMasks.resize(m_NumberOfLRImages);
+    m_PreviousImageStates.resize(m_NumberOfLRImages);
+    m_PreviousMaskStates.resize(m_NumberOfLRImages);
+    m_SliceCorners.resize(m_NumberOfLRImages);
 
+    for(unsigned int im = 0; im < m_NumberOfLRImages; im++)
+    {
+        m_PreviousImages[im] = m_Images[im].GetPointer();
+        m_PreviousMasks[im]  = m_Masks[im]->GetImage();
+        m_PreviousImageStates[im] = GetInputState(m_Images[im].GetPointer());
+        m_PreviousMaskStates[im]  = GetInputState(m_Masks[im]->GetImage());
+
+        unsigned int numberOfSlices = m_Images[im]->GetLargestPossibleRegion().GetSize()[2];
+        m_SliceCorners[im].resize(numberOfSlices);
+        for(unsigned int slice = 0; slice < numberOfSlices; slice++)
+        {
+            this->GetSliceCorners(im, slice, m_SliceCorners[im][slice]);
+        }
+    }
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+void SRHMatrixComputation< TImage >::WriteTelemetry(double startTime, bool cached, unsigned int rebuiltSlices) const
+{
+    if(!btk::Telemetry::GetInstance().IsEnabled())
+    {
+        return;
+    }
 
-//                } //end of loop over the support region
+    btk::Telemetry::Record record("h_build");
+    record.SetValue("rows", m_H->GetNumberOfRows());
+    record.SetValue("columns", m_H->GetNumberOfColumns());
+    record.SetValue("non_zeros", m_H->GetNumberOfNonZeros());
+    record.SetValue("cached", cached);
+    record.SetValue("rebuilt_slices", rebuiltSlices);
+    record.AddPhaseTime("h_build", btk::Telemetry::GetTime() - startTime);
+    btk::Telemetry::GetInstance().Write(record);
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+void SRHMatrixComputation< TImage >::InitializeCacheKey(ObservationMatrixCache< PrecisionType > & cache, const std::vector< const PSFKernelCache::Samples * > & psfSamples) const
+{
+    cache.SetHRGeometry(m_ReferenceImage);
+    cache.SetPSFType(m_PSF->GetNameOfClass());
+    cache.AddData(&m_RowSelection, sizeof(bool));
 
-//            }// end if bspline index inside sr image
+    for(unsigned int im = 0; im < m_NumberOfLRImages; im++)
+    {
+        cache.AddLRGeometry(m_Images[im]);
+        cache.AddTransform(m_Transforms[im]);
 
-                    //FRANCOIS VERSION :
+        // the sampled PSF depends on all the parameters of the PSF (FWHM, functions of a HybridPSF...), not only on its class
+        const PSFKernelCache::Samples & samples = *psfSamples[im];
+        for(unsigned int p = 0; p < samples.offsets.size(); p++)
+        {
+            for(unsigned int d = 0; d < 3; d++)
+            {
+                double offset = samples.offsets[p][d];
+                cache.AddData(&offset, sizeof(double));
+            }
+        }
+        if(!samples.values.empty())
+        {
+            cache.AddData(&samples.values[0], samples.values.size() * sizeof(double));
+        }
 
-                    //Get the interpolation weight using itkBSplineInterpolationWeightFunction
-                    bsplineFunction->Evaluate(srContIndex,bsplineWeights,bsplineStartIndex);
+        // the rows of H depend on the masks, and Y on the intensities
+        cache.AddData(m_Masks[im]->GetImage()->GetBufferPointer(),
+                      m_Masks[im]->GetImage()->GetBufferedRegion().GetNumberOfPixels() * sizeof(typename MaskType::PixelType));
+        cache.AddData(m_Images[im]->GetBufferPointer(),
+                      m_Images[im]->GetBufferedRegion().GetNumberOfPixels() * sizeof(typename ImageType::PixelType));
+    }
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+void SRHMatrixComputation< TImage >::SelectVoxels(unsigned int im, const std::vector< typename PointType::VectorType > & psfOffsets,
+                                                  std::vector< std::vector< unsigned int > > & voxels) const
+{
+    // radius of the PSF
+    double radius = 0.0;
+    for(unsigned int p = 0; p < psfOffsets.size(); p++)
+    {
+        radius = std::max(radius, (double)psfOffsets[p].GetNorm());
+    }
 
-                    //Get the support size for interpolation
-                    bsplineSize = bsplineFunction->GetSupportSize();
+    // physical bounding box of the buffer of the reference image (where the PSF samples are kept), enlarged by the radius of the PSF
+    PointType lowerBound;
+    PointType upperBound;
+    lowerBound.Fill(std::numeric_limits< double >::max());
+    upperBound.Fill(-std::numeric_limits< double >::max());
 
-                    //Check if the bspline support region is inside the HR image
-                    bsplineEndIndex[0] = bsplineStartIndex[0] + bsplineSize[0];
-                    bsplineEndIndex[1] = bsplineStartIndex[1] + bsplineSize[1];
-                    bsplineEndIndex[2] = bsplineStartIndex[2] + bsplineSize[2];
+    for(unsigned int c = 0; c < 8; c++)
+    {
+        ContinuousIndexType corner;
+        for(unsigned int i = 0; i < 3; i++)
+        {
+            corner[i] = m_OutputImageRegion.GetIndex()[i] - 0.5 + ((c >> i) & 1) * m_OutputImageRegion.GetSize()[i];
+        }
 
-                    if(m_ReferenceImage->GetLargestPossibleRegion().IsInside(bsplineStartIndex)
-                            && m_ReferenceImage->GetLargestPossibleRegion().IsInside(bsplineEndIndex))
-                    {
-                        //Set the support region
-                        bsplineRegion.SetSize(bsplineSize);
-                        bsplineRegion.SetIndex(bsplineStartIndex);
+        PointType point;
+        m_ReferenceImage->TransformContinuousIndexToPhysicalPoint(corner, point);
 
-                        //Instantiate an iterator on HR image over the bspline region
-                        ImageRegionConstIteratorWithIndex< ImageType > itHRImage(m_ReferenceImage,bsplineRegion);
+        for(unsigned int i = 0; i < 3; i++)
+        {
+            lowerBound[i] = std::min(lowerBound[i], point[i] - radius);
+            upperBound[i] = std::max(upperBound[i], point[i] + radius);
+        }
+    }
 
-                        //linear index of bspline weights
-                        unsigned int weightLinearIndex = 0;
+    // the slices can be skipped as a whole when the transform of every slice is affine
+    const bool affineSlices = dynamic_cast< const SliceBySliceTransformType * >(m_Transforms[im].GetPointer()) != NULL ||
+                              m_Transforms[im]->IsLinear();
 
-                        //Loop over the support region
-                        for(itHRImage.GoToBegin(); !itHRImage.IsAtEnd(); ++itHRImage)
-                        {
+    RegionType lrRegion = m_Images[im]->GetLargestPossibleRegion();
+    SizeType lrSize = lrRegion.GetSize();
 
-                            //Get coordinate in HR image
-                            IndexType hrIndex = itHRImage.GetIndex();
-                            //Compute the corresponding linear index
-                            hrLinearIndex = hrIndex[0] + hrIndex[1]*size_hr[0] + hrIndex[2]*size_hr[0]*size_hr[1];
-                            //Add weight*PSFValue to the corresponding element in H
-                            m_H->operator()(lrLinearIndex, hrLinearIndex)  += psfValue * bsplineWeights[weightLinearIndex];
-                            weightLinearIndex++;
+    voxels.assign(lrSize[2], std::vector< unsigned int >());
 
-                        } //end of loop over the support region
+    int slice;
+    #pragma omp parallel for private(slice) schedule(dynamic)
+    for(slice = 0; slice < (int)lrSize[2]; slice++)
+    {
+        IndexType lrIndex = lrRegion.GetIndex();
+        lrIndex[2] += slice;
 
-                    }// end if bspline index inside sr image
+        if(affineSlices)
+        {
+            // bounding box of the transformed slice (given by its corners)
+            PointType sliceLowerBound;
+            PointType sliceUpperBound;
+            sliceLowerBound.Fill(std::numeric_limits< double >::max());
+            sliceUpperBound.Fill(-std::numeric_limits< double >::max());
 
-                } // if psf point is inside sr image
+            for(unsigned int c = 0; c < 4; c++)
+            {
+                IndexType corner = lrIndex;
+                corner[0] += (c & 1) * (lrSize[0]-1);
+                corner[1] += ((c >> 1) & 1) * (lrSize[1]-1);
 
-            }// for PSF voxels
+                PointType lrPoint;
+                m_Images[im]->TransformIndexToPhysicalPoint(corner, lrPoint);
+                PointType srPoint = m_Transforms[im]->TransformPoint(lrPoint);
 
-        }//for voxels
+                for(unsigned int i = 0; i < 3; i++)
+                {
+                    sliceLowerBound[i] = std::min(sliceLowerBound[i], srPoint[i]);
+                    sliceUpperBound[i] = std::max(sliceUpperBound[i], srPoint[i]);
+                }
+            }
 
-        offset += m_Images[im]->GetLargestPossibleRegion().GetNumberOfPixels();
-        assert(offset < UINT_MAX);
-    }//for im
+            bool intersects = true;
+            for(unsigned int i = 0; i < 3; i++)
+            {
+                intersects = intersects && sliceUpperBound[i] >= lowerBound[i] && sliceLowerBound[i] <= upperBound[i];
+            }
 
+            if(!intersects)
+            {
+                continue;
+            }
+        }
 
+        for(unsigned int v = 0; v < lrSize[0]*lrSize[1]; v++)
+        {
+            lrIndex[0] = lrRegion.GetIndex()[0] + v % lrSize[0];
+            lrIndex[1] = lrRegion.GetIndex()[1] + v / lrSize[0];
 
-    // normalization of H
-    for (unsigned int i = 0; i < m_H->rows(); i++)
+            // if point is not in the mask we skip it
+            if((!m_Masks[im]->GetImage()->GetPixel(lrIndex)) > 0)
+            {
+                continue;
+            }
+
+            PointType lrPoint;
+            m_Images[im]->TransformIndexToPhysicalPoint(lrIndex, lrPoint);
+            PointType srPoint = m_Transforms[im]->TransformPoint(lrPoint);
+
+            bool inside = true;
+            for(unsigned int i = 0; i < 3; i++)
+            {
+                inside = inside && srPoint[i] >= lowerBound[i] && srPoint[i] <= upperBound[i];
+            }
+
+            if(inside)
+            {
+                voxels[slice].push_back(v);
+            }
+        }
+    }
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+void SRHMatrixComputation< TImage >::ComputeSliceRows(unsigned int im, unsigned int slice, unsigned int firstRow,
+                                                      const std::vector< unsigned int > * voxels,
+                                                      const InterpolatorType * interpolator,
+                                                      const std::vector< typename PointType::VectorType > & psfOffsets,
+                                                      const std::vector< double > & psfValues,
+                                                      btk::SparseMatrix< PrecisionType > & block)
+{
+    //We use linear interpolation for the estimation of point influence in matrix H
+    //(one weight function per call, so that the threads do not share it)
+    typedef itk::BSplineInterpolationWeightFunction<double, 3, 1> itkBSplineFunction;
+    itkBSplineFunction::Pointer bsplineFunction = itkBSplineFunction::New();
+    itkBSplineFunction::WeightsType bsplineWeights;
+    bsplineWeights.SetSize(8); // (bsplineOrder + 1)^3
+    itkBSplineFunction::IndexType   bsplineStartIndex;
+    itkBSplineFunction::IndexType   bsplineEndIndex;
+    itkBSplineFunction::SizeType    bsplineSize = bsplineFunction->GetSupportSize();
+    RegionType                      bsplineRegion;
+
+    SizeType size_hr = m_OutputImageRegion.GetSize();
+
+    RegionType lrRegion = m_Images[im]->GetLargestPossibleRegion();
+    SizeType lrSize = lrRegion.GetSize();
+
+    // one row per voxel of the slice, or per selected voxel
+    unsigned int numberOfRows = (voxels != NULL) ? voxels->size() : lrSize[0]*lrSize[1];
+    block.SetSize(numberOfRows, m_OutputImageRegion.GetNumberOfPixels());
+
+    IndexType lrIndex = lrRegion.GetIndex();
+    lrIndex[2] += slice;
+
+    // for all voxels of the slice
+    for(unsigned int r = 0; r < numberOfRows; r++)
     {
-        double sum = 0.0;
-        sum = m_H->sum_row(i);
+        unsigned int v = (voxels != NULL) ? (*voxels)[r] : r;
+        lrIndex[0] = lrRegion.GetIndex()[0] + v % lrSize[0];
+        lrIndex[1] = lrRegion.GetIndex()[1] + v / lrSize[0];
 
-        vnl_sparse_matrix< PrecisionType >::row & r = m_H->get_row(i);
-        vnl_sparse_matrix< PrecisionType >::row::iterator col_iter = r.begin();
-        for ( ;col_iter != r.end(); ++col_iter)
-        {
+        PointType lrPoint;
+        m_Images[im]->TransformIndexToPhysicalPoint(lrIndex, lrPoint);
+        PointType srPoint = m_Transforms[im]->TransformPoint(lrPoint);
 
-            (*col_iter).second = (*col_iter).second / sum;
+        // if point is not in the mask we skip it
+        if((!m_Masks[im]->GetImage()->GetPixel(lrIndex)) > 0)
+        {
+            continue;
+        }
 
+        // if point is not in the sr image we skip it (the selected voxels may be outside, their PSF reaching the sr image)
+        if(voxels == NULL && !interpolator->IsInsideBuffer(srPoint))
+        {
+            continue;
         }
 
+        //Fill Y (each slice owns its own elements)
+        m_Y->operator()(firstRow + r) = m_Images[im]->GetPixel(lrIndex);
 
-    }
+        // Loop over PSF samples
+        for(unsigned int p = 0; p < psfOffsets.size(); p++)
+        {
+            //Physical point of the PSF sample, in Lr Space, then in sr space
+            PointType psfInLrSpacePoint = lrPoint + psfOffsets[p];
+            PointType transformedPoint = m_Transforms[im]->TransformPoint(psfInLrSpacePoint);
 
+            // if point is not in the sr image we skip it
+            if(!interpolator->IsInsideBuffer(transformedPoint))
+            {
+                continue;
+            }
 
+            // continuous index in sr image
+            ContinuousIndexType srContIndex;
+            m_ReferenceImage->TransformPhysicalPointToContinuousIndex(transformedPoint, srContIndex);
 
-    m_IsHComputed = true;
-    std::cout<<"H computed !"<<std::endl;
+            //Get the interpolation weight using itkBSplineInterpolationWeightFunction
+            bsplineFunction->Evaluate(srContIndex,bsplineWeights,bsplineStartIndex);
 
-    // DEBUG :
-//    std::cout<<"Testing Y, X and simulated Y..."<<std::endl;
-//    //this->TestFillingOfY();
-//    this->TestFillingOfX();
-//    this->SimulateY();
+            //Check if the bspline support region is inside the HR image
+            bsplineEndIndex[0] = bsplineStartIndex[0] + bsplineSize[0];
+            bsplineEndIndex[1] = bsplineStartIndex[1] + bsplineSize[1];
+            bsplineEndIndex[2] = bsplineStartIndex[2] + bsplineSize[2];
+
+            if(m_ReferenceImage->GetLargestPossibleRegion().IsInside(bsplineStartIndex)
+                    && m_ReferenceImage->GetLargestPossibleRegion().IsInside(bsplineEndIndex))
+            {
+                //Set the support region
+                bsplineRegion.SetSize(bsplineSize);
+                bsplineRegion.SetIndex(bsplineStartIndex);
+
+                //Instantiate an iterator on HR image over the bspline region
+                ImageRegionConstIteratorWithIndex< ImageType > itHRImage(m_ReferenceImage,bsplineRegion);
+
+                //linear index of bspline weights
+                unsigned int weightLinearIndex = 0;
+
+                //Loop over the support region
+                for(itHRImage.GoToBegin(); !itHRImage.IsAtEnd(); ++itHRImage)
+                {
+                    //Get coordinate in HR image
+                    IndexType hrIndex = itHRImage.GetIndex();
+                    //Compute the corresponding linear index
+                    unsigned int hrLinearIndex = hrIndex[0] + hrIndex[1]*size_hr[0] + hrIndex[2]*size_hr[0]*size_hr[1];
+                    //Add weight*PSFValue to the corresponding element of the block
+                    block.AddValue(r, hrLinearIndex, psfValues[p] * bsplineWeights[weightLinearIndex]);
+                    weightLinearIndex++;
+
+                } //end of loop over the support region
+
+            }// end if bspline index inside sr image
+
+        }// for PSF samples
+
+    }//for voxels
 
+    block.Finalize();
 }
 //-------------------------------------------------------------------------------------------------
 template< class TImage >
@@ -427,7 +764,7 @@ SRHMatrixComputation< TImage >::SimulateY()
     vnl_vector< PrecisionType > SimY;
 
 
-    m_H->mult(m_X, SimY);
+    m_H->Multiply(m_X, SimY);
 
 
     std::cout<<"Simulation Y is 0 : "<<SimY.is_zero()<<std::endl;
@@ -3,7 +3,7 @@
 namespace btk
 {
 
-SimulateLRImageFilter::SimulateLRImageFilter()
+SimulateLRImageFilter::SimulateLRImageFilter():m_H(NULL)
 {
 }
 //-----------------------------------------------------------------------------------------------------------
@@ -18,7 +18,7 @@ void SimulateLRImageFilter::Update()
 
     //Compute H * x
     vnl_vector<float> Hx;
-    m_H.mult(m_X,Hx);
+    m_H->Multiply(m_X,Hx);
 
     //resize the vector of simulated input LR images
     m_SimulatedOutputImages.resize(m_LRImages.size());
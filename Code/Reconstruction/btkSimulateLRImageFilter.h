@@ -47,12 +47,13 @@
 
 
 //VNL includes
-#include "vnl/vnl_sparse_matrix.h"
+#include "vnl/vnl_vector.h"
 
 // BTK includes
 
 #include "btkMacro.h"
 #include "btkSuperResolutionType.h"
+#include "btkLinearOperator.h"
 
 
 namespace btk
@@ -96,8 +97,8 @@ public:
     btkSetMacro(LRImages, std::vector< itkImage::Pointer >);
     btkGetMacro(LRImages, std::vector< itkImage::Pointer >);
 
-    btkSetMacro(H,vnl_sparse_matrix< float >);
-    btkGetMacro(H,vnl_sparse_matrix< float >);
+    btkSetMacro(H,const btk::LinearOperator< float >*);
+    btkGetMacro(H,const btk::LinearOperator< float >*);
 
     btkSetMacro(X,vnl_vector< float >);
     btkGetMacro(X,vnl_vector< float >);
@@ -112,7 +113,7 @@ private:
 
     std::vector< itkImage::Pointer > m_SimulatedOutputImages;
 
-    vnl_sparse_matrix<float>  m_H;
+    const btk::LinearOperator<float> *  m_H; // H (explicit or matrix-free) is not copied
 
     vnl_vector<float> m_X;
 
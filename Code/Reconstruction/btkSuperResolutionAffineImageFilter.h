@@ -285,6 +285,20 @@ public:
   /** Gets the type of PSF (Boxcar/Gaussian).*/
   itkGetMacro(PSF, unsigned int);
 
+  /** Sets the file caching the H matrix (see LeastSquaresVnlCostFunction). */
+  itkSetMacro(HMatrixCacheFileName, std::string);
+
+  /** Gets the file caching the H matrix. */
+  itkGetMacro(HMatrixCacheFileName, std::string);
+
+  /** Solves the normal equations of the cost function with a preconditioned
+  conjugate gradient instead of minimizing it with vnl_conjugate_gradient
+  (default false). See LeastSquaresVnlCostFunction::SolveNormalEquations. */
+  itkSetMacro(SolveNormalEquations, bool);
+
+  /** Gets the solver used (preconditioned conjugate gradient or not). */
+  itkGetMacro(SolveNormalEquations, bool);
+
 
 #ifdef ITK_USE_CONCEPT_CHECKING
   /** Begin concept checking */
@@ -339,6 +353,10 @@ private:
 
   unsigned int m_PSF;
 
+  std::string m_HMatrixCacheFileName;
+
+  bool m_SolveNormalEquations;
+
 };
 
 
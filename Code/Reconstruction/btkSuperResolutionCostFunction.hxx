@@ -38,9 +38,14 @@
 
 #include "itkObject.h"
 #include "vnl/vnl_matops.h"
-#include "vnl/vnl_sparse_matrix.h"
+#include "vnl/vnl_vector.h"
 
 #include "btkMacro.h"
+#include "btkLinearOperator.h"
+#include "btkFiniteDifferenceStencil.h"
+#include "btkTelemetry.h"
+
+#include "cmath"
 
 namespace btk
 {
@@ -59,10 +64,17 @@ class SuperResolutionCostFunction: public itk::Object
 
         typedef TImage   ImageType;
 
+        typedef btk::FiniteDifferenceStencil< PrecisionType > StencilType;
+
+        /** Value of the cost function: ||Hx - Y||^2/size(Y) + lambda * (Charbonnier function of the first derivatives of x) */
         double GetValue(const vnl_vector< double >& _x);
 
+        /** Gradient of the cost function (data and regularization terms) */
         void GetGradient(const vnl_vector< double >& _x, vnl_vector< double >& _g);
 
+        /** Value and gradient of the cost function, Hx being computed only once */
+        double GetValueAndGradient(const vnl_vector< double >& _x, vnl_vector< double >& _g);
+
 
         itkNewMacro(Self);
 
@@ -70,7 +82,8 @@ class SuperResolutionCostFunction: public itk::Object
         itkTypeMacro(btk::SuperResolutionCostFunction, itk::Object);
 
 
-        btkSetMacro(H,vnl_sparse_matrix< PrecisionType >&);
+        /** Observation operator (a btk::SparseMatrix, or a matrix-free operator) */
+        btkSetMacro(H,const btk::LinearOperator< PrecisionType >*);
 
         btkSetMacro(HtY,vnl_vector< PrecisionType >&);
 
@@ -83,107 +96,16 @@ class SuperResolutionCostFunction: public itk::Object
         btkSetMacro(SRSize, typename ImageType::SizeType);
 
 
-        struct IMG_SIZE
-        {
-           unsigned int width;
-           unsigned int height;
-           unsigned int depth;
-        };
-
-
     protected:
         SuperResolutionCostFunction();
         virtual ~SuperResolutionCostFunction(){}
 
     private:
 
-        void
-        Set(PrecisionType * _array, int _size, PrecisionType _value)
-        {
-            for (unsigned int i = 0; i < _size; i++)
-            {
-                _array[i] = _value;
-            }
-
-        }
-
-
-        /** Gets an image row as a vector. */
-        void GetRow(const vnl_vector<PrecisionType>& _image, IMG_SIZE & _size, int _row, int _frame, PrecisionType * _output)
-        {
-            for (unsigned int i = 0; i < _size.width; i++)
-            {
-                _output[i] = _image[i + _row * _size.width + _frame * _size.width * _size.height];
-            }
-        }
-
-        /** Sets an image row from a vector. */
-        void SetRow(vnl_vector<PrecisionType>& _image, IMG_SIZE & _size, int _row, int _frame, PrecisionType * _input)
-        {
-            for (unsigned int i = 0; i < _size.width; i++)
-            {
-                _image[i + _row * _size.width + _frame * _size.width * _size.height] = _input[i];
-            }
-        }
-
-        /** Gets an image column as a vector. */
-        void GetCol(const vnl_vector<PrecisionType>& _image, IMG_SIZE & _size, int _col, int _frame, PrecisionType * _output)
-        {
-            for (unsigned int i = 0; i < _size.height; i++)
-            {
-                _output[i] = _image[_col + i * _size.width + _frame * _size.width * _size.height];
-            }
-        }
-
-        /** Sets an image column from a vector. */
-        void SetCol(vnl_vector<PrecisionType>& _image, IMG_SIZE & _size, int _col, int _frame, PrecisionType * _input)
-        {
-            for (unsigned int i = 0; i < _size.height; i++)
-            {
-                _image[_col + i * _size.width + _frame * _size.width * _size.height] = _input[i];
-            }
-        }
-
-        /** Gets an image z-axis as a vector. */
-        void GetSpec(const vnl_vector<PrecisionType>& _image, IMG_SIZE & _size, int _row, int _col, PrecisionType * _output)
-        {
-            for (unsigned int i = 0; i < _size.depth; i++)
-            {
-                _output[i] = _image[_col + _row * _size.width + i * _size.width * _size.height];
-            }
-        }
-
-        /** Sets an image z-axis from a vector. */
-        void SetSpec(vnl_vector<PrecisionType>& _image, IMG_SIZE & _size, int _row, int _col, PrecisionType * _input)
-        {
-            for (unsigned int i = 0; i < _size.depth; i++)
-            {
-                _image[_col + _row * _size.width + i * _size.width * _size.height] = _input[i];
-            }
-        }
-
-
-        /** Mirror of the position pos. abs(pos) must not be > 2*(size-1) */
-        int Mirror(int _pos, int _size);
-
-        void Convol1d(PrecisionType * _kernel, int _ksize, PrecisionType * _src, int _src_size, PrecisionType * _dest);
-
-        /** 3D convolution : over the rows */
-        void Convol3dx(const vnl_vector<PrecisionType>& _image, vnl_vector<PrecisionType>& _image_conv,
-            IMG_SIZE& _size, PrecisionType * _kernel, int _ksize);
-
-        /** 3D convolution : over the columns */
-        void Convol3dy(const vnl_vector<PrecisionType>& _image, vnl_vector<PrecisionType>& _image_conv,
-            IMG_SIZE & _size, PrecisionType * _kernel, int _ksize);
-
-        /** 3D convolution : over the spectra */
-        void Convol3dz(const vnl_vector<PrecisionType>& _image, vnl_vector<PrecisionType>& _image_conv,
-            IMG_SIZE & _size, PrecisionType * _kernel, int _ksize);
+        /** Compute the value of the cost function, and its gradient if _g is not NULL */
+        double Evaluate(const vnl_vector< double >& _x, vnl_vector< double > * _g);
 
-
-    private:
-
-        vnl_sparse_matrix< PrecisionType > m_H;
+        const btk::LinearOperator< PrecisionType > * m_H; // H is not copied
 
         vnl_vector< PrecisionType > m_HtY;
 
@@ -193,10 +115,21 @@ class SuperResolutionCostFunction: public itk::Object
 
         unsigned int m_NumberOfParameters;
 
-        IMG_SIZE        m_X_Size;
+        /** First derivatives of x along the three axes */
+        StencilType     m_Stencil;
 
         typename ImageType::SizeType    m_SRSize;
 
+        /** Work buffers of Evaluate (allocated once) */
+        vnl_vector< PrecisionType > m_XFloat;
+        vnl_vector< PrecisionType > m_Residual;     /**< Hx - Y */
+        vnl_vector< PrecisionType > m_HtResidual;   /**< Ht(Hx - Y) */
+        vnl_vector< PrecisionType > m_Derivative;
+        vnl_vector< PrecisionType > m_Work;
+
+        /** Number of evaluations (iteration of the telemetry) */
+        unsigned int m_NumberOfEvaluations;
+
 };
 }
 
@@ -38,7 +38,7 @@
 namespace btk
 {
 template< class TImage >
-SuperResolutionCostFunction< TImage >::SuperResolutionCostFunction()
+SuperResolutionCostFunction< TImage >::SuperResolutionCostFunction():m_H(NULL), m_NumberOfEvaluations(0)
 {
 }
 //-------------------------------------------------------------------------------------------------
@@ -46,241 +46,131 @@ template < class TImage >
 double SuperResolutionCostFunction< TImage >::
 GetValue(const vnl_vector<double> &_x)
 {
-    // Calculate the error with respect to the low resolution images
-
-    vnl_vector<PrecisionType>  x_float;
-    x_float = vnl_matops::d2f(_x);
-
-    vnl_vector<PrecisionType> Hx;
-    this->m_H.mult(x_float,Hx);
-
-    m_X_Size.width = m_SRSize[0];
-    m_X_Size.height = m_SRSize[1];
-    m_X_Size.depth = m_SRSize[2];
-
-//    vnl_vector<PrecisionType> Hx;
-//    this->m_H.mult(_x,Hx);
-
-    //vnl_vector<float> HxMinusY;
-    vnl_vector<PrecisionType> HxMinusY;
-    HxMinusY = Hx - this->m_Y;
-    //HxMinusY = Y - Hx;
-
-    Hx.clear();
-
-    double mse = HxMinusY.squared_magnitude()/ HxMinusY.size();
-    //double mse = HxMinusY.magnitude()/ HxMinusY.size();
-    //double mse = HxMinusY.two_norm()/ HxMinusY.size();
-    //double mse = HxMinusY.one_norm()/ HxMinusY.size();
-    //double mse = HxMinusY.rms()/ HxMinusY.size();
-
-    HxMinusY.clear();
-
-    // Calculate the square of 1st derivatives along x, y, and z
-    double reg = 0.0;
-    double regCH = 0.0;
-
-    //float* kernel = new float[2];
-    PrecisionType* kernel = new PrecisionType[2];
-    kernel[0] = -1; kernel[1] = 1;
-
-
-    vnl_vector<float> DxX;
-    DxX.set_size( x_float.size() );
-
-/*    vnl_vector<PrecisionType> DxX;
-    DxX.set_size( _x.size() )*/;
-
-    Convol3dx(x_float, DxX, m_X_Size, kernel, 2);
-    //Convol3dx(_x, DxX, m_X_Size, kernel, 2);
-
-       //for(unsigned int i=0; i<x_float.size(); i++)
-    for(unsigned int i=0; i<_x.size(); i++)
-    {
-        //reg += DxX[i]*DxX[i] / x_float.size();
-        reg += DxX[i]*DxX[i] / _x.size();
-        regCH += 2* sqrt(1 + (DxX[i]*DxX[i]/ _x.size()))-2;
-    }
-    DxX.clear();
-
-    vnl_vector<float> DyX;
-    DyX.set_size( x_float.size() );
-
-//    vnl_vector<PrecisionType> DyX;
-//    DyX.set_size( _x.size() );
-
-    Convol3dy(x_float, DyX, m_X_Size, kernel, 2);
-    //Convol3dy(_x, DyX, m_X_Size, kernel, 2);
-    //for(unsigned int i=0; i<x_float.size(); i++)
-    for(unsigned int i=0; i<_x.size(); i++)
-    {
-        //reg += DyX[i]*DyX[i] / x_float.size();
-        reg += DyX[i]*DyX[i] / _x.size();
-        regCH += 2 * sqrt(1 + (DyX[i]*DyX[i]/ _x.size())) -2;
-    }
-    DyX.clear();
-
-    vnl_vector<float> DzX;
-    DzX.set_size( x_float.size() );
-
-//    vnl_vector<PrecisionType> DzX;
-//    DzX.set_size( _x.size() );
-
-    Convol3dz(x_float, DzX, m_X_Size, kernel, 2);
-    //Convol3dz(_x, DzX, m_X_Size, kernel, 2);
-    //for(unsigned int i=0; i<x_float.size(); i++)
-    for(unsigned int i=0; i<_x.size(); i++)
-    {
-        //reg += DzX[i]*DzX[i] / x_float.size();
-        reg += DzX[i]*DzX[i] / _x.size();
-        regCH += 2 * sqrt(1 + (DzX[i]*DzX[i]/ _x.size())) -2;
-    }
-    DzX.clear();
-
-    delete[] kernel;
-
-    // Calculate the cost function by combining both terms
-    //std::cout<<"Reg : "<<reg<<", CH reg : "<<regCH<<std::endl;
-
-    double value = mse + m_Lambda*regCH;
-
-    //std::cout << "error, mse, reg = " << value << " , " << mse << " , " <<reg<<" , "<< m_Lambda*reg << std::endl;
-
-    return value;
+    return this->Evaluate(_x, NULL);
 }
 //-------------------------------------------------------------------------------------------------
 template< class TImage >
 void SuperResolutionCostFunction< TImage >::
 GetGradient(const vnl_vector< double > & _x, vnl_vector< double >& _g)
 {
-    vnl_vector<float>  x_float;
-
-    x_float = vnl_matops::d2f(_x);
+    this->Evaluate(_x, &_g);
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+double SuperResolutionCostFunction< TImage >::
+GetValueAndGradient(const vnl_vector< double > & _x, vnl_vector< double >& _g)
+{
+    return this->Evaluate(_x, &_g);
+}
+//-------------------------------------------------------------------------------------------------
+template< class TImage >
+double SuperResolutionCostFunction< TImage >::
+Evaluate(const vnl_vector< double > & _x, vnl_vector< double > * _g)
+{
+    m_Stencil.SetSize(m_SRSize[0], m_SRSize[1], m_SRSize[2]);
 
-    vnl_vector<float> Hx;
-    m_H.mult(x_float,Hx);
+    bool telemetry = btk::Telemetry::GetInstance().IsEnabled();
+    double time = telemetry ? btk::Telemetry::GetTime() : 0.0;
+    double spmvTime = 0.0;
 
-//    vnl_vector< PrecisionType > Hx;
-//    m_H.mult(_x,Hx);
+    const long n = _x.size();
+    long i;
 
+    // The work buffers are only allocated at the first call (set_size keeps the memory when the size is unchanged)
+    m_XFloat.set_size(n);
+    m_Derivative.set_size(n);
 
-    // Calculate Ht*Hx. Note that this is calculated as Hx*H since
-    // Ht*Hx = (Hxt*H)t and for Vnl (Hxt*H)t = Hxt*H = Hx*H because
-    // the vnl_vector doesn't have a 2nd dimension. This allows us
-    // to save a lot of memory because we don't need to store Ht.
+    #pragma omp parallel for private(i) schedule(static)
+    for(i = 0; i < n; i++)
+    {
+        m_XFloat[i] = _x[i];
+    }
 
-    //vnl_vector<float> HtHx;
-    vnl_vector<PrecisionType> HtHx;
-    m_H.pre_mult(Hx,HtHx);
-    Hx.clear();
+    // Data term: mse = ||Hx - Y||^2 / size(Y), with gradient 2/size(Y) Ht(Hx - Y). Hx is computed once for both.
+    this->m_H->Multiply(m_XFloat, m_Residual);
+    m_Residual -= this->m_Y;
 
-    double factor = 2.0 / m_Y.size();
-    _g = vnl_matops::f2d( (-m_HtY + HtHx)*factor );
-    //_g = (-m_HtY + HtHx)*factor ;
+    double residualNorm2 = m_Residual.squared_magnitude();
+    double mse = residualNorm2 / m_Residual.size();
 
+    if(_g != NULL)
+    {
+        this->m_H->TransposeMultiply(m_Residual, m_HtResidual);
 
+        _g->set_size(n);
+        double factor = 2.0 / m_Y.size();
 
-    HtHx.clear();
-}
+        #pragma omp parallel for private(i) schedule(static)
+        for(i = 0; i < n; i++)
+        {
+            (*_g)[i] = factor * m_HtResidual[i];
+        }
 
-//-------------------------------------------------------------------------------------------------
-template < class TImage >
-int SuperResolutionCostFunction< TImage >::Mirror(int _pos, int _size)
-{
-    int output = std::abs(_pos);
+        m_Work.set_size(n);
+    }
 
-    while(output >= _size)
+    if(telemetry)
     {
-        output = std::abs(output - (output - _size + 1) * 2);
+        spmvTime = btk::Telemetry::GetTime() - time;
+        time = btk::Telemetry::GetTime();
     }
 
-    return output;
-}
-
-//-------------------------------------------------------------------------------------------------
-template < class TImage >
-void SuperResolutionCostFunction< TImage >::
-Convol1d(PrecisionType *_kernel, int _ksize, PrecisionType *_src, int _src_size, PrecisionType *_dest)
-{
-    int n2 = _ksize / 2;
-    int k;
+    // Regularization term (Charbonnier function of the first derivatives along x, y, and z):
+    // reg = sum 2*sqrt(1 + d^2/n) - 2, with gradient D^T (2d / (n*sqrt(1 + d^2/n))) for every derivative D
+    double regCH = 0.0;
 
-    Set(_dest, _src_size, 0);
-    for (int i = 0; i < _src_size; i++)
+    for(unsigned int axis = 0; axis < 3; axis++)
     {
-        for (int j = 0; j < _ksize; j++)
-        {
-            k = i - j + n2;
-            k = this->Mirror(k, _src_size);
-            _dest[i] += _kernel[j] * _src[k];
-        }
-    }
-}
+        m_Stencil.Apply(axis, StencilType::FORWARD_DIFFERENCE, m_XFloat, m_Derivative);
 
-//-------------------------------------------------------------------------------------------------
-template < class TImage >
-void SuperResolutionCostFunction< TImage >::
-Convol3dx(const vnl_vector<PrecisionType> &_image, vnl_vector<PrecisionType> &_image_conv, IMG_SIZE &_size, PrecisionType *_kernel, int _ksize)
-{
-    PrecisionType * drow = new PrecisionType[_size.width];
-    PrecisionType * srow = new PrecisionType[_size.width];
+        double axisReg = 0.0;
 
-    for (unsigned int l = 0; l < _size.depth; l++)
-    {
-        for (unsigned int py = 0; py < _size.height; py++)
+        #pragma omp parallel for private(i) schedule(static) reduction(+:axisReg)
+        for(i = 0; i < n; i++)
         {
-            GetRow(_image, _size, py, l, srow);
-            Convol1d(_kernel, _ksize, srow, _size.width, drow);
-            SetRow(_image_conv, _size, py, l, drow);
-        }
-    }
+            double d = m_Derivative[i];
+            double root = std::sqrt(1 + d*d / n);
 
-    delete[] drow;
-    delete[] srow;
-}
+            axisReg += 2*root - 2;
 
-//-------------------------------------------------------------------------------------------------
-template < class TImage >
-void SuperResolutionCostFunction< TImage >::
-Convol3dy(const vnl_vector<PrecisionType> &_image, vnl_vector<PrecisionType> &_image_conv, IMG_SIZE &_size, PrecisionType *_kernel, int _ksize)
-{
-    PrecisionType * dcol = new PrecisionType[_size.height];
-    PrecisionType * scol = new PrecisionType[_size.height];
+            // the derivative is replaced with the derivative of the Charbonnier function
+            m_Derivative[i] = 2*d / (n * root);
+        }
+        regCH += axisReg;
 
-    for (unsigned int l = 0; l < _size.depth; l++)
-    {
-        for (unsigned int px = 0; px < _size.width; px++)
+        if(_g != NULL)
         {
-            GetCol(_image, _size, px, l, scol);
-            Convol1d(_kernel, _ksize, scol, _size.height, dcol);
-            SetCol(_image_conv, _size, px, l, dcol);
+            m_Stencil.ApplyTranspose(axis, StencilType::FORWARD_DIFFERENCE, m_Derivative, m_Work);
+
+            #pragma omp parallel for private(i) schedule(static)
+            for(i = 0; i < n; i++)
+            {
+                (*_g)[i] += m_Lambda * m_Work[i];
+            }
         }
     }
 
-    delete[] dcol;
-    delete[] scol;
-}
+    // Calculate the cost function by combining both terms
+    double value = mse + m_Lambda*regCH;
 
-//-------------------------------------------------------------------------------------------------
-template < class TImage >
-void SuperResolutionCostFunction< TImage >::
-Convol3dz(const vnl_vector<PrecisionType> &_image, vnl_vector<PrecisionType> &_image_conv, IMG_SIZE &_size, PrecisionType *_kernel, int _ksize)
-{
-    PrecisionType * dspec = new PrecisionType[_size.depth];
-    PrecisionType * sspec = new PrecisionType[_size.depth];
+    m_NumberOfEvaluations++;
 
-    for (unsigned int py = 0; py < _size.height; py++)
+    if(telemetry)
     {
-        for (unsigned int px = 0; px < _size.width; px++)
-        {
-            GetSpec(_image, _size, py, px, sspec);
-            Convol1d(_kernel, _ksize, sspec, _size.depth, dspec);
-            SetSpec(_image_conv, _size, py, px, dspec);
-        }
+        btk::Telemetry::Record record("super_resolution_cost");
+        record.SetIteration(m_NumberOfEvaluations);
+        record.SetValue("cost", value);
+        record.SetValue("data_term", mse);
+        record.SetValue("regularization", m_Lambda*regCH);
+        record.SetValue("residual_norm", std::sqrt(residualNorm2));
+        record.SetValue("gradient", _g != NULL);
+        record.AddPhaseTime("spmv", spmvTime);
+        record.AddPhaseTime("regularization", btk::Telemetry::GetTime() - time);
+        btk::Telemetry::GetInstance().Write(record);
     }
 
-    delete[] dspec;
-    delete[] sspec;
+    return value;
 }
+
 //-------------------------------------------------------------------------------------------------
 }
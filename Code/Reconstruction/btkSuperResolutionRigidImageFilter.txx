@@ -62,6 +62,7 @@ SuperResolutionRigidImageFilter<TInputImage, TOutputImage   ,TInterpolatorPrecis
   m_Iterations = 30;
   m_Lambda = 0.1;
   m_PSF = GAUSSIAN;
+  m_SolveNormalEquations = false;
 }
 
 /**
@@ -181,8 +182,15 @@ SuperResolutionRigidImageFilter<TInputImage,TOutputImage   ,TInterpolatorPrecisi
   f.SetReferenceImage(this -> GetReferenceImage());
   f.SetLambda( m_Lambda );
   f.SetPSF( m_PSF );
+  f.SetHMatrixCacheFileName( m_HMatrixCacheFileName );
   f.Initialize();
 
+  if ( m_SolveNormalEquations )
+  {
+    f.SolveNormalEquations(m_x, m_Iterations);
+    return;
+  }
+
   // Setup optimizer
 
   vnl_conjugate_gradient cg(f);
@@ -52,18 +52,22 @@
 #include "itkBinaryThresholdImageFilter.h"
 #include "itkAbsoluteValueDifferenceImageFilter.h"
 #include "itkStatisticsImageFilter.h"
-#include "itkLaplacianImageFilter.h"
 
-#include "vnl/vnl_sparse_matrix.h"
-#include "vnl/vnl_inverse.h"
-#include "vnl/algo/vnl_sparse_lu.h"
+#include "vnl/vnl_vector.h"
 
 #include "../Denoising/btkNLMTool.h"
+#include "../Maths/btkSparseMatrix.h"
+#include "../Maths/btkFiniteDifferenceStencil.h"
+#include "../Maths/btkFiniteDifferenceOperator.h"
+#include "../Maths/btkConjugateGradientSolver.h"
+#include "../Maths/btkResidualBackProjection.h"
+#include "../Tools/btkTelemetry.h"
 
 
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <cmath>
 
 class SuperResolutionDataManager;
 
@@ -89,23 +93,28 @@ public:
   typedef itk::AbsoluteValueDifferenceImageFilter <itkImage, itkImage, itkImage>  itkAbsoluteValueDifferenceImageFilter;  
   typedef itk::StatisticsImageFilter<itkImage>                            itkStatisticsImageFilter;
 
-  typedef itk::LaplacianImageFilter<itkImage , itkImage >                 itkLaplacianFilter;
 
 
   int                       m_psftype; // 0: 3D interpolated boxcar, 1: 3D oversampled boxcar
   std::vector<itkPointer>   m_PSF;
   int                       m_interpolationOrderPSF;
   int                       m_interpolationOrderIBP;
-  vnl_sparse_matrix<double> m_H;
+  btk::SparseMatrix<double> m_H;
   vnl_vector<double>         m_Y;
   vnl_vector<double>         m_X;
   float                     m_paddingValue;
   std::vector<unsigned int> m_offset;
+  unsigned int              m_maxIterationsCG; // maximum number of iterations of the conjugate gradient (pseudo-inverse)
+  double                    m_toleranceCG;     // relative residual at which the conjugate gradient stops (pseudo-inverse)
+  unsigned int              m_iterationIBP;    // number of calls to IteratedBackProjection (telemetry)
   
   SuperResolutionTools(){
     m_interpolationOrderPSF = 1;  //linear interpolation for interpolated PSF
     m_psftype = 1;                //interpolated PSF by default (1: oversampled PSF)
     m_paddingValue = 0;           //0 is considered as background by default.
+    m_maxIterationsCG = 200;
+    m_toleranceCG = 1e-6;
+    m_iterationIBP = 0;
   };
   
   void SetPSFInterpolationOrderPSF(int & order);
@@ -113,8 +122,13 @@ public:
   void SetPSFComputation(int & type);
   void InitializePSF(SuperResolutionDataManager & data);
   void HComputation(SuperResolutionDataManager & data);
+  void HComputationSlice(SuperResolutionDataManager & data, unsigned int i, unsigned int slice,
+                         const std::vector< itkImage::PointType::VectorType > & psfOffsets,
+                         const std::vector< double > & psfValues,
+                         btk::SparseMatrix<double> & block);
   void UpdateX(SuperResolutionDataManager & data);
   void SimulateLRImages(SuperResolutionDataManager & data);
+  void FillSimulatedLRImages(SuperResolutionDataManager & data, const vnl_vector<double> & Hx);
   double IteratedBackProjection(SuperResolutionDataManager & data, int & nlm, float & beta, int & medianIBP);
   void CreateMaskHRImage(SuperResolutionDataManager & data);
   void SRUsingPseudoInverse(SuperResolutionDataManager & data);
@@ -257,41 +271,42 @@ void SuperResolutionTools::InitializePSF(SuperResolutionDataManager & data)
         //set nearest neighbour interpolation mode
         bsInterpolator->SetSplineOrder(0);
         
-        //Loop over voxels of HR PSF
-        for(itPSF.GoToBegin(); !itPSF.IsAtEnd(); ++itPSF){
-          
-          double sum = 0;
-          int x,y,z;
-          //Coordinate in HR image
-          hrIndex = itPSF.GetIndex();
-          itkContinuousIndex hrContIndex;
-          itkImage::PointType hrPoint;
-          itkContinuousIndex lrContIndex;
+        {
+          //The LR boxcar and the HR PSF are not rotated: the oversampled value of a HR voxel is the product of the
+          //number of samples falling into the boxcar along each axis, so the samples are counted once per axis.
+          std::vector< double > counts[3];
           
-          //Coordinate in physical space
-          m_PSF[i]->TransformIndexToPhysicalPoint(hrIndex,hrPoint);          
-          //Continuous coordinate in LR image
-          LRPSF->TransformPhysicalPointToContinuousIndex(hrPoint,lrContIndex);     
-
-          for(z=0; z<nbSamples; z++)
-            for(y=0; y<nbSamples; y++)
-              for(x=0; x<nbSamples; x++){
-
-                hrContIndex[0] = hrIndex[0] - 0.5 + 1.0*x/nbSamples;
-                hrContIndex[1] = hrIndex[1] - 0.5 + 1.0*y/nbSamples;
-                hrContIndex[2] = hrIndex[2] - 0.5 + 1.0*z/nbSamples;
+          for(uint axis=0; axis<3; axis++){
+            counts[axis].assign(hrSize[axis],0.0);
+            
+            for(uint h=0; h<hrSize[axis]; h++)
+              for(int s=0; s<nbSamples; s++){
+                
+                itkContinuousIndex hrContIndex = hrIndexCenter;
+                hrContIndex[axis] = h - 0.5 + 1.0*s/nbSamples;
                 
                 //Coordinate in physical space
+                itkImage::PointType hrPoint;
                 m_PSF[i]->TransformContinuousIndexToPhysicalPoint(hrContIndex,hrPoint);
                 
-                //Continuous coordinate in LR image
+                //Continuous coordinate in LR image (at the center of the LR voxel along the other axes)
+                itkContinuousIndex lrContIndex;
                 LRPSF->TransformPhysicalPointToContinuousIndex(hrPoint,lrContIndex);
+                for(uint other=0; other<3; other++)
+                  if(other != axis)
+                    lrContIndex[other] = lrIndexCenter[other];
                 
-                sum += bsInterpolator->EvaluateAtContinuousIndex(lrContIndex);              
+                counts[axis][h] += bsInterpolator->EvaluateAtContinuousIndex(lrContIndex);
               }
+          }
           
-          //Set oversampled value to m_PSF
-          itPSF.Set(sum);
+          //Loop over voxels of HR PSF
+          for(itPSF.GoToBegin(); !itPSF.IsAtEnd(); ++itPSF){
+            hrIndex = itPSF.GetIndex();
+            
+            //Set oversampled value to m_PSF
+            itPSF.Set(counts[0][hrIndex[0]] * counts[1][hrIndex[1]] * counts[2][hrIndex[2]]);
+          }
         }
         break;
         case 2: 
@@ -349,7 +364,9 @@ void SuperResolutionTools::InitializePSF(SuperResolutionDataManager & data)
 void SuperResolutionTools::HComputation(SuperResolutionDataManager & data)
 {
   std::cout<<"Computing the matrix H (y=Hx) + fill y and x. \n";
+  double startTime = btk::Telemetry::GetTime();
   //Principle: for each voxel of the LR images, we compute the influence of each voxel of the PSF (centered at the current LR voxel) and add the corresponding influence value (PSF value * interpolation weight) in the matrix H
+  //The rows of H are computed in parallel, one block of rows per slice of the LR images.
  
   // Set size of matrices
   unsigned int ncols = data.m_inputHRImage->GetLargestPossibleRegion().GetNumberOfPixels();
@@ -361,37 +378,21 @@ void SuperResolutionTools::HComputation(SuperResolutionDataManager & data)
     m_offset[im] = nrows;
     nrows += data.m_inputLRImages[im]->GetLargestPossibleRegion().GetNumberOfPixels();
   }
-  m_H.set_size(nrows, ncols);
+  m_H.SetSize(nrows, ncols);
   m_Y.set_size(nrows);
   m_Y.fill(0.0);
   m_X.set_size(ncols);
   m_X.fill(0.0);
   
   //linear index : an integer value corresponding to (x,y,z) triplet coordinates (ITK index)
-  uint lrLinearIndex = 0;
   uint hrLinearIndex = 0;
+  itkImage::IndexType hrIndex;  //index in HR image
 
-  //Temporary variables
-  itkImage::IndexType lrIndex;  //index of the current voxel in the LR image
-  itkImage::PointType lrPoint;  //physical point location of lrIndex
-  itkImage::IndexType psfIndex; //index of the current voxel in the PSF
-  itkImage::PointType psfPoint; //physical point location of psfIndex
-  itkImage::PointType transformedPoint; //Physical point location after applying affine transform
-  itkContinuousIndex  hrContIndex;  //continuous index in HR image of psfPoint
-  itkImage::IndexType hrIndex;  //index in HR image of interpolated psfPoint
-
-  //We use linear interpolation for the estimation of point influence in matrix H 
-  typedef itk::BSplineInterpolationWeightFunction<double, 3, 1> itkBSplineFunction;
-  itkBSplineFunction::Pointer bsplineFunction = itkBSplineFunction::New();
-  itkBSplineFunction::WeightsType bsplineWeights;
-  bsplineWeights.SetSize(8); // (bsplineOrder + 1)^3
-  itkBSplineFunction::IndexType   bsplineStartIndex;
-  itkBSplineFunction::IndexType   bsplineEndIndex;
-  itkBSplineFunction::SizeType    bsplineSize;
-  itkImage::RegionType            bsplineRegion;
-  
   //Get the size of the HR image
   itkImage::SizeType  hrSize  = data.m_inputHRImage->GetLargestPossibleRegion().GetSize();
+
+  //One block of rows of H per slice of each LR image
+  std::vector< btk::SparseMatrix<double> > blocks;
   
   std::cout<<"loop over LR images\n";
   for(uint i=0; i<data.m_inputLRImages.size(); i++){
@@ -400,16 +401,11 @@ void SuperResolutionTools::HComputation(SuperResolutionDataManager & data)
     //Get the size of the current LR image
     itkImage::SizeType  lrSize  = data.m_inputLRImages[i]->GetLargestPossibleRegion().GetSize();
 
-    //Instantiate an iterator over the current LR image
-    itkIteratorWithIndex itLRImage(data.m_inputLRImages[i],data.m_inputLRImages[i]->GetLargestPossibleRegion());
-    
-    //Instantiate an iterator over the current PSF
-    itkIteratorWithIndex itPSF(m_PSF[i],m_PSF[i]->GetLargestPossibleRegion());
-    
     //Set the correct direction for the PSF of the current image
     m_PSF[i]->SetDirection(data.m_inputLRImages[i]->GetDirection());
     
-    //Compute temporary variables for setting the correct origin of the PSF for every voxel of the LR image 
+    //Compute the center of the PSF: centering the PSF on a LR voxel only changes its origin, so the PSF voxels
+    //are stored once as offsets to this center (and the PSF image is not modified by the threads)
     itkImage::SizeType psfSize = m_PSF[i]->GetLargestPossibleRegion().GetSize();
     itkContinuousIndex psfIndexCenter;
     psfIndexCenter[0] = (psfSize[0]-1)/2.0;
@@ -417,125 +413,32 @@ void SuperResolutionTools::HComputation(SuperResolutionDataManager & data)
     psfIndexCenter[2] = (psfSize[2]-1)/2.0;
     itkImage::PointType psfPointCenter;
     m_PSF[i]->TransformContinuousIndexToPhysicalPoint(psfIndexCenter,psfPointCenter);
-    itkImage::PointType psfOrigin;
 
-    //Loop over the voxels of the current LR image
-    for(itLRImage.GoToBegin(); !itLRImage.IsAtEnd(); ++itLRImage){
- 
-      //Test on padding value (speed-up and keep H as sparse as possible)
-      if(itLRImage.Get() > m_paddingValue){
-        
-        //Coordinate in the current LR image
-        lrIndex = itLRImage.GetIndex();
-        
-        //std::cout<<"current LR index:"<<lrIndex[0]<<" "<<lrIndex[1]<<" "<<lrIndex[2]<<" -------------- \n";
-        
-        //Compute the corresponding linear index of lrIndex
-        lrLinearIndex = m_offset[i] + lrIndex[0] + lrIndex[1]*lrSize[0] + lrIndex[2]*lrSize[0]*lrSize[1];
-        
-        //Fill m_Y
-        m_Y[lrLinearIndex] = itLRImage.Get();
-        
-        //Change the origin of the PSF so that itLRImage location corresponds to the center of the PSF
-        data.m_inputLRImages[i]->TransformIndexToPhysicalPoint(lrIndex,lrPoint);
-        psfOrigin[0] = lrPoint[0] - psfPointCenter[0];
-        psfOrigin[1] = lrPoint[1] - psfPointCenter[1];
-        psfOrigin[2] = lrPoint[2] - psfPointCenter[2];
-        m_PSF[i]->SetOrigin(psfOrigin);
-        
-        //std::cout<<"current lr point:"<<lrPoint[0]<<" "<<lrPoint[1]<<" "<<lrPoint[2]<<" \n";
-        //std::cout<<"psfSize:"<<psfSize[0]<<" "<<psfSize[1]<<" "<<psfSize[2]<<" \n";
-        //std::cout<<"psfIndexCenter:"<<psfIndexCenter[0]<<" "<<psfIndexCenter[1]<<" "<<psfIndexCenter[2]<<"\n";
-        //std::cout<<"psfPointCenter:"<<psfPointCenter[0]<<" "<<psfPointCenter[1]<<" "<<psfPointCenter[2]<<"\n";
-        //std::cout<<"psf origin:"<<psfOrigin[0]<<" "<<psfOrigin[1]<<" "<<psfOrigin[2]<<" \n";
-        
-        //Loop over the m_PSF
-        for(itPSF.GoToBegin(); !itPSF.IsAtEnd(); ++itPSF){
-                  
-          if(itPSF.Get() > 0){
-            
-            //Get coordinate in m_PSF
-            psfIndex = itPSF.GetIndex();
-            
-            //Compute the physical point of psfIndex
-            m_PSF[i]->TransformIndexToPhysicalPoint(psfIndex,psfPoint);
-            
-            //Apply estimated affine transform to psfPoint (need to apply the inverse since the transform goes from the HR image to the LR image)           
-            transformedPoint = data.m_inverseAffineTransform[i]->TransformPoint(psfPoint);
-            
-            //Get back to the index in the HR image
-            data.m_inputHRImage->TransformPhysicalPointToContinuousIndex(transformedPoint,hrContIndex);
-            //std::cout<<"hrContIndex no check: "<<hrContIndex[0]<<" "<<hrContIndex[1]<<" "<<hrContIndex[2]<<" \n ";
+    std::vector< itkImage::PointType::VectorType > psfOffsets;
+    std::vector< double > psfValues;
+    itkIteratorWithIndex itPSF(m_PSF[i],m_PSF[i]->GetLargestPossibleRegion());
+    for(itPSF.GoToBegin(); !itPSF.IsAtEnd(); ++itPSF){
+      if(itPSF.Get() > 0){
+        itkImage::PointType psfPoint;
+        m_PSF[i]->TransformIndexToPhysicalPoint(itPSF.GetIndex(),psfPoint);
+        psfOffsets.push_back(psfPoint - psfPointCenter);
+        psfValues.push_back(itPSF.Get());
+      }
+    }
 
-            //Check if the continuous index hrContIndex is inside the HR image
-            if (data.m_inputHRImage->GetLargestPossibleRegion().IsInside(hrContIndex)) {
-              
-              //std::cout<<"hrContIndex: "<<hrContIndex[0]<<" "<<hrContIndex[1]<<" "<<hrContIndex[2]<<" \n ";
-              //Get the interpolation weight using itkBSplineInterpolationWeightFunction
-              bsplineFunction->Evaluate(hrContIndex,bsplineWeights,bsplineStartIndex);
-              //std::cout<<"bsplineIndex: "<<bsplineStartIndex[0]<<" "<<bsplineStartIndex[1]<<" "<<bsplineStartIndex[2]<<"\n";
-              
-              //Get the support size for interpolation
-              bsplineSize = bsplineFunction->GetSupportSize();
-              
-              //Check if the bspline support region is inside the HR image
-              bsplineEndIndex[0] = bsplineStartIndex[0] + bsplineSize[0];
-              bsplineEndIndex[1] = bsplineStartIndex[1] + bsplineSize[1];
-              bsplineEndIndex[2] = bsplineStartIndex[2] + bsplineSize[2];
-              
-              if( (data.m_inputHRImage->GetLargestPossibleRegion().IsInside(bsplineStartIndex)) && (data.m_inputHRImage->GetLargestPossibleRegion().IsInside(bsplineEndIndex)) ){
-                
-                //Set the support region
-                bsplineRegion.SetSize(bsplineSize);
-                bsplineRegion.SetIndex(bsplineStartIndex);
-                
-                //Instantiate an iterator on HR image over the bspline region
-                itkIteratorWithIndex itHRImage(data.m_inputHRImage,bsplineRegion);
-                
-                //linear index of bspline weights
-                unsigned int weightLinearIndex = 0;
-                
-                //Loop over the support region
-                for(itHRImage.GoToBegin(); !itHRImage.IsAtEnd(); ++itHRImage){
-  
-                  //Get coordinate in HR image
-                  hrIndex = itHRImage.GetIndex();
-                  
-                  //Compute the corresponding linear index
-                  hrLinearIndex = hrIndex[0] + hrIndex[1]*hrSize[0] + hrIndex[2]*hrSize[0]*hrSize[1];
-                  
-                  //Add weight*PSFValue to the corresponding element in H
-                  m_H(lrLinearIndex,hrLinearIndex) += itPSF.Get() * bsplineWeights[weightLinearIndex];
-                  weightLinearIndex += 1;
-                  //std::cout<<"HR point:"<<hrIndex[0]<<" "<<hrIndex[1]<<" "<<hrIndex[2]<<", weight:"<<m_H(lrLinearIndex,hrLinearIndex)<<"\n";
-                  
-                } //end of loop over the support region
-                
-              } //end of if support region inside HR image
-              
-            } //end of check of hrContIndex
+    unsigned int firstBlock = blocks.size();
+    blocks.resize(firstBlock + lrSize[2]);
 
-          } //end of if itPSF > 0
-          
-        } //end of loop over PSF
-        
-      } //end of if on padding value
-    
-    } //end of loop over voxels of LR image
+    int slice;
+    #pragma omp parallel for private(slice) schedule(dynamic)
+    for(slice = 0; slice < (int)lrSize[2]; slice++)
+      HComputationSlice(data, i, slice, psfOffsets, psfValues, blocks[firstBlock + slice]);
     
   } //end of loop over the set of LR images
   
-  // Normalize m_H
-  for(uint i = 0; i < m_H.rows(); i++){
-    
-    double sum = m_H.sum_row(i);
-    
-    vnl_sparse_matrix<double>::row & r = m_H.get_row(i);
-    vnl_sparse_matrix<double>::row::iterator col_iter;
-    
-    for (col_iter = r.begin(); col_iter != r.end(); ++col_iter)
-      (*col_iter).second = (*col_iter).second / sum;
-  }
+  //Gather the blocks and normalize m_H
+  m_H.SetRowBlocks(blocks);
+  m_H.NormalizeRows();
   
   //Fill m_X
   //Instantiate an iterator on HR image
@@ -545,6 +448,138 @@ void SuperResolutionTools::HComputation(SuperResolutionDataManager & data)
     hrLinearIndex = hrIndex[0] + hrIndex[1]*hrSize[0] + hrIndex[2]*hrSize[0]*hrSize[1];
     m_X[hrLinearIndex] = itHRImage.Get();
   }
+
+  if(btk::Telemetry::GetInstance().IsEnabled()){
+    btk::Telemetry::Record record("h_build");
+    record.SetValue("rows", nrows);
+    record.SetValue("columns", ncols);
+    record.SetValue("non_zeros", m_H.GetNumberOfNonZeros());
+    record.AddPhaseTime("h_build", btk::Telemetry::GetTime() - startTime);
+    btk::Telemetry::GetInstance().Write(record);
+  }
+}
+void SuperResolutionTools::HComputationSlice(SuperResolutionDataManager & data, unsigned int i, unsigned int slice,
+                                             const std::vector< itkImage::PointType::VectorType > & psfOffsets,
+                                             const std::vector< double > & psfValues,
+                                             btk::SparseMatrix<double> & block)
+{
+  //linear index : an integer value corresponding to (x,y,z) triplet coordinates (ITK index)
+  uint lrLinearIndex = 0;
+  uint hrLinearIndex = 0;
+
+  //Temporary variables
+  itkImage::IndexType lrIndex;  //index of the current voxel in the LR image
+  itkImage::PointType lrPoint;  //physical point location of lrIndex
+  itkImage::PointType psfPoint; //physical point location of the PSF voxel
+  itkImage::PointType transformedPoint; //Physical point location after applying affine transform
+  itkContinuousIndex  hrContIndex;  //continuous index in HR image of psfPoint
+  itkImage::IndexType hrIndex;  //index in HR image of interpolated psfPoint
+
+  //We use linear interpolation for the estimation of point influence in matrix H (one weight function per slice, not shared by the threads)
+  typedef itk::BSplineInterpolationWeightFunction<double, 3, 1> itkBSplineFunction;
+  itkBSplineFunction::Pointer bsplineFunction = itkBSplineFunction::New();
+  itkBSplineFunction::WeightsType bsplineWeights;
+  bsplineWeights.SetSize(8); // (bsplineOrder + 1)^3
+  itkBSplineFunction::IndexType   bsplineStartIndex;
+  itkBSplineFunction::IndexType   bsplineEndIndex;
+  itkBSplineFunction::SizeType    bsplineSize = bsplineFunction->GetSupportSize();
+  itkImage::RegionType            bsplineRegion;
+
+  //Get the size of the HR image
+  itkImage::SizeType  hrSize  = data.m_inputHRImage->GetLargestPossibleRegion().GetSize();
+
+  //Region of the current slice
+  itkImage::RegionType sliceRegion = data.m_inputLRImages[i]->GetLargestPossibleRegion();
+  itkImage::SizeType  lrSize  = sliceRegion.GetSize();
+  sliceRegion.SetIndex(2, sliceRegion.GetIndex()[2] + slice);
+  sliceRegion.SetSize(2, 1);
+
+  //First row of the slice in m_H
+  uint firstRow = m_offset[i] + sliceRegion.GetIndex()[2]*lrSize[0]*lrSize[1];
+  block.SetSize(lrSize[0]*lrSize[1], data.m_inputHRImage->GetLargestPossibleRegion().GetNumberOfPixels());
+
+  //Instantiate an iterator over the current slice
+  itkIteratorWithIndex itLRImage(data.m_inputLRImages[i],sliceRegion);
+
+  //Loop over the voxels of the current slice
+  for(itLRImage.GoToBegin(); !itLRImage.IsAtEnd(); ++itLRImage){
+ 
+    //Test on padding value (speed-up and keep H as sparse as possible)
+    if(itLRImage.Get() > m_paddingValue){
+      
+      //Coordinate in the current LR image
+      lrIndex = itLRImage.GetIndex();
+      
+      //Compute the corresponding linear index of lrIndex
+      lrLinearIndex = m_offset[i] + lrIndex[0] + lrIndex[1]*lrSize[0] + lrIndex[2]*lrSize[0]*lrSize[1];
+      
+      //Fill m_Y (the slices fill disjoint parts of m_Y)
+      m_Y[lrLinearIndex] = itLRImage.Get();
+      
+      //The PSF is centered on the current LR voxel
+      data.m_inputLRImages[i]->TransformIndexToPhysicalPoint(lrIndex,lrPoint);
+      
+      //Loop over the PSF voxels
+      for(unsigned int p=0; p<psfOffsets.size(); p++){
+          
+        //Compute the physical point of the PSF voxel
+        psfPoint = lrPoint + psfOffsets[p];
+        
+        //Apply estimated affine transform to psfPoint (need to apply the inverse since the transform goes from the HR image to the LR image)           
+        transformedPoint = data.m_inverseAffineTransform[i]->TransformPoint(psfPoint);
+        
+        //Get back to the index in the HR image
+        data.m_inputHRImage->TransformPhysicalPointToContinuousIndex(transformedPoint,hrContIndex);
+
+        //Check if the continuous index hrContIndex is inside the HR image
+        if (data.m_inputHRImage->GetLargestPossibleRegion().IsInside(hrContIndex)) {
+          
+          //Get the interpolation weight using itkBSplineInterpolationWeightFunction
+          bsplineFunction->Evaluate(hrContIndex,bsplineWeights,bsplineStartIndex);
+          
+          //Check if the bspline support region is inside the HR image
+          bsplineEndIndex[0] = bsplineStartIndex[0] + bsplineSize[0];
+          bsplineEndIndex[1] = bsplineStartIndex[1] + bsplineSize[1];
+          bsplineEndIndex[2] = bsplineStartIndex[2] + bsplineSize[2];
+          
+          if( (data.m_inputHRImage->GetLargestPossibleRegion().IsInside(bsplineStartIndex)) && (data.m_inputHRImage->GetLargestPossibleRegion().IsInside(bsplineEndIndex)) ){
+            
+            //Set the support region
+            bsplineRegion.SetSize(bsplineSize);
+            bsplineRegion.SetIndex(bsplineStartIndex);
+            
+            //Instantiate an iterator on HR image over the bspline region
+            itkIteratorWithIndex itHRImage(data.m_inputHRImage,bsplineRegion);
+            
+            //linear index of bspline weights
+            unsigned int weightLinearIndex = 0;
+            
+            //Loop over the support region
+            for(itHRImage.GoToBegin(); !itHRImage.IsAtEnd(); ++itHRImage){
+
+              //Get coordinate in HR image
+              hrIndex = itHRImage.GetIndex();
+              
+              //Compute the corresponding linear index
+              hrLinearIndex = hrIndex[0] + hrIndex[1]*hrSize[0] + hrIndex[2]*hrSize[0]*hrSize[1];
+              
+              //Add weight*PSFValue to the corresponding element of the block
+              block.AddValue(lrLinearIndex - firstRow, hrLinearIndex, psfValues[p] * bsplineWeights[weightLinearIndex]);
+              weightLinearIndex += 1;
+              
+            } //end of loop over the support region
+            
+          } //end of if support region inside HR image
+          
+        } //end of check of hrContIndex
+        
+      } //end of loop over PSF
+      
+    } //end of if on padding value
+  
+  } //end of loop over voxels of the slice
+
+  block.Finalize();
 }
 void SuperResolutionTools::UpdateX(SuperResolutionDataManager & data)
 {
@@ -570,8 +605,13 @@ void SuperResolutionTools::SimulateLRImages(SuperResolutionDataManager & data)
   
   //Compute H * x
   vnl_vector<double> Hx;
-  m_H.mult(m_X,Hx);
+  m_H.Multiply(m_X,Hx);
   
+  FillSimulatedLRImages(data, Hx);
+}
+
+void SuperResolutionTools::FillSimulatedLRImages(SuperResolutionDataManager & data, const vnl_vector<double> & Hx)
+{
   //resize the vector of simulated input LR images
   data.m_simulatedInputLRImages.resize(data.m_inputLRImages.size());
   
@@ -623,127 +663,47 @@ double SuperResolutionTools::IteratedBackProjection(SuperResolutionDataManager &
   std::cout<<"Do iterated back projection\n";
   std::cout<<"NLM Filtering type: "<<nlm<<"\n";
   
-  std::cout<<"Compute y-Hx\n";
-  SimulateLRImages(data);
+  m_iterationIBP++;
+  bool telemetry = btk::Telemetry::GetInstance().IsEnabled();
+  double time = telemetry ? btk::Telemetry::GetTime() : 0.0;
+  double backProjectionTime = 0.0;
+  double nlmTime = 0.0;
+  double residualNorm = 0.0;
   
-  std::cout<<"Update the current HR image\n";
-  //Initialize to 0 the output HR image
-  data.m_outputHRImage->FillBuffer(0);
-    
-  //parameters for interpolation (bspline interpolator)
-  int interpolationOrder = m_interpolationOrderIBP;
-  itkBSplineInterpolator::Pointer bsInterpolator = itkBSplineInterpolator::New();
-  bsInterpolator->SetSplineOrder(interpolationOrder);
+  std::cout<<"Compute y-Hx and back-project it\n";
+  UpdateX(data);
   
-  std::string s = "";
-  std::vector<itkPointer>   errorImages;            //difference image between simulated images and observed images.
-  errorImages.resize(data.m_inputLRImages.size());
+  //y-Hx is back-projected through H and averaged (or its median taken) over the LR images in a single pass over the HR voxels
+  btk::ResidualBackProjection<double> backProjection;
+  backProjection.SetObservationMatrix(&m_H);
+  backProjection.SetGroups(m_offset);
+  backProjection.SetMedian(medianIBP == 1);
   
-  for(uint i=0; i<data.m_inputLRImages.size(); i++){
-
-    //compute the difference between LR input and the simulated LR image
-    itkSubtractImageFilter::Pointer subtractFilter = itkSubtractImageFilter::New ();
-    subtractFilter->SetInput1(data.m_inputLRImages[i]);
-    subtractFilter->SetInput2(data.m_simulatedInputLRImages[i]);
-    subtractFilter->Update();
-
-    std::ostringstream oss ;
-    oss << i+1 ;
-    //s = "ibp_"+oss.str()+"_substract.nii.gz";
-    //data.WriteOneImage(subtractFilter->GetOutput(), s);
-    
-    //interpolate the LR difference 
-    itkResampleFilter::Pointer resample = itkResampleFilter::New();
-    resample->SetTransform(data.m_affineTransform[i]);
-    resample->SetInterpolator(bsInterpolator);
-    resample->UseReferenceImageOn();
-    resample->SetReferenceImage(data.m_currentHRImage);
-    resample->SetInput(subtractFilter->GetOutput());
-    resample->Update();
-    
-    errorImages[i] = resample->GetOutput();
-
-    //s = "ibp_"+oss.str()+"_resample.nii.gz";
-    //data.WriteOneImage(errorImages[i], s);
-
-    
-
-    //Add the interpolated differences
-    itkAddImageFilter::Pointer addFilter = itkAddImageFilter::New ();
-    addFilter->SetInput1(data.m_outputHRImage);
-    addFilter->SetInput2(resample->GetOutput());
-    addFilter->Update();
-    
-    data.m_outputHRImage = addFilter->GetOutput();
-    /*
-    std::string s1 = "switch_out.nii.gz";
-      data.WriteOneImage(data.m_outputHRImage, s1);
-    */
-
-    //s = "ibp_"+oss.str()+"_simulated.nii.gz";
-    //data.WriteOneImage(data.m_simulatedInputLRImages[i], s);
-        
+  vnl_vector<double> correction;
+  backProjection.Compute(m_Y, m_X, correction);
+  
+  FillSimulatedLRImages(data, backProjection.GetSimulation());
+  
+  if(telemetry){
+    //residual of the current estimate (the one the back-projection has been computed from)
+    const vnl_vector<double> & Hx = backProjection.GetSimulation();
+    double residualNorm2 = 0.0;
+    for(unsigned int r = 0; r < m_Y.size(); r++)
+      residualNorm2 += (m_Y[r] - Hx[r]) * (m_Y[r] - Hx[r]);
+    residualNorm = std::sqrt(residualNorm2);
   }
-
-  //Iterator over the output image filled with backprojected error.
-  itkIteratorWithIndex itImage(data.m_outputHRImage,data.m_outputHRImage->GetLargestPossibleRegion());
   
-  /*
-      //Normalize the resampled difference image
-      for(itImage.GoToBegin(); !itImage.IsAtEnd(); ++itImage)
-        itImage.Set( itImage.Get() / data.m_inputLRImages.size() );
-  */
-      
-  //std::string s2 = "switch_in.nii.gz";
-
-  //FIXME : switch for filtering choice runs under MacOSX but not under Debian !!!
-  /*        
-  switch(medianIBP)
-  {
-    case 0:
-    std::cout<<"Averaging the error maps (obtained for each LR image)\n";
-      data.m_outputHRImage->FillBuffer(0);
-
-      for(uint i=0; i<data.m_inputLRImages.size(); i++)
-      {
-        //Add the interpolated differences
-        itkAddImageFilter::Pointer addFilter = itkAddImageFilter::New ();
-        addFilter->SetInput1(data.m_outputHRImage);
-        addFilter->SetInput2(errorImages[i]);
-        addFilter->Update();    
-        data.m_outputHRImage = addFilter->GetOutput();        
-      }
-
-      data.WriteOneImage(data.m_outputHRImage, s2);
-
-      break;
-    case 1:
-        std::cout<<"Compute the median of the error map at each voxel\n"; 
-        for(itImage.GoToBegin(); !itImage.IsAtEnd(); ++itImage)
-        {
-          itkImage::IndexType p = itImage.GetIndex();
-          std::vector<double>  v;
-          for(uint i=0; i<data.m_inputLRImages.size(); i++)
-            v.push_back(errorImages[i]->GetPixel(p));
-          std::sort(v.begin(), v.end());
-          
-          itImage.Set(v.size() * v[(int)(v.size()/2)]); 
-          
-        }
-            
-      break;
-    default:
-      std::cout<<"Invalid choice for the median IBP parameter (0 or 1).\n"; 
-      break;          
+  std::cout<<"Update the current HR image\n";
+  itkImage::SizeType hrSize = data.m_outputHRImage->GetLargestPossibleRegion().GetSize();
+  itkIteratorWithIndex itImage(data.m_outputHRImage,data.m_outputHRImage->GetLargestPossibleRegion());
+  for(itImage.GoToBegin(); !itImage.IsAtEnd(); ++itImage){
+    itkImage::IndexType hrIndex = itImage.GetIndex();
+    itImage.Set(correction[hrIndex[0] + hrIndex[1]*hrSize[0] + hrIndex[2]*hrSize[0]*hrSize[1]]);
+  }
+  if(telemetry){
+    backProjectionTime = btk::Telemetry::GetTime() - time;
+    time = btk::Telemetry::GetTime();
   }
-
-  */
-  //Normalize the resampled difference image
-  for(itImage.GoToBegin(); !itImage.IsAtEnd(); ++itImage)
-  {
-    double value = itImage.Get() / data.m_inputLRImages.size();  
-    itImage.Set( value );
-  }   
     
        
   
@@ -763,6 +723,8 @@ double SuperResolutionTools::IteratedBackProjection(SuperResolutionDataManager &
     //s = "ibp_nlm_error.nii.gz";
     //data.WriteOneImage(data.m_outputHRImage, s);     
   }
+  if(telemetry)
+    nlmTime = btk::Telemetry::GetTime() - time;
  
   //Update the HR image correspondly
   itkAddImageFilter::Pointer addFilter2 = itkAddImageFilter::New ();
@@ -774,6 +736,8 @@ double SuperResolutionTools::IteratedBackProjection(SuperResolutionDataManager &
   //s = "ibp_updated.nii.gz";
   //data.WriteOneImage(data.m_currentHRImage, s);      
   
+  if(telemetry)
+    time = btk::Telemetry::GetTime();
   if(nlm==2){
     std::cout<<"Smooth the current reconstructed image ------------------ \n";
     btk::NLMTool<float> myTool;
@@ -787,6 +751,8 @@ double SuperResolutionTools::IteratedBackProjection(SuperResolutionDataManager &
     //s = "ibp_nlm_smooth.nii.gz";
     //data.WriteOneImage(data.m_currentHRImage, s);                
   }  
+  if(telemetry)
+    nlmTime += btk::Telemetry::GetTime() - time;
   
   std::cout<<"Compute the changes between the two consecutive estimates\n";
   itkAbsoluteValueDifferenceImageFilter::Pointer absoluteValueDifferenceFilter = itkAbsoluteValueDifferenceImageFilter::New ();
@@ -828,6 +794,18 @@ double SuperResolutionTools::IteratedBackProjection(SuperResolutionDataManager &
   double manjonCriterion = 0.002*statisticsImageFilter->GetSigma(); //As defined in Manjon et al. 2010
   std::cout<<"stopping criterion : "<<manjonCriterion<<"\n";
   
+  if(telemetry){
+    btk::Telemetry::Record record("ibp");
+    record.SetIteration(m_iterationIBP);
+    record.SetValue("residual_norm", residualNorm);
+    record.AddPhaseTime("back_projection", backProjectionTime);
+    if(nlm==1 || nlm==2)
+      record.AddPhaseTime("nlm", nlmTime);
+    record.SetValue("change", meanMagnitude);
+    record.SetValue("stopping_criterion", manjonCriterion);
+    btk::Telemetry::GetInstance().Write(record);
+  }
+  
   if(meanMagnitude < manjonCriterion)
     meanMagnitude = 0;
     
@@ -888,147 +866,51 @@ void SuperResolutionTools::CreateMaskHRImage(SuperResolutionDataManager & data)
 void SuperResolutionTools::SRUsingPseudoInverse(SuperResolutionDataManager & data)
 {
   std::cout<<"Super-resolution using regularized pseudo-inverse approach"<<std::endl; 
-  //Create a patch containing values of a laplacian filter
-  itkPointer diracPatch = itkImage::New();
-  itkImage::IndexType start;
-  start[0] = 0; 
-  start[1] = 0;
-  start[2] = 0;
-  itkImage::SizeType size;
-  size[0] = 3;
-  size[1] = 3;
-  size[2] = 3;
-  itkImage::RegionType region;
-  region.SetSize(size);
-  region.SetIndex(start);
-  
-  diracPatch->SetRegions(region);
-  diracPatch->Allocate();
-  diracPatch->FillBuffer(0.0);
-  
-  start[0] = 1;
-  start[1] = 1;
-  start[2] = 1;
-  //Initialize laplacianPatch as a dirac  
-  diracPatch->SetPixel(start,1);
-    
-  itkLaplacianFilter::Pointer laplacian = itkLaplacianFilter::New();
-  laplacian->SetInput( diracPatch ); // NOTE: input image type must be double or float
-  laplacian->Update();
-    
-  itkPointer laplacianPatch = laplacian->GetOutput();
-  //--------------------------------------------------------
-  
-  //Compute the square matrix D (laplacian filter)
-  
-  // Set size of matrices
+  //Regularization operator D: 7-point laplacian filter (the neighbours outside the HR image being ignored),
+  //applied on the fly (no matrix is built)
   unsigned int n = data.m_inputHRImage->GetLargestPossibleRegion().GetNumberOfPixels();
   std::cout<<"Number of voxels:"<<n<<std::endl;
-  vnl_sparse_matrix<double>  D;
-  D.set_size(n, n);
-  
-  
+
+  //Get the size of the current HR image
+  itkImage::SizeType  hrSize  = data.m_inputHRImage->GetLargestPossibleRegion().GetSize();
+
+  btk::FiniteDifferenceStencil<double> stencil;
+  stencil.SetSize(hrSize[0], hrSize[1], hrSize[2]);
+  stencil.SetBoundary(btk::FiniteDifferenceStencil<double>::ZERO_BOUNDARY);
+  btk::FiniteDifferenceOperator<double> D(stencil);
+
   //linear index : an integer value corresponding to (x,y,z) triplet coordinates (ITK index)
   uint hrLinearIndex = 0;
-  uint hrLinearIndexTmp = 0;
-
-  //Temporary variables
   itkImage::IndexType hrIndex;     //index in HR image
-  itkImage::IndexType hrIndexTmp;  //index in HR image of tmp points
 
-  //Instantiate an iterator over the current HR image
-  itkIteratorWithIndex itHRImage(data.m_inputHRImage,data.m_inputHRImage->GetLargestPossibleRegion());
+  std::cout<< "Taille de H : "<<m_H.GetNumberOfRows()<<" "<<m_H.GetNumberOfColumns()<<std::endl;
 
-  //Get the size of the current HR image
-  itkImage::SizeType  hrSize  = data.m_inputHRImage->GetLargestPossibleRegion().GetSize();
+  //Regularized pseudo-inverse: m_X = inverse(m_H.transpose()*m_H +lambda*D.transpose()*D) * m_H.transpose() * m_Y
+  //The normal equations are solved by a preconditioned conjugate gradient (products by H and D only), starting from
+  //the current estimate m_X (filled with the input HR image by HComputation).
+  double lambda = 1e-5;
 
-  //Loop over the voxels of the current HR image
-  for(itHRImage.GoToBegin(); !itHRImage.IsAtEnd(); ++itHRImage){
-  
-    //Coordinate in the current LR image
-    hrIndex = itHRImage.GetIndex();
-        
-    //Compute the corresponding linear index of lrIndex
-    hrLinearIndex = hrIndex[0] + hrIndex[1]*hrSize[0] + hrIndex[2]*hrSize[0]*hrSize[1];
-    
-    for(uint i=0; i<size[0]; i++)
-    for(uint j=0; j<size[1]; j++)
-    for(uint k=0; k<size[2]; k++)
-    {
-      
-      //index du voisin de hrIndex
-      hrIndexTmp[0] = hrIndex[0] - size[0]/2 +i;
-      hrIndexTmp[1] = hrIndex[1] - size[0]/2 +j;
-      hrIndexTmp[2] = hrIndex[2] - size[0]/2 +k;
-      
-      hrLinearIndexTmp = hrIndexTmp[0] + hrIndexTmp[1]*hrSize[0] + hrIndexTmp[2]*hrSize[0]*hrSize[1];
-      
-      //index dans le laplacianPatch
-      start[0] = i;
-      start[1] = j;
-      start[2] = k;
-      
-      if( data.m_inputHRImage->GetLargestPossibleRegion().IsInside( hrIndexTmp ) )
-        D(hrLinearIndex, hrLinearIndexTmp) += laplacianPatch->GetPixel(start);
-        
-    }
-  } 
-  std::cout<< "Taille de H : "<<m_H.rows()<<" "<<m_H.cols()<<std::endl;
-  std::cout<< "Taille de D : "<<D.rows()<<" "<<D.cols()<<std::endl;
-  
-  
-  std::ofstream myfile_H;
-  myfile_H.open ("matrix_H.txt");
-  for(uint i = 0; i < m_H.rows(); i++)
-  {
-    for(uint j = 0; j < m_H.cols(); j++)
-    {
-      myfile_H << m_H(i,j) <<" ";
-    }
-    myfile_H << std::endl;
+  std::cout<<"Solve the normal equations using preconditioned conjugate gradient"<<std::endl;
+  btk::ConjugateGradientSolver<double> solver;
+  solver.SetObservationOperator(&m_H);
+  solver.AddRegularization(&D, lambda);
+  solver.SetPreconditioner(btk::ConjugateGradientSolver<double>::JACOBI_PRECONDITIONER);
+  solver.SetMaximumNumberOfIterations(m_maxIterationsCG);
+  solver.SetTolerance(m_toleranceCG);
+  solver.SetVerbose(true);
+  double time = btk::Telemetry::GetTime();
+  solver.Solve(m_Y, m_X);
+
+  std::cout<<"Conjugate gradient: "<<solver.GetNumberOfIterations()<<" iterations, relative residual: "<<solver.GetRelativeResidual()<<std::endl;
+
+  if(btk::Telemetry::GetInstance().IsEnabled()){
+    btk::Telemetry::Record record("pseudo_inverse");
+    record.SetValue("lambda", lambda);
+    record.SetValue("iterations", solver.GetNumberOfIterations());
+    record.SetValue("relative_residual", solver.GetRelativeResidual());
+    record.AddPhaseTime("solve", btk::Telemetry::GetTime() - time);
+    btk::Telemetry::GetInstance().Write(record);
   }
-  myfile_H.close();
-
-  std::ofstream myfile_D;
-  myfile_D.open ("matrix_D.txt");
-  for(uint i = 0; i < D.rows(); i++)
-  {
-    for(uint j = 0; j < D.cols(); j++)
-    {
-      myfile_D << D(i,j) <<" ";
-    }
-    myfile_D << std::endl;
-  }
-  myfile_D.close();  
-  
-  //Apply pseudo-inverse technique
-  //m_X = inverse(m_H.transpose()*m_H +lambda*D.transpose()*D) * m_H.transpose() * m_Y;
-
-  double lambda = 1e-5;
-  
-  std::cout<<"Inverse sparse matrix using LU decomposition"<<std::endl;
-  //inverse of sparse matrix is not supported by vnl !!
-  //Use LU decomposition (which works only with double values)
-  vnl_sparse_matrix<double>  M;
-  M = m_H.transpose()*m_H +lambda*D.transpose()*D;
-  
-    
-  vnl_sparse_matrix<double>  invM(n,n);    
-  vnl_sparse_lu lu(M,vnl_sparse_lu::quiet);
-
-  for(uint i=0; i<n; i++) 
-  {    
-    std::cout<<"current line:"<<i<<std::endl;
-    vnl_vector<double> b(n, 0.0), x(n);
-    b(i)=1;
-    lu.solve(b, &x);
-    std::cout<<"fill the inverse matrix"<<std::endl;
-    for(uint j=0; j<n; j++)
-      invM(i,j)=x(j);
-  }  
-  
-  invM = invM * m_H.transpose();  
-  invM.mult(m_Y,m_X);
   
   std::cout<<"Fill the output HR image"<<std::endl;
   data.m_outputHRImage->FillBuffer(0);
@@ -42,6 +42,12 @@
 #include "btkOrientedSpatialFunction.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkTransform.h"
+#include "btkSparseMatrix.h"
+#include "btkFiniteDifferenceStencil.h"
+#include "btkFiniteDifferenceOperator.h"
+#include "btkConjugateGradientSolver.h"
+#include "btkObservationMatrixCache.h"
+#include "btkTelemetry.h"
 
 namespace btk
 {
@@ -90,6 +96,7 @@ class LeastSquaresVnlCostFunction : public vnl_cost_function
 
   typedef vnl_vector<float> VnlVectorType;
   typedef vnl_sparse_matrix<float> VnlSparseMatrixType;
+  typedef FiniteDifferenceStencil<float> StencilType;
 
   struct img_size {
      unsigned int width;
@@ -145,50 +152,23 @@ class LeastSquaresVnlCostFunction : public vnl_cost_function
 
   vnl_sparse_matrix<float> GetHMatrix();
 
-  private:
-
-  void set(float * array, int size, float value);
-
-  /** Mirror of the position pos. abs(pos) must not be > 2*(size-1) */
-  int mirror(int pos, int size);
-
-  /** Gets an image row as a vector. */
-  void get_row(const vnl_vector<float>& image, img_size & size, int row,
-      int frame, float * output);
-
-  /** Sets an image row from a vector. */
-  void set_row(vnl_vector<float>& image, img_size & size, int row, int frame,
-      float * input);
-
-  /** Gets an image column as a vector. */
-  void get_col(const vnl_vector<float>& image, img_size & size, int col,
-      int frame, float * output);
-
-  /** Sets an image column from a vector. */
-  void set_col(vnl_vector<float>& image, img_size & size, int col, int frame,
-      float * input);
-
-  /** Gets an image z-axis as a vector. */
-  void get_spec(const vnl_vector<float>& image, img_size & size, int row,
-      int col, float * output);
-
-  /** Sets an image z-axis from a vector. */
-  void set_spec(vnl_vector<float>& image, img_size & size, int row, int col,
-      float * input);
-
-  void convol1d(float * kernel, int ksize, float * src, int src_size, float * dest);
-
-  // 3D convolution : over the rows
-  void convol3dx(const vnl_vector<float>& image, vnl_vector<float>& image_conv,
-      img_size& size, float * kernel, int ksize);
-
-  // 3D convolution : over the columns
-  void convol3dy(const vnl_vector<float>& image, vnl_vector<float>& image_conv,
-      img_size & size, float * kernel, int ksize);
+  /** Minimizes the cost function (quadratic) by solving its normal equations
+  (H^T H / size(Y) + lambda / size(x) sum_d D_d^T D_d) x = H^T Y / size(Y)
+  with a Jacobi preconditioned conjugate gradient, starting from x. This is an
+  alternative to vnl_conjugate_gradient, which also minimizes f but uses a
+  gradient without the regularization term. Initialize must be called first. */
+  void SolveNormalEquations(vnl_vector<double>& x, unsigned int iterations,
+      double tolerance = 1e-6);
+
+  /** Sets the file caching H and Y: they are read from this file when the
+  inputs have not changed since it was written, and written to it otherwise
+  (no cache if empty, default). */
+  void SetHMatrixCacheFileName(const std::string & fileName)
+  {
+    m_HMatrixCacheFileName = fileName;
+  }
 
-  // 3D convolution : over the spectra
-  void convol3dz(const vnl_vector<float>& image, vnl_vector<float>& image_conv,
-      img_size & size, float * kernel, int ksize);
+  private:
 
   // Gets the first derivative of an image along the x axis.
   void get_derivative_x(const vnl_vector<double>& x, vnl_vector<float>& deriv_x);
@@ -203,6 +183,9 @@ class LeastSquaresVnlCostFunction : public vnl_cost_function
   vnl_vector<float> HtY;
   vnl_vector<float> Y;
 
+  // Finite differences on the SR image (of size x_size)
+  StencilType stencil;
+
   float lambda;
 
   std::vector<ImagePointer>  m_Images;
@@ -212,6 +195,16 @@ class LeastSquaresVnlCostFunction : public vnl_cost_function
   std::vector< std::vector<TransformPointerType> > m_Transforms;
   RegionType m_OutputImageRegion;
   unsigned int m_PSF;
+  std::string m_HMatrixCacheFileName;
+
+  /** Describes the inputs H and Y depend on in the key of the cache. */
+  void InitializeCacheKey(ObservationMatrixCache<float> & cache) const;
+
+  /** Writes the telemetry of the computation of H (started at startTime). */
+  void WriteHTelemetry(double startTime, bool cached) const;
+
+  // Number of evaluations of f (iteration of the telemetry)
+  unsigned int m_NumberOfEvaluations;
 
 };
 
@@ -45,192 +45,16 @@ vnl_cost_function(dim)
 {
   lambda = 0.1;
   m_PSF = FunctionType::GAUSSIAN;
+  m_NumberOfEvaluations = 0;
 }
 
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::set(float * array, int size, float value)
-{
-  for (int i = 0; i < size; i++)
-  array[i] = value;
-}
-
-// Mirror of the position pos. abs(pos) must not be > 2*(size-1)
-template <class TImage>
-int
-LeastSquaresVnlCostFunction<TImage>::mirror(int pos, int size)
-{
-  int output = abs(pos);
-
-  while (output >= size)
-    output = abs(output - (output - size + 1) * 2);
-
-  return output;
-}
-
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::get_row(const vnl_vector<float>& image,
-    img_size & size, int row, int frame, float * output)
-{
-  for (unsigned int i = 0; i < size.width; i++)
-  output[i] = image[i + row * size.width + frame * size.width * size.height];
-}
-
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::set_row(vnl_vector<float>& image,
-    img_size & size, int row, int frame, float * input)
-{
-  for (unsigned int i = 0; i < size.width; i++)
-    image[i + row * size.width + frame * size.width * size.height] = input[i];
-}
-
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::get_col(const vnl_vector<float>& image,
-    img_size & size, int col, int frame, float * output)
-{
-  for (unsigned int i = 0; i < size.height; i++)
-    output[i] = image[col + i * size.width + frame * size.width * size.height];
-}
-
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::set_col(vnl_vector<float>& image,
-    img_size & size, int col, int frame, float * input)
-{
-  for (unsigned int i = 0; i < size.height; i++)
-    image[col + i * size.width + frame * size.width * size.height] = input[i];
-}
-
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::get_spec(const vnl_vector<float>& image,
-    img_size & size, int row, int col, float * output)
-{
-  for (unsigned int i = 0; i < size.depth; i++)
-  output[i] = image[col + row * size.width + i * size.width * size.height];
-}
-
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::set_spec(vnl_vector<float>& image,
-    img_size & size, int row, int col, float * input)
-{
-  for (unsigned int i = 0; i < size.depth; i++)
-    image[col + row * size.width + i * size.width * size.height] = input[i];
-}
-
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::convol1d(float * kernel, int ksize,
-    float * src, int src_size, float * dest)
-{
-  int n2 = ksize / 2;
-  int k;
-
-  set(dest, src_size, 0);
-  for (int i = 0; i < src_size; i++)
-  {
-    for (int j = 0; j < ksize; j++)
-    {
-      k = i - j + n2;
-      k = mirror(k, src_size); // dcb|abcd    wxyz|yxw
-      dest[i] += kernel[j] * src[k];
-    }
-  }
-}
-
-// 3D convolution : over the rows
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::convol3dx(const vnl_vector<float>& image,
-    vnl_vector<float>& image_conv, img_size& size, float * kernel, int ksize)
-{
-  float * drow = new float[size.width];
-  float * srow = new float[size.width];
-
-  for (unsigned int l = 0; l < size.depth; l++) {
-    for (unsigned int py = 0; py < size.height; py++) {
-      get_row(image, size, py, l, srow);
-      convol1d(kernel, ksize, srow, size.width, drow);
-      set_row(image_conv, size, py, l, drow);
-    }
-  }
-
-  delete[] drow;
-  delete[] srow;
-}
-
-// 3D convolution : over the columns
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::convol3dy(const vnl_vector<float>& image,
-    vnl_vector<float>& image_conv, img_size & size, float * kernel, int ksize)
-{
-  float * dcol = new float[size.height];
-  float * scol = new float[size.height];
-
-  for (unsigned int l = 0; l < size.depth; l++) {
-    for (unsigned int px = 0; px < size.width; px++) {
-      get_col(image, size, px, l, scol);
-      convol1d(kernel, ksize, scol, size.height, dcol);
-      set_col(image_conv, size, px, l, dcol);
-    }
-  }
-
-  delete[] dcol;
-  delete[] scol;
-}
-
-// 3D convolution : over the spectra
-template <class TImage>
-void
-LeastSquaresVnlCostFunction<TImage>::convol3dz(const vnl_vector<float>& image,
-    vnl_vector<float>& image_conv, img_size & size, float * kernel, int ksize)
-{
-  float * dspec = new float[size.depth];
-  float * sspec = new float[size.depth];
-
-  for (unsigned int py = 0; py < size.height; py++) {
-    for (unsigned int px = 0; px < size.width; px++) {
-      get_spec(image, size, py, px, sspec);
-      convol1d(kernel, ksize, sspec, size.depth, dspec);
-      set_spec(image_conv, size, py, px, dspec);
-    }
-  }
-
-  delete[] dspec;
-  delete[] sspec;
-}
-
-// 3D convolution : over the spectra
+// Gets the first derivatives of an image (x[i+1] - x[i], mirrored boundaries)
 template <class TImage>
 void
 LeastSquaresVnlCostFunction<TImage>::get_derivative_x(const vnl_vector<double>& x,
     vnl_vector<float>& deriv_x)
 {
-
-  vnl_vector<float>  x_float;
-  x_float = vnl_matops::d2f(x);
-
-  float* kernel = new float[2];
-  kernel[0] = -1; kernel[1] = 1;
-
-  float * drow = new float[x_size.width];
-  float * srow = new float[x_size.width];
-
-  for (unsigned int l = 0; l < x_size.depth; l++) {
-    for (unsigned int py = 0; py < x_size.height; py++) {
-      get_row(x_float, x_size, py, l, srow);
-      convol1d(kernel, 2, srow, x_size.width, drow);
-      set_row(deriv_x, x_size, py, l, drow);
-    }
-  }
-
-  delete[] drow;
-  delete[] srow;
+  stencil.Apply(0, StencilType::FORWARD_DIFFERENCE, vnl_matops::d2f(x), deriv_x);
 }
 
 template <class TImage>
@@ -238,26 +62,7 @@ void
 LeastSquaresVnlCostFunction<TImage>::get_derivative_y(const vnl_vector<double>& x,
     vnl_vector<float>& deriv_y)
 {
-
-  vnl_vector<float>  x_float;
-  x_float = vnl_matops::d2f(x);
-
-  float* kernel = new float[2];
-  kernel[0] = -1; kernel[1] = 1;
-
-  float * dcol = new float[x_size.height];
-  float * scol = new float[x_size.height];
-
-  for (unsigned int l = 0; l < x_size.depth; l++) {
-    for (unsigned int px = 0; px < x_size.width; px++) {
-      get_col(x_float, x_size, px, l, scol);
-      convol1d(kernel, 2, scol, x_size.height, dcol);
-      set_col(deriv_y, x_size, px, l, dcol);
-    }
-  }
-
-  delete[] dcol;
-  delete[] scol;
+  stencil.Apply(1, StencilType::FORWARD_DIFFERENCE, vnl_matops::d2f(x), deriv_y);
 }
 
 template <class TImage>
@@ -265,32 +70,16 @@ void
 LeastSquaresVnlCostFunction<TImage>::get_derivative_z(const vnl_vector<double>& x,
     vnl_vector<float>& deriv_z)
 {
-
-  vnl_vector<float>  x_float;
-  x_float = vnl_matops::d2f(x);
-
-  float* kernel = new float[2];
-  kernel[0] = -1; kernel[1] = 1;
-
-  float * dspec = new float[x_size.depth];
-  float * sspec = new float[x_size.depth];
-
-  for (unsigned int py = 0; py < x_size.height; py++) {
-    for (unsigned int px = 0; px < x_size.width; px++) {
-      get_spec(x_float, x_size, py, px, sspec);
-      convol1d(kernel, 2, sspec, x_size.depth, dspec);
-      set_spec(deriv_z, x_size, py, px, dspec);
-    }
-  }
-
-  delete[] dspec;
-  delete[] sspec;
+  stencil.Apply(2, StencilType::FORWARD_DIFFERENCE, vnl_matops::d2f(x), deriv_z);
 }
 
 template <class TImage>
 double
 LeastSquaresVnlCostFunction<TImage>::f(const vnl_vector<double>& x)
 {
+  bool telemetry = Telemetry::GetInstance().IsEnabled();
+  double time = telemetry ? Telemetry::GetTime() : 0.0;
+
   // Calculate the error with respect to the low resolution images
 
   vnl_vector<float>  x_float;
@@ -313,37 +102,20 @@ LeastSquaresVnlCostFunction<TImage>::f(const vnl_vector<double>& x)
 
   HxMinusY.clear();
 
+  double spmvTime = telemetry ? Telemetry::GetTime() - time : 0.0;
+  time = telemetry ? Telemetry::GetTime() : 0.0;
+
   // Calculate the square of 1st derivatives along x, y, and z
   double reg = 0.0;
 
-  float* kernel = new float[2];
-  kernel[0] = -1; kernel[1] = 1;
-
-  //float* kernel = new float[3];
-  //kernel[0] = 1; kernel[1] = 2; kernel[2] = 1;
-
-  vnl_vector<float> DxX;
-  DxX.set_size( x_float.size() );
-  convol3dx(x_float, DxX, x_size, kernel, 2);
-  for(unsigned int i=0; i<x_float.size(); i++)
-    reg += DxX[i]*DxX[i] / x_float.size();
-  DxX.clear();
-
-  vnl_vector<float> DyX;
-  DyX.set_size( x_float.size() );
-  convol3dy(x_float, DyX, x_size, kernel, 2);
-  for(unsigned int i=0; i<x_float.size(); i++)
-    reg += DyX[i]*DyX[i] / x_float.size();
-  DyX.clear();
-
-  vnl_vector<float> DzX;
-  DzX.set_size( x_float.size() );
-  convol3dz(x_float, DzX, x_size, kernel, 2);
-  for(unsigned int i=0; i<x_float.size(); i++)
-    reg += DzX[i]*DzX[i] / x_float.size();
-  DzX.clear();
-
-  delete[] kernel;
+  vnl_vector<float> DX;
+  for(unsigned int axis = 0; axis < 3; axis++)
+  {
+    stencil.Apply(axis, StencilType::FORWARD_DIFFERENCE, x_float, DX);
+    for(unsigned int i=0; i<x_float.size(); i++)
+      reg += DX[i]*DX[i] / x_float.size();
+  }
+  DX.clear();
 
   // Calculate the cost function by combining both terms
 
@@ -352,6 +124,21 @@ LeastSquaresVnlCostFunction<TImage>::f(const vnl_vector<double>& x)
   std::cout << "error, mse, reg = " << value << " , " << mse << " , "
       << lambda*reg << std::endl;
 
+  m_NumberOfEvaluations++;
+
+  if ( telemetry )
+  {
+    Telemetry::Record record("least_squares_cost");
+    record.SetIteration(m_NumberOfEvaluations);
+    record.SetValue("cost", value);
+    record.SetValue("data_term", mse);
+    record.SetValue("regularization", lambda*reg);
+    record.SetValue("residual_norm", std::sqrt(mse * Y.size()));
+    record.AddPhaseTime("spmv", spmvTime);
+    record.AddPhaseTime("regularization", Telemetry::GetTime() - time);
+    Telemetry::GetInstance().Write(record);
+  }
+
   return value;
 
 }
@@ -386,35 +173,70 @@ LeastSquaresVnlCostFunction<TImage>::gradf(const vnl_vector<double>& x,
 
 /*    factor = 2*lambda/x_float.size();
 
-  float* kernel = new float[3];
-  kernel[0] = -1; kernel[1] = 2; kernel[2] = -1;
+  vnl_vector<float> DX;
+  for(unsigned int axis = 0; axis < 3; axis++)
+  {
+    stencil.Apply(axis, StencilType::SECOND_DIFFERENCE, x_float, DX);
+    g = g - vnl_matops::f2d( DX * factor );
+  } */
 
-  vnl_vector<float> DxX;
-  DxX.set_size( x_float.size() );
-  convol3dx(x_float, DxX, x_size, kernel, 3);
-  g = g + vnl_matops::f2d( DxX * factor );
-  DxX.clear();
+}
 
-  vnl_vector<float> DyX;
-  DyX.set_size( x_float.size() );
-  convol3dy(x_float, DyX, x_size, kernel, 3);
-  g = g + vnl_matops::f2d( DyX * factor );
-  DyX.clear();
+template <class TImage>
+void
+LeastSquaresVnlCostFunction<TImage>::SolveNormalEquations(vnl_vector<double>& x,
+    unsigned int iterations, double tolerance)
+{
+  // Multithreaded copy of H for the products of the solver
+  btk::SparseMatrix<float> Hcsr(H.rows(), H.cols());
+  for(unsigned int i = 0; i < H.rows(); i++)
+  {
+    VnlSparseMatrixType::row & r = H.get_row(i);
+    for(unsigned int j = 0; j < r.size(); j++)
+      Hcsr.AddValue(i, r[j].first, r[j].second);
+  }
+  Hcsr.Finalize();
 
-  vnl_vector<float> DzX;
-  DzX.set_size( x_float.size() );
-  convol3dz(x_float, DzX, x_size, kernel, 3);
-  g = g + vnl_matops::f2d( DzX * factor );
-  DzX.clear();
+  // Regularization: first derivatives along x, y and z (as in f)
+  FiniteDifferenceOperator<float> Dx(stencil, 0, StencilType::FORWARD_DIFFERENCE);
+  FiniteDifferenceOperator<float> Dy(stencil, 1, StencilType::FORWARD_DIFFERENCE);
+  FiniteDifferenceOperator<float> Dz(stencil, 2, StencilType::FORWARD_DIFFERENCE);
 
-  delete[] kernel; */
+  ConjugateGradientSolver<float> solver;
+  solver.SetObservationOperator(&Hcsr, 1.0 / Y.size());
+  solver.AddRegularization(&Dx, lambda / x.size());
+  solver.AddRegularization(&Dy, lambda / x.size());
+  solver.AddRegularization(&Dz, lambda / x.size());
+  solver.SetMaximumNumberOfIterations(iterations);
+  solver.SetTolerance(tolerance);
+  solver.SetVerbose(true);
 
+  double time = Telemetry::GetTime();
+
+  vnl_vector<float> x_float = vnl_matops::d2f(x);
+  solver.Solve(Y, x_float);
+  x = vnl_matops::f2d(x_float);
+
+  std::cout << "conjugate gradient: " << solver.GetNumberOfIterations()
+      << " iterations, relative residual = " << solver.GetRelativeResidual()
+      << std::endl;
+
+  if ( Telemetry::GetInstance().IsEnabled() )
+  {
+    Telemetry::Record record("conjugate_gradient");
+    record.SetValue("iterations", solver.GetNumberOfIterations());
+    record.SetValue("relative_residual", solver.GetRelativeResidual());
+    record.AddPhaseTime("solve", Telemetry::GetTime() - time);
+    Telemetry::GetInstance().Write(record);
+  }
 }
 
 template <class TImage>
 void
 LeastSquaresVnlCostFunction<TImage>::Initialize()
 {
+  double startTime = Telemetry::GetTime();
+
   m_OutputImageRegion = m_ReferenceImage -> GetLargestPossibleRegion();
   IndexType start_hr  = m_OutputImageRegion.GetIndex();
   SizeType  size_hr   = m_OutputImageRegion.GetSize();
@@ -423,6 +245,7 @@ LeastSquaresVnlCostFunction<TImage>::Initialize()
   x_size.width  = size_hr[0];
   x_size.height = size_hr[1];
   x_size.depth  = size_hr[2];
+  stencil.SetSize(x_size.width, x_size.height, x_size.depth);
 
   IndexType end_hr;
   end_hr[0] = start_hr[0] + size_hr[0] - 1 ;
@@ -457,6 +280,28 @@ LeastSquaresVnlCostFunction<TImage>::Initialize()
   Y.set_size(nrows);
   Y.fill(0.0);
 
+  // H and Y are read from the cache when the inputs have not changed
+  ObservationMatrixCache<float> cache(m_HMatrixCacheFileName);
+  if ( m_HMatrixCacheFileName != "" )
+  {
+    this -> InitializeCacheKey(cache);
+
+    SparseMatrix<float> cachedH;
+    if ( cache.Read(cachedH, &Y) )
+    {
+      for (unsigned int i = 0; i < cachedH.GetNumberOfRows(); i++)
+      {
+        VnlSparseMatrixType::row & r = H.get_row(i);
+        for (unsigned long k = cachedH.GetRowBegin(i); k < cachedH.GetRowEnd(i); k++)
+          r.push_back( VnlSparseMatrixType::pair_t( cachedH.GetColumns()[k], cachedH.GetValues()[k] ) );
+      }
+
+      H.pre_mult(Y,HtY);
+      this -> WriteHTelemetry(startTime, true);
+      return;
+    }
+  }
+
   unsigned int im;
   #pragma omp parallel for private(im) schedule(dynamic)
 
@@ -644,12 +489,73 @@ LeastSquaresVnlCostFunction<TImage>::Initialize()
 
   }
 
+  if ( m_HMatrixCacheFileName != "" )
+  {
+    // the rows of vnl_sparse_matrix are sorted by column
+    SparseMatrix<float> cachedH(H.rows(), H.cols());
+    for (unsigned int i = 0; i < H.rows(); i++)
+    {
+      VnlSparseMatrixType::row & r = H.get_row(i);
+      for (VnlSparseMatrixType::row::iterator col_iter = r.begin(); col_iter != r.end(); ++col_iter)
+        cachedH.AddValue( i, (*col_iter).first, (*col_iter).second );
+    }
+    cachedH.Finalize();
+
+    cache.Write(cachedH, &Y);
+  }
+
   // Precalcule Ht*Y. Note that this is calculated as Y*H since
   // Ht*Y = (Yt*H)t and for Vnl (Yt*H)t = (Yt*H) = Y*H because
   // the vnl_vector doesn't have a 2nd dimension. This allows us
   // to save a lot of memory because we don't need to store Ht.
   H.pre_mult(Y,HtY);
 
+  this -> WriteHTelemetry(startTime, false);
+
+}
+
+template <class TImage>
+void
+LeastSquaresVnlCostFunction<TImage>::WriteHTelemetry(double startTime, bool cached) const
+{
+  if ( !Telemetry::GetInstance().IsEnabled() )
+    return;
+
+  Telemetry::Record record("h_build");
+  record.SetValue("rows", H.rows());
+  record.SetValue("columns", H.cols());
+  record.SetValue("cached", cached);
+  record.AddPhaseTime("h_build", Telemetry::GetTime() - startTime);
+  Telemetry::GetInstance().Write(record);
+}
+
+template <class TImage>
+void
+LeastSquaresVnlCostFunction<TImage>::InitializeCacheKey(ObservationMatrixCache<float> & cache) const
+{
+  cache.SetHRGeometry( m_ReferenceImage );
+
+  std::stringstream psf;
+  psf << m_PSF;
+  cache.SetPSFType( psf.str() );
+
+  for(unsigned int im = 0; im < m_Images.size(); im++)
+  {
+    cache.AddLRGeometry( m_Images[im] );
+    cache.AddLRRegion( m_Regions[im] );
+
+    for(unsigned int i = 0; i < m_Transforms[im].size(); i++)
+      if ( m_Transforms[im][i] )
+        cache.AddTransform( m_Transforms[im][i] );
+
+    // the rows of H depend on the masks, and Y on the intensities
+    if ( m_Masks.size() > 0 )
+      cache.AddData( m_Masks[im] -> GetImage() -> GetBufferPointer(),
+                     m_Masks[im] -> GetImage() -> GetBufferedRegion().GetNumberOfPixels() * sizeof(typename MaskType::PixelType) );
+
+    cache.AddData( m_Images[im] -> GetBufferPointer(),
+                   m_Images[im] -> GetBufferedRegion().GetNumberOfPixels() * sizeof(typename ImageType::PixelType) );
+  }
 }
 
 template <class TImage>
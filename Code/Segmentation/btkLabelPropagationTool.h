@@ -47,6 +47,9 @@ knowledge of the CeCILL-B license and that you accept its terms.
 
 #include "itkChiSquareDistribution.h"
 
+#include "btkPatchDistanceKernel.h"
+#include "btkPatchStatistics.h"
+
 #include <string>
 #include <iomanip>
 #include <sstream>
@@ -161,8 +164,8 @@ class LabelFusionTool
   double GetLabelPatchUsingNormalization(typename itkTImage::IndexType p, itkTPointer & patch);
   void AddLabelPatchToLabelImage(typename itkTImage::IndexType p, itkTPointer & patch, double weight);
   void AddFuzzyLabelPatchToLabelImage(typename itkTImage::IndexType p, itkTPointer & patch, std::vector< std::map<T, float> > & vectorMap);
-  double PatchDistance(itkTPointer & p,itkTPointer & q);
-  double PatchDistance(itkFloatPointer & p,itkFloatPointer & q);
+  double PatchDistance(itkTPointer & p,itkTPointer & q, double cutoff = std::numeric_limits<double>::max());
+  double PatchDistance(itkFloatPointer & p,itkFloatPointer & q, double cutoff = std::numeric_limits<double>::max());
   void GetOutput(itkTPointer & outputImage);
   void GetWeightImage(itkFloatPointer & outputImage);
   void GetFuzzyWeightImage(itkFloatPointer & outputImage, int label);
@@ -487,36 +490,8 @@ void LabelFusionTool<T>::SetOptimizationStrategy(int o)
     std::cout<<"Optimized mode requirements: Computing Mean and Variance images\n";
     InitImage(m_meanImage);
     InitImage(m_varianceImage);
-
-    int x,y,z;
-    #pragma omp parallel for private(x,y,z) schedule(dynamic)
-    for(z=0; z < (int)m_size[2]; z++)
-      for(y=0; y < (int)m_size[1]; y++)
-        for(x=0; x < (int)m_size[0]; x++){
-	  typename itkTImage::IndexType p;
-	  p[0] = x;
-	  p[1] = y;
-	  p[2] = z;
-
-  	  if( m_maskImage->GetPixel(p) > 0 ){	  
-	    itkTPointer patch = itkTImage::New();
-            CreatePatch(patch);
-            GetPatch(p,patch,m_inputImage);
-            itkTIterator itp( patch, patch->GetRequestedRegion() );
-            double m = 0;
-            double m2= 0;
-            for(itp.GoToBegin(); !itp.IsAtEnd(); ++itp){
-              m += itp.Get();
-              m2+= (itp.Get() * itp.Get());	
-            }
-            int n = patch->GetLargestPossibleRegion().GetNumberOfPixels();
-            float mean = m / n;
-            float variance = (m2 / n) - (mean * mean) ;
-            
-            m_meanImage->SetPixel( p, mean );	  	  
-            m_varianceImage->SetPixel( p, variance );	  	  
-	  }
-      }
+    PatchStatistics::ComputeMeanAndVariance(m_inputImage->GetBufferPointer(), m_maskImage->GetBufferPointer(), m_size, m_halfPatchSize,
+                                            m_meanImage->GetBufferPointer(), m_varianceImage->GetBufferPointer());
 
   m_meanAnatomicalImages.resize(m_anatomicalImages.size());
   m_varianceAnatomicalImages.resize(m_anatomicalImages.size());
@@ -525,35 +500,8 @@ void LabelFusionTool<T>::SetOptimizationStrategy(int o)
     InitImage(m_meanAnatomicalImages[i]);
     InitImage(m_varianceAnatomicalImages[i]);
 
-    int x,y,z;
-    #pragma omp parallel for private(x,y,z) schedule(dynamic)
-    for(z=0; z < (int)m_size[2]; z++)
-      for(y=0; y < (int)m_size[1]; y++)
-        for(x=0; x < (int)m_size[0]; x++){
-	  typename itkTImage::IndexType p;
-	  p[0] = x;
-	  p[1] = y;
-	  p[2] = z;
-
-  	  if( m_maskImage->GetPixel(p) > 0 ){	  
-	    itkTPointer patch = itkTImage::New();
-            CreatePatch(patch);
-            GetPatch(p,patch,m_anatomicalImages[i]);
-            itkTIterator itp( patch, patch->GetRequestedRegion() );
-            double m = 0;
-            double m2= 0;
-            for(itp.GoToBegin(); !itp.IsAtEnd(); ++itp){
-              m += itp.Get();
-              m2+= (itp.Get() * itp.Get());	
-            }
-            int n = patch->GetLargestPossibleRegion().GetNumberOfPixels();
-            float mean = m / n;
-            float variance = (m2 / n) - (mean * mean) ;
-            
-            m_meanAnatomicalImages[i]->SetPixel( p, mean );	  	  
-            m_varianceAnatomicalImages[i]->SetPixel( p, variance );	  	  
-	  }
-      }
+    PatchStatistics::ComputeMeanAndVariance(m_anatomicalImages[i]->GetBufferPointer(), m_maskImage->GetBufferPointer(), m_size, m_halfPatchSize,
+                                            m_meanAnatomicalImages[i]->GetBufferPointer(), m_varianceAnatomicalImages[i]->GetBufferPointer());
   }
 
   //}
@@ -1341,6 +1289,7 @@ double LabelFusionTool<T>::GetDenoisedPatch(typename itkTImage::IndexType p, itk
   
   //go through the neighbourhood with a region iterator
   itkTIteratorWithIndex it( m_inputImage, searchRegion);
+  double bestDistance = std::numeric_limits<double>::max();
   typename itkTImage::IndexType neighbourPixelIndex;	
 
   for(it.GoToBegin(); !it.IsAtEnd(); ++it){
@@ -1360,7 +1309,13 @@ double LabelFusionTool<T>::GetDenoisedPatch(typename itkTImage::IndexType p, itk
         GetPatch(neighbourPixelIndex, neighbourPatch, m_anatomicalImages[i]);
         //GetNormalizedPatch(neighbourPixelIndex, neighbourPatch, m_anatomicalImages[i], meanNeighbour, stddevNeighbour);
 
-        double weight = exp( - PatchDistance(centralPatch, neighbourPatch) / m_rangeBandwidth);
+        //skip the patches whose weight is negligible wrt the best one found so far
+        double cutoff = btk::PatchDistanceKernel::Cutoff(m_rangeBandwidth, bestDistance);
+        double distance = PatchDistance(centralPatch, neighbourPatch, cutoff);
+        if(distance > cutoff) continue;
+        if(distance < bestDistance) bestDistance = distance;
+
+        double weight = exp( - distance / m_rangeBandwidth);
         //double weight = exp( - PatchDistance(normalizedCentralPatch, neighbourPatch) / m_rangeBandwidth);
 
         if(weight>wmax)
@@ -1440,6 +1395,7 @@ double LabelFusionTool<T>::GetDenoisedPatchSylvain(typename itkTImage::IndexType
   
   //go through the neighbourhood with a region iterator
   itkTIteratorWithIndex it( m_inputImage, searchRegion);
+  double bestDistance = std::numeric_limits<double>::max();
   typename itkTImage::IndexType neighbourPixelIndex;	
 
   for(it.GoToBegin(); !it.IsAtEnd(); ++it){
@@ -1455,7 +1411,13 @@ double LabelFusionTool<T>::GetDenoisedPatchSylvain(typename itkTImage::IndexType
       
         GetPatch(neighbourPixelIndex, neighbourPatch, m_anatomicalImages[i]);
 
-        double weight = exp( - PatchDistance(centralPatch, neighbourPatch) / m_rangeBandwidth);
+        //skip the patches whose weight is negligible wrt the best one found so far
+        double cutoff = btk::PatchDistanceKernel::Cutoff(m_rangeBandwidth, bestDistance);
+        double distance = PatchDistance(centralPatch, neighbourPatch, cutoff);
+        if(distance > cutoff) continue;
+        if(distance < bestDistance) bestDistance = distance;
+
+        double weight = exp( - distance / m_rangeBandwidth);
 
         if(weight>wmax)
           if( (p[0] != neighbourPixelIndex[0]) && (p[1] != neighbourPixelIndex[1]) && (p[2] != neighbourPixelIndex[2]) ) //has to be modify (not appropriate if the input image is in the anatomical input images.
@@ -1537,6 +1499,7 @@ double LabelFusionTool<T>::GetHRPatch(typename itkTImage::IndexType p, itkFloatP
     
   //go through the neighbourhood with a region iterator
   itkTIteratorWithIndex it( m_inputImage, searchRegion);
+  double bestDistance = std::numeric_limits<double>::max();
   typename itkTImage::IndexType neighbourPixelIndex;	
   
   for(it.GoToBegin(); !it.IsAtEnd(); ++it){
@@ -1553,7 +1516,13 @@ double LabelFusionTool<T>::GetHRPatch(typename itkTImage::IndexType p, itkFloatP
         GetPatch(neighbourPixelIndex, neighbourPatch, m_anatomicalImages[i]);
         GetPatch(neighbourPixelIndex, neighbourHRPatch, m_labelImages[i]);
         
-        double weight = exp( - PatchDistance(centralPatch, neighbourPatch) / m_rangeBandwidth);
+        //skip the patches whose weight is negligible wrt the best one found so far
+        double cutoff = btk::PatchDistanceKernel::Cutoff(m_rangeBandwidth, bestDistance);
+        double distance = PatchDistance(centralPatch, neighbourPatch, cutoff);
+        if(distance > cutoff) continue;
+        if(distance < bestDistance) bestDistance = distance;
+
+        double weight = exp( - distance / m_rangeBandwidth);
         
         if(weight>wmax)
           if( (p[0] != neighbourPixelIndex[0]) && (p[1] != neighbourPixelIndex[1]) && (p[2] != neighbourPixelIndex[2]) ) //has to be modify (not appropriate if the input image is in the anatomical input images.
@@ -1664,6 +1633,7 @@ double LabelFusionTool<T>:: GetLabelPatch(typename itkTImage::IndexType p, itkTP
 
   //go through the neighbourhood with a region iterator
   itkTIteratorWithIndex it( m_inputImage, searchRegion);
+  double bestDistance = std::numeric_limits<double>::max();
   typename itkTImage::IndexType neighbourPixelIndex;
 
   for(it.GoToBegin(); !it.IsAtEnd(); ++it){
@@ -1681,7 +1651,13 @@ double LabelFusionTool<T>:: GetLabelPatch(typename itkTImage::IndexType p, itkTP
         //GetPatch(neighbourPixelIndex, neighbourLabelPatch, m_labelImages[i]);
         //GetPatch(neighbourPixelIndex, neighbourPatch, m_anatomicalImages[i]);
 
-        double weight = exp( - PatchDistance(centralPatch, neighbourPatch) / m_rangeBandwidth);
+        //skip the patches whose weight is negligible wrt the best one found so far
+        double cutoff = btk::PatchDistanceKernel::Cutoff(m_rangeBandwidth, bestDistance);
+        double distance = PatchDistance(centralPatch, neighbourPatch, cutoff);
+        if(distance > cutoff) continue;
+        if(distance < bestDistance) bestDistance = distance;
+
+        double weight = exp( - distance / m_rangeBandwidth);
         sum += weight;
 
         //Add this label patch to the current estimate using the computed weight
@@ -1741,6 +1717,7 @@ void LabelFusionTool<T>:: GetFuzzyLabelPatch(typename itkTImage::IndexType p, it
 
   //go through the neighbourhood with a region iterator
   itkTIteratorWithIndex it( m_inputImage, searchRegion);
+  double bestDistance = std::numeric_limits<double>::max();
   typename itkTImage::IndexType neighbourPixelIndex;
 
   for(it.GoToBegin(); !it.IsAtEnd(); ++it){
@@ -1757,7 +1734,13 @@ void LabelFusionTool<T>:: GetFuzzyLabelPatch(typename itkTImage::IndexType p, it
         Get2Patches(neighbourPixelIndex, neighbourPatch, m_anatomicalImages[i], neighbourLabelPatch, m_labelImages[i]); 
         //GetPatch(neighbourPixelIndex, neighbourLabelPatch, m_labelImages[i]);
         //GetPatch(neighbourPixelIndex, neighbourPatch, m_anatomicalImages[i]);
-        double weight = exp( - PatchDistance(centralPatch, neighbourPatch) / m_rangeBandwidth);
+        //skip the patches whose weight is negligible wrt the best one found so far
+        double cutoff = btk::PatchDistanceKernel::Cutoff(m_rangeBandwidth, bestDistance);
+        double distance = PatchDistance(centralPatch, neighbourPatch, cutoff);
+        if(distance > cutoff) continue;
+        if(distance < bestDistance) bestDistance = distance;
+
+        double weight = exp( - distance / m_rangeBandwidth);
 
         //Add this label patch to the current estimate using the computed weight
         k = 0;
@@ -1807,6 +1790,7 @@ double LabelFusionTool<T>:: GetLabelPatchUsingNormalization(typename itkTImage::
 
   //go through the neighbourhood with a region iterator
   itkTIteratorWithIndex it( m_inputImage, searchRegion);
+  double bestDistance = std::numeric_limits<double>::max();
   typename itkTImage::IndexType neighbourPixelIndex;
 
   for(it.GoToBegin(); !it.IsAtEnd(); ++it){
@@ -1826,7 +1810,13 @@ double LabelFusionTool<T>:: GetLabelPatchUsingNormalization(typename itkTImage::
         GetNormalizedPatch(neighbourPixelIndex, neighbourPatch, m_anatomicalImages[i], meanNeighbour, stddevNeighbour);
         GetPatch(neighbourPixelIndex, neighbourLabelPatch, m_labelImages[i]);
 
-        double weight = exp( - PatchDistance(normalizedCentralPatch, neighbourPatch) / m_rangeBandwidth);
+        //skip the patches whose weight is negligible wrt the best one found so far
+        double cutoff = btk::PatchDistanceKernel::Cutoff(m_rangeBandwidth, bestDistance);
+        double distance = PatchDistance(normalizedCentralPatch, neighbourPatch, cutoff);
+        if(distance > cutoff) continue;
+        if(distance < bestDistance) bestDistance = distance;
+
+        double weight = exp( - distance / m_rangeBandwidth);
         sum += weight;
 
         //Add this label patch to the current estimate using the computed weight
@@ -1903,33 +1893,15 @@ void LabelFusionTool<T>::AddFuzzyLabelPatchToLabelImage(typename itkTImage::Inde
 
 
 template <typename T>
-double LabelFusionTool<T>::PatchDistance(itkTPointer & p,itkTPointer & q)
+double LabelFusionTool<T>::PatchDistance(itkTPointer & p,itkTPointer & q, double cutoff)
 {
-  double diff=0;
-  double dist = 0;
-  itkTConstIterator itp( p, p->GetLargestPossibleRegion() );
-  itkTConstIterator itq( q, q->GetLargestPossibleRegion() );
-
-  for(itp.GoToBegin(), itq.GoToBegin(); !itp.IsAtEnd(); ++itp, ++itq){
-    diff = itp.Get() - itq.Get();
-    dist += diff*diff;	
-  }
-  return dist;
+  return btk::PatchDistanceKernel::Compute(p->GetBufferPointer(), q->GetBufferPointer(), p->GetLargestPossibleRegion().GetNumberOfPixels(), cutoff);
 }
 
 template <typename T>
-double LabelFusionTool<T>::PatchDistance(itkFloatPointer & p,itkFloatPointer & q)
+double LabelFusionTool<T>::PatchDistance(itkFloatPointer & p,itkFloatPointer & q, double cutoff)
 {
-  double diff=0;
-  double dist = 0;
-  itkFloatConstIterator itp( p, p->GetLargestPossibleRegion() );
-  itkFloatConstIterator itq( q, q->GetLargestPossibleRegion() );
-
-  for(itp.GoToBegin(), itq.GoToBegin(); !itp.IsAtEnd(); ++itp, ++itq){
-    diff = itp.Get() - itq.Get();
-    dist += diff*diff;	
-  }
-  return dist;
+  return btk::PatchDistanceKernel::Compute(p->GetBufferPointer(), q->GetBufferPointer(), p->GetLargestPossibleRegion().GetNumberOfPixels(), cutoff);
 }
 
 template <typename T>
@@ -49,6 +49,8 @@
 #include "itkImage.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
+#include "itkImageIOFactory.h"
+#include "itkImageIORegion.h"
 #include "itkNumericTraits.h"
 #include "itkVector.h"
 #include "itkCastImageFilter.h"
@@ -93,6 +95,28 @@ namespace btk
              */
             static void WriteImage(std::vector< typename TImageInput::Pointer > &images, std::vector< std::string > &fileNames);
 
+            /**
+             * @brief Test if the format of an image file can be written region by region (streamed writing).
+             * @param fileName File name of the image to write.
+             * @return True if the regions of the image can be written one after the other, false otherwise.
+             */
+            static bool CanStreamWrite(const std::string &fileName);
+
+            /**
+             * @brief Test if an image file can be read region by region (streamed reading).
+             * @param fileName File name of the image to read.
+             * @return True if a region of the image can be read without reading the whole file, false otherwise (e.g. compressed files).
+             */
+            static bool CanStreamRead(const std::string &fileName);
+
+            /**
+             * @brief Write a region of an image in an image file (streamed writing), the other regions of the file being kept.
+             * @param image Image whose buffered region is the region to write (indices of the whole image). Its largest possible region is set to largestRegion.
+             * @param largestRegion Region of the whole image stored in the file.
+             * @param fileName File name of the image to write.
+             */
+            static void WriteImageRegion(typename TImageInput::Pointer image, const typename TImageInput::RegionType &largestRegion, const std::string &fileName);
+
             /**
              * @brief Read an image.
              * @param fileName File name of the image to read.
@@ -86,6 +86,47 @@ void ImageHelper< TImageInput, TImageOutput >::WriteImage(std::vector< typename
 
 //----------------------------------------------------------------------------------------
 
+template < class TImageInput, class TImageOutput >
+bool ImageHelper< TImageInput, TImageOutput >::CanStreamWrite(const std::string &fileName)
+{
+    itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(fileName.c_str(), itk::ImageIOFactory::WriteMode);
+
+    return imageIO.IsNotNull() && imageIO->CanStreamWrite();
+}
+
+//----------------------------------------------------------------------------------------
+
+template < class TImageInput, class TImageOutput >
+bool ImageHelper< TImageInput, TImageOutput >::CanStreamRead(const std::string &fileName)
+{
+    itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(fileName.c_str(), itk::ImageIOFactory::ReadMode);
+
+    // a compressed file has to be decompressed from its beginning to read any region
+    bool compressed = fileName.size() > 3 && fileName.compare(fileName.size()-3, 3, ".gz") == 0;
+
+    return imageIO.IsNotNull() && imageIO->CanStreamRead() && !compressed;
+}
+
+//----------------------------------------------------------------------------------------
+
+template < class TImageInput, class TImageOutput >
+void ImageHelper< TImageInput, TImageOutput >::WriteImageRegion(typename TImageInput::Pointer image, const typename TImageInput::RegionType &largestRegion, const std::string &fileName)
+{
+    image->SetLargestPossibleRegion(largestRegion);
+
+    // region of the file, relatively to the first index of the whole image
+    itk::ImageIORegion ioRegion(TImageInput::ImageDimension);
+    itk::ImageIORegionAdaptor< TImageInput::ImageDimension >::Convert(image->GetBufferedRegion(), ioRegion, largestRegion.GetIndex());
+
+    typename ImageWriter::Pointer writer = ImageWriter::New();
+    writer->SetFileName(fileName);
+    writer->SetInput(image);
+    writer->SetIORegion(ioRegion);
+    writer->Update();
+}
+
+//----------------------------------------------------------------------------------------
+
 template < class TImageInput, class TImageOutput >
 typename TImageInput::Pointer ImageHelper< TImageInput, TImageOutput >::ReadImage(const std::string &fileName)
 {
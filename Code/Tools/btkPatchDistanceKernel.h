@@ -0,0 +1,241 @@
+/*
+Copyright or © or Copr. Université de Strasbourg - Centre National de la Recherche Scientifique
+
+16 october 2026
+rousseau@unistra.fr
+
+This software is governed by the CeCILL-B license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL-B
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL-B license and that you accept its terms.
+*/
+
+#ifndef BTK_PATCH_DISTANCE_KERNEL_H
+#define BTK_PATCH_DISTANCE_KERNEL_H
+
+#include "cmath"
+#include "cfloat"
+#include "limits"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace btk
+{
+
+  /**
+  * @class PatchDistanceKernel
+  * @brief Squared L2 distance between two contiguous patches, with early exit.
+  * The summation stops as soon as the partial distance exceeds a cutoff: beyond
+  * it, the NLM weight exp(-d/h) is negligible. float and double patches are
+  * processed with SSE2 or AVX2 instructions when the compiler enables them
+  * (see the USE_NATIVE_ARCH option), other types use the scalar loop.
+  * @author François Rousseau
+  * @ingroup Tools
+  */
+  class PatchDistanceKernel
+  {
+    public:
+
+      /**
+       * @brief Distance above which exp(-d/h) is below the double precision wrt the best weight found so far.
+       * @param rangeBandwidth Range bandwidth h of the NLM weights
+       * @param bestDistance Smallest distance found so far in the search region (0 if the central patch is part of it)
+       * @return cutoff to pass to Compute
+       */
+      static inline double Cutoff(double rangeBandwidth, double bestDistance = 0)
+      {
+        return bestDistance - rangeBandwidth * std::log(DBL_EPSILON);
+      }
+
+      /**
+       * @brief Compute the squared L2 distance between p and q.
+       * @param p First patch (n contiguous values)
+       * @param q Second patch (n contiguous values)
+       * @param n Number of values of the patches
+       * @param cutoff The computation stops once the partial distance is above this value
+       * @return the distance, or a partial distance larger than cutoff
+       */
+      template<typename T>
+      static inline double Compute(const T * p, const T * q, unsigned int n, double cutoff = std::numeric_limits<double>::max())
+      {
+        double dist = 0;
+        unsigned int k = 0;
+        //the partial sum is checked every 8 values
+        for(; k + 8 <= n; k += 8)
+        {
+          for(unsigned int j=k; j < k+8; j++)
+          {
+            double diff = p[j] - q[j];
+            dist += diff*diff;
+          }
+          if(dist > cutoff)
+          {
+            return dist;
+          }
+        }
+        for(; k < n; k++)
+        {
+          double diff = p[k] - q[k];
+          dist += diff*diff;
+        }
+        return dist;
+      }
+  };
+
+#if defined(__SSE2__)
+  /**
+   * @brief float specialization: differences are computed in float (as in the scalar version) and accumulated in double.
+   */
+  template<>
+  inline double PatchDistanceKernel::Compute<float>(const float * p, const float * q, unsigned int n, double cutoff)
+  {
+    unsigned int k = 0;
+#if defined(__AVX2__)
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for(; k + 8 <= n; k += 8)
+    {
+      __m256 diff = _mm256_sub_ps( _mm256_loadu_ps(p+k), _mm256_loadu_ps(q+k) );
+      __m256d lo  = _mm256_cvtps_pd( _mm256_castps256_ps128(diff) );
+      __m256d hi  = _mm256_cvtps_pd( _mm256_extractf128_ps(diff, 1) );
+      acc0 = _mm256_add_pd( acc0, _mm256_mul_pd(lo, lo) );
+      acc1 = _mm256_add_pd( acc1, _mm256_mul_pd(hi, hi) );
+
+      __m256d s  = _mm256_add_pd(acc0, acc1);
+      __m128d s2 = _mm_add_pd( _mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1) );
+      if( _mm_cvtsd_f64( _mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)) ) > cutoff )
+      {
+        break;
+      }
+    }
+    __m256d s  = _mm256_add_pd(acc0, acc1);
+    __m128d s2 = _mm_add_pd( _mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1) );
+    double dist = _mm_cvtsd_f64( _mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)) );
+#else
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for(; k + 4 <= n; k += 4)
+    {
+      __m128  diff = _mm_sub_ps( _mm_loadu_ps(p+k), _mm_loadu_ps(q+k) );
+      __m128d lo   = _mm_cvtps_pd(diff);
+      __m128d hi   = _mm_cvtps_pd( _mm_movehl_ps(diff, diff) );
+      acc0 = _mm_add_pd( acc0, _mm_mul_pd(lo, lo) );
+      acc1 = _mm_add_pd( acc1, _mm_mul_pd(hi, hi) );
+
+      if( (k & 7) == 4 )
+      {
+        __m128d s = _mm_add_pd(acc0, acc1);
+        if( _mm_cvtsd_f64( _mm_add_sd(s, _mm_unpackhi_pd(s, s)) ) > cutoff )
+        {
+          k += 4;
+          break;
+        }
+      }
+    }
+    __m128d s = _mm_add_pd(acc0, acc1);
+    double dist = _mm_cvtsd_f64( _mm_add_sd(s, _mm_unpackhi_pd(s, s)) );
+#endif
+    if(dist > cutoff)
+    {
+      return dist;
+    }
+    for(; k < n; k++)
+    {
+      double diff = p[k] - q[k];
+      dist += diff*diff;
+    }
+    return dist;
+  }
+
+  /**
+   * @brief double specialization.
+   */
+  template<>
+  inline double PatchDistanceKernel::Compute<double>(const double * p, const double * q, unsigned int n, double cutoff)
+  {
+    unsigned int k = 0;
+#if defined(__AVX2__)
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for(; k + 8 <= n; k += 8)
+    {
+      __m256d d0 = _mm256_sub_pd( _mm256_loadu_pd(p+k), _mm256_loadu_pd(q+k) );
+      __m256d d1 = _mm256_sub_pd( _mm256_loadu_pd(p+k+4), _mm256_loadu_pd(q+k+4) );
+      acc0 = _mm256_add_pd( acc0, _mm256_mul_pd(d0, d0) );
+      acc1 = _mm256_add_pd( acc1, _mm256_mul_pd(d1, d1) );
+
+      __m256d s  = _mm256_add_pd(acc0, acc1);
+      __m128d s2 = _mm_add_pd( _mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1) );
+      if( _mm_cvtsd_f64( _mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)) ) > cutoff )
+      {
+        break;
+      }
+    }
+    __m256d s  = _mm256_add_pd(acc0, acc1);
+    __m128d s2 = _mm_add_pd( _mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1) );
+    double dist = _mm_cvtsd_f64( _mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)) );
+#else
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for(; k + 4 <= n; k += 4)
+    {
+      __m128d d0 = _mm_sub_pd( _mm_loadu_pd(p+k), _mm_loadu_pd(q+k) );
+      __m128d d1 = _mm_sub_pd( _mm_loadu_pd(p+k+2), _mm_loadu_pd(q+k+2) );
+      acc0 = _mm_add_pd( acc0, _mm_mul_pd(d0, d0) );
+      acc1 = _mm_add_pd( acc1, _mm_mul_pd(d1, d1) );
+
+      if( (k & 7) == 4 )
+      {
+        __m128d s = _mm_add_pd(acc0, acc1);
+        if( _mm_cvtsd_f64( _mm_add_sd(s, _mm_unpackhi_pd(s, s)) ) > cutoff )
+        {
+          k += 4;
+          break;
+        }
+      }
+    }
+    __m128d s = _mm_add_pd(acc0, acc1);
+    double dist = _mm_cvtsd_f64( _mm_add_sd(s, _mm_unpackhi_pd(s, s)) );
+#endif
+    if(dist > cutoff)
+    {
+      return dist;
+    }
+    for(; k < n; k++)
+    {
+      double diff = p[k] - q[k];
+      dist += diff*diff;
+    }
+    return dist;
+  }
+#endif
+
+} // namespace btk
+
+#endif // BTK_PATCH_DISTANCE_KERNEL_H
@@ -0,0 +1,186 @@
+/*
+Copyright or © or Copr. Université de Strasbourg - Centre National de la Recherche Scientifique
+
+16 october 2026
+rousseau@unistra.fr
+
+This software is governed by the CeCILL-B license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL-B
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL-B license and that you accept its terms.
+*/
+
+#ifndef BTK_PATCH_STATISTICS_H
+#define BTK_PATCH_STATISTICS_H
+
+#include "vector"
+#include "algorithm"
+
+namespace btk
+{
+
+  /**
+  * @class PatchStatistics
+  * @brief Mean and variance of the patches centred on every voxel of a 3D image.
+  * The sums of the values and of the squared values over the patches are computed by
+  * separable box sums (x, then y, then z), so the cost does not depend on the patch size.
+  * Voxels outside the image are considered as 0 and the number of voxels is always
+  * the full patch size, as when the patch is cropped from the image.
+  * @author François Rousseau
+  * @ingroup Tools
+  */
+  class PatchStatistics
+  {
+    public:
+
+      /**
+       * @brief Compute the mean and variance images.
+       * @param image Pixel buffer of the input image (x first, then y, then z)
+       * @param mask Pixel buffer of the mask image (only voxels > 0 are written), or NULL to process every voxel
+       * @param size Size of the image
+       * @param halfPatchSize Half size of the patch along each axis
+       * @param meanImage Pixel buffer of the output mean image
+       * @param varianceImage Pixel buffer of the output variance image
+       */
+      template<typename TInput, typename TMask, typename TSize, typename TOutput>
+      static void ComputeMeanAndVariance(const TInput * image, const TMask * mask, const TSize & size, const TSize & halfPatchSize, TOutput * meanImage, TOutput * varianceImage)
+      {
+        long sx = size[0];
+        long sy = size[1];
+        long sz = size[2];
+        long h[3] = { (long)halfPatchSize[0], (long)halfPatchSize[1], (long)halfPatchSize[2] };
+        int n = (2*h[0]+1) * (2*h[1]+1) * (2*h[2]+1);
+
+        std::vector<double> sum(sx*sy*sz);
+        std::vector<double> sum2(sx*sy*sz);
+
+        //box sums along x, directly from the image
+        long y,z;
+        #pragma omp parallel private(y,z)
+        {
+        std::vector<double> line(sx);
+        std::vector<double> line2(sx);
+
+        #pragma omp for schedule(static)
+        for(z=0; z < sz; z++)
+        {
+          for(y=0; y < sy; y++)
+          {
+            long start = sx * ( y + sy * z );
+            for(long x=0; x < sx; x++)
+            {
+              line[x]  = image[start+x];
+              line2[x] = line[x] * line[x];
+            }
+            BoxSum(&line[0], sx, h[0], &sum[start], 1);
+            BoxSum(&line2[0], sx, h[0], &sum2[start], 1);
+          }
+        }
+        }
+
+        //box sums along y and z, in place
+        BoxSumAlongAxis(sum, sx, sy, sz, 1, h[1]);
+        BoxSumAlongAxis(sum2, sx, sy, sz, 1, h[1]);
+        BoxSumAlongAxis(sum, sx, sy, sz, 2, h[2]);
+        BoxSumAlongAxis(sum2, sx, sy, sz, 2, h[2]);
+
+        long v;
+        #pragma omp parallel for private(v) schedule(static)
+        for(v=0; v < sx*sy*sz; v++)
+        {
+          if( (mask == NULL) || (mask[v] > 0) )
+          {
+            float mean = sum[v] / n;
+            float variance = (sum2[v] / n) - (mean * mean);
+            meanImage[v] = mean;
+            varianceImage[v] = variance;
+          }
+        }
+      }
+
+    protected:
+
+      /**
+       * @brief Zero-padded box sum of half size h of a line of n values, written with the given stride.
+       */
+      static inline void BoxSum(const double * line, long n, long h, double * out, long stride)
+      {
+        //running sum over the window [i-h, i+h] clipped to the line
+        double s = 0;
+        for(long j=0; j < std::min(h, n); j++)
+        {
+          s += line[j];
+        }
+        for(long i=0; i < n; i++)
+        {
+          if(i+h < n)
+          {
+            s += line[i+h];
+          }
+          if(i-h-1 >= 0)
+          {
+            s -= line[i-h-1];
+          }
+          out[i*stride] = s;
+        }
+      }
+
+      /**
+       * @brief In place box sum along the y (axis = 1) or z (axis = 2) axis of an image.
+       */
+      static void BoxSumAlongAxis(std::vector<double> & data, long sx, long sy, long sz, int axis, long h)
+      {
+        if(h == 0)
+        {
+          return;
+        }
+        long n      = (axis == 1) ? sy : sz;
+        long stride = (axis == 1) ? sx : sx*sy;
+        long other  = (axis == 1) ? sz : sy;   //lines are processed in parallel along this axis
+
+        long j;
+        #pragma omp parallel private(j)
+        {
+        std::vector<double> line(n);
+
+        #pragma omp for schedule(static)
+        for(j=0; j < other; j++)
+        {
+          for(long x=0; x < sx; x++)
+          {
+            long start = (axis == 1) ? x + sx*sy*j : x + sx*j;
+            for(long i=0; i < n; i++)
+            {
+              line[i] = data[start + i*stride];
+            }
+            BoxSum(&line[0], n, h, &data[start], stride);
+          }
+        }
+        }
+      }
+  };
+
+} // namespace btk
+
+#endif // BTK_PATCH_STATISTICS_H
@@ -43,6 +43,7 @@ knowledge of the CeCILL-B license and that you accept its terms.
 
 
 #include "btkPatch2.h"
+#include "btkPatchStatistics.h"
 
 namespace btk
 {
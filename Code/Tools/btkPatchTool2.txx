@@ -137,28 +137,13 @@ template<typename T>
 void PatchTool2<T>::ComputeMeanAndVarianceImage(itkTImagePointer & image, itkTImagePointer & maskImage, itkFloatImagePointer & meanImage, itkFloatImagePointer & varianceImage)
 {
   std::cout<<"Computing mean and variance images ...\n";
-  int x,y,z;
   typename itkTImage::SizeType imageSize = image->GetLargestPossibleRegion().GetSize();
+  typename itkTImage::SizeType halfPatchSize;
+  for(unsigned int i=0; i!= 3; i++)
+    halfPatchSize[i] = (m_FullPatchSize[i]-1)/2;
 
-  #pragma omp parallel for private(x,y,z) schedule(dynamic)
-  for(z=0; z < (int)imageSize[2]; z++)
-    for(y=0; y < (int)imageSize[1]; y++)
-      for(x=0; x < (int)imageSize[0]; x++){
-         typename itkTImage::IndexType p;
-         p[0] = x;
-         p[1] = y;
-         p[2] = z;
-
-         if( maskImage->GetPixel(p) > 0 ){
-           btk::Patch2<T> patch = btk::Patch2<T>(image, m_FullPatchSize, p);
-           float mean = 0;
-           float variance = 0;
-           patch.ComputeMeanAndVariance(mean, variance);
-
-           meanImage->SetPixel( p, mean );
-           varianceImage->SetPixel( p, variance );
-         }
-      }
+  PatchStatistics::ComputeMeanAndVariance(image->GetBufferPointer(), maskImage->GetBufferPointer(), imageSize, halfPatchSize,
+                                          meanImage->GetBufferPointer(), varianceImage->GetBufferPointer());
 }
 
 template<typename T>
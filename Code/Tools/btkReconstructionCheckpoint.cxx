@@ -0,0 +1,242 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkReconstructionCheckpoint.h"
+
+// ITK includes
+#include "itksys/SystemTools.hxx"
+
+// STL includes
+#include "iostream"
+#include "fstream"
+#include "cstdio"
+
+namespace btk
+{
+
+ReconstructionCheckpoint::ReconstructionCheckpoint(const std::string & directory) : m_Directory(directory), m_Generation(0)
+{
+    if(!itksys::SystemTools::MakeDirectory(m_Directory.c_str()))
+    {
+        btkException("ReconstructionCheckpoint: unable to create the directory " + m_Directory + ".");
+    }
+
+    // the new files are numbered after the ones of an existing checkpoint, which stays valid until the next save
+    std::map< std::string, std::string > values;
+    if(this->ReadStateFile(m_Generation, values, m_ReplacedFiles))
+    {
+        std::cout<<"Checkpoint "<<m_Generation<<" found in "<<m_Directory<<" (replaced by the next checkpoint if not loaded).\n";
+    }
+}
+
+//------------------------------------------------------------------------------------------------
+
+std::string ReconstructionCheckpoint::GetStateFileName() const
+{
+    return m_Directory + "/checkpoint.txt";
+}
+
+//------------------------------------------------------------------------------------------------
+
+bool ReconstructionCheckpoint::ReadStateFile(unsigned int & generation, std::map< std::string, std::string > & values, std::map< std::string, std::string > & files) const
+{
+    std::ifstream file(this->GetStateFileName().c_str());
+
+    if(!file.is_open())
+    {
+        return false;
+    }
+
+    values.clear();
+    files.clear();
+    generation = 0;
+
+    // one "key=value" per line, the files being stored as "file:name=path"
+    std::string line;
+    while(std::getline(file, line))
+    {
+        std::string::size_type separator = line.find('=');
+
+        if(separator == std::string::npos)
+        {
+            continue;
+        }
+
+        std::string key   = line.substr(0, separator);
+        std::string value = line.substr(separator+1);
+
+        if(key == "generation")
+        {
+            std::istringstream(value) >> generation;
+        }
+        else if(key.compare(0, 5, "file:") == 0)
+        {
+            files[key.substr(5)] = value;
+        }
+        else
+        {
+            values[key] = value;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------
+
+bool ReconstructionCheckpoint::Load()
+{
+    if(!this->ReadStateFile(m_Generation, m_Values, m_Files))
+    {
+        return false;
+    }
+
+    m_NewFiles.clear();
+    m_ReplacedFiles.clear();
+
+    std::cout<<"Checkpoint "<<m_Generation<<" read from "<<m_Directory<<".\n";
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------
+
+void ReconstructionCheckpoint::Save()
+{
+    std::map< std::string, std::string > files = m_Files;
+    for(std::map< std::string, std::string >::const_iterator it = m_NewFiles.begin(); it != m_NewFiles.end(); ++it)
+    {
+        files[it->first] = it->second;
+    }
+
+    // the state file is written under a temporary name, and then renamed, so that an interrupted run keeps the previous one
+    const std::string stateFileName = this->GetStateFileName();
+    const std::string temporaryFileName = stateFileName + ".tmp";
+    std::ofstream file(temporaryFileName.c_str(), std::ios::out | std::ios::trunc);
+
+    if(!file.is_open())
+    {
+        btkException("ReconstructionCheckpoint: unable to write the file " + temporaryFileName + ".");
+    }
+
+    file << "generation=" << m_Generation+1 << "\n";
+    for(std::map< std::string, std::string >::const_iterator it = m_Values.begin(); it != m_Values.end(); ++it)
+    {
+        file << it->first << "=" << it->second << "\n";
+    }
+    for(std::map< std::string, std::string >::const_iterator it = files.begin(); it != files.end(); ++it)
+    {
+        file << "file:" << it->first << "=" << it->second << "\n";
+    }
+
+    file.close();
+
+    if(file.fail())
+    {
+        std::remove(temporaryFileName.c_str());
+        btkException("ReconstructionCheckpoint: error while writing the file " + temporaryFileName + ".");
+    }
+
+    // rename does not replace an existing file on every system
+    if(std::rename(temporaryFileName.c_str(), stateFileName.c_str()) != 0 &&
+       (std::remove(stateFileName.c_str()) != 0 || std::rename(temporaryFileName.c_str(), stateFileName.c_str()) != 0))
+    {
+        btkException("ReconstructionCheckpoint: unable to rename " + temporaryFileName + " to " + stateFileName + ".");
+    }
+
+    // the files replaced by a new version are not needed anymore
+    for(std::map< std::string, std::string >::const_iterator it = m_NewFiles.begin(); it != m_NewFiles.end(); ++it)
+    {
+        std::map< std::string, std::string >::const_iterator previous = m_Files.find(it->first);
+
+        if(previous != m_Files.end() && previous->second != it->second)
+        {
+            std::remove((m_Directory + "/" + previous->second).c_str());
+        }
+    }
+
+    // the files of a checkpoint which has not been loaded are not referenced anymore
+    for(std::map< std::string, std::string >::const_iterator it = m_ReplacedFiles.begin(); it != m_ReplacedFiles.end(); ++it)
+    {
+        std::map< std::string, std::string >::const_iterator current = files.find(it->first);
+
+        if(current == files.end() || current->second != it->second)
+        {
+            std::remove((m_Directory + "/" + it->second).c_str());
+        }
+    }
+    m_ReplacedFiles.clear();
+
+    m_Files = files;
+    m_NewFiles.clear();
+    m_Generation++;
+
+    std::cout<<"Checkpoint "<<m_Generation<<" written to "<<m_Directory<<".\n";
+}
+
+//------------------------------------------------------------------------------------------------
+
+bool ReconstructionCheckpoint::HasValue(const std::string & key) const
+{
+    return m_Values.find(key) != m_Values.end();
+}
+
+//------------------------------------------------------------------------------------------------
+
+std::string ReconstructionCheckpoint::NewFileName(const std::string & name, const std::string & extension)
+{
+    std::ostringstream fileName;
+    fileName << name << "." << m_Generation+1 << extension;
+
+    m_NewFiles[name] = fileName.str();
+
+    return m_Directory + "/" + fileName.str();
+}
+
+//------------------------------------------------------------------------------------------------
+
+std::string ReconstructionCheckpoint::GetFileName(const std::string & name) const
+{
+    std::map< std::string, std::string >::const_iterator it = m_Files.find(name);
+
+    if(it == m_Files.end())
+    {
+        btkException("ReconstructionCheckpoint: no file " + name + " in the checkpoint.");
+    }
+
+    return m_Directory + "/" + it->second;
+}
+
+} // namespace btk
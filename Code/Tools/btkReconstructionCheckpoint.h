@@ -0,0 +1,175 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_RECONSTRUCTION_CHECKPOINT_H
+#define BTK_RECONSTRUCTION_CHECKPOINT_H
+
+// Local includes
+#include "btkMacro.h"
+
+// STL includes
+#include "string"
+#include "map"
+#include "sstream"
+
+namespace btk
+{
+
+/**
+ * @class ReconstructionCheckpoint
+ * @brief Checkpoint of a long-running reconstruction, stored in a directory: values (iteration counters, metrics...)
+ * and files (current high-resolution estimate, transforms...), so that an interrupted run can be resumed.
+ *
+ * The files of a new checkpoint are written under new names (see NewFileName). The state file listing the values and
+ * the files is then replaced by Save() (written under a temporary name and renamed), and only then the files of the
+ * previous checkpoint are removed: an interruption at any time leaves a complete checkpoint.
+ * A checkpoint already in the directory which is not loaded is replaced by the first save: the generations go on from
+ * its generation, so that no file it references is overwritten before the new state file is written.
+ *
+ * Typical use: Load() when resuming, read the values and the files (GetValue, GetFileName), and at the end of every
+ * iteration write the files to NewFileName(), set the values and call Save().
+ * @author François Rousseau
+ * @ingroup Tools
+ */
+class ReconstructionCheckpoint
+{
+    public:
+
+        /**
+         * @brief Constructor (the directory is created if needed, and the generation of a checkpoint it contains is read).
+         * @param directory Directory of the checkpoint
+         */
+        ReconstructionCheckpoint(const std::string & directory);
+
+        /**
+         * @brief Read the last saved checkpoint of the directory.
+         * @return false if the directory does not contain any checkpoint
+         */
+        bool Load();
+
+        /**
+         * @brief Save the checkpoint: the values and the files given by NewFileName since the last save replace the
+         * previous ones, whose files are removed.
+         */
+        void Save();
+
+        /**
+         * @brief Return true if the checkpoint contains a value.
+         */
+        bool HasValue(const std::string & key) const;
+
+        /**
+         * @brief Set a value (saved by Save).
+         * @param key Name of the value (without '=' nor new line)
+         * @param value Value (written with operator<<, without new line)
+         */
+        template < typename T >
+        void SetValue(const std::string & key, const T & value)
+        {
+            std::ostringstream stream;
+            stream.precision(17);
+            stream << value;
+            m_Values[key] = stream.str();
+        }
+
+        /**
+         * @brief Get a value (read with operator>>, an exception is thrown if the checkpoint does not contain it).
+         */
+        template < typename T >
+        T GetValue(const std::string & key) const
+        {
+            std::map< std::string, std::string >::const_iterator it = m_Values.find(key);
+
+            T value = T();
+            std::istringstream stream(it != m_Values.end() ? it->second : std::string());
+
+            if(it == m_Values.end() || !(stream >> value))
+            {
+                btkException("ReconstructionCheckpoint: no valid value " + key + " in the checkpoint.");
+            }
+
+            return value;
+        }
+
+        /**
+         * @brief Name of the file to write a new version of a file of the checkpoint to (e.g. "estimate" and ".nii.gz").
+         * The file is part of the checkpoint once Save() has been called.
+         */
+        std::string NewFileName(const std::string & name, const std::string & extension);
+
+        /**
+         * @brief Name of a file of the saved checkpoint (an exception is thrown if the checkpoint does not contain it).
+         */
+        std::string GetFileName(const std::string & name) const;
+
+        /**
+         * @brief Directory of the checkpoint.
+         */
+        const std::string & GetDirectory() const
+        {
+            return m_Directory;
+        }
+
+    private:
+
+        /** Name of the state file */
+        std::string GetStateFileName() const;
+
+        /**
+         * @brief Read the state file of the directory.
+         * @return false if the directory does not contain any checkpoint
+         */
+        bool ReadStateFile(unsigned int & generation, std::map< std::string, std::string > & values, std::map< std::string, std::string > & files) const;
+
+        std::string                             m_Directory;
+
+        /** Number of saves of the checkpoint (the version of the files) */
+        unsigned int                            m_Generation;
+
+        std::map< std::string, std::string >    m_Values;
+
+        /** Files of the saved checkpoint (names relative to the directory) */
+        std::map< std::string, std::string >    m_Files;
+
+        /** Files written since the last save (names relative to the directory) */
+        std::map< std::string, std::string >    m_NewFiles;
+
+        /** Files of a checkpoint of the directory which has not been loaded (removed by the next save) */
+        std::map< std::string, std::string >    m_ReplacedFiles;
+};
+
+} // namespace btk
+
+#endif // BTK_RECONSTRUCTION_CHECKPOINT_H
@@ -0,0 +1,291 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkTelemetry.h"
+
+// ITK includes
+#include "itksys/SystemTools.hxx"
+
+// STL includes
+#include "sstream"
+#include "cmath"
+#include "limits"
+
+// System includes
+#if !defined(_WIN32)
+#include "sys/resource.h"
+#endif
+
+namespace btk
+{
+
+namespace
+{
+
+/** Write a string as a JSON string */
+void WriteString(std::ostream & stream, const std::string & value)
+{
+    stream << '"';
+
+    for(std::string::const_iterator c = value.begin(); c != value.end(); c++)
+    {
+        switch(*c)
+        {
+            case '"':  stream << "\\\""; break;
+            case '\\': stream << "\\\\"; break;
+            case '\n': stream << "\\n"; break;
+            case '\t': stream << "\\t"; break;
+            default:
+                if(static_cast< unsigned char >(*c) < 0x20)
+                {
+                    stream << ' ';
+                }
+                else
+                {
+                    stream << *c;
+                }
+        }
+    }
+
+    stream << '"';
+}
+
+/** Write a number as a JSON number (null if it is not finite) */
+void WriteNumber(std::ostream & stream, double value)
+{
+    if(std::isfinite(value))
+    {
+        stream << value;
+    }
+    else
+    {
+        stream << "null";
+    }
+}
+
+/** Write "key":value pairs (without braces), each one preceded by a comma if first is false */
+void WriteMembers(std::ostream & stream, const std::vector< std::pair< std::string, double > > & members, bool first)
+{
+    for(unsigned int i = 0; i < members.size(); i++)
+    {
+        if(i > 0 || !first)
+        {
+            stream << ',';
+        }
+
+        WriteString(stream, members[i].first);
+        stream << ':';
+        WriteNumber(stream, members[i].second);
+    }
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------------------------
+
+Telemetry::Record::Record(const std::string & source) : m_Source(source), m_HasIteration(false), m_Iteration(0)
+{
+    // ----
+}
+
+//------------------------------------------------------------------------------------------------
+
+void Telemetry::Record::SetIteration(unsigned int iteration)
+{
+    m_HasIteration = true;
+    m_Iteration = iteration;
+}
+
+//------------------------------------------------------------------------------------------------
+
+void Telemetry::Record::SetValue(const std::string & key, double value)
+{
+    for(unsigned int i = 0; i < m_Values.size(); i++)
+    {
+        if(m_Values[i].first == key)
+        {
+            m_Values[i].second = value;
+            return;
+        }
+    }
+
+    m_Values.push_back(std::make_pair(key, value));
+}
+
+//------------------------------------------------------------------------------------------------
+
+void Telemetry::Record::AddPhaseTime(const std::string & phase, double seconds)
+{
+    for(unsigned int i = 0; i < m_PhaseTimes.size(); i++)
+    {
+        if(m_PhaseTimes[i].first == phase)
+        {
+            m_PhaseTimes[i].second += seconds;
+            return;
+        }
+    }
+
+    m_PhaseTimes.push_back(std::make_pair(phase, seconds));
+}
+
+//------------------------------------------------------------------------------------------------
+
+Telemetry::Telemetry() : m_Enabled(false), m_StartTime(0.0)
+{
+    // ----
+}
+
+//------------------------------------------------------------------------------------------------
+
+Telemetry & Telemetry::GetInstance()
+{
+    static Telemetry instance;
+
+    return instance;
+}
+
+//------------------------------------------------------------------------------------------------
+
+void Telemetry::Open(const std::string & fileName)
+{
+    #pragma omp critical(btkTelemetry)
+    {
+        if(m_File.is_open())
+        {
+            m_File.close();
+        }
+
+        m_File.clear();
+        m_File.open(fileName.c_str());
+        m_Enabled = m_File.is_open();
+        m_StartTime = GetTime();
+    }
+
+    if(!m_Enabled)
+    {
+        btkException("Telemetry: unable to open the file " + fileName + ".");
+    }
+}
+
+//------------------------------------------------------------------------------------------------
+
+void Telemetry::Close()
+{
+    #pragma omp critical(btkTelemetry)
+    {
+        m_Enabled = false;
+
+        if(m_File.is_open())
+        {
+            m_File.close();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------
+
+void Telemetry::Write(const Record & record)
+{
+    // the line is built outside of the critical section, and written at once
+    std::ostringstream line;
+    line.precision(10);
+
+    line << "{\"source\":";
+    WriteString(line, record.m_Source);
+
+    if(record.m_HasIteration)
+    {
+        line << ",\"iteration\":" << record.m_Iteration;
+    }
+
+    line << ",\"elapsed\":";
+    WriteNumber(line, GetTime() - m_StartTime);
+
+    WriteMembers(line, record.m_Values, false);
+
+    if(!record.m_PhaseTimes.empty())
+    {
+        line << ",\"phases\":{";
+        WriteMembers(line, record.m_PhaseTimes, true);
+        line << '}';
+    }
+
+    double peakRSS = GetPeakResidentSetSize();
+    line << ",\"peak_rss_kb\":";
+    WriteNumber(line, peakRSS >= 0.0 ? peakRSS : std::numeric_limits< double >::quiet_NaN());
+
+    line << "}\n";
+
+    #pragma omp critical(btkTelemetry)
+    {
+        if(m_Enabled)
+        {
+            // flushed at every line, so that the telemetry of an interrupted run is kept
+            m_File << line.str() << std::flush;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------
+
+double Telemetry::GetTime()
+{
+    return itksys::SystemTools::GetTime();
+}
+
+//------------------------------------------------------------------------------------------------
+
+double Telemetry::GetPeakResidentSetSize()
+{
+#if !defined(_WIN32)
+    struct rusage usage;
+
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return -1.0;
+    }
+
+#if defined(__APPLE__)
+    // bytes on Mac OS X
+    return static_cast< double >(usage.ru_maxrss) / 1024.0;
+#else
+    return static_cast< double >(usage.ru_maxrss);
+#endif
+#else
+    return -1.0;
+#endif
+}
+
+} // namespace btk
@@ -0,0 +1,172 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 16/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#ifndef BTK_TELEMETRY_H
+#define BTK_TELEMETRY_H
+
+// Local includes
+#include "btkMacro.h"
+
+// STL includes
+#include "string"
+#include "vector"
+#include "utility"
+#include "fstream"
+
+namespace btk
+{
+
+/**
+ * @class Telemetry
+ * @brief Process-wide writer of the telemetry of the reconstruction algorithms: one JSON object per line
+ * (e.g. one per iteration of a solver) with its values (cost, data and regularization terms, residual norm...),
+ * the wall time of its phases (H build, SpMV, regularization, NLM, registration...) and the peak resident set size.
+ *
+ * Telemetry is disabled until a file is opened, so that the instrumented code only has to check IsEnabled():
+ * @code
+ * if(btk::Telemetry::GetInstance().IsEnabled())
+ * {
+ *     btk::Telemetry::Record record("ibp");
+ *     record.SetIteration(i);
+ *     record.SetValue("residual_norm", norm);
+ *     record.AddPhaseTime("nlm", time);
+ *     btk::Telemetry::GetInstance().Write(record);
+ * }
+ * @endcode
+ * @author François Rousseau
+ * @ingroup Tools
+ */
+class Telemetry
+{
+    public:
+
+        /**
+         * @class Record
+         * @brief One line of telemetry, written by Telemetry::Write.
+         */
+        class Record
+        {
+            public:
+
+                /**
+                 * @brief Constructor.
+                 * @param source Name of the instrumented algorithm (e.g. "ibp", "image_reconstruction")
+                 */
+                Record(const std::string & source);
+
+                /**
+                 * @brief Set the iteration of the algorithm (not written if not set).
+                 */
+                void SetIteration(unsigned int iteration);
+
+                /**
+                 * @brief Set a value (non-finite values are written as null).
+                 */
+                void SetValue(const std::string & key, double value);
+
+                /**
+                 * @brief Add a wall time (in seconds) to a phase.
+                 */
+                void AddPhaseTime(const std::string & phase, double seconds);
+
+            private:
+
+                friend class Telemetry;
+
+                std::string                                   m_Source;
+                bool                                          m_HasIteration;
+                unsigned int                                  m_Iteration;
+
+                /** Values and phase times, in insertion order */
+                std::vector< std::pair< std::string, double > > m_Values;
+                std::vector< std::pair< std::string, double > > m_PhaseTimes;
+        };
+
+        /**
+         * @brief The telemetry of the process.
+         */
+        static Telemetry & GetInstance();
+
+        /**
+         * @brief Open the JSON-lines file the records are written to (an exception is thrown if it cannot be opened).
+         */
+        void Open(const std::string & fileName);
+
+        /**
+         * @brief Close the file (telemetry is then disabled).
+         */
+        void Close();
+
+        /**
+         * @brief Return true if a file is open.
+         */
+        bool IsEnabled() const
+        {
+            return m_Enabled;
+        }
+
+        /**
+         * @brief Write a record on a new line (thread safe), with the time elapsed since Open() and the peak RSS.
+         */
+        void Write(const Record & record);
+
+        /**
+         * @brief Current wall time, in seconds.
+         */
+        static double GetTime();
+
+        /**
+         * @brief Peak resident set size of the process, in kB (negative if not available on this platform).
+         */
+        static double GetPeakResidentSetSize();
+
+    private:
+
+        Telemetry();
+
+        /** Not implemented */
+        Telemetry(const Telemetry &);
+        void operator=(const Telemetry &);
+
+        std::ofstream   m_File;
+        bool            m_Enabled;
+
+        /** Time of Open() */
+        double          m_StartTime;
+};
+
+} // namespace btk
+
+#endif // BTK_TELEMETRY_H
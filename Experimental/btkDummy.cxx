@@ -46,7 +46,7 @@
 #include "itkTransformFileReader.h"
 #include "itkResampleImageFilter.h"
 
-#include "vnl/vnl_sparse_matrix.h"
+#include "vnl/vnl_vector.h"
 
 #include <omp.h>
 
@@ -331,7 +331,7 @@ int main(int argc, char** argv)
     btk::PandoraBoxReconstructionFilters::ComputePSFImage(psfImage, outputSpacing, inputLRStacks[0][0]->GetSpacing() );
     
     //Compute the parameters (H,X,Y) of the observation model
-    vnl_sparse_matrix<float> H;
+    btk::SparseMatrix<float> H;
     vnl_vector<float>        Y;
     vnl_vector<float>        X;
     btk::PandoraBoxReconstructionFilters::ComputerObservationModelParameters(H, Y, X, tmpImage, inputMaskStacks, inputLRStacks, inverseAffineSBSTransforms, psfImage);
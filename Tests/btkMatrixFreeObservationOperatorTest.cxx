@@ -0,0 +1,259 @@
+/*==========================================================================
+  
+  © Université de Strasbourg - Centre National de la Recherche Scientifique
+  
+  Date: 17/10/2026
+  Author(s): François Rousseau (rousseau@unistra.fr)
+  
+  This software is governed by the CeCILL-B license under French law and
+  abiding by the rules of distribution of free software.  You can  use,
+  modify and/ or redistribute the software under the terms of the CeCILL-B
+  license as circulated by CEA, CNRS and INRIA at the following URL
+  "http://www.cecill.info".
+  
+  As a counterpart to the access to the source code and  rights to copy,
+  modify and redistribute granted by the license, users are provided only
+  with a limited warranty  and the software's author,  the holder of the
+  economic rights,  and the successive licensors  have only  limited
+  liability.
+  
+  In this respect, the user's attention is drawn to the risks associated
+  with loading,  using,  modifying and/or developing or reproducing the
+  software by the user in light of its specific status of free software,
+  that may mean  that it is complicated to manipulate,  and  that  also
+  therefore means  that it is reserved for developers  and  experienced
+  professionals having in-depth computer knowledge. Users are therefore
+  encouraged to load and test the software's suitability as regards their
+  requirements in conditions enabling the security of their systems and/or
+  data to be ensured and,  more generally, to use and operate it in the
+  same conditions as regards security.
+  
+  The fact that you are presently reading this means that you have had
+  knowledge of the CeCILL-B license and that you accept its terms.
+  
+==========================================================================*/
+
+#include "btkHighResolutionIBPFilter.h"
+#include "btkMatrixFreeObservationOperator.h"
+
+#include "itkImage.h"
+#include "itkEuler3DTransform.h"
+#include "itkImageRegionIteratorWithIndex.h"
+
+#include "vnl/vnl_vector.h"
+
+#include "iostream"
+#include "cmath"
+#include "cstdlib"
+#include "algorithm"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * @brief Gives access to the matrix H assembled by HighResolutionIBPFilter::HComputation.
+ */
+class IBPFilterWithH : public btk::HighResolutionIBPFilter
+{
+public:
+    void ComputeH()
+    {
+        this->HComputation();
+    }
+};
+
+static btk::itkImage::Pointer CreateImage(unsigned int sx, unsigned int sy, unsigned int sz, double spacingZ, bool swapAxes)
+{
+    btk::itkImage::SizeType size;
+    size[0] = sx; size[1] = sy; size[2] = sz;
+    btk::itkImage::RegionType region;
+    region.SetSize(size);
+
+    btk::itkImage::SpacingType spacing;
+    spacing[0] = 1.0; spacing[1] = 1.0; spacing[2] = spacingZ;
+
+    btk::itkImage::Pointer image = btk::itkImage::New();
+    image->SetRegions(region);
+    image->SetSpacing(spacing);
+    if(swapAxes)
+    {
+        //slices acquired along x
+        btk::itkImage::DirectionType direction;
+        direction.Fill(0.0);
+        direction[0][2] = 1.0; direction[1][1] = 1.0; direction[2][0] = -1.0;
+        image->SetDirection(direction);
+
+        btk::itkImage::PointType origin;
+        origin[0] = 1.0; origin[1] = 0.0; origin[2] = 11.0;
+        image->SetOrigin(origin);
+    }
+    image->Allocate();
+
+    //smooth positive values, some voxels below the padding value
+    btk::itkIteratorWithIndex it(image, region);
+    for(it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+        btk::itkImage::IndexType index = it.GetIndex();
+        float value = 10.0 + 5.0 * std::sin(0.5 * index[0]) * std::cos(0.3 * index[1]) + index[2];
+        if(index[0] == 0 && index[1] < 3)
+        {
+            value = 0;
+        }
+        it.Set(value);
+    }
+    return image;
+}
+
+static btk::itkImage::Pointer CreatePSF(double spacingZ)
+{
+    btk::itkImage::SizeType size;
+    size[0] = 3; size[1] = 3; size[2] = 5;
+    btk::itkImage::RegionType region;
+    region.SetSize(size);
+
+    btk::itkImage::SpacingType spacing;
+    spacing[0] = 1.0; spacing[1] = 1.0; spacing[2] = spacingZ / 4.0;
+
+    btk::itkImage::Pointer psf = btk::itkImage::New();
+    psf->SetRegions(region);
+    psf->SetSpacing(spacing);
+    psf->Allocate();
+
+    btk::itkIteratorWithIndex it(psf, region);
+    for(it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+        btk::itkImage::IndexType index = it.GetIndex();
+        double d2 = (index[0]-1.0)*(index[0]-1.0) + (index[1]-1.0)*(index[1]-1.0) + 0.25*(index[2]-2.0)*(index[2]-2.0);
+        it.Set(std::exp(-d2));
+    }
+    return psf;
+}
+
+static double MaxDifference(const vnl_vector< float > & a, const vnl_vector< float > & b, double & maxValue)
+{
+    double maxDifference = 0;
+    maxValue = 0;
+    for(unsigned int k = 0; k < a.size(); k++)
+    {
+        maxDifference = std::max(maxDifference, (double)std::fabs(a[k] - b[k]));
+        maxValue = std::max(maxValue, (double)std::fabs(a[k]));
+    }
+    return maxDifference;
+}
+
+/**
+ * @brief Check that MatrixFreeObservationOperator computes the same products as the matrix H assembled by
+ * HighResolutionIBPFilter::HComputation, and that H^T*y does not depend on the number of threads.
+ */
+int main (int, char* [])
+{
+    std::cout<<"Matrix-free observation operator test"<<std::endl;
+
+    //HR image and two LR images: an axial one with a rigid motion, and a sagittal one
+    btk::itkImage::Pointer imageHR = CreateImage(12, 12, 12, 1.0, false);
+
+    std::vector< btk::itkImage::Pointer > imagesLR(2);
+    imagesLR[0] = CreateImage(12, 12, 4, 3.0, false);
+    imagesLR[1] = CreateImage(12, 12, 4, 3.0, true);
+
+    std::vector< btk::itkImage::Pointer > psf(2);
+    psf[0] = CreatePSF(3.0);
+    psf[1] = CreatePSF(3.0);
+
+    btk::itkEulerTransform::Pointer motion = btk::itkEulerTransform::New();
+    btk::itkEulerTransform::ParametersType parameters = motion->GetParameters();
+    parameters[0] = 0.05; parameters[1] = -0.03; parameters[2] = 0.1;
+    parameters[3] = 0.4;  parameters[4] = -0.2;  parameters[5] = 0.3;
+    motion->SetParameters(parameters);
+    btk::itkImage::PointType center;
+    center.Fill(5.5);
+    motion->SetCenter(center);
+
+    std::vector< btk::itkTransformBase::Pointer > inverseTransforms(2);
+    inverseTransforms[0] = motion.GetPointer();
+    inverseTransforms[1] = btk::itkEulerTransform::New().GetPointer();
+
+    //Assembled H
+    IBPFilterWithH filter;
+    filter.SetImageHR(imageHR);
+    filter.SetImagesLR(imagesLR);
+    filter.SetPSF(psf);
+    filter.SetInverseTransformsLR(inverseTransforms);
+    filter.SetTransformType(btk::EULER_3D);
+    filter.SetPaddingValue(0);
+    filter.ComputeH();
+    const btk::SparseMatrix< float > & H = filter.GetH();
+
+    //Matrix-free operator
+    btk::MatrixFreeObservationOperator op;
+    op.SetImageHR(imageHR);
+    op.SetImagesLR(imagesLR);
+    op.SetPSF(psf);
+    op.SetInverseTransforms(inverseTransforms);
+    op.SetPaddingValue(0);
+    op.Initialize();
+
+    bool testPassed = true;
+    if(op.GetNumberOfRows() != H.GetNumberOfRows() || op.GetNumberOfColumns() != H.GetNumberOfColumns())
+    {
+        std::cout<<"Error: the sizes of the operator and of H differ."<<std::endl;
+        return EXIT_FAILURE;
+    }
+
+    vnl_vector< float > x(op.GetNumberOfColumns());
+    for(unsigned int k = 0; k < x.size(); k++)
+    {
+        x[k] = 1.0 + std::sin(0.37 * k);
+    }
+    vnl_vector< float > y(op.GetNumberOfRows());
+    for(unsigned int k = 0; k < y.size(); k++)
+    {
+        y[k] = (k % 7 == 0) ? 0.0 : std::cos(0.21 * k);
+    }
+
+    //y = Hx
+    vnl_vector< float > yH, yOp;
+    H.Multiply(x, yH);
+    op.Multiply(x, yOp);
+    double maxValue;
+    double difference = MaxDifference(yH, yOp, maxValue);
+    std::cout<<"Hx : maximum difference "<<difference<<" (maximum value "<<maxValue<<")"<<std::endl;
+    if(maxValue == 0 || difference > 1e-5 * maxValue)
+    {
+        testPassed = false;
+    }
+
+    //x = H^T y
+    vnl_vector< float > xH, xOp;
+    H.TransposeMultiply(y, xH);
+    op.TransposeMultiply(y, xOp);
+    difference = MaxDifference(xH, xOp, maxValue);
+    std::cout<<"H^T y : maximum difference "<<difference<<" (maximum value "<<maxValue<<")"<<std::endl;
+    if(maxValue == 0 || difference > 1e-5 * maxValue)
+    {
+        testPassed = false;
+    }
+
+#ifdef _OPENMP
+    //H^T y is the same with one thread
+    int numberOfThreads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    vnl_vector< float > xOneThread;
+    op.TransposeMultiply(y, xOneThread);
+    omp_set_num_threads(numberOfThreads);
+    if(MaxDifference(xOp, xOneThread, maxValue) != 0)
+    {
+        std::cout<<"H^T y depends on the number of threads."<<std::endl;
+        testPassed = false;
+    }
+#endif
+
+    if(!testPassed)
+    {
+        std::cout<<"Matrix-free observation operator test failed."<<std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout<<"Matrix-free observation operator test passed."<<std::endl;
+    return EXIT_SUCCESS;
+}